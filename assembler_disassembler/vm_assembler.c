@@ -20,6 +20,7 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "vm_opcodes.h"
 #include "vm_opcodes_def.h"
 #include "vm_assembler_utils.h"
 #include "vm_assembler.h"
@@ -92,6 +93,8 @@ const char *directive[14] = {
 
 uint32_t assembler_deep = 0;
 uint32_t label_deep = 0;
+uint32_t assembler_globals_qty = 0;
+vm_module_build_t assembler_module = { 0 };
 
 static bool correct_plus(char **line) {
     if (*line == NULL)
@@ -445,6 +448,41 @@ static void assembler_free(label_macro_t **label) {
     }
 }
 
+static void module_free(void) {
+    free(assembler_module.consts);
+    free(assembler_module.symbols);
+    free(assembler_module.names);
+    free(assembler_module.lines);
+    memset(&assembler_module, 0, sizeof(vm_module_build_t));
+}
+
+static void module_const(uint32_t pc, uint32_t len) {
+    assembler_module.consts = realloc(assembler_module.consts, (assembler_module.consts_qty + 1) * sizeof(vm_module_const_t));
+    assembler_module.consts[assembler_module.consts_qty].pc = pc;
+    assembler_module.consts[assembler_module.consts_qty].len = len;
+    ++assembler_module.consts_qty;
+}
+
+static void module_line(uint32_t pc, uint32_t line) {
+    assembler_module.lines = realloc(assembler_module.lines, (assembler_module.lines_qty + 1) * sizeof(vm_module_line_t));
+    assembler_module.lines[assembler_module.lines_qty].pc = pc;
+    assembler_module.lines[assembler_module.lines_qty].line = line;
+    ++assembler_module.lines_qty;
+}
+
+static void module_symbol(const char *name, uint32_t pc) {
+    uint32_t len = strlen(name) + 1;
+
+    assembler_module.symbols = realloc(assembler_module.symbols, (assembler_module.symbols_qty + 1) * sizeof(vm_module_symbol_t));
+    assembler_module.symbols[assembler_module.symbols_qty].name = assembler_module.names_len;
+    assembler_module.symbols[assembler_module.symbols_qty].pc = pc;
+    ++assembler_module.symbols_qty;
+
+    assembler_module.names = realloc(assembler_module.names, assembler_module.names_len + len);
+    memcpy(assembler_module.names + assembler_module.names_len, name, len);
+    assembler_module.names_len += len;
+}
+
 static bool emit(uint8_t **hex, data_t data, arg_type_t type, uint32_t **pc, uint8_t ind) {
     switch (type) {
         case ARG_U08:
@@ -740,7 +778,7 @@ assembler_error_t vm_assembler(char **program, uint32_t *pc, uint8_t **hex, uint
     if (program == NULL)
         return ASSMBLR_FAIL;
 
-    label_macro_t *label = *lbl;
+    label_macro_t *label = lbl != NULL ? *lbl : NULL;
     uint32_t instruction = 0;
     arg_type_t arg_type[8];
     uint8_t ret = ASSMBLR_OK;
@@ -759,7 +797,10 @@ assembler_error_t vm_assembler(char **program, uint32_t *pc, uint8_t **hex, uint
     uint32_t *line_pc = calloc(1, sizeof(uint32_t));
     uint32_t line_pc_qty = 0;
 
-    ++assembler_deep;
+    if (assembler_deep++ == 0) {
+        assembler_globals_qty = 0;
+        module_free();
+    }
 
     // search labels, equ and macro directives
     uint8_t res = label_equ_macro(program, &label, label_qty);
@@ -787,6 +828,7 @@ assembler_error_t vm_assembler(char **program, uint32_t *pc, uint8_t **hex, uint
         line_pc[line_pc_qty++] = *pc;
         line_pc = realloc(line_pc, (line_pc_qty + 1) * sizeof(uint32_t));
         line_pc[line_pc_qty] = 0;
+        module_line(*pc, *progline);
 
         printf("(%04u) [%04u] %s", (*progline), *pc, line_orig);
 
@@ -839,6 +881,7 @@ assembler_error_t vm_assembler(char **program, uint32_t *pc, uint8_t **hex, uint
 
         // if is data directive, emit
         if (res == ASSMBLR_DATA) {
+            uint32_t data_pc = *pc;
             switch (instruction) {
                 case DIRECTIVE_DATAU8:
                 case DIRECTIVE_DATAU16:
@@ -854,6 +897,7 @@ assembler_error_t vm_assembler(char **program, uint32_t *pc, uint8_t **hex, uint
                         }
                         emit(hex, value, instruction - DIRECTIVE_DATAU8 + 1, &pc, 0);
                     }
+                    module_const(data_pc, *pc - data_pc);
                     printf("\n");
                     goto next_line;
                     break;
@@ -867,6 +911,7 @@ assembler_error_t vm_assembler(char **program, uint32_t *pc, uint8_t **hex, uint
                     free(value.str);
                     value.u8 = 0;
                     emit(hex, value, ARG_U08, &pc, 0);
+                    module_const(data_pc, *pc - data_pc);
                     printf("\n");
                     goto next_line;
                     break;
@@ -887,6 +932,13 @@ assembler_error_t vm_assembler(char **program, uint32_t *pc, uint8_t **hex, uint
         if (ret != ASSMBLR_OK)
             goto error;
 
+        // global slots used by program (0xffffffff is indirect register)
+        if (instruction == SET_GLOBAL || instruction == GET_GLOBAL) {
+            uint32_t var_idx = (*hex)[*pc - 4] | ((*hex)[*pc - 3] << 8) | ((*hex)[*pc - 2] << 16) | ((uint32_t) (*hex)[*pc - 1] << 24);
+            if (var_idx != 0xffffffff && var_idx >= assembler_globals_qty)
+                assembler_globals_qty = var_idx + 1;
+        }
+
 
         /////////////////////////////////////////////////
         printf("\n");
@@ -919,6 +971,11 @@ end:
             (*hex)[label_to_pc[n].in_pc + 3] = pc_value >> 24;
         }
     }
+    if (assembler_deep == 0 && ret == ASSMBLR_OK) {
+        for (label_macro_t *lbl_tmp = label; lbl_tmp != NULL && lbl_tmp->name != NULL; lbl_tmp = lbl_tmp->next)
+            if (lbl_tmp->type == LBL_LABEL)
+                module_symbol(lbl_tmp->name, lbl_tmp->pc_line - 1 < line_pc_qty ? line_pc[lbl_tmp->pc_line - 1] : *pc);
+    }
     free(line_pc);
     free(label_to_pc);
     assembler_free(&label);
@@ -20,6 +20,8 @@
 
 #include <stdint.h>
 
+#include "vm_module.h"
+
 typedef enum ASSEMBLER_ERROR{
     ASSMBLR_OK,            //
     ASSMBLR_BADNAME,       //
@@ -49,6 +51,8 @@ typedef struct label_macro_s {
 } label_macro_t;
 
 extern const char *assembler_error[];
+extern uint32_t assembler_globals_qty; // global slots used by last assembled program
+extern vm_module_build_t assembler_module; // constants, symbols and lines of last assembled program (see vm_module_write)
 
          // uint8_t vm_assemble_line(char *str, uint32_t *pc, uint8_t **hex);
             char* vm_assembler_load_file(char *file_name);
@@ -22,8 +22,11 @@
 #include <ctype.h>
 #include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "vm.h"
+#include "vm_module.h"
 #include "vm_assembler.h"
 #include "vm_assembler_utils.h"
 #include "vm_disassembler.h"
@@ -56,13 +59,16 @@ const vm_err_str_t vm_err[] = {
         { EP(VM_ERR_HEAPNOTEXIST)  , "referenced heap not used or not exist"             },
         { EP(VM_ERR_INDUNDERZERO)  , "indirect register has been decremented under zero" },
         { EP(VM_ERR_OVERFLOW)      , "overflow"                                          },
+        { EP(VM_ERR_PENDING)       , "foreign call pending, continue after vm_resume"    },
+        { EP(VM_ERR_OUTOFFUEL)     , "fuel exhausted, continue after vm_refuel"          },
+        { EP(VM_ERR_INTERRUPTED)   , "interrupted, continue after vm_interrupt_clear"    },
         { EP(VM_ERR_FAIL)          , "generic fail"                                      },
 };
 
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
-        printf("MISSING FILENAME!!!! \n");
+        printf("MISSING FILENAME!!!! (example <file.prg|file.svmb> [out.svmb])\n");
         exit(1);
     }
 
@@ -77,11 +83,13 @@ int main(int argc, char *argv[]) {
     vm_program_t prg;
     vm_ffilib_t externals;
     uint32_t label_qty = 0;
+    vm_module_t *module = NULL;
+    size_t name_len = strlen(argv[1]);
 
     printf("start file: %s\n\n", argv[1]);
 
     // create new thread
-    vm_create_thread(&thread);
+    vm_create_thread(&thread, NULL);
 
     // load FFI print (foreign function 0)
     externals.foreign_functions = malloc(sizeof(void*));
@@ -95,29 +103,48 @@ int main(int argc, char *argv[]) {
 
     thread->externals = &externals;
 
-    // create empty code space
-    hex = malloc(sizeof(uint8_t));
-
-    // load program
-    program = vm_assembler_load_file(argv[1]);
-
-    // assemble file
-    printf("---------- start assembler\n\n");
-    res = vm_assembler(&program, &qty, &hex, &errline, &progline, label, &label_qty);
-    printf("\n---------- assembler result %s [(%u) %s]\n\n", res == ASSMBLR_OK ? "ok" : "fail", res, assembler_error[res]);
-
-    //print hex of code
-    print_hex(hex, qty, 0);
+    if (name_len > 5 && strcmp(argv[1] + name_len - 5, ".svmb") == 0) {
+        // map assembled module (no assembler on start)
+        if ((module = vm_module_load(argv[1], true)) == NULL) {
+            printf("BAD MODULE!!!! \n");
+            exit(1);
+        }
+        prg = module->program;
+    } else {
+        // create empty code space
+        hex = malloc(sizeof(uint8_t));
+
+        // load program
+        program = vm_assembler_load_file(argv[1]);
+
+        // assemble file
+        printf("---------- start assembler\n\n");
+        res = vm_assembler(&program, &qty, &hex, &errline, &progline, label, &label_qty);
+        printf("\n---------- assembler result %s [(%u) %s]\n\n", res == ASSMBLR_OK ? "ok" : "fail", res, assembler_error[res]);
+
+        //print hex of code
+        print_hex(hex, qty, 0);
+
+        // load code on VM
+        prg.prog = hex;
+        prg.prog_len = qty;
+        prg.globals_qty = assembler_globals_qty;
+
+        // save module for next starts
+        if (argc > 2 && res == ASSMBLR_OK) {
+            int fd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            bool saved = fd >= 0 && vm_module_write(fd, &prg, &assembler_module, true);
+            printf("---------- module %s: %s\n", argv[2], saved ? "ok" : "fail");
+            if (fd >= 0)
+                close(fd);
+        }
+    }
 
-    // load code on VM
-    prg.prog = hex;
-    prg.prog_len = qty;
     thread->halted = false;
 
     // execute code
     printf("\n---------- execute code\n");
-    while (thread->pc < prg.prog_len && thread->halted == false)
-        vm_step(&thread, &prg);
+    vm_run(&thread, &prg);
 
     // print internal end result
     printf("---------- execute result: %s [(%u) %s: %s] (exit value: %u)\n", thread->status == VM_ERR_OK ? "ok" : "fail", thread->status,
@@ -130,6 +157,7 @@ int main(int argc, char *argv[]) {
     // free all used
     free(program);
     free(hex);
+    vm_module_unload(module);
 
     printf("\n");
     return 0;
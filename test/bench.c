@@ -0,0 +1,1497 @@
+/*
+ * @bench.c
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "vm.h"
+#include "vm_assembler.h"
+#include "vm_libstring.h"
+#include "vm_libstrbuilder.h"
+#include "vm_libhashmap.h"
+#include "vm_libchannel.h"
+#include "ffi_fiber.h"
+#include "ffi_async.h"
+#include "ffi_parallel.h"
+#include "ffi_shared.h"
+#include "vm_executor.h"
+#include "vm_module.h"
+#include "termcolors.h"
+
+#define BENCH_RUNS 200000
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// assemble without the assembler trace
+static void bench_assemble(const char *source, vm_program_t *program) {
+    uint32_t qty = 0, errline = 0, progline = 0, label_qty = 0;
+    label_macro_t **label = NULL;
+    uint8_t *hex = malloc(sizeof(uint8_t));
+    char *str = strdup(source);
+
+    fflush(stdout);
+    int out = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    assembler_error_t res = vm_assembler(&str, &qty, &hex, &errline, &progline, label, &label_qty);
+    fflush(stdout);
+    dup2(out, STDOUT_FILENO);
+    close(null);
+    close(out);
+
+    assert(res == ASSMBLR_OK);
+    free(str);
+    program->prog = hex;
+    program->prog_len = qty;
+    program->globals_qty = assembler_globals_qty;
+}
+
+static void bench_run(vm_thread_t **thread, vm_program_t *program) {
+    while ((*thread)->pc < program->prog_len && (*thread)->halted == false)
+        vm_step(thread, program);
+}
+
+static void bench_report(const char *name, double ns, uint32_t runs) {
+    printf("  %-40s %10.1f ns/run\n", name, ns / runs);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+static const char *bench_script =
+        "PUSH_CONST_STRING str\n" //
+        "PUSH_UINT 0\n"           // LIBSTRING
+        "NEW_LIB_OBJ\n"           //
+        "SET_GLOBAL 0\n"          //
+        "PUSH_0\n"                //
+        "SET_GLOBAL 1\n"          //
+        ".label loop\n"           //
+        "GET_GLOBAL 1\n"          //
+        "INC\n"                   //
+        "SET_GLOBAL 1\n"          //
+        "GET_GLOBAL 1\n"          //
+        "PUSH_UINT 8\n"           //
+        "LT\n"                    //
+        "GOTOZ end\n"             //
+        "GOTO loop\n"             //
+        ".label end\n"            //
+        "HALT 0\n"                //
+        ".label str\n"            //
+        ".string \"bench\"\n";    //
+
+void bench_thread_reuse(void) {
+    vm_program_t program;
+    vm_ffilib_t externals = { 0 };
+    lib_entry libs[1] = { lib_entry_strings };
+    vm_thread_t *thread = NULL;
+    double start;
+
+    externals.lib = libs;
+    externals.lib_qty = 1;
+    bench_assemble(bench_script, &program);
+
+    printf("\n---[ BENCH THREAD REUSE ]---\n");
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++) {
+        vm_create_thread(&thread, NULL);
+        thread->externals = &externals;
+        bench_run(&thread, &program);
+        assert(thread->status == VM_ERR_HALT);
+        vm_destroy_thread(&thread);
+    }
+    bench_report("create / run / destroy", bench_now() - start, BENCH_RUNS);
+
+    vm_create_thread(&thread, NULL);
+    thread->externals = &externals;
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++) {
+        bench_run(&thread, &program);
+        assert(thread->status == VM_ERR_HALT);
+        vm_thread_reset(&thread);
+    }
+    bench_report("reset / run", bench_now() - start, BENCH_RUNS);
+    vm_destroy_thread(&thread);
+
+    free(program.prog);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+static const char *bench_arith_script =
+        "PUSH_0\n"                // local 0: counter
+        "PUSH_0\n"                // local 1: sum
+        "CALL 2 fn\n"             //
+        "HALT 0\n"                //
+        ".label fn\n"             //
+        ".label loop\n"           //
+        "GET_LOCAL_FF 0\n"        //
+        "INC\n"                   //
+        "SET_LOCAL_FF 0\n"        //
+        "GET_LOCAL_FF 1\n"        //
+        "GET_LOCAL_FF 0\n"        //
+        "ADD\n"                   //
+        "SET_LOCAL_FF 1\n"        //
+        "GET_LOCAL_FF 0\n"        //
+        "PUSH_UINT 1000\n"        //
+        "LT\n"                    //
+        "GOTOZ end\n"             //
+        "GOTO loop\n"             //
+        ".label end\n"            //
+        "RETURN\n";               //
+
+static const char *bench_array_script =
+        "PUSH_0\n"                //
+        "SET_GLOBAL 0\n"          //
+        ".label loop\n"           //
+        "CALL 0 fn\n"             //
+        "GET_GLOBAL 0\n"          //
+        "INC\n"                   //
+        "SET_GLOBAL 0\n"          //
+        "GET_GLOBAL 0\n"          //
+        "PUSH_UINT 100\n"         //
+        "LT\n"                    //
+        "GOTOZ end\n"             //
+        "GOTO loop\n"             //
+        ".label end\n"            //
+        "HALT 0\n"                //
+        ".label fn\n"             //
+        "PUSH_NULL_N 64\n"        //
+        "NEW_ARRAY 64\n"          // collected on return
+        "GET_ARRAY_VALUE 63\n"    //
+        "RETURN\n";               //
+
+void bench_value_layout(void) {
+    vm_program_t arith, array;
+    vm_thread_t *thread = NULL;
+    double start;
+
+#ifdef VM_VALUE_COMPACT
+    printf("\n---[ BENCH VALUE LAYOUT (compact) ]---\n");
+#else
+    printf("\n---[ BENCH VALUE LAYOUT ]---\n");
+#endif
+    printf("  %-40s %10zu bytes\n", "vm_value_t", sizeof(vm_value_t));
+    printf("  %-40s %10zu bytes\n", "vm_heap_object_t", sizeof(vm_heap_object_t));
+    printf("  %-40s %10.2f bytes\n", "heap object + metadata", sizeof(vm_heap_object_t) + sizeof(uint8_t) + 2 / 8.0);
+    printf("  %-40s %10zu bytes\n", "default stack", VM_THREAD_STACK_SIZE * sizeof(vm_value_t));
+    printf("  %-40s %10zu\n", "values per cache line", 64 / sizeof(vm_value_t));
+
+    bench_assemble(bench_arith_script, &arith);
+    bench_assemble(bench_array_script, &array);
+    vm_create_thread(&thread, NULL);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+        bench_run(&thread, &arith);
+        assert(thread->status == VM_ERR_HALT);
+        vm_thread_reset(&thread);
+    }
+    bench_report("arithmetic loop (1000 iterations)", bench_now() - start, BENCH_RUNS / 100);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+        bench_run(&thread, &array);
+        assert(thread->status == VM_ERR_HALT);
+        vm_thread_reset(&thread);
+    }
+    bench_report("array 64 create / collect (100 times)", bench_now() - start, BENCH_RUNS / 100);
+
+    vm_destroy_thread(&thread);
+    free(arith.prog);
+    free(array.prog);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+static const char *bench_string_script =
+        "PUSH_0\n"                //
+        "CALL 1 fn\n"             //
+        "HALT 0\n"                //
+        ".label fn\n"             //
+        ".label loop\n"           //
+        "PUSH_CONST_STRING a\n"   //
+        "PUSH_CONST_STRING b\n"   //
+        "EQU\n"                   //
+        "DROP\n"                  //
+        "GET_LOCAL_FF 0\n"        //
+        "INC\n"                   //
+        "SET_LOCAL_FF 0\n"        //
+        "GET_LOCAL_FF 0\n"        //
+        "PUSH_UINT 1000\n"        //
+        "LT\n"                    //
+        "GOTOZ end\n"             //
+        "GOTO loop\n"             //
+        ".label end\n"            //
+        "RETURN\n"                //
+        ".label a\n"              //
+        ".string \"configuration.network.interface.primary\"\n" //
+        ".label b\n"              //
+        ".string \"configuration.network.interface.primary\"\n"; //
+
+void bench_string_equality(void) {
+    vm_program_t program;
+    vm_thread_t *thread = NULL;
+    vm_thread_config_t config = { .intern_strings = true };
+    double start;
+
+    printf("\n---[ BENCH STRING EQUALITY ]---\n");
+    bench_assemble(bench_string_script, &program);
+
+    for (uint8_t intern = 0; intern < 2; intern++) {
+        vm_create_thread(&thread, intern ? &config : NULL);
+        start = bench_now();
+        for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+            bench_run(&thread, &program);
+            assert(thread->status == VM_ERR_HALT);
+            vm_thread_reset(&thread);
+        }
+        bench_report(intern ? "EQU interned (1000 iterations)" : "EQU strcmp (1000 iterations)", bench_now() - start, BENCH_RUNS / 100);
+        vm_destroy_thread(&thread);
+    }
+
+    free(program.prog);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+static const char *bench_slice_script =
+        "PUSH_CONST_STRING str\n" //
+        "PUSH_UINT 0\n"           // LIBSTRING
+        "NEW_LIB_OBJ\n"           //
+        "SET_GLOBAL 0\n"          //
+        "PUSH_0\n"                //
+        "CALL 1 fn\n"             //
+        "HALT 0\n"                //
+        ".label fn\n"             //
+        ".label loop\n"           //
+        "PUSH_UINT 40\n"          //
+        "GET_GLOBAL 0\n"          //
+        "LIB_FN 1 0\n"            // LIBSTRING_FN_LEFT
+        "LIB_FN 0 0\n"            // LIBSTRING_FN_LEN
+        "DROP\n"                  //
+        "GET_LOCAL_FF 0\n"        //
+        "INC\n"                   //
+        "SET_LOCAL_FF 0\n"        //
+        "GET_LOCAL_FF 0\n"        //
+        "PUSH_UINT 1000\n"        //
+        "LT\n"                    //
+        "GOTOZ end\n"             //
+        "GOTO loop\n"             //
+        ".label end\n"            //
+        "RETURN\n"                //
+        ".label str\n"            //
+        ".string \"configuration.network.interface.primary.address.ipv4\"\n"; //
+
+void bench_string_slices(void) {
+    vm_program_t program;
+    vm_ffilib_t externals = { 0 };
+    lib_entry libs[1] = { lib_entry_strings };
+    vm_thread_t *thread = NULL;
+    double start;
+
+    externals.lib = libs;
+    externals.lib_qty = 1;
+    bench_assemble(bench_slice_script, &program);
+
+    printf("\n---[ BENCH STRING SLICES ]---\n");
+
+    vm_create_thread(&thread, NULL);
+    thread->externals = &externals;
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+        bench_run(&thread, &program);
+        assert(thread->status == VM_ERR_HALT);
+        vm_thread_reset(&thread);
+    }
+    bench_report("LEFT / LEN (1000 iterations)", bench_now() - start, BENCH_RUNS / 100);
+    vm_destroy_thread(&thread);
+
+    free(program.prog);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+static const char *bench_small_script =
+        "PUSH_CONST_STRING str\n" //
+        "PUSH_UINT 0\n"           // LIBSTRING
+        "NEW_LIB_OBJ\n"           //
+        "SET_GLOBAL 0\n"          //
+        "PUSH_0\n"                //
+        "CALL 1 fn\n"             //
+        "HALT 0\n"                //
+        ".label fn\n"             //
+        ".label loop\n"           //
+        "PUSH_UINT 14\n"          //
+        "PUSH_UINT 20\n"          //
+        "GET_GLOBAL 0\n"          //
+        "LIB_FN 3 0\n"            // LIBSTRING_FN_MID
+        "LIB_FN 0 0\n"            // LIBSTRING_FN_LEN
+        "DROP\n"                  //
+        "GET_LOCAL_FF 0\n"        //
+        "INC\n"                   //
+        "SET_LOCAL_FF 0\n"        //
+        "GET_LOCAL_FF 0\n"        //
+        "PUSH_UINT 1000\n"        //
+        "LT\n"                    //
+        "GOTOZ end\n"             //
+        "GOTO loop\n"             //
+        ".label end\n"            //
+        "RETURN\n"                //
+        ".label str\n"            //
+        ".string \"configuration.network.interface.primary.address.ipv4\"\n"; //
+
+void bench_string_small(void) {
+    vm_program_t program;
+    vm_ffilib_t externals = { 0 };
+    lib_entry libs[1] = { lib_entry_strings };
+    vm_thread_t *thread = NULL;
+    double start;
+
+    externals.lib = libs;
+    externals.lib_qty = 1;
+    bench_assemble(bench_small_script, &program);
+
+    printf("\n---[ BENCH SMALL STRINGS ]---\n");
+
+    vm_create_thread(&thread, NULL);
+    thread->externals = &externals;
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+        bench_run(&thread, &program);
+        assert(thread->status == VM_ERR_HALT);
+        vm_thread_reset(&thread);
+    }
+    bench_report("MID 7 chars / LEN (1000 iterations)", bench_now() - start, BENCH_RUNS / 100);
+    vm_destroy_thread(&thread);
+
+    free(program.prog);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+#define BENCH_LOG_LINE "ts=2024-01-01T10:00:00 host=app01 level=info msg=request served path=/api/v1/items status=200 ts=2024-01-01T10:00:00 host=app01 level=info msg=request served path=/api/v1/items status=200 ts=2024-01-01T10:00:00 host=app01 level=info msg=request served path=/api/v1/items status=200 ts=2024-01-01T10:00:00 host=app01 level=info msg=request served path=/api/v1/items status=200 level=error msg=disk full"
+
+static const char *bench_find_script =
+        "PUSH_CONST_STRING str\n"     //
+        "PUSH_UINT 0\n"               // LIBSTRING
+        "NEW_LIB_OBJ\n"               //
+        "SET_GLOBAL 0\n"              //
+        "PUSH_0\n"                    //
+        "CALL 1 fn\n"                 //
+        "HALT 0\n"                    //
+        ".label fn\n"                 //
+        ".label loop\n"               //
+        "PUSH_UINT 0\n"               //
+        "PUSH_CONST_STRING needle\n"  //
+        "GET_GLOBAL 0\n"              //
+        "LIB_FN 8 0\n"                // LIBSTRING_FN_FIND
+        "DROP\n"                      //
+        "GET_LOCAL_FF 0\n"            //
+        "INC\n"                       //
+        "SET_LOCAL_FF 0\n"            //
+        "GET_LOCAL_FF 0\n"            //
+        "PUSH_UINT 1000\n"            //
+        "LT\n"                        //
+        "GOTOZ end\n"                 //
+        "GOTO loop\n"                 //
+        ".label end\n"                //
+        "RETURN\n"                    //
+        ".label str\n"                //
+        ".string \"" BENCH_LOG_LINE "\"\n" //
+        ".label needle\n"             //
+        ".string \"level=error\"\n";  //
+
+static const char *bench_find_any_script =
+        "PUSH_CONST_STRING str\n"     //
+        "PUSH_UINT 0\n"               // LIBSTRING
+        "NEW_LIB_OBJ\n"               //
+        "SET_GLOBAL 0\n"              //
+        "PUSH_CONST_STRING n0\n"      //
+        "PUSH_CONST_STRING n1\n"      //
+        "PUSH_CONST_STRING n2\n"      //
+        "NEW_ARRAY 3\n"               //
+        "SET_GLOBAL 1\n"              //
+        "PUSH_0\n"                    //
+        "CALL 1 fn\n"                 //
+        "HALT 0\n"                    //
+        ".label fn\n"                 //
+        ".label loop\n"               //
+        "PUSH_UINT 0\n"               //
+        "GET_GLOBAL 1\n"              //
+        "GET_GLOBAL 0\n"              //
+        "LIB_FN 11 0\n"               // LIBSTRING_FN_FIND_ANY
+        "DROP\n"                      //
+        "DROP\n"                      //
+        "GET_LOCAL_FF 0\n"            //
+        "INC\n"                       //
+        "SET_LOCAL_FF 0\n"            //
+        "GET_LOCAL_FF 0\n"            //
+        "PUSH_UINT 1000\n"            //
+        "LT\n"                        //
+        "GOTOZ end\n"                 //
+        "GOTO loop\n"                 //
+        ".label end\n"                //
+        "RETURN\n"                    //
+        ".label str\n"                //
+        ".string \"" BENCH_LOG_LINE "\"\n" //
+        ".label n0\n"                 //
+        ".string \"level=fatal\"\n"   //
+        ".label n1\n"                 //
+        ".string \"level=warn\"\n"    //
+        ".label n2\n"                 //
+        ".string \"level=error\"\n";  //
+
+void bench_string_find(void) {
+    vm_program_t find, find_any;
+    vm_ffilib_t externals = { 0 };
+    lib_entry libs[1] = { lib_entry_strings };
+    vm_thread_t *thread = NULL;
+    double start;
+
+    externals.lib = libs;
+    externals.lib_qty = 1;
+    bench_assemble(bench_find_script, &find);
+    bench_assemble(bench_find_any_script, &find_any);
+
+    printf("\n---[ BENCH STRING FIND ]---\n");
+
+    vm_create_thread(&thread, NULL);
+    thread->externals = &externals;
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+        bench_run(&thread, &find);
+        assert(thread->status == VM_ERR_HALT);
+        vm_thread_reset(&thread);
+    }
+    bench_report("FIND in 400 chars (1000 iterations)", bench_now() - start, BENCH_RUNS / 100);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+        bench_run(&thread, &find_any);
+        assert(thread->status == VM_ERR_HALT);
+        vm_thread_reset(&thread);
+    }
+    bench_report("FIND_ANY 3 needles (1000 iterations)", bench_now() - start, BENCH_RUNS / 100);
+    vm_destroy_thread(&thread);
+
+    free(find.prog);
+    free(find_any.prog);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+static const char *bench_concat_script =
+        "PUSH_CONST_STRING item\n" //
+        "PUSH_UINT 0\n"            // LIBSTRING
+        "NEW_LIB_OBJ\n"            //
+        "SET_GLOBAL 0\n"           //
+        "PUSH_0\n"                 //
+        "CALL 1 fn\n"              //
+        "HALT 0\n"                 //
+        ".label fn\n"              //
+        ".label loop\n"            //
+        "PUSH_CONST_STRING item\n" //
+        "GET_GLOBAL 0\n"           //
+        "LIB_FN 4 0\n"             // LIBSTRING_FN_CONCAT
+        "SET_GLOBAL 0\n"           //
+        "GET_LOCAL_FF 0\n"         //
+        "INC\n"                    //
+        "SET_LOCAL_FF 0\n"         //
+        "GET_LOCAL_FF 0\n"         //
+        "PUSH_UINT 1000\n"         //
+        "LT\n"                     //
+        "GOTOZ end\n"              //
+        "GOTO loop\n"              //
+        ".label end\n"             //
+        "RETURN\n"                 //
+        ".label item\n"            //
+        ".string \"field,\"\n";    //
+
+static const char *bench_builder_script =
+        "PUSH_UINT 1\n"            // LIBSTRBUILDER
+        "NEW_LIB_OBJ\n"            //
+        "SET_GLOBAL 0\n"           //
+        "PUSH_0\n"                 //
+        "CALL 1 fn\n"              //
+        "GET_GLOBAL 0\n"           //
+        "LIB_FN 3 0\n"             // LIBSTRBUILDER_FN_FINISH
+        "HALT 0\n"                 //
+        ".label fn\n"              //
+        ".label loop\n"            //
+        "PUSH_CONST_STRING item\n" //
+        "GET_GLOBAL 0\n"           //
+        "LIB_FN 0 0\n"             // LIBSTRBUILDER_FN_APPEND
+        "DROP\n"                   //
+        "GET_LOCAL_FF 0\n"         //
+        "INC\n"                    //
+        "SET_LOCAL_FF 0\n"         //
+        "GET_LOCAL_FF 0\n"         //
+        "PUSH_UINT 1000\n"         //
+        "LT\n"                     //
+        "GOTOZ end\n"              //
+        "GOTO loop\n"              //
+        ".label end\n"             //
+        "RETURN\n"                 //
+        ".label item\n"            //
+        ".string \"field,\"\n";    //
+
+void bench_string_build(void) {
+    vm_program_t concat, builder;
+    vm_ffilib_t externals = { 0 };
+    lib_entry libs[2] = { lib_entry_strings, lib_entry_strbuilder };
+    vm_thread_t *thread = NULL;
+    double start;
+
+    externals.lib = libs;
+    externals.lib_qty = 2;
+    bench_assemble(bench_concat_script, &concat);
+    bench_assemble(bench_builder_script, &builder);
+
+    printf("\n---[ BENCH STRING BUILD ]---\n");
+
+    vm_create_thread(&thread, NULL);
+    thread->externals = &externals;
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 1000; n++) {
+        bench_run(&thread, &concat);
+        assert(thread->status == VM_ERR_HALT);
+        vm_thread_reset(&thread);
+    }
+    bench_report("CONCAT (1000 appends)", bench_now() - start, BENCH_RUNS / 1000);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 1000; n++) {
+        bench_run(&thread, &builder);
+        assert(thread->status == VM_ERR_HALT);
+        vm_thread_reset(&thread);
+    }
+    bench_report("builder APPEND / FINISH (1000 appends)", bench_now() - start, BENCH_RUNS / 1000);
+    vm_destroy_thread(&thread);
+
+    free(concat.prog);
+    free(builder.prog);
+}
+
+void bench_string_numbers(void) {
+    char buf[32];
+    uint32_t sink = 0;
+    double start;
+    vm_value_t value;
+
+    printf("\n---[ BENCH STRING NUMBERS ]---\n");
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++)
+        sink += snprintf(buf, sizeof(buf), "%d", (int32_t) (n * 2654435761U));
+    bench_report("snprintf %d", bench_now() - start, BENCH_RUNS);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++)
+        sink += libstring_itoa((int32_t) (n * 2654435761U), buf);
+    bench_report("libstring_itoa", bench_now() - start, BENCH_RUNS);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++)
+        sink += snprintf(buf, sizeof(buf), "%.9g", n * 0.37f);
+    bench_report("snprintf %.9g", bench_now() - start, BENCH_RUNS);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++)
+        sink += libstring_ftoa(n * 0.37f, buf);
+    bench_report("libstring_ftoa (shortest)", bench_now() - start, BENCH_RUNS);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++) {
+        uint32_t len = libstring_ftoa(n * 0.37f, buf);
+        buf[len] = '\0';
+        sink += strtof(buf, NULL) > 0;
+    }
+    bench_report("libstring_ftoa + strtof", bench_now() - start, BENCH_RUNS);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++) {
+        uint32_t len = libstring_ftoa(n * 0.37f, buf);
+        sink += libstring_parse_number(buf, len, VM_VAL_FLOAT, &value) && value.number.real > 0;
+    }
+    bench_report("libstring_ftoa + libstring_parse_number", bench_now() - start, BENCH_RUNS);
+
+    assert(sink > 0);
+}
+
+#define BENCH_MAP_KEYS 255 // array capacity, largest set a script can scan
+
+static void bench_map_call(vm_thread_t **thread, vm_value_t map, vm_value_t key, uint8_t call_type) {
+    vm_push(thread, key);
+    vm_push(thread, map);
+    lib_entry_hashtable(thread, call_type, map.lib_obj.lib_idx, 0);
+}
+
+void bench_hashmap(void) {
+    vm_ffilib_t externals = { 0 };
+    lib_entry libs[2] = { lib_entry_strings, lib_entry_hashtable };
+    vm_thread_t *thread = NULL;
+    vm_value_t keys[BENCH_MAP_KEYS], skeys[BENCH_MAP_KEYS], value = { .type = VM_VAL_UINT };
+    char names[BENCH_MAP_KEYS][16];
+    vm_heap_object_t obj = { 0 };
+    uint32_t sink = 0;
+    double start;
+
+    externals.lib = libs;
+    externals.lib_qty = 2;
+    vm_create_thread(&thread, NULL);
+    thread->externals = &externals;
+
+    obj.lib_obj.lib_idx = 1;
+    vm_value_t map = { .type = VM_VAL_LIB_OBJ };
+    map.lib_obj.lib_idx = 1;
+    map.lib_obj.heap_ref = vm_heap_save(thread->heap, VM_VAL_LIB_OBJ, false, obj, &(thread->frames[0].gc_mark));
+    lib_entry_hashtable(&thread, VM_EDFAT_NEW, 1, map.lib_obj.heap_ref);
+
+    for (uint32_t n = 0; n < BENCH_MAP_KEYS; n++) {
+        keys[n] = (vm_value_t) { .type = VM_VAL_UINT };
+        keys[n].number.uinteger = n * 2654435761U;
+        snprintf(names[n], sizeof(names[n]), "key_%u", n);
+        skeys[n] = (vm_value_t) { .type = VM_VAL_CONST_STRING };
+        VM_CSTR_SET(skeys[n], names[n], true);
+
+        value.number.uinteger = n;
+        vm_push(&thread, value);
+        bench_map_call(&thread, map, keys[n], LIBHASHMAP_FN_SET);
+        vm_push(&thread, value);
+        bench_map_call(&thread, map, skeys[n], LIBHASHMAP_FN_SET);
+        thread->sp -= 2;
+    }
+
+    printf("\n---[ BENCH HASHMAP (%u keys) ]---\n", BENCH_MAP_KEYS);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++) {
+        vm_value_t key = keys[n % BENCH_MAP_KEYS];
+        for (uint32_t k = 0; k < BENCH_MAP_KEYS; k++)
+            if (keys[k].type == key.type && keys[k].number.uinteger == key.number.uinteger) {
+                sink += k;
+                break;
+            }
+    }
+    bench_report("linear scan (uint)", bench_now() - start, BENCH_RUNS);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++) {
+        bench_map_call(&thread, map, keys[n % BENCH_MAP_KEYS], LIBHASHMAP_FN_GET);
+        sink += vm_pop(&thread).number.uinteger;
+    }
+    bench_report("GET (uint)", bench_now() - start, BENCH_RUNS);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++) {
+        const char *key = names[n % BENCH_MAP_KEYS];
+        for (uint32_t k = 0; k < BENCH_MAP_KEYS; k++)
+            if (strcmp(VM_CSTR_ADDR(skeys[k]), key) == 0) {
+                sink += k;
+                break;
+            }
+    }
+    bench_report("linear scan (string)", bench_now() - start, BENCH_RUNS);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++) {
+        bench_map_call(&thread, map, skeys[n % BENCH_MAP_KEYS], LIBHASHMAP_FN_GET);
+        sink += vm_pop(&thread).number.uinteger;
+    }
+    bench_report("GET (string)", bench_now() - start, BENCH_RUNS);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++) {
+        value.number.uinteger = n;
+        vm_push(&thread, value);
+        bench_map_call(&thread, map, value, LIBHASHMAP_FN_SET);
+        thread->sp--;
+    }
+    bench_report("SET (growing to 200000 keys)", bench_now() - start, BENCH_RUNS);
+
+    assert(sink > 0);
+    vm_destroy_thread(&thread);
+}
+
+#define BENCH_FIBERS 10000
+
+static const char *bench_fibers_script =
+        "PUSH_0\n"                   //
+        "SET_GLOBAL 0\n"             //
+        ".label spawn\n"             //
+        "PUSH_NULL\n"                // argument
+        "CALL_FOREIGN 0 worker 0\n"  // FFI_FIBER_ENQUEUE
+        "GET_GLOBAL 0\n"             //
+        "INC\n"                      //
+        "SET_GLOBAL 0\n"             //
+        "GET_GLOBAL 0\n"             //
+        "PUSH_UINT 10000\n"          // BENCH_FIBERS
+        "LT\n"                       //
+        "GOTOZ run\n"                //
+        "GOTO spawn\n"               //
+        ".label run\n"               //
+        "CALL_FOREIGN 4 0 0\n"       // FFI_FIBER_YIELD
+        "GET_RETVAL\n"               //
+        "GOTOZ end\n"                // no more fibers
+        "GOTO run\n"                 //
+        ".label end\n"               //
+        "HALT 0\n"                   //
+        ".label worker\n"            //
+        "DROP\n"                     //
+        "CALL_FOREIGN 4 0 0\n"       // FFI_FIBER_YIELD x 10
+        "CALL_FOREIGN 4 0 0\n"       //
+        "CALL_FOREIGN 4 0 0\n"       //
+        "CALL_FOREIGN 4 0 0\n"       //
+        "CALL_FOREIGN 4 0 0\n"       //
+        "CALL_FOREIGN 4 0 0\n"       //
+        "CALL_FOREIGN 4 0 0\n"       //
+        "CALL_FOREIGN 4 0 0\n"       //
+        "CALL_FOREIGN 4 0 0\n"       //
+        "CALL_FOREIGN 4 0 0\n"       //
+        "CALL_FOREIGN 1 0 0\n";      // FFI_FIBER_DEQUEUE
+
+void bench_fibers(void) {
+    vm_program_t program;
+    vm_ffilib_t externals = { 0 };
+    vm_foreign_function_t ffis[1] = { ffi_fiber };
+    vm_thread_t *thread = NULL;
+    double start;
+
+    externals.foreign_functions = ffis;
+    externals.foreign_functions_qty = 1;
+    bench_assemble(bench_fibers_script, &program);
+
+    printf("\n---[ BENCH FIBERS (%u fibers, 10 yields each) ]---\n", BENCH_FIBERS);
+
+    vm_create_thread(&thread, NULL);
+    thread->externals = &externals;
+    start = bench_now();
+    bench_run(&thread, &program);
+    assert(thread->status == VM_ERR_HALT);
+    bench_report("spawn, yield and end (per switch)", bench_now() - start, BENCH_FIBERS * 12);
+    printf("  %-40s %10zu bytes\n", "memory of a new fiber",
+            sizeof(ffi_fiber_t) + FFI_FIBER_STACK_SIZE * sizeof(vm_value_t) + FFI_FIBER_FRAMES_SIZE * sizeof(vm_frame_t)
+                    + VM_HEAP_MARK_WORDS * sizeof(uint32_t) + (ID_ALLOC_WORD(thread->max_call_depth) + 1) * sizeof(uint32_t));
+    ffi_fiber_destroy(&thread);
+    vm_destroy_thread(&thread);
+
+    free(program.prog);
+}
+
+#define BENCH_ASYNC 1000
+
+static const char *bench_async_script =
+        "PUSH_0\n"                   //
+        "SET_GLOBAL 0\n"             //
+        ".label spawn\n"             //
+        "PUSH_NULL\n"                // argument
+        "CALL_FOREIGN 0 worker 0\n"  // FFI_FIBER_ENQUEUE
+        "GET_GLOBAL 0\n"             //
+        "INC\n"                      //
+        "SET_GLOBAL 0\n"             //
+        "GET_GLOBAL 0\n"             //
+        "PUSH_UINT 1000\n"           // BENCH_ASYNC
+        "LT\n"                       //
+        "GOTOZ run\n"                //
+        "GOTO spawn\n"               //
+        ".label run\n"               //
+        "CALL_FOREIGN 4 0 0\n"       // FFI_FIBER_YIELD
+        "GET_RETVAL\n"               //
+        "GOTOZ end\n"                // no more fibers
+        "GOTO run\n"                 //
+        ".label end\n"               //
+        "HALT 0\n"                   //
+        ".label worker\n"            //
+        "DROP\n"                     //
+        "CALL_FOREIGN 0 0 1\n"       // FFI_ASYNC_SLEEP 0 ms x 10
+        "CALL_FOREIGN 0 0 1\n"       //
+        "CALL_FOREIGN 0 0 1\n"       //
+        "CALL_FOREIGN 0 0 1\n"       //
+        "CALL_FOREIGN 0 0 1\n"       //
+        "CALL_FOREIGN 0 0 1\n"       //
+        "CALL_FOREIGN 0 0 1\n"       //
+        "CALL_FOREIGN 0 0 1\n"       //
+        "CALL_FOREIGN 0 0 1\n"       //
+        "CALL_FOREIGN 0 0 1\n"       //
+        "CALL_FOREIGN 1 0 0\n";      // FFI_FIBER_DEQUEUE
+
+void bench_async(void) {
+    vm_program_t program;
+    vm_ffilib_t externals = { 0 };
+    vm_foreign_function_t ffis[2] = { ffi_fiber, ffi_async };
+    vm_thread_t *thread = NULL;
+    ffi_async_loop_t *loop = ffi_async_create();
+    double start;
+
+    externals.foreign_functions = ffis;
+    externals.foreign_functions_qty = 2;
+    bench_assemble(bench_async_script, &program);
+
+    printf("\n---[ BENCH ASYNC (%u fibers, 10 timers each) ]---\n", BENCH_ASYNC);
+
+    vm_create_thread(&thread, NULL);
+    thread->externals = &externals;
+    ffi_async_attach(loop, thread, &program);
+    start = bench_now();
+    ffi_async_run(loop);
+    assert(thread->status == VM_ERR_HALT);
+    bench_report("timer, suspend and resume (per wait)", bench_now() - start, BENCH_ASYNC * 10);
+    ffi_async_destroy(loop);
+    ffi_fiber_destroy(&thread);
+    vm_destroy_thread(&thread);
+
+    free(program.prog);
+}
+
+void bench_fuel(void) {
+    vm_program_t arith;
+    vm_thread_t *thread = NULL;
+    double start;
+
+    printf("\n---[ BENCH FUEL ]---\n");
+
+    bench_assemble(bench_arith_script, &arith);
+    vm_create_thread(&thread, NULL);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+        vm_run(&thread, &arith);
+        assert(thread->status == VM_ERR_HALT);
+        vm_thread_reset(&thread);
+    }
+    bench_report("arithmetic loop, not metered", bench_now() - start, BENCH_RUNS / 100);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+        vm_refuel(&thread, 0xffffffff);
+        vm_run(&thread, &arith);
+        assert(thread->status == VM_ERR_HALT);
+        vm_thread_reset(&thread);
+    }
+    bench_report("arithmetic loop, metered", bench_now() - start, BENCH_RUNS / 100);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+        vm_refuel(&thread, 100);
+        while (vm_run(&thread, &arith) == VM_ERR_OUTOFFUEL)
+            vm_refuel(&thread, 100);
+        assert(thread->status == VM_ERR_HALT);
+        vm_thread_reset(&thread);
+    }
+    bench_report("arithmetic loop, slices of 100", bench_now() - start, BENCH_RUNS / 100);
+
+    vm_destroy_thread(&thread);
+    free(arith.prog);
+}
+
+void bench_executor(void) {
+    vm_program_t program;
+    vm_ffilib_t externals = { 0 };
+    lib_entry libs[1] = { lib_entry_strings };
+    vm_job_t *jobs = calloc(BENCH_RUNS, sizeof(vm_job_t));
+    uint32_t workers[2] = { 1, 0 };
+    char name[64];
+    double start;
+
+    externals.lib = libs;
+    externals.lib_qty = 1;
+    bench_assemble(bench_script, &program);
+    for (uint32_t n = 0; n < BENCH_RUNS; n++) {
+        jobs[n].program = &program;
+        jobs[n].externals = &externals;
+    }
+
+    printf("\n---[ BENCH EXECUTOR (%ld cores) ]---\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (uint32_t w = 0; w < 4; w++) {
+        vm_executor_t *executor = vm_executor_create(workers[w % 2], NULL);
+        executor->slice = w < 2 ? 0 : 100;
+        start = bench_now();
+        for (uint32_t n = 0; n < BENCH_RUNS; n++)
+            vm_executor_submit(executor, &jobs[n]);
+        vm_executor_wait(executor);
+        snprintf(name, sizeof(name), "submit / run / wait (%u workers, slice %u)", executor->workers_qty, executor->slice);
+        bench_report(name, bench_now() - start, BENCH_RUNS);
+        assert(jobs[BENCH_RUNS - 1].status == VM_ERR_HALT);
+        vm_executor_destroy(executor);
+    }
+
+    free(jobs);
+    free(program.prog);
+}
+
+#define BENCH_CHANNEL_BATCH 32
+
+// host queue with a mutex: how threads exchanged values without channels
+typedef struct bench_locked_queue_s {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    vm_value_t values[LIBCHANNEL_DEFAULT_SIZE];
+    uint32_t head, tail;
+} bench_locked_queue_t;
+
+typedef struct bench_channel_peer_s {
+    vm_thread_t *thread;
+    vm_value_t channel;
+    bench_locked_queue_t *queue;
+    uint32_t batch;
+} bench_channel_peer_t;
+
+static void bench_locked_send(bench_locked_queue_t *queue, vm_value_t value) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->head - queue->tail == LIBCHANNEL_DEFAULT_SIZE)
+        pthread_cond_wait(&queue->wake, &queue->lock);
+    queue->values[queue->head++ % LIBCHANNEL_DEFAULT_SIZE] = value;
+    pthread_cond_broadcast(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static vm_value_t bench_locked_recv(bench_locked_queue_t *queue) {
+    pthread_mutex_lock(&queue->lock);
+    while (queue->head == queue->tail)
+        pthread_cond_wait(&queue->wake, &queue->lock);
+    vm_value_t value = queue->values[queue->tail++ % LIBCHANNEL_DEFAULT_SIZE];
+    pthread_cond_broadcast(&queue->wake);
+    pthread_mutex_unlock(&queue->lock);
+
+    return value;
+}
+
+static void bench_channel_call(vm_thread_t **thread, vm_value_t channel, uint8_t call_type, uint32_t mode) {
+    vm_push(thread, channel);
+    lib_entry_channel(thread, call_type, channel.lib_obj.lib_idx, mode);
+}
+
+static void* bench_channel_producer(void *arg) {
+    bench_channel_peer_t *peer = arg;
+    vm_value_t value = { .type = VM_VAL_UINT };
+
+    for (uint32_t n = 0; n < BENCH_RUNS; n += peer->batch) {
+        value.number.uinteger = n;
+        if (peer->queue != NULL) {
+            bench_locked_send(peer->queue, value);
+            continue;
+        }
+
+        for (uint32_t b = 0; b < peer->batch; b++)
+            vm_push(&peer->thread, value);
+        if (peer->batch == 1)
+            bench_channel_call(&peer->thread, peer->channel, LIBCHANNEL_FN_SEND, LIBCHANNEL_BLOCK);
+        else {
+            vm_new_uint(count, peer->batch);
+            vm_push(&peer->thread, count);
+            bench_channel_call(&peer->thread, peer->channel, LIBCHANNEL_FN_SEND_BATCH, LIBCHANNEL_BLOCK);
+        }
+        peer->thread->sp = 0;
+    }
+
+    return NULL;
+}
+
+void bench_channels(void) {
+    vm_ffilib_t externals = { 0 };
+    lib_entry libs[1] = { lib_entry_channel };
+    vm_value_t value = { .type = VM_VAL_UINT };
+    bench_locked_queue_t queue = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+    bench_channel_peer_t producer = { 0 };
+    vm_thread_t *thread = NULL;
+    char name[64];
+    pthread_t id;
+    double start;
+
+    externals.lib = libs;
+    externals.lib_qty = 1;
+    vm_create_thread(&thread, NULL);
+    vm_create_thread(&producer.thread, NULL);
+    thread->externals = &externals;
+    producer.thread->externals = &externals;
+
+    printf("\n---[ BENCH CHANNELS (%ld cores) ]---\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS; n++) {
+        bench_locked_send(&queue, value);
+        value = bench_locked_recv(&queue);
+    }
+    bench_report("mutex queue send / recv (same thread)", bench_now() - start, BENCH_RUNS);
+
+    for (uint32_t spsc = 0; spsc < 2; spsc++) {
+        libchannel_t *channel = libchannel_create(LIBCHANNEL_DEFAULT_SIZE, spsc);
+        vm_value_t handle = libchannel_value(&thread, 0, channel);
+
+        start = bench_now();
+        for (uint32_t n = 0; n < BENCH_RUNS; n++) {
+            vm_push(&thread, value);
+            bench_channel_call(&thread, handle, LIBCHANNEL_FN_SEND, LIBCHANNEL_TRY);
+            bench_channel_call(&thread, handle, LIBCHANNEL_FN_RECV, LIBCHANNEL_TRY);
+            thread->sp = 0;
+        }
+        snprintf(name, sizeof(name), "%s send / recv (same thread)", spsc ? "SPSC" : "MPMC");
+        bench_report(name, bench_now() - start, BENCH_RUNS);
+
+        start = bench_now();
+        for (uint32_t n = 0; n < BENCH_RUNS; n += BENCH_CHANNEL_BATCH) {
+            for (uint32_t b = 0; b < BENCH_CHANNEL_BATCH; b++)
+                vm_push(&thread, value);
+            vm_new_uint(count, BENCH_CHANNEL_BATCH);
+            vm_push(&thread, count);
+            bench_channel_call(&thread, handle, LIBCHANNEL_FN_SEND_BATCH, LIBCHANNEL_TRY);
+            thread->sp = 0;
+            vm_push(&thread, count);
+            bench_channel_call(&thread, handle, LIBCHANNEL_FN_RECV_BATCH, LIBCHANNEL_TRY);
+            thread->sp = 0;
+        }
+        snprintf(name, sizeof(name), "%s batch of %u (same thread)", spsc ? "SPSC" : "MPMC", BENCH_CHANNEL_BATCH);
+        bench_report(name, bench_now() - start, BENCH_RUNS);
+
+        vm_thread_reset(&thread);
+        libchannel_release(channel);
+    }
+
+    // producer on another OS thread
+    for (uint32_t mode = 0; mode < 3; mode++) {
+        libchannel_t *channel = libchannel_create(LIBCHANNEL_DEFAULT_SIZE, true);
+        vm_value_t handle = libchannel_value(&thread, 0, channel);
+        producer.channel = libchannel_value(&producer.thread, 0, channel);
+        producer.queue = mode == 0 ? &queue : NULL;
+        producer.batch = mode == 2 ? BENCH_CHANNEL_BATCH : 1;
+
+        start = bench_now();
+        pthread_create(&id, NULL, bench_channel_producer, &producer);
+        for (uint32_t n = 0; n < BENCH_RUNS;) {
+            if (mode == 0) {
+                bench_locked_recv(&queue);
+                n += 1;
+                continue;
+            }
+            vm_new_uint(count, BENCH_CHANNEL_BATCH);
+            vm_push(&thread, count);
+            bench_channel_call(&thread, handle, LIBCHANNEL_FN_RECV_BATCH, LIBCHANNEL_BLOCK);
+            n += vm_pop(&thread).number.uinteger;
+            thread->sp = 0;
+        }
+        pthread_join(id, NULL);
+        bench_report(mode == 0 ? "mutex queue, producer thread" : mode == 1 ? "SPSC single send, producer thread" : "SPSC batch send, producer thread",
+                bench_now() - start, BENCH_RUNS);
+
+        vm_thread_reset(&thread);
+        vm_thread_reset(&producer.thread);
+        libchannel_release(channel);
+    }
+
+    vm_destroy_thread(&thread);
+    vm_destroy_thread(&producer.thread);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+static const char *bench_parallel_script =
+        "PUSH_0\n"                   //
+        "SET_GLOBAL 0\n"             //
+        ".label fill\n"              //
+        "GET_GLOBAL 0\n"             // element (stays on stack)
+        "GET_GLOBAL 0\n"             //
+        "INC\n"                      //
+        "SET_GLOBAL 0\n"             //
+        "GET_GLOBAL 0\n"             //
+        "PUSH_UINT 100\n"            //
+        "LT\n"                       //
+        "GOTOZ map\n"                //
+        "GOTO fill\n"                //
+        ".label map\n"               //
+        "NEW_ARRAY 100\n"            //
+        "CALL_FOREIGN 0 work 0\n"    // FFI_PARALLEL_MAP
+        "GET_RETVAL\n"               //
+        "HALT 0\n"                   //
+        ".label work\n"              //
+        "PUSH_0\n"                   //
+        "SET_LOCAL_FF 1\n"           //
+        ".label spin\n"              //
+        "GET_LOCAL_FF 1\n"           //
+        "INC\n"                      //
+        "SET_LOCAL_FF 1\n"           //
+        "GET_LOCAL_FF 1\n"           //
+        "PUSH_UINT 500\n"            //
+        "LT\n"                       //
+        "GOTOZ done\n"               //
+        "GOTO spin\n"                //
+        ".label done\n"              //
+        "GET_LOCAL_FF 0\n"           //
+        "GET_LOCAL_FF 0\n"           //
+        "MUL\n"                      //
+        "RETURN_VALUE\n"             //
+;
+
+void bench_parallel(void) {
+    vm_thread_t *thread = NULL;
+    vm_program_t program;
+    vm_ffilib_t externals = { 0 };
+    vm_foreign_function_t ffis[1] = { ffi_parallel };
+    uint32_t workers[3] = { 1, 4, 0 };
+    char name[64];
+    double start;
+
+    externals.foreign_functions = ffis;
+    externals.foreign_functions_qty = 1;
+    bench_assemble(bench_parallel_script, &program);
+    vm_create_thread(&thread, NULL);
+    thread->externals = &externals;
+
+    printf("\n---[ BENCH PARALLEL (%ld cores) ]---\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (uint32_t w = 0; w < 3; w++) {
+        ffi_parallel_t *pool = ffi_parallel_create(&program, workers[w], NULL);
+        thread->parallel = pool;
+        start = bench_now();
+        for (uint32_t n = 0; n < BENCH_RUNS / 4000; n++) {
+            vm_run(&thread, &program);
+            assert(thread->status == VM_ERR_HALT && vm_pop(&thread).type == VM_VAL_ARRAY);
+            vm_thread_reset(&thread);
+        }
+        snprintf(name, sizeof(name), "map of 100 calls (%u workers)", pool->workers_qty);
+        bench_report(name, bench_now() - start, BENCH_RUNS / 4000);
+        thread->parallel = NULL;
+        ffi_parallel_destroy(pool);
+    }
+
+    vm_destroy_thread(&thread);
+    free(program.prog);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+static const char *bench_shared_script =
+        "PUSH_0\n"                   //
+        "SET_GLOBAL 0\n"             //
+        ".label loop\n"              //
+        "PUSH_UINT 1\n"              //
+        "CALL_FOREIGN 2 0 0\n"       // FFI_SHARED_ADD
+        "PUSH_UINT 1\n"              //
+        "CALL_FOREIGN 2 0 0\n"       //
+        "PUSH_UINT 1\n"              //
+        "CALL_FOREIGN 2 0 0\n"       //
+        "PUSH_UINT 1\n"              //
+        "CALL_FOREIGN 2 0 0\n"       //
+        "GET_GLOBAL 0\n"             //
+        "INC\n"                      //
+        "SET_GLOBAL 0\n"             //
+        "GET_GLOBAL 0\n"             //
+        "PUSH_UINT 1000\n"           //
+        "LT\n"                       //
+        "GOTOZ end\n"                //
+        "GOTO loop\n"                //
+        ".label end\n"               //
+        "HALT 0\n"                   //
+;
+
+// counter behind a mutex: how scripts shared counters without the shared segment
+static pthread_mutex_t bench_counter_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t bench_counter;
+
+static vm_value_t bench_locked_counter(vm_thread_t **thread, uint8_t fn, uint32_t arg) {
+    vm_value_t value = vm_pop(thread);
+
+    pthread_mutex_lock(&bench_counter_lock);
+    bench_counter += value.number.uinteger;
+    value.number.uinteger = bench_counter;
+    pthread_mutex_unlock(&bench_counter_lock);
+
+    return value;
+}
+
+static void* bench_shared_runner(void *arg) {
+    vm_thread_t *thread = arg;
+    vm_program_t *program = thread->userdata;
+
+    for (uint32_t n = 0; n < BENCH_RUNS / 1000; n++) {
+        vm_run(&thread, program);
+        vm_thread_reset(&thread);
+    }
+
+    return NULL;
+}
+
+void bench_shared(void) {
+    vm_program_t program;
+    vm_ffilib_t externals[2] = { 0 };
+    vm_foreign_function_t ffis[2] = { bench_locked_counter, ffi_shared };
+    const char *names[2] = { "mutex counter", "shared segment add" };
+    ffi_shared_t *shared = ffi_shared_create(1);
+    vm_thread_t *threads[2] = { NULL };
+    pthread_t ids[2];
+    char name[64];
+    double start;
+
+    bench_assemble(bench_shared_script, &program);
+    for (uint32_t t = 0; t < 2; t++) {
+        vm_create_thread(&threads[t], NULL);
+        ffi_shared_attach(shared, threads[t]);
+        threads[t]->userdata = &program;
+    }
+
+    printf("\n---[ BENCH SHARED (%ld cores) ]---\n", sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (uint32_t f = 0; f < 2; f++) {
+        externals[f].foreign_functions = &ffis[f];
+        externals[f].foreign_functions_qty = 1;
+        for (uint32_t t = 0; t < 2; t++)
+            threads[t]->externals = &externals[f];
+
+        for (uint32_t qty = 1; qty <= 2; qty++) {
+            start = bench_now();
+            for (uint32_t t = 0; t < qty; t++)
+                pthread_create(&ids[t], NULL, bench_shared_runner, threads[t]);
+            for (uint32_t t = 0; t < qty; t++)
+                pthread_join(ids[t], NULL);
+            snprintf(name, sizeof(name), "%s, %u threads (per add)", names[f], qty);
+            bench_report(name, bench_now() - start, 4 * qty * BENCH_RUNS);
+        }
+    }
+    assert(ffi_shared_load(shared, 0).number.uinteger == 12 * BENCH_RUNS);
+    assert(bench_counter == 12 * BENCH_RUNS);
+
+    for (uint32_t t = 0; t < 2; t++) {
+        ffi_shared_detach(threads[t]);
+        vm_destroy_thread(&threads[t]);
+    }
+    ffi_shared_release(shared);
+    free(program.prog);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+static const char *bench_clone_script =
+        "PUSH_UINT 0\n"              // LIBHASHMAP
+        "NEW_LIB_OBJ\n"              //
+        "SET_GLOBAL 0\n"             // lookup map
+        "PUSH_0\n"                   //
+        "SET_GLOBAL 1\n"             //
+        ".label fill\n"              //
+        "GET_GLOBAL 1\n"             // value
+        "GET_GLOBAL 1\n"             // key
+        "GET_GLOBAL 0\n"             //
+        "LIB_FN 0 0\n"               // LIBHASHMAP_FN_SET
+        "DROP\n"                     //
+        "GET_GLOBAL 1\n"             //
+        "INC\n"                      //
+        "SET_GLOBAL 1\n"             //
+        "GET_GLOBAL 1\n"             //
+        "PUSH_UINT 1000\n"           //
+        "LT\n"                       //
+        "GOTOZ done\n"               //
+        "GOTO fill\n"                //
+        ".label done\n"              //
+        "HALT 0\n"                   // end of init
+        "PUSH_UINT 500\n"            // request
+        "GET_GLOBAL 0\n"             //
+        "LIB_FN 1 0\n"               // LIBHASHMAP_FN_GET
+        "HALT 1\n"                   //
+;
+
+void bench_clone(void) {
+    vm_thread_t *thread = NULL, *clone = NULL;
+    vm_program_t program;
+    vm_ffilib_t externals = { 0 };
+    lib_entry libs[1] = { lib_entry_hashtable };
+    uint32_t request;
+    double start;
+
+    externals.lib = libs;
+    externals.lib_qty = 1;
+    bench_assemble(bench_clone_script, &program);
+    vm_create_thread(&thread, NULL);
+    thread->externals = &externals;
+
+    printf("\n---[ BENCH CLONE (init: map of 1000 entries) ]---\n");
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+        vm_run(&thread, &program);
+        thread->pc++;
+        thread->halted = false;
+        vm_run(&thread, &program);
+        assert(thread->exit_value == 1 && vm_pop(&thread).number.uinteger == 500);
+        vm_thread_reset(&thread);
+    }
+    bench_report("init + request (reset thread)", bench_now() - start, BENCH_RUNS / 100);
+
+    vm_run(&thread, &program);
+    request = thread->pc + 1;
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+        vm_thread_clone(&clone, thread);
+        clone->pc = request;
+        clone->halted = false;
+        vm_run(&clone, &program);
+        assert(clone->exit_value == 1 && vm_pop(&clone).number.uinteger == 500);
+        vm_destroy_thread(&clone);
+    }
+    bench_report("clone of init + request", bench_now() - start, BENCH_RUNS / 100);
+
+    vm_destroy_thread(&thread);
+    free(program.prog);
+}
+
+void bench_snapshot(void) {
+    vm_thread_t *thread = NULL, *restored = NULL;
+    vm_program_t program;
+    vm_ffilib_t externals = { 0 };
+    lib_entry libs[1] = { lib_entry_hashtable };
+    uint32_t request;
+    double start;
+
+    externals.lib = libs;
+    externals.lib_qty = 1;
+    bench_assemble(bench_clone_script, &program);
+    vm_create_thread(&thread, NULL);
+    thread->externals = &externals;
+
+    printf("\n---[ BENCH SNAPSHOT (init: map of 1000 entries) ]---\n");
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+        vm_run(&thread, &program);
+        thread->pc++;
+        thread->halted = false;
+        vm_run(&thread, &program);
+        assert(thread->exit_value == 1 && vm_pop(&thread).number.uinteger == 500);
+        vm_thread_reset(&thread);
+    }
+    bench_report("init + request (reset thread)", bench_now() - start, BENCH_RUNS / 100);
+
+    FILE *file = tmpfile();
+    vm_run(&thread, &program);
+    request = thread->pc + 1;
+    assert(vm_snapshot(&thread, &program, fileno(file)) == VM_ERR_OK);
+    vm_destroy_thread(&thread);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < BENCH_RUNS / 100; n++) {
+        lseek(fileno(file), 0, SEEK_SET);
+        assert(vm_restore(&restored, &program, &externals, fileno(file)) == VM_ERR_OK);
+        restored->pc = request;
+        restored->halted = false;
+        vm_run(&restored, &program);
+        assert(restored->exit_value == 1 && vm_pop(&restored).number.uinteger == 500);
+        vm_destroy_thread(&restored);
+    }
+    bench_report("restore of init + request", bench_now() - start, BENCH_RUNS / 100);
+
+    fclose(file);
+    free(program.prog);
+}
+
+void bench_module(void) {
+    const char *block = "GET_GLOBAL 0\nINC\nSET_GLOBAL 0\n";
+    uint32_t blocks = 2000, runs = 100;
+    char *source = malloc(blocks * strlen(block) + 32);
+    char path[] = "/tmp/bench_module_XXXXXX";
+    vm_thread_t *thread = NULL;
+    vm_program_t program;
+    double start;
+
+    strcpy(source, "PUSH_0\nSET_GLOBAL 0\n");
+    for (uint32_t n = 0; n < blocks; n++)
+        strcat(source, block);
+    strcat(source, "HALT 0\n");
+
+    printf("\n---[ BENCH MODULE (program of %u lines) ]---\n", blocks * 3 + 3);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < runs; n++) {
+        bench_assemble(source, &program);
+        vm_create_thread(&thread, NULL);
+        vm_run(&thread, &program);
+        assert(thread->globals->global_vars[0].number.integer == blocks);
+        vm_destroy_thread(&thread);
+        if (n < runs - 1)
+            free(program.prog);
+    }
+    bench_report("assemble + run", bench_now() - start, runs);
+
+    int fd = mkstemp(path);
+    assert(fd >= 0 && vm_module_write(fd, &program, &assembler_module, true));
+    close(fd);
+    free(program.prog);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < runs; n++) {
+        vm_module_t *module = vm_module_load(path, false);
+        vm_create_thread(&thread, NULL);
+        vm_run(&thread, &module->program);
+        assert(thread->globals->global_vars[0].number.integer == blocks);
+        vm_destroy_thread(&thread);
+        vm_module_unload(module);
+    }
+    bench_report("load module + run", bench_now() - start, runs);
+
+    start = bench_now();
+    for (uint32_t n = 0; n < runs; n++) {
+        vm_module_t *module = vm_module_load(path, true);
+        vm_create_thread(&thread, NULL);
+        vm_run(&thread, &module->program);
+        assert(thread->globals->global_vars[0].number.integer == blocks);
+        vm_destroy_thread(&thread);
+        vm_module_unload(module);
+    }
+    bench_report("load module (checksum) + run", bench_now() - start, runs);
+
+    unlink(path);
+    free(source);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
+int main(void) {
+    printf(BWHT "--------------- START BENCH ---------------\n");
+
+    bench_thread_reuse();
+    bench_value_layout();
+    bench_string_equality();
+    bench_string_slices();
+    bench_string_small();
+    bench_string_find();
+    bench_string_build();
+    bench_string_numbers();
+    bench_hashmap();
+    bench_fibers();
+    bench_async();
+    bench_fuel();
+    bench_executor();
+    bench_channels();
+    bench_parallel();
+    bench_shared();
+    bench_clone();
+    bench_snapshot();
+    bench_module();
+
+    printf("\n--------------- END BENCH ---------------\n" COLOR_RESET);
+
+    return EXIT_SUCCESS;
+}
@@ -22,13 +22,25 @@
 #include <ctype.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "vm.h"
 #include "vm_assembler.h"
 #include "vm_assembler_utils.h"
 #include "vm_disassembler.h"
 #include "vm_libstring.h"
+#include "vm_libstrbuilder.h"
+#include "vm_libhashmap.h"
+#include "vm_libchannel.h"
 #include "vm_libtest.h"
+#include "ffi_fiber.h"
+#include "ffi_async.h"
+#include "ffi_parallel.h"
+#include "ffi_shared.h"
+#include "vm_executor.h"
+#include "vm_module.h"
 #include "termcolors.h"
 
 #define EP(x) [x] = #x
@@ -49,11 +61,57 @@ const char *vm_errors[] = {
         EP(VM_ERR_HEAPNOTEXIST),
         EP(VM_ERR_INDUNDERZERO),
         EP(VM_ERR_OVERFLOW),
+        EP(VM_ERR_PENDING),
+        EP(VM_ERR_OUTOFFUEL),
+        EP(VM_ERR_INTERRUPTED),
         EP(VM_ERR_FAIL),
 };
 
 /////////////////////////////////////////////////////////////////////////////////////
 
+// interrupt a running thread from another OS thread
+static void* test_interrupter(void *arg) {
+    vm_thread_t *thread = arg;
+
+    usleep(1000);
+    vm_interrupt(&thread, 7);
+    return NULL;
+}
+
+// sum of executor job results
+static _Atomic uint32_t test_executor_sum;
+
+static void test_executor_done(vm_job_t *job, vm_thread_t **thread) {
+    assert(job->status == VM_ERR_HALT && job->ret_val.type == VM_VAL_UINT);
+    atomic_fetch_add(&test_executor_sum, job->ret_val.number.uinteger);
+}
+
+// run a program on its own OS thread
+typedef struct test_runner_s {
+    vm_thread_t *thread;
+    vm_program_t *program;
+} test_runner_t;
+
+static void* test_runner(void *arg) {
+    test_runner_t *runner = arg;
+
+    vm_run(&runner->thread, runner->program);
+    return NULL;
+}
+
+// submit children jobs (userdata) from the worker: they go to its deque and are stolen by the others
+static vm_executor_t *test_executor;
+
+static void test_executor_spawn(vm_job_t *job, vm_thread_t **thread) {
+    vm_job_t *children = job->userdata;
+
+    test_executor_done(job, thread);
+    for (uint32_t n = 0; n < 8; n++)
+        assert(vm_executor_submit(test_executor, &children[n]));
+}
+
+/////////////////////////////////////////////////////////////////////////////////////
+
 void test_opcodes(void) {
     uint32_t tests_qty = 0, tests_fails = 0;
     uint32_t progline = 0;
@@ -81,7 +139,7 @@ void test_opcodes(void) {
         progline = 0;                                                                                                                                   \
         printf(BWHT"  --" BLUB " start test: " #opcode COLOR_RESET BWHT "\n");                                                                          \
         qty = 0;                                                                                                                                        \
-        vm_create_thread(&thread);                                                                                                                      \
+        vm_create_thread(&thread, NULL);                                                                                                                \
         hex = malloc(sizeof(uint8_t));                                                                                                                  \
         str = strdup( prg );                                                                                                                            \
         printf("      -- start assembler: \n"BCYN);                                                                                                     \
@@ -94,7 +152,8 @@ void test_opcodes(void) {
         vm_disassembler(hex, qty);                                                                                                                      \
         printf(BWHT"      -- end disassembler\n");                                                                                                      \
         program.prog = hex;                                                                                                                             \
-        program.prog_len = qty
+        program.prog_len = qty;                                                                                                                         \
+        program.globals_qty = assembler_globals_qty
 
 #define TEST_EXECUTE                                                                                                                                    \
 	    printf("      -- start execute\n");                                                                                                             \
@@ -728,6 +787,44 @@ void test_opcodes(void) {
     assert(vm_value.number.real == 34);
     OP_TEST_END();
 
+    END_TEST();
+    ///////////////////////////////////
+    START_TEST(GLOBAL SLOTS,     //
+            "PUSH_INT 5\n"          //
+            "SET_GLOBAL 300\n"      // beyond initial slots
+            "GET_GLOBAL 300\n"      //
+            "GET_GLOBAL 7\n"        // never set
+            );                      //
+
+    assert(program.globals_qty == 301);
+    printf("      -- start execute (vm_run)\n");
+    vm_run(&thread, &program);
+    OP_TEST_START(20, 2, 0);
+    assert(thread->globals->global_vars_size >= 301);
+    assert(thread->globals->global_vars_qty == 301);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_NULL);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_INT);
+    assert(vm_value.number.integer == 5);
+    OP_TEST_END();
+
+    END_TEST();
+    ///////////////////////////////////
+    START_TEST(GLOBAL SLOTS LIMIT,      //
+            "PUSH_INT 5\n"              //
+            "SET_GLOBAL 2147483648\n"   // over VM_MAX_GLOBAL_VARS
+            "HALT 0\n"                  //
+            );                          //
+
+    TEST_EXECUTE;
+    OP_TEST_START(10, 1, 0);
+    assert(thread->status == VM_ERR_OUTOFRANGE);
+    assert(thread->globals->global_vars_size <= VM_MAX_GLOBAL_VARS);
+    vm_thread_reset(&thread);
+    assert(vm_run(&thread, &program) == VM_ERR_OUTOFRANGE && thread->pc == 0); // untrusted globals_qty
+    OP_TEST_END();
+
     END_TEST();
     ///////////////////////////////////
     START_TEST(GOTO,           //
@@ -824,6 +921,268 @@ void test_opcodes(void) {
     END_TEST();
     free(externals.foreign_functions);
     ///////////////////////////////////
+    START_TEST(FIBERS,                  //
+            "PUSH_UINT 0\n"             //
+            "SET_GLOBAL 0\n"            //
+            "PUSH_UINT 1\n"             // argument
+            "CALL_FOREIGN 0 worker 0\n" // FFI_FIBER_ENQUEUE (fiber 1)
+            "PUSH_UINT 100\n"           // argument
+            "CALL_FOREIGN 0 worker 0\n" // FFI_FIBER_ENQUEUE (fiber 2)
+            "CALL_FOREIGN 4 0 0\n"      // FFI_FIBER_YIELD
+            "GET_GLOBAL 0\n"            // each fiber added once
+            "CALL_FOREIGN 4 0 0\n"      // FFI_FIBER_YIELD
+            "GET_GLOBAL 0\n"            // each fiber added twice and ended
+            "CALL_FOREIGN 2 0 0\n"      // FFI_FIBER_CURRENT
+            "GET_RETVAL\n"              //
+            "HALT 99\n"                 // end
+            ".label worker\n"           //
+            "CALL 1 add\n"              //
+            "GET_RETVAL\n"              //
+            "CALL_FOREIGN 4 0 0\n"      // FFI_FIBER_YIELD
+            "CALL 1 add\n"              //
+            "GET_RETVAL\n"              //
+            "CALL_FOREIGN 1 0 0\n"      // FFI_FIBER_DEQUEUE
+            ".label add\n"              //
+            "GET_LOCAL 0\n"             //
+            "GET_GLOBAL 0\n"            //
+            "ADD\n"                     //
+            "SET_GLOBAL 0\n"            //
+            "PUSH_NULL_N 40\n"          // grow fiber stack
+            "GET_LOCAL 0\n"             //
+            "RETURN_VALUE\n"            //
+            );                          //
+
+    externals.foreign_functions = malloc(sizeof(void*));
+    externals.foreign_functions_qty = 1;
+    externals.foreign_functions[0] = ffi_fiber;
+    thread->externals = &externals;
+
+    TEST_EXECUTE;
+    OP_TEST_START(82, 3, 0);
+    assert(((ffi_fiber_scheduler_t*) thread->fibers)->qty == 1);
+    assert(thread->stack_grow == false);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 202);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 101);
+    OP_TEST_END();
+    ffi_fiber_destroy(&thread);
+    END_TEST();
+    free(externals.foreign_functions);
+    ///////////////////////////////////
+    START_TEST(ASYNC,                   //
+            "PUSH_UINT 0\n"             //
+            "SET_GLOBAL 0\n"            //
+            "PUSH_UINT 1\n"             // argument
+            "CALL_FOREIGN 0 worker 0\n" // FFI_FIBER_ENQUEUE (fiber 1)
+            "PUSH_UINT 100\n"           // argument
+            "CALL_FOREIGN 0 worker 0\n" // FFI_FIBER_ENQUEUE (fiber 2)
+            "CALL_FOREIGN 0 20 1\n"     // FFI_ASYNC_SLEEP 20 ms (fibers run meanwhile)
+            "GET_RETVAL\n"              //
+            "GET_GLOBAL 0\n"            //
+            "HALT 99\n"                 // end
+            ".label worker\n"           //
+            "CALL_FOREIGN 0 1 1\n"      // FFI_ASYNC_SLEEP 1 ms
+            "GET_GLOBAL 0\n"            //
+            "ADD\n"                     //
+            "SET_GLOBAL 0\n"            //
+            "CALL_FOREIGN 1 0 0\n"      // FFI_FIBER_DEQUEUE
+            );                          //
+
+    externals.foreign_functions = malloc(2 * sizeof(void*));
+    externals.foreign_functions_qty = 2;
+    externals.foreign_functions[0] = ffi_fiber;
+    externals.foreign_functions[1] = ffi_async;
+    thread->externals = &externals;
+
+    ffi_async_loop_t *loop = ffi_async_create();
+    assert(ffi_async_attach(loop, thread, &program));
+    ffi_async_run(loop);
+    printf("      -- pc: %u, sp: %u, fp: %u\n", thread->pc, thread->sp, thread->fp);
+    OP_TEST_START(57, 2, 0);
+    assert(thread->status == VM_ERR_HALT && thread->pending == 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 101);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_BOOL && vm_value.number.boolean == true);
+    OP_TEST_END();
+    ffi_async_destroy(loop);
+    assert(thread->async == NULL);
+    ffi_fiber_destroy(&thread);
+    END_TEST();
+    free(externals.foreign_functions);
+    ///////////////////////////////////
+    START_TEST(FUEL,               //
+            "PUSH_0\n"             //
+            "SET_GLOBAL 0\n"       //
+            ".label loop\n"        //
+            "GET_GLOBAL 0\n"       //
+            "INC\n"                //
+            "SET_GLOBAL 0\n"       //
+            "GET_GLOBAL 0\n"       //
+            "PUSH_UINT 10\n"       //
+            "LT\n"                 //
+            "GOTOZ end\n"          //
+            "GOTO loop\n"          // charged (9 times)
+            ".label end\n"         //
+            "GET_GLOBAL 0\n"       //
+            "HALT 99\n"            // end
+            );                     //
+
+    uint32_t slices = 0;
+    vm_refuel(&thread, 3);
+    while (vm_run(&thread, &program) == VM_ERR_OUTOFFUEL) {
+        assert(thread->fuel == 0 && thread->halted);
+        ++slices;
+        vm_refuel(&thread, 3);
+    }
+    printf("      -- pc: %u, sp: %u, fp: %u\n", thread->pc, thread->sp, thread->fp);
+    OP_TEST_START(44, 1, 0);
+    assert(thread->status == VM_ERR_HALT && slices == 3);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 10);
+    OP_TEST_END();
+    END_TEST();
+    ///////////////////////////////////
+    START_TEST(INTERRUPT,          //
+            "PUSH_0\n"             //
+            ".label loop\n"        //
+            "INC\n"                //
+            "GOTO loop\n"          // endless
+            );                     //
+
+    pthread_t interrupter;
+    pthread_create(&interrupter, NULL, test_interrupter, thread);
+    assert(vm_run(&thread, &program) == VM_ERR_INTERRUPTED);
+    pthread_join(interrupter, NULL);
+    assert(thread->halted && vm_interrupt_clear(&thread) == 7);
+    assert(thread->status == VM_ERR_OK && !thread->halted && thread->interrupt == 0);
+    vm_interrupt(&thread, 1);
+    assert(vm_run(&thread, &program) == VM_ERR_INTERRUPTED);
+    printf("      -- pc: %u, sp: %u, fp: %u\n", thread->pc, thread->sp, thread->fp);
+    OP_TEST_START(1, 1, 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger > 1);
+    OP_TEST_END();
+    END_TEST();
+    ///////////////////////////////////
+    START_TEST(EXECUTOR,           //
+            "CALL 1 double\n"      //
+            "HALT 99\n"            // end
+            ".label double\n"      //
+            "GET_LOCAL 0\n"        //
+            "GET_LOCAL 0\n"        //
+            "ADD\n"                //
+            "RETURN_VALUE\n"       //
+            );                     //
+
+    vm_executor_t *executor = vm_executor_create(4, NULL);
+    vm_job_t *jobs = calloc(1000, sizeof(vm_job_t));
+    atomic_init(&test_executor_sum, 0);
+    for (uint32_t n = 0; n < 1000; n++) {
+        jobs[n].program = &program;
+        jobs[n].args[0].type = VM_VAL_UINT;
+        jobs[n].args[0].number.uinteger = n;
+        jobs[n].args_qty = 1;
+        jobs[n].done = test_executor_done;
+        assert(vm_executor_submit(executor, &jobs[n]));
+    }
+    vm_executor_wait(executor);
+    OP_TEST_START(0, 0, 0);
+    assert(atomic_load(&test_executor_sum) == 999000);
+    assert(jobs[999].exit_value == 99 && jobs[999].ret_val.number.uinteger == 1998);
+    for (uint32_t n = 0; n < executor->workers_qty; n++)
+        assert(executor->workers[n].thread->sp == 0 && executor->workers[n].thread->status == VM_ERR_OK);
+    OP_TEST_END();
+    vm_executor_destroy(executor);
+    free(jobs);
+    END_TEST();
+    ///////////////////////////////////
+    START_TEST(EXECUTOR SLICE,     //
+            "CALL 1 count\n"       //
+            "HALT 99\n"            // end
+            ".label count\n"       //
+            "PUSH_0\n"             //
+            "SET_GLOBAL 0\n"       //
+            ".label loop\n"        //
+            "GET_GLOBAL 0\n"       //
+            "INC\n"                //
+            "SET_GLOBAL 0\n"       //
+            "GET_GLOBAL 0\n"       //
+            "PUSH_UINT 10\n"       //
+            "LT\n"                 //
+            "GOTOZ end\n"          //
+            "GOTO loop\n"          // charged
+            ".label end\n"         //
+            "GET_LOCAL 0\n"        //
+            "GET_GLOBAL 0\n"       //
+            "ADD\n"                //
+            "RETURN_VALUE\n"       //
+            );                     //
+
+    test_executor = vm_executor_create(2, NULL);
+    test_executor->slice = 3;
+    vm_job_t *sliced = calloc(73, sizeof(vm_job_t));
+    atomic_init(&test_executor_sum, 0);
+    for (uint32_t n = 0; n < 72; n++) {
+        sliced[n].program = &program;
+        sliced[n].args[0].type = VM_VAL_UINT;
+        sliced[n].args[0].number.uinteger = n;
+        sliced[n].args_qty = 1;
+        sliced[n].done = test_executor_done;
+    }
+    for (uint32_t n = 0; n < 8; n++) {
+        sliced[n].done = test_executor_spawn;
+        sliced[n].userdata = &sliced[8 + n * 8];
+        assert(vm_executor_submit(test_executor, &sliced[n]));
+    }
+    // metered job: out of fuel after its own budget, not preempted
+    sliced[72].program = &program;
+    sliced[72].args[0] = sliced[0].args[0];
+    sliced[72].args_qty = 1;
+    sliced[72].fuel = 5;
+    assert(vm_executor_submit(test_executor, &sliced[72]));
+    vm_executor_wait(test_executor);
+    OP_TEST_START(0, 0, 0);
+    assert(atomic_load(&test_executor_sum) == 2556 + 72 * 10);
+    assert(sliced[71].exit_value == 99 && sliced[71].ret_val.number.uinteger == 81 && sliced[71].thread == NULL);
+    assert(sliced[72].status == VM_ERR_OUTOFFUEL && sliced[72].thread == NULL);
+    OP_TEST_END();
+    vm_executor_destroy(test_executor);
+    free(sliced);
+    END_TEST();
+    ///////////////////////////////////
+    START_TEST(EXECUTOR FIBERS,         //
+            "PUSH_UINT 1\n"             // argument
+            "CALL_FOREIGN 0 worker 0\n" // FFI_FIBER_ENQUEUE (fiber 1 on a clean thread)
+            "HALT 99\n"                 // end (fiber left queued)
+            ".label worker\n"           //
+            "CALL_FOREIGN 1 0 0\n"      // FFI_FIBER_DEQUEUE
+            );                          //
+
+    externals.foreign_functions = malloc(sizeof(void*));
+    externals.foreign_functions_qty = 1;
+    externals.foreign_functions[0] = ffi_fiber;
+
+    executor = vm_executor_create(1, NULL);
+    vm_job_t fiber_jobs[3] = { 0 };
+    for (uint32_t n = 0; n < 3; n++) {
+        fiber_jobs[n].program = &program;
+        fiber_jobs[n].externals = &externals;
+        assert(vm_executor_submit(executor, &fiber_jobs[n]));
+    }
+    vm_executor_wait(executor);
+    OP_TEST_START(0, 0, 0);
+    for (uint32_t n = 0; n < 3; n++)
+        assert(fiber_jobs[n].exit_value == 99 && fiber_jobs[n].ret_val.number.uinteger == 1);
+    assert(executor->workers[0].thread->fibers == NULL);
+    OP_TEST_END();
+    vm_executor_destroy(executor);
+    END_TEST();
+    free(externals.foreign_functions);
+    ///////////////////////////////////
     START_TEST(1 SET_LOCAL / GET_LOCAL, //
             "PUSH_INT 10\n"             //
             "PUSH_INT 20\n"             //
@@ -982,7 +1341,7 @@ void test_opcodes(void) {
     OP_TEST_START(6, 1, 0);
     vm_value = vm_pop(&thread);
     assert(vm_value.type == VM_VAL_CONST_STRING);
-    assert(strcmp(vm_value.cstr.addr, "string test") == 0);
+    assert(strcmp(VM_CSTR_ADDR(vm_value), "string test") == 0);
     OP_TEST_END();
 
     END_TEST();
@@ -1088,7 +1447,56 @@ void test_opcodes(void) {
     OP_TEST_START(33, 2, 0);
     vm_value = vm_pop(&thread);
     assert(vm_value.type == VM_VAL_CONST_STRING);
-    assert(strcmp(vm_value.cstr.addr, "string test") == 0);
+    assert(strcmp(VM_CSTR_ADDR(vm_value), "string test") == 0);
+    OP_TEST_END();
+    END_TEST();
+    free(externals.lib);
+
+    START_TEST(STRING INTERN,        //
+            "PUSH_CONST_STRING a\n"  //
+            "PUSH_CONST_STRING b\n"  // same text at other address
+            "EQU\n"                  //
+            "PUSH_CONST_STRING b\n"  //
+            "PUSH_UINT 0\n"          //
+            "NEW_LIB_OBJ\n"          //
+            "LIB_FN 10 0\n"          // LIBSTRING_FN_INTERN
+            "PUSH_CONST_STRING a\n"  //
+            "EQU\n"                  //
+            "HALT 99\n"              //
+            ".label a\n"             //
+            ".string \"key\"\n"      //
+            ".label b\n"             //
+            ".string \"key\"\n"      //
+            );                       //
+
+    vm_thread_config_t intern_config = { .intern_strings = true };
+    vm_destroy_thread(&thread);
+    vm_create_thread(&thread, &intern_config);
+    externals.lib = calloc(1, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_strings;
+    ++externals.lib_qty;
+    thread->externals = &externals;
+
+    TEST_EXECUTE;
+    OP_TEST_START(35, 2, 0);
+    assert(thread->strings->qty == 1);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_BOOL && vm_value.number.boolean == true);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_BOOL && vm_value.number.boolean == true);
+    vm_value = vm_intern(&thread, "key", 3);
+    assert(VM_CSTR_IS_INTERNED(vm_value));
+    assert(vm_intern_hash(vm_value) == vm_string_hash("key", 3));
+
+    // other program in the same buffer
+    uint8_t *intern_key = hex + qty - 8; // label a
+    assert(memcmp(intern_key, "key", 4) == 0);
+    intern_key[2] = 'x';
+    vm_thread_reset(&thread);
+    assert(thread->strings->qty == 0 && thread->strings->const_qty == 0);
+    TEST_EXECUTE;
+    assert(thread->pc == 35 && thread->sp == 2);
+    assert(vm_pop(&thread).number.boolean == false && vm_pop(&thread).number.boolean == false);
     OP_TEST_END();
     END_TEST();
     free(externals.lib);
@@ -1142,7 +1550,7 @@ void test_opcodes(void) {
     OP_TEST_START(29, 1, 0);
     vm_value = vm_pop(&thread);
     assert(vm_value.type == VM_VAL_CONST_STRING);
-    assert(strcmp(vm_value.cstr.addr, "string") == 0);
+    assert(strcmp(VM_CSTR_ADDR(vm_value), "string") == 0);
     OP_TEST_END();
     END_TEST();
     free(externals.lib);
@@ -1169,7 +1577,7 @@ void test_opcodes(void) {
     OP_TEST_START(29, 1, 0);
     vm_value = vm_pop(&thread);
     assert(vm_value.type == VM_VAL_CONST_STRING);
-    assert(strcmp(vm_value.cstr.addr, "test") == 0);
+    assert(strcmp(VM_CSTR_ADDR(vm_value), "test") == 0);
     OP_TEST_END();
     END_TEST();
     free(externals.lib);
@@ -1197,7 +1605,7 @@ void test_opcodes(void) {
     OP_TEST_START(34, 1, 0);
     vm_value = vm_pop(&thread);
     assert(vm_value.type == VM_VAL_CONST_STRING);
-    assert(strcmp(vm_value.cstr.addr, "ing te") == 0);
+    assert(strcmp(VM_CSTR_ADDR(vm_value), "ing te") == 0);
     OP_TEST_END();
     END_TEST();
     free(externals.lib);
@@ -1226,7 +1634,7 @@ void test_opcodes(void) {
     OP_TEST_START(34, 1, 0);
     vm_value = vm_pop(&thread);
     assert(vm_value.type == VM_VAL_CONST_STRING);
-    assert(strcmp(vm_value.cstr.addr, "strest") == 0);
+    assert(strcmp(VM_CSTR_ADDR(vm_value), "strest") == 0);
     OP_TEST_END();
     END_TEST();
     free(externals.lib);
@@ -1255,7 +1663,7 @@ void test_opcodes(void) {
     OP_TEST_START(34, 1, 0);
     vm_value = vm_pop(&thread);
     assert(vm_value.type == VM_VAL_CONST_STRING);
-    assert(strcmp(vm_value.cstr.addr, "str other stringing test") == 0);
+    assert(strcmp(VM_CSTR_ADDR(vm_value), "str other stringing test") == 0);
     OP_TEST_END();
     END_TEST();
     free(externals.lib);
@@ -1284,7 +1692,7 @@ void test_opcodes(void) {
     OP_TEST_START(34, 1, 0);
     vm_value = vm_pop(&thread);
     assert(vm_value.type == VM_VAL_CONST_STRING);
-    assert(strcmp(vm_value.cstr.addr, "str other s") == 0);
+    assert(strcmp(VM_CSTR_ADDR(vm_value), "str other s") == 0);
     OP_TEST_END();
     END_TEST();
     free(externals.lib);
@@ -1317,7 +1725,1009 @@ void test_opcodes(void) {
     OP_TEST_END();
     END_TEST();
     free(externals.lib);
+    START_TEST(STRING LIBRARY: FIND_ALL / FIND_ANY, //
+            "PUSH_UINT 0\n"              // pos for FIND_ALL
+            "PUSH_CONST_STRING error\n"  //
+            "PUSH_CONST_STRING log\n"    //
+            "PUSH_UINT 0\n"              // LIBSTRING
+            "NEW_LIB_OBJ\n"              // push new LIBSTRING object
+            "LIB_FN 12 0\n"              // LIBSTRING_FN_FIND_ALL
+            "PUSH_UINT 0\n"              // pos for FIND_ANY
+            "PUSH_CONST_STRING warn\n"   //
+            "PUSH_CONST_STRING fatal\n"  //
+            "NEW_ARRAY 2\n"              // needles
+            "PUSH_CONST_STRING log\n"    //
+            "PUSH_UINT 0\n"              // LIBSTRING
+            "NEW_LIB_OBJ\n"              // push new LIBSTRING object
+            "LIB_FN 11 0\n"              // LIBSTRING_FN_FIND_ANY
+            "HALT 99\n"                  // end
+            ".label log\n"               //
+            ".string \"2024-01-01 info start, 2024-01-01 error disk, 2024-01-02 fatal oom, 2024-01-03 error net\"\n" //
+            ".label error\n"             //
+            ".string \"error\"\n"        //
+            ".label warn\n"              //
+            ".string \"warn\"\n"         //
+            ".label fatal\n"             //
+            ".string \"fatal\"\n"        //
+            );                           //
+
+    externals.lib = calloc(1, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_strings;
+    ++externals.lib_qty;
+    thread->externals = &externals;
+
+    TEST_EXECUTE;
+    OP_TEST_START(63, 3, 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 57);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 1);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_ARRAY);
+    vm_heap_object_t *positions = vm_heap_load(thread->heap, vm_value.heap_ref);
+    assert(positions->array.qty == 2);
+    assert(positions->array.fields[0].number.uinteger == 34 && positions->array.fields[1].number.uinteger == 79);
+    OP_TEST_END();
+    END_TEST();
+    free(externals.lib);
+
+    START_TEST(STRING LIBRARY: FIND_ALL HEAP FULL, //
+            "PUSH_UINT 0\n"              // pos for FIND_ALL
+            "PUSH_CONST_STRING error\n"  //
+            "PUSH_CONST_STRING error\n"  //
+            "PUSH_UINT 0\n"              // LIBSTRING
+            "NEW_LIB_OBJ\n"              // push new LIBSTRING object (last heap slot)
+            "LIB_FN 12 0\n"              // LIBSTRING_FN_FIND_ALL
+            "HALT 99\n"                  // end
+            ".label error\n"             //
+            ".string \"error\"\n"        //
+            );                           //
+
+    externals.lib = calloc(1, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_strings;
+    ++externals.lib_qty;
+    thread->externals = &externals;
+
+    vm_heap_object_t heap_filler = { .value = { .type = VM_VAL_NULL } };
+    for (uint32_t n = 0; n < VM_MAX_HEAP - 1; n++)
+        vm_heap_save(thread->heap, VM_VAL_GENERIC, false, heap_filler, &thread->frames[0].gc_mark);
+
+    TEST_EXECUTE;
+    OP_TEST_START(27, 3, 0);
+    assert(thread->status == VM_ERR_OUTOFMEMORY);
+    assert(STK_TOP(&thread).type == VM_VAL_LIB_OBJ);
+    OP_TEST_END();
+    END_TEST();
+    free(externals.lib);
+
+    START_TEST(STRING LIBRARY: SLICE / INLINE, //
+            "PUSH_UINT 5\n"             // pos for RIGHT
+            "PUSH_UINT 9\n"             // pos for LEFT
+            "PUSH_CONST_STRING str\n"   // push constant string
+            "PUSH_UINT 0\n"             // LIBSTRING
+            "NEW_LIB_OBJ\n"             // push new LIBSTRING object
+            "LIB_FN 1 0\n"              // LIBSTRING_FN_LEFT
+            "SWAP\n"                    //
+            "PUSH_CONST_STRING str\n"   // push constant string
+            "PUSH_UINT 0\n"             // LIBSTRING
+            "NEW_LIB_OBJ\n"             // push new LIBSTRING object
+            "LIB_FN 2 0\n"              // LIBSTRING_FN_RIGHT
+            "PUSH_CONST_STRING key\n"   // push constant string
+            "PUSH_UINT 0\n"             // LIBSTRING
+            "NEW_LIB_OBJ\n"             // push new LIBSTRING object
+            "HALT 99\n"                 // end
+            ".label str\n"              //
+            ".string \"string slice test\"\n" //
+            ".label key\n"              //
+            ".string \"key\"\n"         //
+            );                          //
+
+    externals.lib = calloc(1, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_strings;
+    ++externals.lib_qty;
+    thread->externals = &externals;
+
+    TEST_EXECUTE;
+    OP_TEST_START(57, 3, 0);
+    vm_heap_object_t *key = vm_heap_load(thread->heap, vm_pop(&thread).lib_obj.heap_ref);
+    libstring_t *right = vm_heap_load(thread->heap, vm_pop(&thread).lib_obj.heap_ref)->lib_obj.addr;
+    libstring_t *left = vm_heap_load(thread->heap, vm_pop(&thread).lib_obj.heap_ref)->lib_obj.addr;
+    // short strings are stored in the heap object
+    assert(key->lib_obj.identifier == STRING_LIBRARY_IDENTIFIER_INLINE && strcmp(key->lib_obj.data, "key") == 0);
+    // no copies: slices reference the program image through their parent
+    assert(left->len == 10 && memcmp(left->str, "string sli", 10) == 0);
+    assert(right->len == 12 && memcmp(right->str, "g slice test", 12) == 0);
+    assert(left->cap == 0 && right->cap == 0);
+    assert(left->parent != NULL && left->parent->cap == 0 && left->parent->refs == 2);
+    assert(left->str == left->parent->str && right->str == right->parent->str + 5);
+    assert((uint8_t*) left->str >= program.prog && (uint8_t*) left->str < program.prog + program.prog_len);
+    OP_TEST_END();
+    END_TEST();
+    free(externals.lib);
+
+    START_TEST(STRING LIBRARY: NUMBERS,        //
+            "PUSH_FLOAT 0.1\n"                 //
+            "PUSH_CONST_STRING str\n"          // push constant string
+            "PUSH_UINT 0\n"                    // LIBSTRING
+            "NEW_LIB_OBJ\n"                    // push new LIBSTRING object
+            "LIB_FN 13 0\n"                    // LIBSTRING_FN_FROM_NUM
+            "LIB_FN 9 0\n"                     // LIBSTRING_FN_TO_CSTR
+            "PUSH_CONST_STRING real\n"         // push constant string
+            "PUSH_UINT 0\n"                    // LIBSTRING
+            "NEW_LIB_OBJ\n"                    // push new LIBSTRING object
+            "LIB_FN 14 0\n"                    // LIBSTRING_FN_TO_NUM (guess type)
+            "PUSH_CONST_STRING int\n"          // push constant string
+            "PUSH_UINT 0\n"                    // LIBSTRING
+            "NEW_LIB_OBJ\n"                    // push new LIBSTRING object
+            "LIB_FN 14 3\n"                    // LIBSTRING_FN_TO_NUM (VM_VAL_INT)
+            "HALT 99\n"                        // end
+            ".label str\n"                     //
+            ".string \"value=\"\n"             //
+            ".label real\n"                    //
+            ".string \"-1.25e2\"\n"            //
+            ".label int\n"                     //
+            ".string \"-2147483648\"\n"        //
+            );                                 //
+
+    externals.lib = calloc(1, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_strings;
+    ++externals.lib_qty;
+    thread->externals = &externals;
+
+    TEST_EXECUTE;
+    OP_TEST_START(63, 3, 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_INT && vm_value.number.integer == INT32_MIN);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_FLOAT && vm_value.number.real == -125.0f);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_CONST_STRING);
+    // shortest representation that reads back the same float
+    assert(strcmp(VM_CSTR_ADDR(vm_value), "value=0.1") == 0);
+    free(VM_CSTR_ADDR(vm_value));
+    OP_TEST_END();
+    END_TEST();
+    free(externals.lib);
+
+    START_TEST(STRING BUILDER,              //
+            "PUSH_UINT 1\n"                  // LIBSTRBUILDER
+            "NEW_LIB_OBJ\n"                  // push new LIBSTRBUILDER object
+            "PUSH_UINT 100\n"                //
+            "SWAP\n"                         //
+            "LIB_FN 1 0\n"                   // LIBSTRBUILDER_FN_RESERVE
+            "PUSH_CONST_STRING str\n"        //
+            "SWAP\n"                         //
+            "LIB_FN 0 0\n"                   // LIBSTRBUILDER_FN_APPEND
+            "PUSH_INT -5\n"                  //
+            "SWAP\n"                         //
+            "LIB_FN 0 0\n"                   // LIBSTRBUILDER_FN_APPEND
+            "PUSH_CONST_STRING sep\n"        //
+            "SWAP\n"                         //
+            "LIB_FN 0 0\n"                   // LIBSTRBUILDER_FN_APPEND
+            "PUSH_FLOAT 1.5\n"               //
+            "SWAP\n"                         //
+            "LIB_FN 0 0\n"                   // LIBSTRBUILDER_FN_APPEND
+            "LIB_FN 3 0\n"                   // LIBSTRBUILDER_FN_FINISH (to LIBSTRING)
+            "LIB_FN 9 0\n"                   // LIBSTRING_FN_TO_CSTR
+            "HALT 99\n"                      // end
+            ".label str\n"                   //
+            ".string \"id,\"\n"              //
+            ".label sep\n"                   //
+            ".string \",\"\n"                //
+            );                               //
+
+    externals.lib = calloc(2, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_strings;
+    externals.lib[1] = lib_entry_strbuilder;
+    ++externals.lib_qty;
+    thread->externals = &externals;
+
+    TEST_EXECUTE;
+    OP_TEST_START(79, 1, 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_CONST_STRING);
+    assert(strcmp(VM_CSTR_ADDR(vm_value), "id,-5,1.5") == 0);
+    free(VM_CSTR_ADDR(vm_value));
+    OP_TEST_END();
+    END_TEST();
+    free(externals.lib);
+    START_TEST(HASHMAP LIBRARY,                 //
+            "PUSH_UINT 1\n"                     // LIBHASHMAP
+            "NEW_LIB_OBJ\n"                     // push new LIBHASHMAP object
+            "SET_GLOBAL 0\n"                    //
+            "CALL 0 fill\n"                     // value is allocated in a frame that ends
+            "PUSH_CONST_STRING key\n"           //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 1 0\n"                      // LIBHASHMAP_FN_GET
+            "LIB_FN 9 0\n"                      // LIBSTRING_FN_TO_CSTR
+            "PUSH_FLOAT 2.5\n"                  //
+            "PUSH_INT -1\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 0\n"                      // LIBHASHMAP_FN_SET
+            "DROP\n"                            //
+            "PUSH_INT -1\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 3 0\n"                      // LIBHASHMAP_FN_CONTAINS
+            "PUSH_CONST_STRING key\n"           //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 2 0\n"                      // LIBHASHMAP_FN_DELETE
+            "LIB_FN 4 0\n"                      // LIBHASHMAP_FN_LEN
+            "PUSH_UINT 0\n"                     // cursor
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 5 0\n"                      // LIBHASHMAP_FN_NEXT
+            "HALT 99\n"                         // end
+            ".label fill\n"                     //
+            "PUSH_CONST_STRING value\n"         //
+            "PUSH_UINT 0\n"                     // LIBSTRING
+            "NEW_LIB_OBJ\n"                     // push new LIBSTRING object
+            "PUSH_CONST_STRING key\n"           //
+            "PUSH_UINT 0\n"                     // LIBSTRING
+            "NEW_LIB_OBJ\n"                     // key as string object
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 0\n"                      // LIBHASHMAP_FN_SET
+            "DROP\n"                            //
+            "RETURN\n"                          //
+            ".label key\n"                      //
+            ".string \"name\"\n"                //
+            ".label value\n"                    //
+            ".string \"retained value\"\n"      //
+            );                                  //
+
+    externals.lib = calloc(2, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_strings;
+    externals.lib[1] = lib_entry_hashtable;
+    ++externals.lib_qty;
+    thread->externals = &externals;
+
+    TEST_EXECUTE;
+    OP_TEST_START(116, 6, 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger > 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_INT && vm_value.number.integer == -1);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_FLOAT && vm_value.number.real == 2.5f);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 1);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_BOOL && vm_value.number.boolean);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_CONST_STRING);
+    // value survived the end of the frame that created it
+    assert(strcmp(VM_CSTR_ADDR(vm_value), "retained value") == 0);
+    free(VM_CSTR_ADDR(vm_value));
+    // string keys are owned by the map, not interned in thread
+    assert(thread->strings == NULL);
+    OP_TEST_END();
+    END_TEST();
+    free(externals.lib);
+
+    START_TEST(HASHMAP SHARED VALUE,            //
+            "PUSH_UINT 0\n"                     // LIBHASHMAP
+            "NEW_LIB_OBJ\n"                     //
+            "SET_GLOBAL 0\n"                    //
+            "CALL 0 fill\n"                     //
+            "CALL 0 remove\n"                   // removed keys in a frame that ends
+            "PUSH_UINT 2\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 1 0\n"                      // LIBHASHMAP_FN_GET
+            "HALT 99\n"                         // end
+            ".label fill\n"                     //
+            "PUSH_INT 10\n"                     //
+            "PUSH_INT 20\n"                     //
+            "NEW_ARRAY 2\n"                     //
+            "SET_GLOBAL 1\n"                    //
+            "GET_GLOBAL 1\n"                    //
+            "PUSH_UINT 1\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 0\n"                      // LIBHASHMAP_FN_SET
+            "DROP\n"                            //
+            "GET_GLOBAL 1\n"                    //
+            "PUSH_UINT 2\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 0\n"                      // LIBHASHMAP_FN_SET (same array)
+            "DROP\n"                            //
+            "GET_GLOBAL 1\n"                    //
+            "PUSH_UINT 3\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 0\n"                      // LIBHASHMAP_FN_SET (same array)
+            "DROP\n"                            //
+            "RETURN\n"                          //
+            ".label remove\n"                   //
+            "PUSH_UINT 1\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 2 0\n"                      // LIBHASHMAP_FN_DELETE
+            "DROP\n"                            //
+            "PUSH_INT 5\n"                      //
+            "PUSH_UINT 3\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 0\n"                      // LIBHASHMAP_FN_SET (overwrite)
+            "DROP\n"                            //
+            "RETURN\n"                          //
+            );                                  //
+
+    externals.lib = calloc(1, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_hashtable;
+    externals.lib_qty = 1;
+    thread->externals = &externals;
+
+    TEST_EXECUTE;
+    OP_TEST_START(40, 1, 0);
+    assert(thread->status == VM_ERR_HALT && thread->exit_value == 99);
+    vm_value = vm_pop(&thread);
+    // still held by key 2
+    assert(vm_value.type == VM_VAL_ARRAY && vm_heap_type(thread->heap, vm_value.heap_ref) == VM_VAL_ARRAY);
+    assert(vm_heap_load(thread->heap, vm_value.heap_ref)->array.fields[1].number.integer == 20);
+    libhashmap_t *shared_map = vm_heap_load(thread->heap, thread->globals->global_vars[0].lib_obj.heap_ref)->lib_obj.addr;
+    assert(shared_map->refs[vm_value.heap_ref] == 1);
+    OP_TEST_END();
+    END_TEST();
+    free(externals.lib);
+
+    ///////////////////////////////////
+    START_TEST(CHANNEL LIBRARY,                 //
+            "PUSH_UINT 1\n"                     // LIBCHANNEL
+            "NEW_LIB_OBJ\n"                     // push new LIBCHANNEL object
+            "SET_GLOBAL 0\n"                    //
+            "PUSH_INT -5\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 0\n"                      // LIBCHANNEL_FN_SEND (block)
+            "DROP\n"                            //
+            "PUSH_CONST_STRING text\n"          //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 1\n"                      // LIBCHANNEL_FN_SEND (try)
+            "DROP\n"                            //
+            "PUSH_UINT 1\n"                     //
+            "PUSH_UINT 2\n"                     //
+            "PUSH_UINT 3\n"                     //
+            "NEW_ARRAY 3\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 0\n"                      // LIBCHANNEL_FN_SEND (deep copy)
+            "DROP\n"                            //
+            "PUSH_UINT 7\n"                     //
+            "PUSH_UINT 8\n"                     //
+            "PUSH_UINT 2\n"                     // count
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 2 0\n"                      // LIBCHANNEL_FN_SEND_BATCH
+            "DROP\n"                            //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 4 0\n"                      // LIBCHANNEL_FN_LEN
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 1 1\n"                      // LIBCHANNEL_FN_RECV (try)
+            "DROP\n"                            //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 1 1\n"                      // LIBCHANNEL_FN_RECV (try)
+            "DROP\n"                            //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 1 2\n"                      // LIBCHANNEL_FN_RECV (yield)
+            "DROP\n"                            //
+            "GET_ARRAY_VALUE 2\n"               //
+            "PUSH_UINT 4\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 3 1\n"                      // LIBCHANNEL_FN_RECV_BATCH (try)
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 1 1\n"                      // LIBCHANNEL_FN_RECV (try, empty)
+            "HALT 99\n"                         // end
+            ".label text\n"                     //
+            ".string \"message\"\n"             //
+            );                                  //
+
+    externals.lib = calloc(2, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_strings;
+    externals.lib[1] = lib_entry_channel;
+    externals.lib_qty = 2;
+    thread->externals = &externals;
+
+    TEST_EXECUTE;
+    OP_TEST_START(180, 10, 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_BOOL && !vm_value.number.boolean);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_NULL);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 2);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 8);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 7);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 3);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_ARRAY && vm_heap_type(thread->heap, vm_value.heap_ref) == VM_VAL_ARRAY);
+    vm_value = vm_pop(&thread);
+    // owned copy of the program constant
+    assert(vm_value.type == VM_VAL_CONST_STRING && !VM_CSTR_IS_PROGRAM(vm_value) && strcmp(VM_CSTR_ADDR(vm_value), "message") == 0);
+    free(VM_CSTR_ADDR(vm_value));
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_INT && vm_value.number.integer == -5);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 5);
+    OP_TEST_END();
+    END_TEST();
+    free(externals.lib);
+
+    START_TEST(CHANNEL BATCH STACK LIMIT,       //
+            "PUSH_UINT 0\n"                     // LIBCHANNEL
+            "NEW_LIB_OBJ\n"                     //
+            "SET_GLOBAL 0\n"                    //
+            "PUSH_UINT 0\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 1\n"                      // LIBCHANNEL_FN_SEND (try)
+            "DROP\n"                            //
+            "PUSH_UINT 1\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 1\n"                      // LIBCHANNEL_FN_SEND (try)
+            "DROP\n"                            //
+            "PUSH_UINT 2\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 1\n"                      // LIBCHANNEL_FN_SEND (try)
+            "DROP\n"                            //
+            "PUSH_UINT 3\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 1\n"                      // LIBCHANNEL_FN_SEND (try)
+            "DROP\n"                            //
+            "PUSH_UINT 4\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 1\n"                      // LIBCHANNEL_FN_SEND (try)
+            "DROP\n"                            //
+            "PUSH_UINT 5\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 1\n"                      // LIBCHANNEL_FN_SEND (try)
+            "DROP\n"                            //
+            "PUSH_UINT 6\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 1\n"                      // LIBCHANNEL_FN_SEND (try)
+            "DROP\n"                            //
+            "PUSH_UINT 7\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 1\n"                      // LIBCHANNEL_FN_SEND (try)
+            "DROP\n"                            //
+            "PUSH_UINT 8\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 1\n"                      // LIBCHANNEL_FN_SEND (try)
+            "DROP\n"                            //
+            "PUSH_UINT 9\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 1\n"                      // LIBCHANNEL_FN_SEND (try)
+            "DROP\n"                            //
+            "PUSH_UINT 100\n"                   //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 3 1\n"                      // LIBCHANNEL_FN_RECV_BATCH (try)
+            "HALT 99\n"                         // end
+            );                                  //
+
+    vm_thread_config_t batch_config = { .stack_size = 8 };
+    vm_destroy_thread(&thread);
+    vm_create_thread(&thread, &batch_config);
+    externals.lib = calloc(1, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_channel;
+    externals.lib_qty = 1;
+    thread->externals = &externals;
+
+    TEST_EXECUTE;
+    OP_TEST_START(198, 8, 0);
+    assert(thread->status == VM_ERR_HALT && thread->exit_value == 99);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 7); // only the free slots
+    for (uint32_t n = 7; n > 0; n--)
+        assert(vm_pop(&thread).number.uinteger == n - 1);
+    OP_TEST_END();
+    END_TEST();
+    free(externals.lib);
+
+    START_TEST(CHANNEL THREADS,                 //
+            "SET_GLOBAL 0\n"                    // channel
+            "GOTOZ consumer\n"                  // role
+            "PUSH_0\n"                          //
+            "SET_GLOBAL 1\n"                    //
+            ".label send\n"                     //
+            "GET_GLOBAL 1\n"                    //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 0 0\n"                      // LIBCHANNEL_FN_SEND (block)
+            "DROP\n"                            //
+            "GET_GLOBAL 1\n"                    //
+            "INC\n"                             //
+            "SET_GLOBAL 1\n"                    //
+            "GET_GLOBAL 1\n"                    //
+            "PUSH_UINT 1000\n"                  //
+            "LT\n"                              //
+            "GOTOZ end\n"                       //
+            "GOTO send\n"                       //
+            ".label consumer\n"                 //
+            "PUSH_0\n"                          //
+            "SET_GLOBAL 1\n"                    // sum
+            "PUSH_0\n"                          //
+            "SET_GLOBAL 2\n"                    // received
+            ".label recv\n"                     //
+            "GET_GLOBAL 0\n"                    //
+            "LIB_FN 1 2\n"                      // LIBCHANNEL_FN_RECV (yield: runs again while empty)
+            "DROP\n"                            //
+            "GET_GLOBAL 1\n"                    //
+            "ADD\n"                             //
+            "SET_GLOBAL 1\n"                    //
+            "GET_GLOBAL 2\n"                    //
+            "INC\n"                             //
+            "SET_GLOBAL 2\n"                    //
+            "GET_GLOBAL 2\n"                    //
+            "PUSH_UINT 1000\n"                  //
+            "LT\n"                              //
+            "GOTOZ end\n"                       //
+            "GOTO recv\n"                       //
+            ".label end\n"                      //
+            "GET_GLOBAL 1\n"                    //
+            "HALT 99\n"                         // end
+            );                                  //
+
+    externals.lib = calloc(1, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_channel;
+    externals.lib_qty = 1;
+    libchannel_t *channel = libchannel_create(16, true);
+    test_runner_t runners[2] = { { .program = &program }, { .program = &program } };
+    pthread_t ids[2];
+    for (uint32_t n = 0; n < 2; n++) {
+        vm_create_thread(&runners[n].thread, NULL);
+        runners[n].thread->externals = &externals;
+        vm_new_uint(role, n);
+        vm_push(&runners[n].thread, role);
+        vm_push(&runners[n].thread, libchannel_value(&runners[n].thread, 0, channel));
+        pthread_create(&ids[n], NULL, test_runner, &runners[n]);
+    }
+    libchannel_release(channel);
+    for (uint32_t n = 0; n < 2; n++)
+        pthread_join(ids[n], NULL);
+    OP_TEST_START(0, 0, 0);
+    assert(runners[0].thread->status == VM_ERR_HALT && runners[1].thread->status == VM_ERR_HALT);
+    vm_value = vm_pop(&runners[0].thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 499500);
+    OP_TEST_END();
+    for (uint32_t n = 0; n < 2; n++)
+        vm_destroy_thread(&runners[n].thread);
+    END_TEST();
+    free(externals.lib);
     ///////////////////////////////////
+    START_TEST(PARALLEL,                       //
+            "PUSH_UINT 1\n"                  //
+            "PUSH_UINT 2\n"                  //
+            "PUSH_UINT 3\n"                  //
+            "PUSH_UINT 4\n"                  //
+            "PUSH_UINT 5\n"                  //
+            "PUSH_UINT 6\n"                  //
+            "PUSH_UINT 7\n"                  //
+            "PUSH_UINT 8\n"                  //
+            "PUSH_UINT 9\n"                  //
+            "PUSH_UINT 10\n"                 //
+            "NEW_ARRAY 10\n"                   //
+            "SET_GLOBAL 0\n"                   //
+            "GET_GLOBAL 0\n"                   //
+            "CALL_FOREIGN 0 square 0\n"        // FFI_PARALLEL_MAP
+            "GET_RETVAL\n"                     //
+            "GET_ARRAY_VALUE 9\n"              //
+            "PUSH_UINT 5\n"                    // initial value
+            "GET_GLOBAL 0\n"                   //
+            "CALL_FOREIGN 2 add 0\n"           // FFI_PARALLEL_REDUCE
+            "GET_RETVAL\n"                     //
+            "PUSH_UINT 100\n"                  //
+            "CALL_FOREIGN 1 index 0\n"         // FFI_PARALLEL_FOR
+            "GET_RETVAL\n"                     //
+            "PUSH_UINT 20\n"                   //
+            "CALL_FOREIGN 1 fail 0\n"          // FFI_PARALLEL_FOR (HALT on child)
+            "GET_RETVAL\n"                     //
+            "PUSH_UINT 4294967295\n"           // chunks over 32 bits
+            "CALL_FOREIGN 1 fail 0\n"          // FFI_PARALLEL_FOR (HALT on child)
+            "GET_RETVAL\n"                     //
+            "HALT 99\n"                        // end
+            ".label square\n"                  //
+            "GET_LOCAL 0\n"                    // element
+            "GET_LOCAL 0\n"                    //
+            "MUL\n"                            //
+            "RETURN_VALUE\n"                   //
+            ".label add\n"                     //
+            "GET_LOCAL 0\n"                    //
+            "GET_LOCAL 1\n"                    //
+            "ADD\n"                            //
+            "RETURN_VALUE\n"                   //
+            ".label index\n"                   //
+            "GET_LOCAL 0\n"                    // child global
+            "SET_GLOBAL 0\n"                   //
+            "RETURN\n"                         //
+            ".label fail\n"                    //
+            "HALT 1\n"                         //
+            );                                  //
+
+    externals.foreign_functions = malloc(sizeof(void*));
+    externals.foreign_functions_qty = 1;
+    externals.foreign_functions[0] = ffi_parallel;
+    thread->externals = &externals;
+    ffi_parallel_t *parallel = ffi_parallel_create(&program, 3, NULL);
+    assert(parallel != NULL && parallel->workers_qty == 3);
+    thread->parallel = parallel;
+
+    TEST_EXECUTE;
+    OP_TEST_START(147, 6, 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_BOOL && vm_value.number.boolean == false);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_BOOL && vm_value.number.boolean == false);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_BOOL && vm_value.number.boolean == true);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 60);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 100);
+    OP_TEST_END();
+    ffi_parallel_destroy(parallel);
+    END_TEST();
+    free(externals.foreign_functions);
+    ///////////////////////////////////
+    START_TEST(SHARED,                         //
+            "GOTOZ add\n"                      // role
+            "CALL_FOREIGN 0 0 0\n"             // FFI_SHARED_LOAD
+            "GET_RETVAL\n"                     //
+            "PUSH_UINT 1999\n"                 // expected
+            "PUSH_UINT 7\n"                    //
+            "CALL_FOREIGN 3 0 0\n"             // FFI_SHARED_CAS (fail)
+            "GET_RETVAL\n"                     //
+            "PUSH_UINT 2000\n"                 // expected
+            "PUSH_UINT 7\n"                    //
+            "CALL_FOREIGN 3 0 0\n"             // FFI_SHARED_CAS
+            "GET_RETVAL\n"                     //
+            "PUSH_UINT 9\n"                    //
+            "CALL_FOREIGN 4 0 0\n"             // FFI_SHARED_EXCHANGE
+            "GET_RETVAL\n"                     //
+            "PUSH_INT 1\n"                     //
+            "CALL_FOREIGN 1 0 0\n"             // FFI_SHARED_STORE (not the type of slot)
+            "GET_RETVAL\n"                     //
+            "HALT 99\n"                        // end
+            ".label add\n"                     //
+            "PUSH_0\n"                         //
+            "SET_GLOBAL 0\n"                   //
+            ".label loop\n"                    //
+            "PUSH_UINT 1\n"                    //
+            "CALL_FOREIGN 2 0 0\n"             // FFI_SHARED_ADD (UINT)
+            "PUSH_FLOAT 0.5\n"                 //
+            "CALL_FOREIGN 2 1 0\n"             // FFI_SHARED_ADD (FLOAT)
+            "GET_GLOBAL 0\n"                   //
+            "INC\n"                            //
+            "SET_GLOBAL 0\n"                   //
+            "GET_GLOBAL 0\n"                   //
+            "PUSH_UINT 1000\n"                 //
+            "LT\n"                             //
+            "GOTOZ end\n"                      //
+            "GOTO loop\n"                      //
+            ".label end\n"                     //
+            "HALT 99\n"                        //
+            );                                  //
+
+    externals.foreign_functions = malloc(sizeof(void*));
+    externals.foreign_functions_qty = 1;
+    externals.foreign_functions[0] = ffi_shared;
+    ffi_shared_t *shared = ffi_shared_create(2);
+    vm_value_t shared_real = { .type = VM_VAL_FLOAT };
+    shared_real.number.real = 0;
+    assert(ffi_shared_init(shared, 1, shared_real));
+    test_runner_t adders[2] = { { .program = &program }, { .program = &program } };
+    pthread_t adder_ids[2];
+    for (uint32_t n = 0; n < 2; n++) {
+        vm_create_thread(&adders[n].thread, NULL);
+        adders[n].thread->externals = &externals;
+        ffi_shared_attach(shared, adders[n].thread);
+        vm_new_uint(role, 0);
+        vm_push(&adders[n].thread, role);
+        pthread_create(&adder_ids[n], NULL, test_runner, &adders[n]);
+    }
+    for (uint32_t n = 0; n < 2; n++) {
+        pthread_join(adder_ids[n], NULL);
+        ffi_shared_detach(adders[n].thread);
+        vm_destroy_thread(&adders[n].thread);
+    }
+    shared_real = ffi_shared_load(shared, 1);
+    assert(shared_real.type == VM_VAL_FLOAT && shared_real.number.real == 1000);
+    thread->externals = &externals;
+    ffi_shared_attach(shared, thread);
+    ffi_shared_release(shared);
+    vm_new_uint(checker, 1);
+    vm_push(&thread, checker);
+
+    TEST_EXECUTE;
+    OP_TEST_START(91, 5, 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_BOOL && vm_value.number.boolean == false);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 7);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_BOOL && vm_value.number.boolean == true);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_BOOL && vm_value.number.boolean == false);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 2000);
+    assert(ffi_shared_load(thread->shared, 0).number.uinteger == 9);
+    OP_TEST_END();
+    ffi_shared_detach(thread);
+    END_TEST();
+    free(externals.foreign_functions);
+    ///////////////////////////////////
+    START_TEST(CLONE,                          //
+            "PUSH_INT 10\n"                    //
+            "PUSH_INT 20\n"                    //
+            "NEW_ARRAY 2\n"                    //
+            "SET_GLOBAL 0\n"                   // lookup array
+            "PUSH_CONST_STRING str\n"          //
+            "PUSH_UINT 0\n"                    // LIBSTRING
+            "NEW_LIB_OBJ\n"                    //
+            "SET_GLOBAL 1\n"                   //
+            "HALT 0\n"                         // end of init
+            "GET_GLOBAL 0\n"                   //
+            "PUSH_INT 45\n"                    //
+            "SET_ARRAY_VALUE 0\n"              // copy on write
+            "GET_ARRAY_VALUE 0\n"              //
+            "GET_GLOBAL 1\n"                   //
+            "LIB_FN 0 0\n"                     // LIBSTRING_FN_LEN
+            "HALT 99\n"                        // end
+            ".label str\n"                     //
+            ".string \"lookup table of the init\"\n" //
+            );                                  //
+
+    externals.lib = calloc(1, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_strings;
+    externals.lib_qty = 1;
+    thread->externals = &externals;
+
+    TEST_EXECUTE;
+    assert(thread->status == VM_ERR_HALT && thread->exit_value == 0);
+    vm_push(&thread, vm_intern(&thread, "key", 3));
+    test_runner_t clones[2] = { { .program = &program }, { .program = &program } };
+    pthread_t clone_ids[2];
+    for (uint32_t n = 0; n < 2; n++) {
+        assert(vm_thread_clone(&clones[n].thread, thread) == VM_ERR_OK);
+        assert(clones[n].thread != NULL && clones[n].thread->sp == 1 && clones[n].thread->heap->image == thread->heap->image);
+        clones[n].thread->pc = thread->pc + 1; // request, after HALT 0
+        clones[n].thread->halted = false;
+        pthread_create(&clone_ids[n], NULL, test_runner, &clones[n]);
+    }
+    for (uint32_t n = 0; n < 2; n++) {
+        pthread_join(clone_ids[n], NULL);
+        assert(clones[n].thread->status == VM_ERR_HALT && clones[n].thread->exit_value == 99 && clones[n].thread->sp == 4);
+        vm_value = vm_pop(&clones[n].thread);
+        assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 24);
+        vm_value = vm_pop(&clones[n].thread);
+        assert(vm_value.type == VM_VAL_INT && vm_value.number.integer == 45);
+        vm_value = STK_OBJ(&clones[n].thread, 0);
+        assert(VM_CSTR_IS_INTERNED(vm_value) && VM_CSTR_ADDR(vm_value) != VM_CSTR_ADDR(STK_TOP(&thread)));
+        assert(strcmp(VM_CSTR_ADDR(vm_value), "key") == 0);
+        vm_destroy_thread(&clones[n].thread);
+    }
+    // source keeps its own values
+    assert(vm_heap_load(thread->heap, thread->globals->global_vars[0].heap_ref)->array.fields[0].number.integer == 10);
+    thread->pc++;
+    thread->halted = false;
+    TEST_EXECUTE;
+    OP_TEST_START(64, 4, 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 24);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_INT && vm_value.number.integer == 45);
+    OP_TEST_END();
+    END_TEST();
+    free(externals.lib);
+
+    START_TEST(SNAPSHOT,                       //
+            "PUSH_INT 10\n"                    //
+            "PUSH_INT 20\n"                    //
+            "NEW_ARRAY 2\n"                    //
+            "SET_GLOBAL 0\n"                   // lookup array
+            "PUSH_CONST_STRING str\n"          //
+            "PUSH_UINT 0\n"                    // LIBSTRING
+            "NEW_LIB_OBJ\n"                    //
+            "SET_GLOBAL 1\n"                   //
+            "PUSH_UINT 1\n"                    // LIBHASHMAP
+            "NEW_LIB_OBJ\n"                    //
+            "SET_GLOBAL 2\n"                   //
+            "PUSH_INT 7\n"                     //
+            "PUSH_CONST_STRING key\n"          //
+            "GET_GLOBAL 2\n"                   //
+            "LIB_FN 0 0\n"                     // LIBHASHMAP_FN_SET
+            "DROP\n"                           //
+            "HALT 0\n"                         // end of init
+            "GET_GLOBAL 0\n"                   //
+            "PUSH_INT 45\n"                    //
+            "SET_ARRAY_VALUE 0\n"              // copy on write of mapped fields
+            "GET_ARRAY_VALUE 0\n"              //
+            "GET_GLOBAL 1\n"                   //
+            "LIB_FN 0 0\n"                     // LIBSTRING_FN_LEN
+            "PUSH_CONST_STRING key\n"          //
+            "GET_GLOBAL 2\n"                   //
+            "LIB_FN 1 0\n"                     // LIBHASHMAP_FN_GET
+            "HALT 99\n"                        // end
+            ".label key\n"                     //
+            ".string \"name\"\n"               //
+            ".label str\n"                     //
+            ".string \"lookup table of the init\"\n" //
+            );                                  //
+
+    externals.lib = calloc(2, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_strings;
+    externals.lib[1] = lib_entry_hashtable;
+    externals.lib_qty = 2;
+    thread->externals = &externals;
+
+    TEST_EXECUTE;
+    assert(thread->status == VM_ERR_HALT && thread->exit_value == 0);
+    vm_push(&thread, vm_intern(&thread, "interned", 8));
+    vm_value.type = VM_VAL_CONST_STRING;
+    VM_CSTR_SET(vm_value, strdup("owned"), false);
+    vm_push(&thread, vm_value);
+
+    FILE *snapshot_file = tmpfile();
+    assert(vm_snapshot(&thread, &program, fileno(snapshot_file)) == VM_ERR_OK);
+    vm_destroy_thread(&thread);
+
+    // other program
+    vm_program_t snapshot_other = { .prog = program.prog, .prog_len = program.prog_len - 1 };
+    lseek(fileno(snapshot_file), 0, SEEK_SET);
+    assert(vm_restore(&thread, &snapshot_other, &externals, fileno(snapshot_file)) == VM_ERR_FAIL && thread == NULL);
+
+    // corrupted sizes
+    vm_snapshot_header_t snapshot_header;
+    assert(pread(fileno(snapshot_file), &snapshot_header, sizeof(vm_snapshot_header_t), 0) == sizeof(vm_snapshot_header_t));
+    uint32_t snapshot_sizes[3] = { 0xffffffff, snapshot_header.stack_size, 0 };
+    assert(pwrite(fileno(snapshot_file), &snapshot_sizes[0], sizeof(uint32_t), offsetof(vm_snapshot_header_t, stack_size)) == sizeof(uint32_t));
+    lseek(fileno(snapshot_file), 0, SEEK_SET);
+    assert(vm_restore(&thread, &program, &externals, fileno(snapshot_file)) == VM_ERR_FAIL && thread == NULL);
+    assert(pwrite(fileno(snapshot_file), &snapshot_sizes[1], sizeof(uint32_t), offsetof(vm_snapshot_header_t, stack_size)) == sizeof(uint32_t));
+    snapshot_sizes[2] = snapshot_header.globals_qty;
+    snapshot_sizes[0] = VM_MAX_GLOBAL_VARS + 1;
+    assert(pwrite(fileno(snapshot_file), &snapshot_sizes[0], sizeof(uint32_t), offsetof(vm_snapshot_header_t, globals_qty)) == sizeof(uint32_t));
+    lseek(fileno(snapshot_file), 0, SEEK_SET);
+    assert(vm_restore(&thread, &program, &externals, fileno(snapshot_file)) == VM_ERR_FAIL && thread == NULL);
+    assert(pwrite(fileno(snapshot_file), &snapshot_sizes[2], sizeof(uint32_t), offsetof(vm_snapshot_header_t, globals_qty)) == sizeof(uint32_t));
+
+    // corrupted registers and strings
+    snapshot_sizes[0] = program.prog_len;
+    assert(pwrite(fileno(snapshot_file), &snapshot_sizes[0], sizeof(uint32_t), offsetof(vm_snapshot_header_t, pc)) == sizeof(uint32_t));
+    lseek(fileno(snapshot_file), 0, SEEK_SET);
+    assert(vm_restore(&thread, &program, &externals, fileno(snapshot_file)) == VM_ERR_FAIL && thread == NULL);
+    assert(pwrite(fileno(snapshot_file), &snapshot_header.pc, sizeof(uint32_t), offsetof(vm_snapshot_header_t, pc)) == sizeof(uint32_t));
+    snapshot_sizes[0] = snapshot_header.sp + 1;
+    assert(pwrite(fileno(snapshot_file), &snapshot_sizes[0], sizeof(uint32_t), offsetof(vm_snapshot_header_t, fp)) == sizeof(uint32_t));
+    lseek(fileno(snapshot_file), 0, SEEK_SET);
+    assert(vm_restore(&thread, &program, &externals, fileno(snapshot_file)) == VM_ERR_FAIL && thread == NULL);
+    assert(pwrite(fileno(snapshot_file), &snapshot_header.fp, sizeof(uint32_t), offsetof(vm_snapshot_header_t, fp)) == sizeof(uint32_t));
+    assert(pread(fileno(snapshot_file), &vm_value, sizeof(vm_value_t), snapshot_header.stack + sizeof(vm_value_t)) == sizeof(vm_value_t));
+    char snapshot_nul[2] = { 'x', '\0' };
+    assert(pwrite(fileno(snapshot_file), &snapshot_nul[0], 1, (uintptr_t) VM_CSTR_ADDR(vm_value) + 5) == 1); // "owned"
+    lseek(fileno(snapshot_file), 0, SEEK_SET);
+    assert(vm_restore(&thread, &program, &externals, fileno(snapshot_file)) == VM_ERR_FAIL && thread == NULL);
+    assert(pwrite(fileno(snapshot_file), &snapshot_nul[1], 1, (uintptr_t) VM_CSTR_ADDR(vm_value) + 5) == 1);
+
+    lseek(fileno(snapshot_file), 0, SEEK_SET);
+    assert(vm_restore(&thread, &program, &externals, fileno(snapshot_file)) == VM_ERR_OK && thread != NULL);
+    fclose(snapshot_file);
+    assert(thread->halted && thread->sp == 2 && thread->globals->global_vars_qty == 3);
+    vm_heap_image_t *snapshot_image = thread->heap->image;
+    vm_value_t *snapshot_fields = vm_heap_load(thread->heap, thread->globals->global_vars[0].heap_ref)->array.fields;
+    assert(snapshot_image != NULL && snapshot_image->map != NULL);
+    assert((uint8_t* ) snapshot_fields > (uint8_t* ) snapshot_image->map && snapshot_fields[1].number.integer == 20); // in place
+    vm_value = vm_pop(&thread);
+    assert(!VM_CSTR_IS_PROGRAM(vm_value) && strcmp(VM_CSTR_ADDR(vm_value), "owned") == 0);
+    free(VM_CSTR_ADDR(vm_value));
+    vm_value = vm_pop(&thread);
+    assert(VM_CSTR_IS_INTERNED(vm_value) && VM_CSTR_ADDR(vm_value) == VM_CSTR_ADDR(vm_intern(&thread, "interned", 8)));
+
+    thread->pc++; // request, after HALT 0
+    thread->halted = false;
+    TEST_EXECUTE;
+    OP_TEST_START(113, 4, 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_INT && vm_value.number.integer == 7);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 24);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_INT && vm_value.number.integer == 45);
+    assert(snapshot_fields[0].number.integer == 10); // mapped fields not written
+    OP_TEST_END();
+    END_TEST();
+    free(externals.lib);
+
+    START_TEST(SNAPSHOT FRAMES,         //
+            "PUSH_UINT 5\n"             // argument
+            "CALL 1 fn\n"               //
+            "HALT 99\n"                 // end
+            ".label fn\n"               //
+            "HALT 1\n"                  // saved inside the call
+            "GET_LOCAL 0\n"             //
+            "RETURN_VALUE\n"            //
+            );                          //
+
+    TEST_EXECUTE;
+    assert(thread->status == VM_ERR_HALT && thread->exit_value == 1 && thread->fc == 1);
+    snapshot_file = tmpfile();
+    assert(vm_snapshot(&thread, &program, fileno(snapshot_file)) == VM_ERR_OK);
+    vm_destroy_thread(&thread);
+
+    // corrupted caller frame
+    assert(pread(fileno(snapshot_file), &snapshot_header, sizeof(vm_snapshot_header_t), 0) == sizeof(vm_snapshot_header_t));
+    vm_snapshot_frame_t snapshot_frame;
+    assert(pread(fileno(snapshot_file), &snapshot_frame, sizeof(vm_snapshot_frame_t), snapshot_header.frames) == sizeof(vm_snapshot_frame_t));
+    vm_snapshot_frame_t snapshot_bad = snapshot_frame;
+    snapshot_bad.locals = snapshot_header.fp + 1;
+    assert(pwrite(fileno(snapshot_file), &snapshot_bad, sizeof(vm_snapshot_frame_t), snapshot_header.frames) == sizeof(vm_snapshot_frame_t));
+    lseek(fileno(snapshot_file), 0, SEEK_SET);
+    assert(vm_restore(&thread, &program, NULL, fileno(snapshot_file)) == VM_ERR_FAIL && thread == NULL);
+    snapshot_bad = snapshot_frame;
+    snapshot_bad.fp = snapshot_header.sp + 1;
+    assert(pwrite(fileno(snapshot_file), &snapshot_bad, sizeof(vm_snapshot_frame_t), snapshot_header.frames) == sizeof(vm_snapshot_frame_t));
+    lseek(fileno(snapshot_file), 0, SEEK_SET);
+    assert(vm_restore(&thread, &program, NULL, fileno(snapshot_file)) == VM_ERR_FAIL && thread == NULL);
+    snapshot_bad = snapshot_frame;
+    snapshot_bad.pc = program.prog_len + 1;
+    assert(pwrite(fileno(snapshot_file), &snapshot_bad, sizeof(vm_snapshot_frame_t), snapshot_header.frames) == sizeof(vm_snapshot_frame_t));
+    lseek(fileno(snapshot_file), 0, SEEK_SET);
+    assert(vm_restore(&thread, &program, NULL, fileno(snapshot_file)) == VM_ERR_FAIL && thread == NULL);
+    assert(pwrite(fileno(snapshot_file), &snapshot_frame, sizeof(vm_snapshot_frame_t), snapshot_header.frames) == sizeof(vm_snapshot_frame_t));
+
+    lseek(fileno(snapshot_file), 0, SEEK_SET);
+    assert(vm_restore(&thread, &program, NULL, fileno(snapshot_file)) == VM_ERR_OK && thread != NULL);
+    fclose(snapshot_file);
+    thread->pc++; // after HALT 1
+    thread->halted = false;
+    TEST_EXECUTE;
+    OP_TEST_START(12, 0, 0);
+    assert(thread->status == VM_ERR_HALT && thread->exit_value == 99 && thread->fc == 0);
+    assert(thread->ret_val.type == VM_VAL_UINT && thread->ret_val.number.uinteger == 5);
+    OP_TEST_END();
+    END_TEST();
+
+    START_TEST(MODULE,                  //
+            "CALL 0 fn\n"               //
+            "GET_RETVAL\n"              //
+            "HALT 99\n"                 // end
+            ".label fn\n"               //
+            "PUSH_CONST_STRING str\n"   //
+            "PUSH_UINT 0\n"             // LIBSTRING
+            "NEW_LIB_OBJ\n"             //
+            "LIB_FN 0 0\n"              // LIBSTRING_FN_LEN
+            "RETURN_VALUE\n"            //
+            ".label str\n"              //
+            ".string \"module\"\n"      //
+            );                          //
+
+    externals.lib = calloc(1, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_strings;
+    externals.lib_qty = 1;
+    thread->externals = &externals;
+
+    char module_path[] = "/tmp/test_module_XXXXXX";
+    int module_fd = mkstemp(module_path);
+    assert(module_fd >= 0 && vm_module_write(module_fd, &program, &assembler_module, true));
+    vm_module_t *module = vm_module_load(module_path, true);
+    assert(module != NULL && module->program.prog != hex && module->program.prog_len == qty);
+    assert(memcmp(module->program.prog, hex, qty) == 0 && module->program.globals_qty == program.globals_qty);
+    assert(((uintptr_t) module->program.prog) % VM_MODULE_ALIGN == 0);
+    uint32_t module_fn = vm_module_symbol(module, "fn");
+    assert(module_fn == 9 && vm_module_symbol(module, "none") == 0xffffffff);
+    assert(module->header->consts_qty == 1 && module->consts[0].pc == vm_module_symbol(module, "str") && module->consts[0].len == 7);
+    assert(vm_module_line(module, 0) == 1 && vm_module_line(module, module_fn) == 4 && vm_module_line(module, module_fn + 1) == 4);
+
+    program = module->program; // run in place
+    TEST_EXECUTE;
+    OP_TEST_START(8, 1, 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT && vm_value.number.uinteger == 6);
+    OP_TEST_END();
+    vm_module_unload(module);
+
+    // corrupted
+    uint8_t module_byte = 0xff;
+    assert(pwrite(module_fd, &module_byte, 1, sizeof(vm_module_header_t)) == 1);
+    assert(vm_module_load(module_path, true) == NULL);
+    module = vm_module_load(module_path, false);
+    assert(module != NULL);
+    vm_module_unload(module);
+    close(module_fd);
+    unlink(module_path);
+    END_TEST();
+    free(externals.lib);
+
     START_TEST(TEST LIBRARY: STATIC LIB OBJECT,//
             "CALL 0 fn\n"    //
             "GET_RETVAL\n"   //
@@ -1366,6 +2776,126 @@ void test_opcodes(void) {
     END_TEST();
     ///////////////////////////////////
 
+    START_TEST(THREAD RESET,          //
+            "PUSH_CONST_STRING str\n"  //
+            "PUSH_UINT 0\n"            // LIBSTRING
+            "NEW_LIB_OBJ\n"            //
+            "SET_GLOBAL 0\n"           //
+            "PUSH_UINT 97\n"           //
+            "@NEW_HEAP_OBJECT\n"       // static object
+            "DROP\n"                   //
+            "PUSH_0\n"                 //
+            "SET_GLOBAL 1\n"           //
+            ".label loop\n"            //
+            "GET_GLOBAL 1\n"           //
+            "INC\n"                    //
+            "SET_GLOBAL 1\n"           //
+            "GET_GLOBAL 1\n"           //
+            "PUSH_UINT 5\n"            //
+            "LT\n"                     //
+            "GOTOZ end\n"              //
+            "GOTO loop\n"              //
+            ".label end\n"             //
+            "GET_GLOBAL 1\n"           //
+            "HALT 99\n"                // end
+            ".label str\n"             //
+            ".string \"string test\"\n" //
+            );                          //
+
+    externals.lib = calloc(1, sizeof(lib_entry));
+    externals.lib[0] = lib_entry_strings;
+    ++externals.lib_qty;
+    thread->externals = &externals;
+
+    for (uint8_t run = 0; run < 2; run++) {
+        TEST_EXECUTE;
+        OP_TEST_START(67, 1, 0);
+        assert(thread->status == VM_ERR_HALT);
+        vm_value = vm_pop(&thread);
+        assert(vm_value.type == VM_VAL_UINT);
+        assert(vm_value.number.uinteger == 5);
+        OP_TEST_END();
+
+        vm_thread_reset(&thread);
+        assert(thread->pc == 0 && thread->sp == 0 && thread->halted == false);
+        assert(thread->globals->global_vars_qty == 0);
+        assert(thread->heap->allocated[0] == 0);
+        assert(thread->externals == &externals);
+    }
+    END_TEST();
+    free(externals.lib);
+    ///////////////////////////////////
+
+    START_TEST(THREAD CONFIG, //
+            "CALL 0 fn\n"     //
+            "HALT 99\n"       // end
+            ".label fn\n"     //
+            "CALL 0 fn\n"     // recurse until max call depth
+            "RETURN\n"        //
+            );                //
+
+    vm_thread_config_t config = { .stack_size = 16, .max_call_depth = 8, .frames_size = 1 };
+    vm_destroy_thread(&thread);
+    vm_create_thread(&thread, &config);
+    assert(thread->stack_size == 16 && thread->frames_size == 2);
+
+    TEST_EXECUTE;
+    OP_TEST_START(14, 0, 0);
+    assert(thread->status == VM_ERR_TOOMANYTHREADS);
+    assert(thread->fc == 8);
+    assert(thread->frames_size == 9);
+    OP_TEST_END();
+    END_TEST();
+    ///////////////////////////////////
+
+    START_TEST(HEAP METADATA, //
+            "PUSH_UINT 97\n"      //
+            "@NEW_HEAP_OBJECT\n"  // static generic
+            "PUSH_0\n"            //
+            "PUSH_1\n"            //
+            "NEW_ARRAY 2\n"       //
+            "HALT 99\n"           // end
+            );                    //
+
+    TEST_EXECUTE;
+    OP_TEST_START(12, 2, 0);
+    vm_value = vm_pop(&thread);
+    assert(vm_heap_type(thread->heap, vm_value.heap_ref) == VM_VAL_ARRAY);
+    assert(!vm_heap_isstatic(thread->heap, vm_value.heap_ref));
+    assert(vm_wordpos_isset_bit(thread->heap->finalize, vm_value.heap_ref));
+    vm_value = vm_pop(&thread);
+    assert(vm_heap_type(thread->heap, vm_value.heap_ref) == VM_VAL_GENERIC);
+    assert(vm_heap_isstatic(thread->heap, vm_value.heap_ref));
+    assert(!vm_wordpos_isset_bit(thread->heap->finalize, vm_value.heap_ref));
+    vm_heap_gc_collect(thread->heap, &(thread->frames[0].gc_mark), false, &thread, false);
+    assert(vm_heap_type(thread->heap, vm_value.heap_ref) == VM_VAL_GENERIC);
+    assert(thread->heap->allocated[0] == (1U << vm_value.heap_ref));
+    OP_TEST_END();
+    END_TEST();
+    ///////////////////////////////////
+
+#ifdef VM_ENABLE_STACK_GUARD
+    START_TEST(STACK GUARD, //
+            ".label loop\n" //
+            "PUSH_1\n"      //
+            "GOTO loop\n"   // unbounded push
+            );              //
+
+    vm_thread_config_t guard_config = { .stack_size = 1000, .stack_guard = true };
+    vm_destroy_thread(&thread);
+    vm_create_thread(&thread, &guard_config);
+
+    printf("      -- start execute (vm_run)\n");
+    assert(vm_run(&thread, &program) == VM_ERR_OVERFLOW);
+    OP_TEST_START(1, 1000, 0);
+    assert(thread->halted == true);
+    vm_value = vm_pop(&thread);
+    assert(vm_value.type == VM_VAL_UINT);
+    OP_TEST_END();
+    END_TEST();
+    ///////////////////////////////////
+#endif
+
     printf("---( tests: %u / fails: %u )---\n", tests_qty, tests_fails);
     printf("---[ END TEST OPCODES ]---\n");
 
@@ -24,6 +24,16 @@
 #include "vm.h"
 #include "vm_opcodes.h"
 
+#ifdef VM_ENABLE_STACK_GUARD
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#define VM_ALIGN_BLOCK(size) (((size) + 15) & ~((size_t) 15)) // thread block regions alignment
+
 // values
 static inline bool vm_are_values_equal(vm_thread_t **thread, vm_value_t a, vm_value_t b) {
     bool result = false;
@@ -64,7 +74,10 @@ static inline bool vm_are_values_equal(vm_thread_t **thread, vm_value_t a, vm_va
             break;
 
         case VM_VAL_CONST_STRING:
-            result = (strcmp(a.cstr.addr, b.cstr.addr) == 0);
+            if (VM_CSTR_IS_INTERNED(a) && VM_CSTR_IS_INTERNED(b))
+                result = VM_CSTR_ADDR(a) == VM_CSTR_ADDR(b);
+            else
+                result = (strcmp(VM_CSTR_ADDR(a), VM_CSTR_ADDR(b)) == 0);
             break;
 
         default:
@@ -73,7 +86,68 @@ static inline bool vm_are_values_equal(vm_thread_t **thread, vm_value_t a, vm_va
     return result;
 }
 
-void vm_push_frame(vm_thread_t **thread, uint8_t locals) {
+// global slots grow geometrically up to VM_MAX_GLOBAL_VARS, new slots are NULL
+vm_errors_t vm_globals_reserve(vm_thread_t **thread, uint32_t qty) {
+    uint64_t size = (*thread)->globals->global_vars_size == 0 ? 8 : (*thread)->globals->global_vars_size;
+
+    if (qty > VM_MAX_GLOBAL_VARS)
+        return VM_ERR_OUTOFRANGE;
+
+    while (size < qty)
+        size *= 2;
+    if (size > VM_MAX_GLOBAL_VARS)
+        size = VM_MAX_GLOBAL_VARS;
+
+    vm_value_t *global_vars = realloc((*thread)->globals->global_vars, size * sizeof(vm_value_t));
+    if (global_vars == NULL)
+        return VM_ERR_OUTOFMEMORY;
+
+    memset(global_vars + (*thread)->globals->global_vars_size, 0, (size - (*thread)->globals->global_vars_size) * sizeof(vm_value_t));
+    (*thread)->globals->global_vars = global_vars;
+    (*thread)->globals->global_vars_size = size;
+
+    return VM_ERR_OK;
+}
+
+// release strings owned by globals
+static void vm_release_globals(vm_thread_t **thread) {
+    for (uint32_t n = 0; n < (*thread)->globals->global_vars_qty; ++n)
+        STK_FREECSTR(thread, (*thread)->globals->global_vars[n]);
+    if ((*thread)->globals->global_vars_qty > 0)
+        memset((*thread)->globals->global_vars, 0, (*thread)->globals->global_vars_qty * sizeof(vm_value_t));
+    (*thread)->globals->global_vars_qty = 0;
+}
+
+// frames preallocated below max_call_depth are doubled on demand (frames are kept if it fails)
+static bool vm_grow_frames(vm_thread_t **thread) {
+    vm_frame_t *inline_frames = (vm_frame_t*) ((uint8_t*) (*thread) + VM_ALIGN_BLOCK(sizeof(vm_thread_t)));
+    uint64_t frames_size = (*thread)->frames_size * 2ULL;
+    vm_frame_t *frames;
+
+    if (frames_size > (*thread)->max_call_depth + 1ULL)
+        frames_size = (*thread)->max_call_depth + 1ULL;
+
+    if ((*thread)->frames == inline_frames) {
+        if ((frames = malloc(frames_size * sizeof(vm_frame_t))) == NULL)
+            return false;
+        memcpy(frames, inline_frames, (*thread)->frames_size * sizeof(vm_frame_t));
+    } else if ((frames = realloc((*thread)->frames, frames_size * sizeof(vm_frame_t))) == NULL)
+        return false;
+
+    (*thread)->frames = frames;
+    (*thread)->frames_size = frames_size;
+
+    return true;
+}
+
+bool vm_push_frame(vm_thread_t **thread, uint8_t locals) {
+    if ((*thread)->fc + 1 >= (*thread)->frames_size && !vm_grow_frames(thread))
+        return false;
+
+    uint32_t *gc_mark = vm_heap_new_gc_mark((*thread)->heap);
+    if (gc_mark == NULL)
+        return false;
+
     (*thread)->frames[(*thread)->fc].pc = (*thread)->pc;
     (*thread)->frames[(*thread)->fc].fp = (*thread)->fp;
     (*thread)->frames[(*thread)->fc].locals = locals;
@@ -83,7 +157,9 @@ void vm_push_frame(vm_thread_t **thread, uint8_t locals) {
     vm_wordpos_set_bit((*thread)->frame_exist, (*thread)->fc);
 #endif
     (*thread)->fp = (*thread)->sp;
-    (*thread)->frames[(*thread)->fc].gc_mark = vm_heap_new_gc_mark((*thread)->heap);
+    (*thread)->frames[(*thread)->fc].gc_mark = gc_mark;
+
+    return true;
 }
 
 void vm_pop_frame(vm_thread_t **thread) {
@@ -102,6 +178,27 @@ void vm_pop_frame(vm_thread_t **thread) {
     (*thread)->pc = frame.pc;
 }
 
+#ifdef VM_ENABLE_FRAMES_ALIVE
+// growable stacks double until qty slots are free over sp (old stack is kept if fail)
+static bool vm_grow_stack(vm_thread_t **thread, uint32_t qty) {
+    uint64_t stack_size = (*thread)->stack_size;
+
+    while ((*thread)->sp + (uint64_t) qty > stack_size)
+        stack_size *= 2;
+    if (stack_size > UINT32_MAX)
+        return false;
+
+    vm_value_t *stack = realloc((*thread)->stack, stack_size * sizeof(vm_value_t));
+    if (stack == NULL)
+        return false;
+
+    (*thread)->stack = stack;
+    (*thread)->stack_size = stack_size;
+
+    return true;
+}
+#endif
+
 // vm
 void vm_step(vm_thread_t **thread, vm_program_t *program) {
     if ((*thread) == NULL)
@@ -113,11 +210,21 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
         return;
     }
 
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    if ((*thread)->sp + VM_STACK_HEADROOM > (*thread)->stack_size && (*thread)->stack_grow && !vm_grow_stack(thread, VM_STACK_HEADROOM)) {
+        (*thread)->status = VM_ERR_OUTOFMEMORY;
+        (*thread)->halted = true;
+        return;
+    }
+#endif
+
     vm_errors_t err = VM_ERR_OK;
     bool modifier = false;
     int8_t ind_inc = 0;
+    uint32_t op_pc = (*thread)->pc;
+    uint8_t op = program->prog[(*thread)->pc];
 
-    switch (OP_MODIFIER(program->prog[(*thread)->pc])) {
+    switch (OP_MODIFIER(op)) {
         case 0x40:
             modifier = true;
             break;
@@ -131,13 +238,21 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
             break;
     }
 
-    program->prog[(*thread)->pc] &= 0x3f;
+    // the program is never modified, so it can be shared between threads and runs
+    op &= 0x3f;
+    ++(*thread)->pc;
 
-    switch (program->prog[(*thread)->pc++]) {
+    switch (op) {
         case PUSH_NULL:
         case PUSH_NULL_N: {
-            uint8_t n = (program->prog[(*thread)->pc - 1] == PUSH_NULL) ? 1 : program->prog[(*thread)->pc++];
+            uint8_t n = (op == PUSH_NULL) ? 1 : program->prog[(*thread)->pc++];
 
+#ifdef VM_ENABLE_FRAMES_ALIVE
+            if ((*thread)->sp + n > (*thread)->stack_size && (*thread)->stack_grow && !vm_grow_stack(thread, n)) {
+                err = VM_ERR_OUTOFMEMORY;
+                break;
+            }
+#endif
             memset(&STK_NEW(thread), 0, sizeof(vm_value_t) * n);
             (*thread)->sp += n;
         }
@@ -147,8 +262,9 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
         case NEW_LIB_OBJ: {
             vm_value_t value = vm_pop(thread);
             vm_heap_object_t obj;
+            vm_value_type_t obj_type;
             vm_value_t ref;
-            bool is_new_lib = program->prog[(*thread)->pc - 1] == NEW_LIB_OBJ ? true : false;
+            bool is_new_lib = op == NEW_LIB_OBJ ? true : false;
 
             if (is_new_lib) {
                 if (value.type != VM_VAL_UINT || value.number.uinteger > (*thread)->externals->lib_qty) {
@@ -157,24 +273,20 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
                 }
 
                 ref.type = VM_VAL_LIB_OBJ;
+                ref.lib_obj.lib_idx = value.number.uinteger;
 
-                obj.type = VM_VAL_LIB_OBJ;
-                obj.static_obj = false;
+                obj_type = VM_VAL_LIB_OBJ;
                 obj.lib_obj.identifier = 0;
                 obj.lib_obj.addr = NULL;
                 obj.lib_obj.lib_idx = value.number.uinteger;
             } else {
                 ref.type = VM_VAL_HEAP_REF;
 
-                obj.type = VM_VAL_GENERIC;
-                obj.static_obj = false;
+                obj_type = VM_VAL_GENERIC;
                 obj.value = value;
             }
 
-            if (modifier)
-                obj.static_obj = true;
-
-            uint32_t heap_ref = vm_heap_save((*thread)->heap, obj, &((*thread)->frames[(*thread)->fc].gc_mark));
+            uint32_t heap_ref = vm_heap_save((*thread)->heap, obj_type, modifier, obj, &((*thread)->frames[(*thread)->fc].gc_mark));
 
             if (is_new_lib) {
                 ref.lib_obj.heap_ref = heap_ref;
@@ -201,10 +313,11 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
                     idx = value.heap_ref;
 
                 vm_heap_object_t *obj = vm_heap_load((*thread)->heap, idx);
-                if (obj->type == VM_VAL_NULL)
+                vm_value_type_t obj_type = vm_heap_type((*thread)->heap, idx);
+                if (obj_type == VM_VAL_NULL)
                     err = VM_ERR_HEAPNOTEXIST;
                 else {
-                    switch (obj->type) {
+                    switch (obj_type) {
                         case VM_VAL_GENERIC: {
                             STK_TOP(thread) = obj->value;
                         }
@@ -304,7 +417,7 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
         case PUSH_CONST_INT32:
         case PUSH_CONST_FLOAT:
         case PUSH_CONST_STRING: {
-            uint8_t type = program->prog[(*thread)->pc - 1] - PUSH_CONST_UINT8;
+            uint8_t type = op - PUSH_CONST_UINT8;
             uint32_t const_pc = vm_read_u32(thread, program, &(*thread)->pc);
 
             if (modifier) {
@@ -355,8 +468,10 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
                 break;
                 case 7: { // string
                     STK_NEW(thread).type = VM_VAL_CONST_STRING;
-                    STK_NEW(thread).cstr.addr = (char*)(program->prog + const_pc);
-                    STK_NEW(thread).cstr.is_program = true;
+                    if ((*thread)->strings != NULL && (*thread)->strings->constants)
+                        VM_CSTR_SET_INTERNED(STK_NEW(thread), vm_intern_constant(thread, program, const_pc));
+                    else
+                        VM_CSTR_SET(STK_NEW(thread), (char*)(program->prog + const_pc), true);
                 }
                 break;
                 default:
@@ -387,9 +502,8 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
                 vm_heap_object_t arr;
                 arr.array.fields = malloc(sizeof(vm_value_t) * n_fields);
                 memcpy(arr.array.fields, &STK_OBJ(thread, (*thread)->sp - n_fields), sizeof(vm_value_t) * n_fields);
-                arr.type = VM_VAL_ARRAY;
                 arr.array.qty = n_fields;
-                uint32_t heap_id = vm_heap_save((*thread)->heap, arr, &((*thread)->frames[(*thread)->fc].gc_mark));
+                uint32_t heap_id = vm_heap_save((*thread)->heap, VM_VAL_ARRAY, false, arr, &((*thread)->frames[(*thread)->fc].gc_mark));
 
                 (*thread)->sp -= n_fields;
 
@@ -410,6 +524,7 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
         case GET_ARRAY_VALUE: {
             uint16_t index = vm_read_u16(thread, program, &(*thread)->pc);
             vm_heap_object_t *arr = vm_heap_load((*thread)->heap, STK_TOP(thread).heap_ref);
+            bool is_array = vm_heap_type((*thread)->heap, STK_TOP(thread).heap_ref) == VM_VAL_ARRAY;
 
             if (modifier) {
                 uint32_t _indx = index + (*thread)->indirect;
@@ -420,7 +535,7 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
                 index = _indx;
             }
 
-            if (arr->type == VM_VAL_ARRAY && index >= 0 && index < arr->array.qty)
+            if (is_array && index >= 0 && index < arr->array.qty)
                 vm_push(thread, arr->array.fields[index]);
             else
                 err = VM_ERR_BAD_VALUE;
@@ -440,11 +555,17 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
             }
 
             vm_heap_object_t *arr = vm_heap_load((*thread)->heap, STK_SND(thread).heap_ref);
+            bool is_array = vm_heap_type((*thread)->heap, STK_SND(thread).heap_ref) == VM_VAL_ARRAY;
             vm_value_t val = vm_pop(thread);
 
-            if (arr->type == VM_VAL_ARRAY && index >= 0 && index < arr->array.qty)
-                arr->array.fields[index] = val;
-            else
+            if (is_array && index >= 0 && index < arr->array.qty) {
+                // fields shared with a clone are copied on first write
+                uint32_t ref = STK_TOP(thread).heap_ref;
+                if (!vm_wordpos_isset_bit((*thread)->heap->shared, ref) || vm_heap_own((*thread)->heap, ref))
+                    arr->array.fields[index] = val;
+                else
+                    err = VM_ERR_OUTOFMEMORY;
+            } else
                 err = VM_ERR_BAD_VALUE;
         }
         break;
@@ -668,23 +789,14 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
                 break;
             }
 
-            vm_heap_object_t value = {
-                .type = VM_VAL_GENERIC,
-                .value = vm_pop(thread)
-            };
+            if (var_idx >= (*thread)->globals->global_vars_size && (err = vm_globals_reserve(thread, var_idx + 1)) != VM_ERR_OK)
+                break;
+            if (var_idx >= (*thread)->globals->global_vars_qty)
+                (*thread)->globals->global_vars_qty = var_idx + 1;
 
-            if (var_idx > VM_MAX_GLOBAL_VARS)
-                err = VM_ERR_OUTOFRANGE;
-            else {
-                if (var_idx < (*thread)->globals->global_vars_qty) {
-                    if (!vm_heap_set((*thread)->heap, value, (*thread)->globals->global_vars[var_idx]))
-                        err = VM_ERR_OUTOFRANGE;
-                } else {
-                    uint32_t heap_id = vm_heap_save((*thread)->heap, value, &((*thread)->frames[0].gc_mark));
-                    (*thread)->globals->global_vars[var_idx] = heap_id;
-                    ++(*thread)->globals->global_vars_qty;
-                }
-            }
+            vm_value_t *slot = &((*thread)->globals->global_vars[var_idx]);
+            STK_FREECSTR(thread, (*slot));
+            *slot = vm_pop(thread);
         }
         break;
 
@@ -701,11 +813,13 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
                 break;
             }
 
-            if (var_idx > (*thread)->globals->global_vars_qty - 1)
+            if (var_idx >= (*thread)->globals->global_vars_qty)
                 err = VM_ERR_OUTOFRANGE;
             else {
-                vm_heap_object_t *value = vm_heap_load((*thread)->heap, (*thread)->globals->global_vars[var_idx]);
-                vm_push(thread, value->value);
+                vm_push(thread, (*thread)->globals->global_vars[var_idx]);
+                // the global keeps its own string
+                if (STK_TOP(thread).type == VM_VAL_CONST_STRING && !VM_CSTR_IS_PROGRAM(STK_TOP(thread)))
+                    VM_CSTR_SET(STK_TOP(thread), strdup(VM_CSTR_ADDR(STK_TOP(thread))), false);
             }
         }
         break;
@@ -757,16 +871,17 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
                 pc_idx += (*thread)->indirect;
             }
 
-            if ((*thread)->fc < VM_THREAD_MAX_CALL_DEPTH) {
-                vm_push_frame(thread, nargs);
-                (*thread)->pc = pc_idx;
-            } else
+            if ((*thread)->fc >= (*thread)->max_call_depth)
                 err = VM_ERR_TOOMANYTHREADS;
+            else if (!vm_push_frame(thread, nargs))
+                err = VM_ERR_OUTOFMEMORY;
+            else
+                (*thread)->pc = pc_idx;
         }
         break;
 
         case RETURN: {
-            vm_value_t vm_value_null = {VM_VAL_NULL};
+            vm_value_t vm_value_null = { .type = VM_VAL_NULL };
             (*thread)->ret_val = vm_value_null;
             if ((*thread)->fc > 0)
                 vm_pop_frame(thread);
@@ -799,6 +914,8 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
 
             if (f_idx <= (*thread)->externals->foreign_functions_qty - 1) {
                 (*thread)->ret_val = (*thread)->externals->foreign_functions[f_idx](thread, fn, arg);
+                if ((*thread)->pending != 0)
+                    err = VM_ERR_PENDING;
             } else
                 err = VM_ERR_FOREINGFNUNKN;
         }
@@ -817,7 +934,7 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
         case GET_LOCAL_FF:
         case GET_LOCAL: {
             uint32_t local_idx =
-            (program->prog[(*thread)->pc - 1] == GET_LOCAL) ?
+            (op == GET_LOCAL) ?
             vm_read_u32(thread, program, &(*thread)->pc) :
             program->prog[(*thread)->pc++];
 
@@ -830,7 +947,7 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
 
         case SET_LOCAL_FF:
         case SET_LOCAL: {
-            uint32_t local_idx = (program->prog[(*thread)->pc - 1] == SET_LOCAL) ?
+            uint32_t local_idx = (op == SET_LOCAL) ?
             vm_read_u32(thread, program, &(*thread)->pc) :
             program->prog[(*thread)->pc++];
 
@@ -945,10 +1062,150 @@ void vm_step(vm_thread_t **thread, vm_program_t *program) {
 
     (*thread)->indirect += ind_inc;
 
+    // interrupt and fuel: checked where a run may repeat code (not forward transfer or call)
+    if (((*thread)->pc <= op_pc || op == CALL) && err == VM_ERR_OK) {
+        if (atomic_load_explicit(&(*thread)->interrupt, memory_order_relaxed) != 0)
+            err = VM_ERR_INTERRUPTED;
+        else if ((*thread)->fuel != 0 && --(*thread)->fuel == 0)
+            err = VM_ERR_OUTOFFUEL;
+    }
+
     (*thread)->status = err;
     (*thread)->halted = (err != VM_ERR_OK);
 }
 
+#ifdef VM_ENABLE_STACK_GUARD
+static __thread vm_thread_t *vm_guard_thread = NULL;
+static __thread sigjmp_buf *vm_guard_jmp = NULL;
+static struct sigaction vm_guard_prev_action;
+static pthread_once_t vm_guard_once = PTHREAD_ONCE_INIT;
+
+// guard page hit by the thread running in vm_run: unwind it, anything else goes to the previous handler
+static void vm_guard_handler(int sig, siginfo_t *info, void *context) {
+    vm_thread_t *thread = vm_guard_thread;
+
+    if (thread != NULL && thread->stack_map != NULL) {
+        uint8_t *guard = (uint8_t*) thread->stack_map + thread->stack_map_size - sysconf(_SC_PAGESIZE);
+        if ((uint8_t*) info->si_addr >= guard && (uint8_t*) info->si_addr < (uint8_t*) thread->stack_map + thread->stack_map_size)
+            siglongjmp(*vm_guard_jmp, 1);
+    }
+
+    if (vm_guard_prev_action.sa_flags & SA_SIGINFO)
+        vm_guard_prev_action.sa_sigaction(sig, info, context);
+    else if (vm_guard_prev_action.sa_handler != SIG_DFL && vm_guard_prev_action.sa_handler != SIG_IGN)
+        vm_guard_prev_action.sa_handler(sig);
+    else
+        signal(sig, SIG_DFL); // faulting instruction is retried and gets the default action
+}
+
+static void vm_guard_install(void) {
+    struct sigaction action = { 0 };
+
+    action.sa_sigaction = vm_guard_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &vm_guard_prev_action);
+}
+
+static uint8_t* vm_guard_stack_map(uint32_t stack_size, size_t *map_size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t stack_bytes = stack_size * sizeof(vm_value_t);
+
+    *map_size = ((stack_bytes + page - 1) / page + 1) * page;
+    uint8_t *map = mmap(NULL, *map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return NULL;
+    // without the guard page an overflow would not trap: the caller keeps the stack inline
+    if (mprotect(map + *map_size - page, page, PROT_NONE) != 0) {
+        munmap(map, *map_size);
+        return NULL;
+    }
+    pthread_once(&vm_guard_once, vm_guard_install);
+
+    return map;
+}
+#endif
+
+vm_errors_t vm_run(vm_thread_t **thread, vm_program_t *program) {
+#ifdef VM_ENABLE_STACK_GUARD
+    vm_thread_t *prev_thread = vm_guard_thread;
+    sigjmp_buf *prev_jmp = vm_guard_jmp;
+    sigjmp_buf jmp;
+
+    if ((*thread)->stack_map != NULL) {
+        if (sigsetjmp(jmp, 1) != 0) {
+            if ((*thread)->sp > (*thread)->stack_size)
+                (*thread)->sp = (*thread)->stack_size;
+            (*thread)->status = VM_ERR_OVERFLOW;
+            (*thread)->halted = true;
+            vm_guard_thread = prev_thread;
+            vm_guard_jmp = prev_jmp;
+            return VM_ERR_OVERFLOW;
+        }
+        vm_guard_thread = *thread;
+        vm_guard_jmp = &jmp;
+    }
+#endif
+
+    if (program->globals_qty > (*thread)->globals->global_vars_size && ((*thread)->status = vm_globals_reserve(thread, program->globals_qty)) != VM_ERR_OK)
+        (*thread)->halted = true;
+
+    while ((*thread)->pc < program->prog_len && (*thread)->halted == false)
+        vm_step(thread, program);
+
+#ifdef VM_ENABLE_STACK_GUARD
+    vm_guard_thread = prev_thread;
+    vm_guard_jmp = prev_jmp;
+#endif
+
+    return (*thread)->status;
+}
+
+uint32_t vm_suspend(vm_thread_t **thread) {
+    if (++(*thread)->pending_seq == 0)
+        ++(*thread)->pending_seq;
+    (*thread)->pending = (*thread)->pending_seq;
+
+    return (*thread)->pending;
+}
+
+void vm_refuel(vm_thread_t **thread, uint32_t fuel) {
+    (*thread)->fuel = fuel;
+    if ((*thread)->status == VM_ERR_OUTOFFUEL) {
+        (*thread)->status = VM_ERR_OK;
+        (*thread)->halted = false;
+    }
+}
+
+void vm_interrupt(vm_thread_t **thread, uint32_t reason) {
+    atomic_store_explicit(&(*thread)->interrupt, reason, memory_order_release);
+}
+
+uint32_t vm_interrupt_clear(vm_thread_t **thread) {
+    uint32_t reason = atomic_exchange_explicit(&(*thread)->interrupt, 0, memory_order_acquire);
+
+    if ((*thread)->status == VM_ERR_INTERRUPTED) {
+        (*thread)->status = VM_ERR_OK;
+        (*thread)->halted = false;
+    }
+
+    return reason;
+}
+
+bool vm_resume(vm_thread_t **thread, uint32_t token, vm_value_t value) {
+    if (token == 0 || (*thread)->pending != token)
+        return false;
+
+    (*thread)->pending = 0;
+    (*thread)->ret_val = value;
+    if ((*thread)->status == VM_ERR_PENDING) {
+        (*thread)->status = VM_ERR_OK;
+        (*thread)->halted = false;
+    }
+
+    return true;
+}
+
 void* vm_alloc(size_t size, void *userdata) {
     void *ret = NULL;
 
@@ -965,22 +1222,271 @@ void* vm_alloc(size_t size, void *userdata) {
     return ret;
 }
 
-void vm_create_thread(vm_thread_t **thread) {
-    (*thread) = calloc(1, sizeof(vm_thread_t));
-    (*thread)->globals = calloc(1, sizeof(vm_globals_t));
-    (*thread)->stack = calloc(VM_THREAD_STACK_SIZE, sizeof(vm_value_t));
+void vm_create_thread(vm_thread_t **thread, const vm_thread_config_t *config) {
+    uint32_t stack_size = VM_THREAD_STACK_SIZE;
+    uint32_t max_call_depth = VM_THREAD_MAX_CALL_DEPTH;
+    uint32_t frames_size = 0;
+
+    if (config != NULL) {
+        if (config->stack_size > 0)
+            stack_size = config->stack_size;
+        if (config->max_call_depth > 0)
+            max_call_depth = config->max_call_depth;
+        frames_size = config->frames_size;
+    }
+
+    // frame 0 is the main frame and push_frame needs one frame ahead
+    if (frames_size == 0 || frames_size > max_call_depth)
+        frames_size = max_call_depth;
+    ++frames_size;
+
+    // layout: thread | frames | stack | globals | frame_exist
+    size_t frames_pos = VM_ALIGN_BLOCK(sizeof(vm_thread_t));
+    size_t stack_pos = frames_pos + VM_ALIGN_BLOCK(frames_size * sizeof(vm_frame_t));
+    size_t stack_bytes = stack_size * sizeof(vm_value_t);
+#ifdef VM_ENABLE_STACK_GUARD
+    uint8_t *stack_map = NULL;
+    size_t stack_map_size = 0;
+    // mapped apart, the stack stays in the block if it can't be mapped
+    if (config != NULL && config->stack_guard && (stack_map = vm_guard_stack_map(stack_size, &stack_map_size)) != NULL)
+        stack_bytes = 0;
+#endif
+    size_t globals_pos = stack_pos + VM_ALIGN_BLOCK(stack_bytes);
+    size_t block_size = globals_pos + VM_ALIGN_BLOCK(sizeof(vm_globals_t));
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    size_t frame_exist_pos = block_size;
+    block_size += (ID_ALLOC_WORD(max_call_depth) + 1) * sizeof(uint32_t);
+#endif
+
+    uint8_t *block = calloc(1, block_size);
+    (*thread) = (vm_thread_t*) block;
+    if (block == NULL) {
+#ifdef VM_ENABLE_STACK_GUARD
+        if (stack_map != NULL)
+            munmap(stack_map, stack_map_size);
+#endif
+        return;
+    }
+    (*thread)->frames = (vm_frame_t*) (block + frames_pos);
+    (*thread)->frames_size = frames_size;
+    (*thread)->max_call_depth = max_call_depth;
+    (*thread)->stack = (vm_value_t*) (block + stack_pos);
+    (*thread)->stack_size = stack_size;
+    (*thread)->globals = (vm_globals_t*) (block + globals_pos);
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    (*thread)->frame_exist = (uint32_t*) (block + frame_exist_pos);
+#endif
+#ifdef VM_ENABLE_STACK_GUARD
+    if (stack_map != NULL) {
+        // stack end is the guard page start
+        (*thread)->stack_map = stack_map;
+        (*thread)->stack_map_size = stack_map_size;
+        (*thread)->stack = (vm_value_t*) (stack_map + stack_map_size - sysconf(_SC_PAGESIZE) - stack_size * sizeof(vm_value_t));
+    }
+#endif
     (*thread)->heap = vm_heap_create(1);
     (*thread)->globals->global_vars_qty = 0;
-    (*thread)->frames[0].gc_mark = vm_heap_new_gc_mark((*thread)->heap);
+    if ((*thread)->heap == NULL || ((*thread)->frames[0].gc_mark = vm_heap_new_gc_mark((*thread)->heap)) == NULL) {
+        if ((*thread)->heap != NULL)
+            vm_heap_destroy((*thread)->heap, thread);
+#ifdef VM_ENABLE_STACK_GUARD
+        if (stack_map != NULL)
+            munmap(stack_map, stack_map_size);
+#endif
+        free(block);
+        (*thread) = NULL;
+        return;
+    }
+
+    if (config != NULL && config->intern_strings)
+        vm_intern_table(thread)->constants = true;
+}
+
+// free constant strings owned by live stack values (dropped values are already released)
+static void vm_release_stack(vm_thread_t **thread) {
+    for (uint32_t n = 0; n < (*thread)->sp; ++n)
+        if ((*thread)->stack[n].type == VM_VAL_CONST_STRING && !VM_CSTR_IS_PROGRAM((*thread)->stack[n]))
+            free(VM_CSTR_ADDR((*thread)->stack[n]));
+}
+
+void vm_thread_reset(vm_thread_t **thread) {
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    // fibers hold frames, stacks and heap references of this thread
+    if ((*thread)->fibers != NULL && (*thread)->fibers_destroy != NULL)
+        (*thread)->fibers_destroy(thread);
+#endif
+
+    // gc marks of frames left open by an unfinished run
+    for (uint32_t n = 1; n <= (*thread)->fc; n++)
+        free((*thread)->frames[n].gc_mark);
+
+    // finalize all live objects (static included) but keep heap capacity
+    vm_heap_gc_collect((*thread)->heap, &((*thread)->heap->allocated), false, thread, true);
+    memset((*thread)->frames[0].gc_mark, 0, VM_HEAP_MARK_WORDS * sizeof(uint32_t));
+
+    vm_release_stack(thread);
+    memset((*thread)->stack, 0, (*thread)->stack_size * sizeof(vm_value_t));
+
+    (*thread)->frames[0].pc = 0;
+    (*thread)->frames[0].fp = 0;
+    (*thread)->frames[0].locals = 0;
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    memset((*thread)->frame_exist, 0, (ID_ALLOC_WORD((*thread)->max_call_depth) + 1) * sizeof(uint32_t));
+#endif
+    vm_release_globals(thread);
+
+    // nothing references interned strings after stack, globals and heap (next program may be loaded in the same buffer)
+    vm_intern_reset(thread);
+
+    (*thread)->exit_value = 0;
+    (*thread)->status = VM_ERR_OK;
+    (*thread)->halted = false;
+    (*thread)->indirect = 0;
+    (*thread)->pc = 0;
+    (*thread)->fp = 0;
+    (*thread)->sp = 0;
+    (*thread)->fc = 0;
+    (*thread)->ret_val.type = VM_VAL_NULL;
+    (*thread)->pending = 0;
+    atomic_store_explicit(&(*thread)->interrupt, 0, memory_order_relaxed);
+}
+
+// value of src for the clone: owned strings are copied and interned strings are interned in the clone
+static void vm_clone_value(vm_thread_t **thread, vm_value_t *value, bool owned) {
+    if (value->type != VM_VAL_CONST_STRING)
+        return;
+
+    char *str = VM_CSTR_ADDR(*value);
+    if (VM_CSTR_IS_INTERNED(*value))
+        *value = vm_intern(thread, str, VM_INTERN_RECORD(str)->len);
+    else if (owned && !VM_CSTR_IS_PROGRAM(*value))
+        VM_CSTR_SET(*value, strdup(str), false);
+}
+
+// interned strings in heap values and array fields
+static void vm_clone_interned(vm_thread_t **thread) {
+    vm_heap_t *heap = (*thread)->heap;
+
+    for (uint32_t pos = 0; pos < heap->size; pos++) {
+        if (!vm_heap_isallocated(heap, pos))
+            continue;
+
+        if (heap->types[pos] == VM_VAL_GENERIC) {
+            vm_clone_value(thread, &heap->data[pos].value, false);
+        } else if (heap->types[pos] == VM_VAL_ARRAY) {
+            for (uint32_t n = 0; n < heap->data[pos].array.qty; n++) {
+                if (heap->data[pos].array.fields[n].type != VM_VAL_CONST_STRING || !VM_CSTR_IS_INTERNED(heap->data[pos].array.fields[n]))
+                    continue;
+                vm_heap_own(heap, pos);
+                vm_clone_value(thread, &heap->data[pos].array.fields[n], false);
+            }
+        }
+    }
+}
+
+vm_errors_t vm_thread_clone(vm_thread_t **thread, vm_thread_t *src) {
+    *thread = NULL;
+    if (src->fc != 0 || src->pending != 0)
+        return VM_ERR_FAIL;
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    if (src->fibers != NULL)
+        return VM_ERR_FAIL;
+#endif
+
+    vm_thread_config_t config = {
+            .stack_size = src->stack_size,
+            .max_call_depth = src->max_call_depth,
+            .frames_size = src->frames_size - 1,
+            .intern_strings = src->strings != NULL && src->strings->constants
+    };
+#ifdef VM_ENABLE_STACK_GUARD
+    config.stack_guard = src->stack_map != NULL;
+#endif
+    vm_create_thread(thread, &config);
+    if (*thread == NULL)
+        return VM_ERR_OUTOFMEMORY;
+
+    vm_heap_t *heap = vm_heap_clone(src->heap);
+    if (heap == NULL) {
+        vm_destroy_thread(thread);
+        *thread = NULL;
+        return VM_ERR_OUTOFMEMORY;
+    }
+    vm_heap_destroy((*thread)->heap, thread);
+    (*thread)->heap = heap;
+    (*thread)->externals = src->externals;
+    memcpy((*thread)->frames[0].gc_mark, src->frames[0].gc_mark, VM_HEAP_MARK_WORDS * sizeof(uint32_t));
+
+    // library objects are made owned by their library, each one is finalized only after
+    for (uint32_t pos = 0; pos < heap->size; pos++) {
+        if (!vm_heap_isallocated(heap, pos) || heap->types[pos] != VM_VAL_LIB_OBJ)
+            continue;
+
+        uint32_t lib_idx = heap->data[pos].lib_obj.lib_idx;
+        if (src->externals == NULL || lib_idx >= src->externals->lib_qty
+                || src->externals->lib[lib_idx](thread, VM_EDFAT_CLONE, lib_idx, pos) != VM_ERR_OK) {
+            vm_destroy_thread(thread);
+            *thread = NULL;
+            return VM_ERR_FAIL;
+        }
+        vm_wordpos_set_bit(heap->finalize, pos);
+    }
+
+    if (src->strings != NULL)
+        vm_clone_interned(thread);
+
+    if (src->globals->global_vars_qty > 0) {
+        if (vm_globals_reserve(thread, src->globals->global_vars_qty) != VM_ERR_OK) {
+            vm_destroy_thread(thread);
+            *thread = NULL;
+            return VM_ERR_OUTOFMEMORY;
+        }
+        memcpy((*thread)->globals->global_vars, src->globals->global_vars, src->globals->global_vars_qty * sizeof(vm_value_t));
+        (*thread)->globals->global_vars_qty = src->globals->global_vars_qty;
+        for (uint32_t n = 0; n < src->globals->global_vars_qty; n++)
+            vm_clone_value(thread, &(*thread)->globals->global_vars[n], true);
+    }
+
+    memcpy((*thread)->stack, src->stack, src->sp * sizeof(vm_value_t));
+    for (uint32_t n = 0; n < src->sp; n++)
+        vm_clone_value(thread, &(*thread)->stack[n], true);
+
+    (*thread)->frames[0] = (vm_frame_t ) { src->frames[0].pc, src->frames[0].fp, src->frames[0].locals, (*thread)->frames[0].gc_mark };
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    memcpy((*thread)->frame_exist, src->frame_exist, (ID_ALLOC_WORD(src->max_call_depth) + 1) * sizeof(uint32_t));
+#endif
+    (*thread)->exit_value = src->exit_value;
+    (*thread)->status = src->status;
+    (*thread)->halted = src->halted;
+    (*thread)->indirect = src->indirect;
+    (*thread)->pc = src->pc;
+    (*thread)->fp = src->fp;
+    (*thread)->sp = src->sp;
+    (*thread)->fuel = src->fuel;
+    (*thread)->parallel = src->parallel;
+    (*thread)->userdata = src->userdata;
+
+    return VM_ERR_OK;
 }
 
 void vm_destroy_thread(vm_thread_t **thread) {
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    // fibers hold frames, stacks and heap references of this thread
+    if ((*thread)->fibers != NULL && (*thread)->fibers_destroy != NULL)
+        (*thread)->fibers_destroy(thread);
+#endif
+
     vm_heap_gc_collect((*thread)->heap, &((*thread)->frames[0].gc_mark), true, thread, true);
     vm_heap_destroy((*thread)->heap, thread);
-    free((*thread)->globals);
-    for (uint32_t n = 0; n < VM_THREAD_STACK_SIZE; ++n)
-        if ((*thread)->stack[n].type == VM_VAL_CONST_STRING && (*thread)->stack[n].cstr.is_program == false)
-            free((*thread)->stack[n].cstr.addr);
-    free((*thread)->stack);
+    vm_release_stack(thread);
+    vm_release_globals(thread);
+    free((*thread)->globals->global_vars);
+    vm_intern_destroy(thread);
+    if ((uint8_t*) (*thread)->frames != (uint8_t*) (*thread) + VM_ALIGN_BLOCK(sizeof(vm_thread_t)))
+        free((*thread)->frames);
+#ifdef VM_ENABLE_STACK_GUARD
+    if ((*thread)->stack_map != NULL)
+        munmap((*thread)->stack_map, (*thread)->stack_map_size);
+#endif
     free((*thread));
 }
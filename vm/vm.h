@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdatomic.h>
 
 #define COMPILER_VERSION_MAYOR 4 // indicate a really big change that can cause a lot of incompatibilities with previous versions
 #define COMPILER_VERSION_MINOR 0 // indicate some change on API or opcode
@@ -31,7 +32,7 @@
 
 /**
  * @def VM_THREAD_STACK_SIZE
- * @brief Maximum stack size
+ * @brief Default stack size (see vm_thread_config_t)
  *
  */
 #ifndef VM_THREAD_STACK_SIZE
@@ -40,7 +41,7 @@
 
 /**
  * @def VM_THREAD_MAX_CALL_DEPTH
- * @brief Maximum call depth
+ * @brief Default maximum call depth (see vm_thread_config_t)
  *
  */
 #ifndef VM_THREAD_MAX_CALL_DEPTH
@@ -48,18 +49,27 @@
 #endif
 
 /**
- * @def VM_MAX_HEAP
- * @brief Maximum heap objects
+ * @def VM_STACK_HEADROOM
+ * @brief Free slots ensured before each instruction on growable stacks (fiber stacks)
  *
  */
-#define VM_MAX_HEAP 128
+#define VM_STACK_HEADROOM 8
 
 /**
  * @def VM_MAX_GLOBAL_VARS
- * @brief Maximum global variables
+ * @brief Maximum global variables (SET_GLOBAL over it ends with VM_ERR_OUTOFRANGE)
+ *
+ */
+#ifndef VM_MAX_GLOBAL_VARS
+#define VM_MAX_GLOBAL_VARS 65536
+#endif
+
+/**
+ * @def VM_MAX_HEAP
+ * @brief Maximum heap objects
  *
  */
-#define VM_MAX_GLOBAL_VARS 128
+#define VM_MAX_HEAP 128
 
 /**
  * @def VM_HEAP_SHRINK_AFTER_GC
@@ -82,6 +92,20 @@
  */
 #define VM_ENABLE_FRAMES_ALIVE
 
+/**
+ * @def VM_ENABLE_STACK_GUARD
+ * @brief Enable guard page protected stacks (vm_thread_config_t.stack_guard, detected in vm_run)
+ *
+ */
+#define VM_ENABLE_STACK_GUARD
+
+/**
+ * @def VM_VALUE_COMPACT
+ * @brief Pack vm_value_t type and payload in 64 bits (access strings with VM_CSTR_* macros)
+ *
+ */
+//#define VM_VALUE_COMPACT
+
 ////////////// END VM CONFIGURATION //////////////
 
 ////////////////// word id ///////////////////////
@@ -98,6 +122,8 @@
 #define vm_wordpos_unset_bit(alloc_word, id)  alloc_word[ID_ALLOC_WORD(id)] = (CLR_BIT(alloc_word[ID_ALLOC_WORD(id)], ID_ALLOC_BIT(id)))
 #define vm_wordpos_isset_bit(alloc_word, id)  (GET_BIT(alloc_word[ID_ALLOC_WORD(id)], ID_ALLOC_BIT(id)) ? 1 : 0)
 
+#define VM_HEAP_MARK_WORDS  (ID_ALLOC_WORD(VM_MAX_HEAP - 1) + 1) /**< words of an allocation/gc mark (covers VM_MAX_HEAP objects) */
+
 //////////////////////////////////////////////////
 
 #define OP_MODIFIER(op)       (op & 0xc0)                         /**< indirect argument */
@@ -120,9 +146,9 @@
         STK_TOP(thread) = __tmp_swap__;
 
  /**< (internal util) free cstr on stack */
-#define STK_FREECSTR(thread, pos)                                            \
-        if (pos.type == VM_VAL_CONST_STRING && pos.cstr.is_program == false) \
-            free(pos.cstr.addr)
+#define STK_FREECSTR(thread, pos)                                       \
+        if (pos.type == VM_VAL_CONST_STRING && !VM_CSTR_IS_PROGRAM(pos)) \
+            free(VM_CSTR_ADDR(pos))
 
  /**< drop top of stack */
 #define STK_DROP(thread)                       \
@@ -237,6 +263,9 @@ typedef enum VM_ERRORS {
     VM_ERR_HEAPNOTEXIST,   /**< referenced heap not used or not exist */
     VM_ERR_INDUNDERZERO,   /**< indirect register has been decremented under zero */
     VM_ERR_OVERFLOW,       /**< overflow */
+    VM_ERR_PENDING,        /**< foreign call pending, continue after vm_resume */
+    VM_ERR_OUTOFFUEL,      /**< fuel exhausted, continue after vm_refuel */
+    VM_ERR_INTERRUPTED,    /**< interrupted by vm_interrupt, continue after vm_interrupt_clear */
     //[...]//
     VM_ERR_FAIL            /**< generic fail */
 } vm_errors_t;
@@ -260,15 +289,19 @@ typedef enum VM_VALUE_TYPE {
 } vm_value_type_t;
 
 typedef enum VM_EXTERNAL_DATA_FUNCTION_ARG_TYPE {
-    VM_EDFAT_NEW = 0xfa,  /**< VM_EDFAT_NEW */
+    VM_EDFAT_NEW = 0xf8,  /**< VM_EDFAT_NEW */
     VM_EDFAT_PUSH,        /**< VM_EDFAT_PUSH */
     VM_EDFAT_CMP,         /**< VM_EDFAT_CMP */
     VM_EDFAT_GC,          /**< VM_EDFAT_GC */
     VM_EDFAT_TOTYPE,      /**< VM_EDFAT_TOTYPE */
+    VM_EDFAT_CLONE,       /**< VM_EDFAT_CLONE (object arg of a cloned heap still holds the source payload: make it owned) */
+    VM_EDFAT_SERIALIZE,   /**< VM_EDFAT_SERIALIZE (write payload of object arg with vm_snapshot_write) */
+    VM_EDFAT_DESERIALIZE, /**< VM_EDFAT_DESERIALIZE (rebuild payload of object arg with vm_snapshot_read) */
 } vm_edf_arg_type_t;
 
 typedef struct vm_thread_s vm_thread_t;
 
+#ifndef VM_VALUE_COMPACT
 /**
  * @struct vm_value_s
  * @brief VM values
@@ -291,13 +324,78 @@ typedef struct vm_value_s {
         } lib_obj;
 
         struct {
-              bool is_program; /**< is a reference to constant in program area */
-              char *addr;      /**< VM_VAL_CONST_STRING */
+              bool is_program;  /**< is a reference to constant in program area */
+              bool is_interned; /**< is an interned string (see vm_intern) */
+              char *addr;       /**< VM_VAL_CONST_STRING */
         } cstr;
           uint32_t heap_ref;   /**< VM_VAL_HEAP_REF */
     };
 } vm_value_t;
 
+#define VM_CSTR_ADDR(v)        ((v).cstr.addr)        /**< VM_VAL_CONST_STRING address */
+#define VM_CSTR_IS_PROGRAM(v)  ((v).cstr.is_program)  /**< VM_VAL_CONST_STRING is a reference to constant in program area */
+#define VM_CSTR_IS_INTERNED(v) ((v).cstr.is_interned) /**< VM_VAL_CONST_STRING is interned (not owned, unique address) */
+
+ /**< set VM_VAL_CONST_STRING address and owner (type not changed) */
+#define VM_CSTR_SET(v, address, program) \
+        ((v).cstr.addr = (address), (v).cstr.is_program = (program), (v).cstr.is_interned = false)
+
+ /**< set VM_VAL_CONST_STRING interned address (type not changed) */
+#define VM_CSTR_SET_INTERNED(v, address) \
+        ((v).cstr.addr = (address), (v).cstr.is_program = true, (v).cstr.is_interned = true)
+#else
+/**
+ * @union vm_value_s
+ * @brief VM values (compact).
+ * Payloads are at most 32 bits, or a 48 bits user space address for strings, so type is a tag byte at the top of the word.
+ * Layout (little endian): bytes 0-3 payload, 4-5 lib_idx, 6 flags, 7 type. Strings: bits 0-47 address.
+ *
+ */
+typedef union vm_value_s {
+    uint64_t bits;                 /**< whole value */
+    struct {
+        union {
+            union {
+                    bool boolean;  /**< VM_VAL_BOOL */
+                 int32_t integer;  /**< VM_VAL_INT */
+                uint32_t uinteger; /**< VM_VAL_UINT */
+                   float real;     /**< VM_VAL_FLOAT */
+                 uint8_t byte[4];  /**< for serialize */
+            } number;
+            uint32_t heap_ref;     /**< VM_VAL_HEAP_REF */
+        };
+        uint16_t lib_idx_;         /**< (internal) storage of lib_obj.lib_idx */
+         uint8_t flags;            /**< VM_VALUE_FLAG_* */
+         uint8_t type;             /**< value type (vm_value_type_t) */
+    };
+    struct __attribute__((packed)) {
+        uint32_t heap_ref;         /**< library object reference */
+        uint16_t lib_idx;          /**< library entry function */
+    } lib_obj;
+} vm_value_t;
+
+#define VM_VALUE_FLAG_PROGRAM  0x01              /**< VM_VAL_CONST_STRING is a reference to constant in program area */
+#define VM_VALUE_FLAG_INTERNED 0x02              /**< VM_VAL_CONST_STRING is interned */
+#define VM_VALUE_ADDR_MASK     0xffffffffffffULL /**< VM_VAL_CONST_STRING address bits */
+
+#define VM_CSTR_ADDR(v)        ((char*) (uintptr_t) ((v).bits & VM_VALUE_ADDR_MASK)) /**< VM_VAL_CONST_STRING address */
+#define VM_CSTR_IS_PROGRAM(v)  (((v).flags & VM_VALUE_FLAG_PROGRAM) != 0)            /**< VM_VAL_CONST_STRING is a reference to constant in program area */
+#define VM_CSTR_IS_INTERNED(v) (((v).flags & VM_VALUE_FLAG_INTERNED) != 0)           /**< VM_VAL_CONST_STRING is interned (not owned, unique address) */
+
+ /**< (internal) set VM_VAL_CONST_STRING address and flags */
+#define VM_CSTR_SET_FLAGS(v, address, _flags)                                                          \
+        ((v).bits = ((v).bits & ~(VM_VALUE_ADDR_MASK | ((uint64_t) 0xff << 48))) | (uintptr_t) (address) \
+                  | ((uint64_t) (_flags) << 48))
+
+ /**< set VM_VAL_CONST_STRING address and owner (type not changed) */
+#define VM_CSTR_SET(v, address, program) VM_CSTR_SET_FLAGS(v, address, (program) ? VM_VALUE_FLAG_PROGRAM : 0)
+
+ /**< set VM_VAL_CONST_STRING interned address (type not changed) */
+#define VM_CSTR_SET_INTERNED(v, address) VM_CSTR_SET_FLAGS(v, address, VM_VALUE_FLAG_PROGRAM | VM_VALUE_FLAG_INTERNED)
+
+_Static_assert(sizeof(vm_value_t) == 8, "compact vm_value_t must be 8 bytes");
+#endif
+
 /**
  * @fn vm_value_t (*vm_foreign_function_t)(vm_state_thread_t **thread, uint8_t fn, uint32_t arg)
  * @brief Foreign function prototype
@@ -324,6 +422,7 @@ typedef vm_errors_t (*lib_entry)(vm_thread_t **thread, uint8_t call_type, uint32
 typedef struct vm_program_s {
     uint8_t *prog;              /**< program */
    uint32_t prog_len;           /**< program length */
+   uint32_t globals_qty;        /**< global vars used by program (slots reserved by vm_run, 0: grow on demand) */
 } vm_program_t;
 
 /**
@@ -351,68 +450,155 @@ typedef struct vm_frame_s {
 
 
 typedef struct vm_globals_s {
-    uint32_t global_vars[VM_MAX_GLOBAL_VARS]; /**< global vars (frame 0 heap indexes) */
-    uint32_t global_vars_qty;                 /**< global vars quantity */
+    vm_value_t *global_vars;      /**< global vars slots */
+      uint32_t global_vars_qty;   /**< global vars quantity (highest set index + 1) */
+      uint32_t global_vars_size;  /**< allocated slots */
 } vm_globals_t;
 
 /**
- * @struct vm_heap_object_s
- * @brief VM heap objects
+ * @struct vm_intern_s
+ * @brief Interned string record
  *
  */
-typedef struct vm_heap_object_s {
-    vm_value_type_t type;       /**< value type */
-    bool static_obj;            /**< static data. Not GC */
+typedef struct vm_intern_s {
+    uint32_t hash;  /**< cached hash (vm_string_hash) */
+    uint32_t len;   /**< length */
+        char str[]; /**< string (null terminated) */
+} vm_intern_t;
 
-    union {
-        vm_value_t value;       /**< generic value */
+#define VM_INTERN_RECORD(addr) ((vm_intern_t*) ((addr) - offsetof(vm_intern_t, str))) /**< record of an interned string address */
 
-        struct {
-               uint8_t qty;     /**< quantity */
-            vm_value_t *fields; /**< data */
-        } array;
+/**
+ * @struct vm_strings_s
+ * @brief Interned strings table
+ *
+ */
+typedef struct vm_strings_s {
+      vm_intern_t **table;      /**< records (open addressing, power of 2 size) */
+         uint32_t size;         /**< table size */
+         uint32_t qty;          /**< records */
+             bool constants;    /**< intern PUSH_CONST_STRING constants */
+    const uint8_t *const_prog;  /**< program of constants cache */
+         uint32_t const_len;    /**< program length of constants cache */
+         uint32_t *const_pc;    /**< constants cache keys (constant address, 0xffffffff: empty) */
+      vm_intern_t **const_str;  /**< constants cache records */
+         uint32_t const_size;   /**< constants cache size */
+         uint32_t const_qty;    /**< constants cache entries */
+} vm_strings_t;
 
-        struct {
-            uint32_t identifier; /**< mark for identify library (only for use on library, not VM) */
-                void *addr;      /**< library obj reference */
-            uint32_t lib_idx;    /**< library entry function */
-        } lib_obj;
-    };
+/**
+ * @union vm_heap_object_u
+ * @brief VM heap objects payload (type and flags are kept apart in vm_heap_t)
+ *
+ */
+typedef union vm_heap_object_u {
+    vm_value_t value;           /**< generic value */
+
+    struct {
+           uint8_t qty;         /**< quantity */
+        vm_value_t *fields;     /**< data */
+    } array;
+
+    struct {
+        union {
+            void *addr;         /**< library obj reference */
+            char data[sizeof(void*)]; /**< library obj inline data (small objects, in place of addr) */
+        };
+        uint32_t identifier;    /**< mark for identify library (only for use on library, not VM) */
+        uint32_t lib_idx;       /**< library entry function */
+    } lib_obj;
 } vm_heap_object_t;
 
+/**
+ * @struct vm_heap_image_s
+ * @brief Payloads (array fields and owned strings) shared by a heap and its clones.
+ * Freed with the last heap that references it.
+ *
+ */
+typedef struct vm_heap_image_s {
+    _Atomic uint32_t refs;    /**< heaps */
+         atomic_flag lock;    /**< protect buffers (heaps sharing the image may be cloned from different OS threads) */
+               void **buffers; /**< payloads */
+            uint32_t qty;     /**< payloads quantity */
+            uint32_t size;    /**< allocated payloads */
+                void *map;     /**< snapshot holding payloads of a restored heap (NULL: none, see vm_restore) */
+              size_t map_size; /**< snapshot mapping size (0: read in an allocated buffer) */
+} vm_heap_image_t;
+
 /**
  * @struct vm_heap_s
  * @brief VM heap structure
  *
  */
 typedef struct vm_heap_s {
-            uint32_t *allocated; /**< mark allocated data */
-            uint32_t size;       /**< size of data heap */
-    vm_heap_object_t *data;      /**< heap data */
+            uint32_t *allocated;   /**< mark allocated data */
+            uint32_t size;         /**< size of data heap */
+            uint32_t *statics;     /**< mark static objects (not GC) */
+            uint32_t *finalize;    /**< mark objects that need release on GC (library, array, owned string) */
+            uint32_t *shared;      /**< mark objects whose payload belongs to image (copied on write, never freed by GC) */
+     vm_heap_image_t *image;       /**< shared payloads (NULL: never cloned) */
+             uint8_t *types;       /**< objects type (vm_value_type_t) */
+    vm_heap_object_t *data;        /**< heap data */
+    vm_heap_object_t null_object;  /**< returned by vm_heap_load for positions not allocated */
 } vm_heap_t;
 
+/**
+ * @struct vm_thread_config_s
+ * @brief Thread creation parameters (zero fields take defaults)
+ *
+ */
+typedef struct vm_thread_config_s {
+    uint32_t stack_size;     /**< stack slots (default: VM_THREAD_STACK_SIZE) */
+    uint32_t max_call_depth; /**< maximum call depth (default: VM_THREAD_MAX_CALL_DEPTH) */
+    uint32_t frames_size;    /**< preallocated frames, grow on demand up to max_call_depth (default: max_call_depth, not grow) */
+#ifdef VM_ENABLE_STACK_GUARD
+    bool     stack_guard;    /**< mmap stack followed by a PROT_NONE page, overflow is VM_ERR_OVERFLOW (unguarded stack if mmap or mprotect fails) */
+#endif
+    bool     intern_strings; /**< intern constant strings (equality by address) */
+} vm_thread_config_t;
+
 /**
  * @struct vm_thread_s
  * @brief VM main thread state
  *
  */
 typedef struct vm_thread_s {
-             uint8_t exit_value;                                             /**< exit value from HALT */
-         vm_errors_t status;                                                 /**< vm status */
-                bool halted;                                                 /**< vm is halted */
-            uint32_t indirect;                                               /**< indirect register */
-            uint32_t pc, fp, sp;                                             /**< program counter, frame pointer, stack pointer */
-          vm_value_t ret_val;                                                /**< return value from CALL / CALL_FOREIGN */
-            uint32_t fc;                                                     /**< frame counter */
-          vm_frame_t frames[VM_THREAD_MAX_CALL_DEPTH];                       /**< frames */
+             uint8_t exit_value;     /**< exit value from HALT */
+         vm_errors_t status;         /**< vm status */
+                bool halted;         /**< vm is halted */
+            uint32_t indirect;       /**< indirect register */
+            uint32_t pc, fp, sp;     /**< program counter, frame pointer, stack pointer */
+          vm_value_t ret_val;        /**< return value from CALL / CALL_FOREIGN */
+            uint32_t pending;        /**< token of the pending foreign call (0: none, see vm_suspend) */
+            uint32_t pending_seq;    /**< last token given by vm_suspend */
+            uint32_t fuel;           /**< remaining fuel, one unit per backward jump or call (0: not metered, see vm_refuel) */
+    _Atomic uint32_t interrupt;      /**< interrupt reason set from any OS thread (0: none, see vm_interrupt) */
+            uint32_t fc;             /**< frame counter */
+          vm_frame_t *frames;        /**< frames */
+            uint32_t frames_size;    /**< allocated frames */
+            uint32_t max_call_depth; /**< maximum call depth */
 #ifdef VM_ENABLE_FRAMES_ALIVE
-            uint32_t frame_exist[((VM_THREAD_MAX_CALL_DEPTH - 1) / 32) + 1]; /**< frame exist (for fiber implementation) */
+            uint32_t *frame_exist;   /**< frame exist (for fiber implementation) */
+#endif
+          vm_value_t *stack;         /**< vm stack */
+            uint32_t stack_size;     /**< stack slots */
+#ifdef VM_ENABLE_FRAMES_ALIVE
+                bool stack_grow;     /**< stack is allocated apart and grows on demand (fiber stacks) */
+                void *fibers;        /**< fiber scheduler (see ffi_fiber, NULL: not used) */
+                void (*fibers_destroy)(vm_thread_t **thread); /**< release fibers (set with fibers, called by vm_thread_reset and vm_destroy_thread) */
+#endif
+#ifdef VM_ENABLE_STACK_GUARD
+                void *stack_map;     /**< guarded stack mapping (NULL: stack in thread block) */
+              size_t stack_map_size; /**< guarded stack mapping size (guard page included) */
 #endif
-          vm_value_t *stack;                                                 /**< vm stack */
-        vm_globals_t *globals;                                               /**< globals vars */
-           vm_heap_t *heap;                                                  /**< heap */
-         vm_ffilib_t *externals;                                             /**< external functions and libraries */
-                void *userdata;                                              /**< generic userdata pointer (not used in vm but useful for foreign functions) */
+        vm_globals_t *globals;       /**< globals vars */
+           vm_heap_t *heap;          /**< heap */
+         vm_ffilib_t *externals;     /**< external functions and libraries */
+        vm_strings_t *strings;       /**< interned strings (NULL: not used yet) */
+                void *async;         /**< event loop script (see ffi_async, NULL: not used) */
+                void *parallel;      /**< pool of child threads (see ffi_parallel, NULL: not used) */
+                void *shared;        /**< shared global segment (see ffi_shared, NULL: not used) */
+                void *userdata;      /**< generic userdata pointer (not used in vm but useful for foreign functions) */
 } vm_thread_t;
 
 /////////////////// API ///////////////////
@@ -427,21 +613,122 @@ typedef struct vm_thread_s {
 void vm_step(vm_thread_t **thread, vm_program_t *program);
 
 /**
- * @fn void vm_create_thread(vm_state_thread_t **thread)
- * @brief Create new thread
+ * @fn vm_errors_t vm_run(vm_thread_t **thread, vm_program_t *program)
+ * @brief Execute until halt or program end.
+ * Stack overflows on guarded stacks end the run with VM_ERR_OVERFLOW.
+ *
+ * @param thread Thread
+ * @param program Program
+ * @return Status
+ */
+vm_errors_t vm_run(vm_thread_t **thread, vm_program_t *program);
+
+/**
+ * @fn uint32_t vm_suspend(vm_thread_t **thread)
+ * @brief Suspend the thread on the current foreign call.
+ * Called from a foreign function that can't complete now: its return value is ignored, the run ends with VM_ERR_PENDING
+ * and the next instruction runs after vm_resume with the given token.
  *
  * @param thread Thread
+ * @return Token of the pending call (never 0)
  */
-void vm_create_thread(vm_thread_t **thread);
+uint32_t vm_suspend(vm_thread_t **thread);
+
+/**
+ * @fn void vm_interrupt(vm_thread_t **thread, uint32_t reason)
+ * @brief Request the stop of a thread. Safe from any OS thread.
+ * Polled at the same points where fuel is charged: the run stops with VM_ERR_INTERRUPTED and state intact.
+ *
+ * @param thread Thread
+ * @param reason Reason (not 0)
+ */
+void vm_interrupt(vm_thread_t **thread, uint32_t reason);
+
+/**
+ * @fn uint32_t vm_interrupt_clear(vm_thread_t **thread)
+ * @brief Clear interrupt request. A thread stopped with VM_ERR_INTERRUPTED can run again.
+ *
+ * @param thread Thread
+ * @return Reason of the interrupt (0: none)
+ */
+uint32_t vm_interrupt_clear(vm_thread_t **thread);
+
+/**
+ * @fn bool vm_resume(vm_thread_t **thread, uint32_t token, vm_value_t value)
+ * @brief Complete a pending foreign call. Value goes to ret_val and the thread can run again (vm_run / vm_step).
+ *
+ * @param thread Thread
+ * @param token Token from vm_suspend
+ * @param value Result of the foreign call
+ * @return false if token is not the pending one
+ */
+bool vm_resume(vm_thread_t **thread, uint32_t token, vm_value_t value);
+
+/**
+ * @fn void vm_refuel(vm_thread_t **thread, uint32_t fuel)
+ * @brief Set fuel of thread. A thread stopped with VM_ERR_OUTOFFUEL can run again.
+ * Fuel is charged at control transfers that don't go forward (loops, returns to a lower address) and at calls,
+ * so any run that doesn't end is stopped. The run stops with VM_ERR_OUTOFFUEL after the instruction that spends the last unit.
+ *
+ * @param thread Thread
+ * @param fuel Fuel (0: not metered)
+ */
+void vm_refuel(vm_thread_t **thread, uint32_t fuel);
+
+/**
+ * @fn void vm_create_thread(vm_thread_t **thread, const vm_thread_config_t *config)
+ * @brief Create new thread.
+ * Thread state, stack, frames and globals are allocated in one contiguous block.
+ *
+ * @param thread Thread (NULL if the block can't be allocated)
+ * @param config Configuration (NULL: defaults)
+ */
+void vm_create_thread(vm_thread_t **thread, const vm_thread_config_t *config);
 
 /**
  * @fn void vm_destroy_thread(vm_state_thread_t **thread))
- * @brief Destroy thread
+ * @brief Destroy thread.
+ * Fibers are released here. Other extensions attached by the host are not: call ffi_shared_detach before
+ * (async and parallel pools are owned by the host).
  *
  * @param thread Thread
  */
 void vm_destroy_thread(vm_thread_t **thread);
 
+/**
+ * @fn void vm_thread_reset(vm_thread_t **thread)
+ * @brief Reset thread for a new run without reallocation.
+ * Fibers are released, live objects are finalized and stack, frames, globals, heap marks and interned strings are cleared.
+ * All buffers keep their actual capacity. An attached shared segment stays attached.
+ *
+ * @param thread Thread
+ */
+void vm_thread_reset(vm_thread_t **thread);
+
+/**
+ * @fn vm_errors_t vm_globals_reserve(vm_thread_t **thread, uint32_t qty)
+ * @brief Reserve global slots (grow geometrically, new slots are NULL)
+ *
+ * @param thread Thread
+ * @param qty Slots
+ * @return VM_ERR_OUTOFRANGE (over VM_MAX_GLOBAL_VARS), VM_ERR_OUTOFMEMORY or VM_ERR_OK
+ */
+vm_errors_t vm_globals_reserve(vm_thread_t **thread, uint32_t qty);
+
+/**
+ * @fn vm_errors_t vm_thread_clone(vm_thread_t **thread, vm_thread_t *src)
+ * @brief Create a thread with the state of src (typically after an init run): globals, stack, heap and registers.
+ * Heap payloads of arrays and owned strings are shared copy-on-write, library objects are copied by their library
+ * (VM_EDFAT_CLONE) and interned strings are interned again in the new thread.
+ * src must be stopped at top level (no open frames, pending call or fibers) and not run during the clone.
+ * Clone and src can then run on different OS threads. async and shared segments are not attached to the clone.
+ *
+ * @param thread Thread (NULL: fail)
+ * @param src Source thread
+ * @return Status (VM_ERR_FAIL: src can't be cloned or a library object fails, VM_ERR_OUTOFMEMORY)
+ */
+vm_errors_t vm_thread_clone(vm_thread_t **thread, vm_thread_t *src);
+
 /**
  * @fn void vm_push(vm_thread_t **thread, vm_value_t value)
  * @brief Push value
@@ -475,13 +762,14 @@ vm_errors_t vm_drop_n(vm_thread_t **thread, uint32_t qty);
  */
 
 /**
- * @fn void vm_push_frame(vm_thread_t **thread, uint8_t nargs)
+ * @fn bool vm_push_frame(vm_thread_t **thread, uint8_t nargs)
  * @brief Push frame (for call)
  *
  * @param thread Thread
  * @param nargs Number of values in stack passed as arguments in call
+ * @return false if frames can't grow (out of memory, thread unchanged)
  */
-void vm_push_frame(vm_thread_t **thread, uint8_t nargs);
+bool vm_push_frame(vm_thread_t **thread, uint8_t nargs);
 
 /**
  * @fn void vm_pop_frame(vm_thread_t **thread)
@@ -579,7 +867,7 @@ inline float vm_read_f32(vm_thread_t **thread, vm_program_t *program, uint32_t *
  * @brief Create heap
  *
  * @param size Initial preallocated data size
- * @return Heap
+ * @return Heap (NULL: fail)
  */
 vm_heap_t* vm_heap_create(uint32_t size);
 
@@ -593,15 +881,17 @@ vm_heap_t* vm_heap_create(uint32_t size);
 void vm_heap_destroy(vm_heap_t *heap, vm_thread_t **thread);
 
 /**
- * @fn uint32_t vm_heap_save(vm_heap_t *heap, vm_heap_object_t value, uint32_t **gc_mark)
+ * @fn uint32_t vm_heap_save(vm_heap_t *heap, vm_value_type_t type, bool static_obj, vm_heap_object_t value, uint32_t **gc_mark)
  * @brief Save new value in an empty space on heap
  *
  * @param heap Heap
+ * @param type Object type (VM_VAL_GENERIC, VM_VAL_ARRAY, VM_VAL_LIB_OBJ)
+ * @param static_obj Static data. Not GC
  * @param value Value
  * @param gc_mark Local gc allocated mark
- * @return
+ * @return Heap position (0xffffffff if full)
  */
-uint32_t vm_heap_save(vm_heap_t *heap, vm_heap_object_t value, uint32_t **gc_mark);
+uint32_t vm_heap_save(vm_heap_t *heap, vm_value_type_t type, bool static_obj, vm_heap_object_t value, uint32_t **gc_mark);
 
 /**
  * @fn vm_heap_object_t* vm_heap_load(vm_heap_t *heap, uint32_t pos)
@@ -613,9 +903,19 @@ uint32_t vm_heap_save(vm_heap_t *heap, vm_heap_object_t value, uint32_t **gc_mar
  */
 vm_heap_object_t* vm_heap_load(vm_heap_t *heap, uint32_t pos);
 
+/**
+ * @fn vm_value_type_t vm_heap_type(vm_heap_t *heap, uint32_t pos)
+ * @brief Retrieve heap object type
+ *
+ * @param heap Heap
+ * @param pos Heap position
+ * @return Type (VM_VAL_NULL if not allocated)
+ */
+vm_value_type_t vm_heap_type(vm_heap_t *heap, uint32_t pos);
+
 /**
  * @fn bool vm_heap_set(vm_heap_t*, vm_heap_object_t, uint32_t)
- * @brief Set value on occupied heap object
+ * @brief Set value on occupied heap object (type and static flag are kept)
  *
  * @param heap Heap
  * @param value Value
@@ -676,6 +976,33 @@ bool vm_heap_isstatic(vm_heap_t *heap, uint32_t pos);
  */
 void vm_heap_gc_collect(vm_heap_t *heap, uint32_t **gc_mark, bool free_mark, vm_thread_t **thread, bool full);
 
+/**
+ * @fn void vm_heap_retain(vm_thread_t **thread, uint32_t pos)
+ * @brief Take a heap object out of the frames gc (it is now owned by a library container). Static objects are ignored
+ *
+ * @param thread Thread
+ * @param pos Heap position
+ */
+void vm_heap_retain(vm_thread_t **thread, uint32_t pos);
+
+/**
+ * @fn void vm_heap_release(vm_thread_t **thread, uint32_t pos)
+ * @brief Give back a retained heap object to the gc of current frame
+ *
+ * @param thread Thread
+ * @param pos Heap position
+ */
+void vm_heap_release(vm_thread_t **thread, uint32_t pos);
+
+/**
+ * @fn void vm_heap_collect(vm_thread_t **thread, uint32_t pos)
+ * @brief Finalize and free a retained heap object now (owner container is being released)
+ *
+ * @param thread Thread
+ * @param pos Heap position
+ */
+void vm_heap_collect(vm_thread_t **thread, uint32_t pos);
+
 /**
  * @fn uint32_t* vm_heap_new_gc_mark(vm_heap_t *heap)
  * @brief Create new gc mark
@@ -692,6 +1019,227 @@ uint32_t* vm_heap_new_gc_mark(vm_heap_t *heap);
  */
 void vm_heap_shrink(vm_heap_t *heap);
 
+/**
+ * @fn vm_heap_t* vm_heap_clone(vm_heap_t *heap)
+ * @brief Copy of heap with the same positions. Array fields and owned strings are shared with heap through its image
+ * and copied on write (see vm_heap_own). Library objects keep the source payload and are not finalized until the
+ * library makes them owned (see VM_EDFAT_CLONE).
+ *
+ * @param heap Heap
+ * @return Heap (NULL: fail)
+ */
+vm_heap_t* vm_heap_clone(vm_heap_t *heap);
+
+/**
+ * @fn bool vm_heap_own(vm_heap_t *heap, uint32_t pos)
+ * @brief Copy payload of a shared object before a write
+ *
+ * @param heap Heap
+ * @param pos Position
+ * @return false if fail
+ */
+bool vm_heap_own(vm_heap_t *heap, uint32_t pos);
+
+////////////////// strings //////////////////
+
+/**
+ * @fn uint32_t vm_string_hash(const char *str, uint32_t len)
+ * @brief String hash (FNV-1a)
+ *
+ * @param str String
+ * @param len Length
+ * @return Hash
+ */
+uint32_t vm_string_hash(const char *str, uint32_t len);
+
+/**
+ * @fn vm_strings_t* vm_intern_table(vm_thread_t **thread)
+ * @brief Thread intern table (created on first use)
+ *
+ * @param thread Thread
+ * @return Intern table
+ */
+vm_strings_t* vm_intern_table(vm_thread_t **thread);
+
+/**
+ * @fn vm_value_t vm_intern(vm_thread_t **thread, const char *str, uint32_t len)
+ * @brief Intern string.
+ * Returns a VM_VAL_CONST_STRING owned by the thread intern table (alive until thread reset or destroy).
+ * Equal strings get the same address.
+ *
+ * @param thread Thread
+ * @param str String
+ * @param len Length
+ * @return Interned string value
+ */
+vm_value_t vm_intern(vm_thread_t **thread, const char *str, uint32_t len);
+
+/**
+ * @fn uint32_t vm_intern_hash(vm_value_t value)
+ * @brief Hash of a VM_VAL_CONST_STRING (cached if interned)
+ *
+ * @param value String value
+ * @return Hash
+ */
+uint32_t vm_intern_hash(vm_value_t value);
+
+/**
+ * @fn char* vm_intern_constant(vm_thread_t **thread, vm_program_t *program, uint32_t const_pc)
+ * @brief Interned address of a program string constant (cached by constant address).
+ * The cache is cleared when the program or its length changes and by vm_thread_reset:
+ * a program modified in place must be run after a reset.
+ *
+ * @param thread Thread
+ * @param program Program
+ * @param const_pc Constant address
+ * @return Interned string
+ */
+char* vm_intern_constant(vm_thread_t **thread, vm_program_t *program, uint32_t const_pc);
+
+/**
+ * @fn void vm_intern_reset(vm_thread_t **thread)
+ * @brief Free all interned strings and clear the constants cache (table capacity is kept)
+ *
+ * @param thread Thread
+ */
+void vm_intern_reset(vm_thread_t **thread);
+
+/**
+ * @fn void vm_intern_destroy(vm_thread_t **thread)
+ * @brief Release intern table
+ *
+ * @param thread Thread
+ */
+void vm_intern_destroy(vm_thread_t **thread);
+
+////////////////// snapshot //////////////////
+
+#define VM_SNAPSHOT_MAGIC   0x534d5653 /**< "SVMS" */
+#define VM_SNAPSHOT_VERSION 1          /**< format version (restore only accepts the same) */
+#define VM_SNAPSHOT_MAX_STACK      0x1000000 /**< maximum stack slots accepted by restore */
+#define VM_SNAPSHOT_MAX_CALL_DEPTH 0x100000  /**< maximum call depth accepted by restore */
+
+/**
+ * @struct vm_snapshot_header_s
+ * @brief Snapshot header. Sections follow at the given offsets (from header, 16 bytes aligned), in host layout:
+ * frames (vm_snapshot_frame_t, fc + 1), frame exist words, stack (sp values), globals (globals_qty values),
+ * heap marks (allocated, statics, finalize), heap types, heap data and payloads (array fields, strings, library records).
+ * Strings of values and heap payload references are stored as offsets (program strings: from program start).
+ *
+ */
+typedef struct vm_snapshot_header_s {
+    uint32_t magic;          /**< VM_SNAPSHOT_MAGIC */
+    uint16_t version;        /**< VM_SNAPSHOT_VERSION */
+     uint8_t value_size;     /**< sizeof(vm_value_t) (value layout) */
+     uint8_t object_size;    /**< sizeof(vm_heap_object_t) */
+    uint32_t mark_words;     /**< VM_HEAP_MARK_WORDS */
+    uint32_t prog_len;       /**< length of program */
+    uint32_t prog_hash;      /**< hash of program (vm_string_hash) */
+    uint32_t stack_size;     /**< thread configuration */
+    uint32_t max_call_depth; /**< thread configuration */
+    uint32_t frames_size;    /**< thread configuration */
+     uint8_t stack_guard;    /**< thread configuration */
+     uint8_t intern_strings; /**< thread configuration */
+     uint8_t exit_value;     /**< register */
+     uint8_t halted;         /**< register */
+    uint32_t status;         /**< register */
+    uint32_t indirect;       /**< register */
+    uint32_t pc, fp, sp, fc; /**< registers */
+    uint32_t fuel;           /**< register */
+    uint32_t globals_qty;    /**< globals */
+    uint32_t heap_size;      /**< heap objects */
+    uint32_t reserved;       /**< 0 */
+  vm_value_t ret_val;        /**< register */
+    uint64_t frames;         /**< offset of frames */
+    uint64_t frame_exist;    /**< offset of frame exist words */
+    uint64_t stack;          /**< offset of stack */
+    uint64_t globals;        /**< offset of globals */
+    uint64_t heap_marks;     /**< offset of heap marks */
+    uint64_t heap_types;     /**< offset of heap types */
+    uint64_t heap_data;      /**< offset of heap data */
+    uint64_t size;           /**< snapshot size */
+} vm_snapshot_header_t;
+
+/**
+ * @struct vm_snapshot_frame_s
+ * @brief Snapshot frame
+ *
+ */
+typedef struct vm_snapshot_frame_s {
+    uint32_t pc, fp;                        /**< program counter, frame pointer */
+    uint32_t locals;                        /**< number of locals */
+    uint32_t gc_mark[VM_HEAP_MARK_WORDS];   /**< gc mark */
+} vm_snapshot_frame_t;
+
+/**
+ * @fn vm_errors_t vm_snapshot(vm_thread_t **thread, vm_program_t *program, int fd)
+ * @brief Write the state of thread (registers, frames, stack, globals and heap) to fd from its current position.
+ * Library objects are written by their library (VM_EDFAT_SERIALIZE).
+ * Thread must be stopped inside the program without a pending call or fibers. async, parallel, shared and userdata are not saved.
+ *
+ * @param thread Thread
+ * @param program Program run by thread
+ * @param fd File descriptor
+ * @return Status (VM_ERR_FAIL: thread can't be saved or write error)
+ */
+vm_errors_t vm_snapshot(vm_thread_t **thread, vm_program_t *program, int fd);
+
+/**
+ * @fn vm_errors_t vm_restore(vm_thread_t **thread, vm_program_t *program, vm_ffilib_t *externals, int fd)
+ * @brief Create a thread with the state saved by vm_snapshot at the current position of fd, for the same program.
+ * The snapshot is mapped (private) and array fields and owned heap strings are used in place (copied on write,
+ * see vm_heap_own). Library objects are rebuilt by their library (VM_EDFAT_DESERIALIZE), interned strings are interned again.
+ *
+ * @param thread Thread (NULL: fail)
+ * @param program Program (same that the saved one)
+ * @param externals External functions and libraries
+ * @param fd File descriptor
+ * @return Status (VM_ERR_FAIL: bad snapshot (sizes, registers, frames or strings out of range) or other program or layout, VM_ERR_OUTOFMEMORY)
+ */
+vm_errors_t vm_restore(vm_thread_t **thread, vm_program_t *program, vm_ffilib_t *externals, int fd);
+
+/**
+ * @fn bool vm_snapshot_write(vm_thread_t **thread, const void *data, uint32_t len)
+ * @brief Append data to the record of the library object in VM_EDFAT_SERIALIZE
+ *
+ * @param thread Thread
+ * @param data Data
+ * @param len Length
+ * @return false if fail
+ */
+bool vm_snapshot_write(vm_thread_t **thread, const void *data, uint32_t len);
+
+/**
+ * @fn bool vm_snapshot_write_value(vm_thread_t **thread, vm_value_t value)
+ * @brief Append a value to the record of the library object in VM_EDFAT_SERIALIZE (strings included)
+ *
+ * @param thread Thread
+ * @param value Value
+ * @return false if fail
+ */
+bool vm_snapshot_write_value(vm_thread_t **thread, vm_value_t value);
+
+/**
+ * @fn const void* vm_snapshot_read(vm_thread_t **thread, uint32_t len)
+ * @brief Next data of the record of the library object in VM_EDFAT_DESERIALIZE (not aligned, valid during the call)
+ *
+ * @param thread Thread
+ * @param len Length
+ * @return Data (NULL: beyond record)
+ */
+const void* vm_snapshot_read(vm_thread_t **thread, uint32_t len);
+
+/**
+ * @fn bool vm_snapshot_read_value(vm_thread_t **thread, vm_value_t *value)
+ * @brief Next value of the record of the library object in VM_EDFAT_DESERIALIZE.
+ * Owned strings are allocated (owned by caller), interned strings are interned in thread.
+ *
+ * @param thread Thread
+ * @param value Value
+ * @return false if fail
+ */
+bool vm_snapshot_read_value(vm_thread_t **thread, vm_value_t *value);
+
 ///////////////////////////////////////////
 
 #endif /* VM_H */
@@ -0,0 +1,387 @@
+/*
+ * @vm_executor.c
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "vm.h"
+#include "vm_executor.h"
+
+// worker running on this OS thread (jobs submitted from a job go to its own deque)
+static __thread vm_executor_worker_t *vm_executor_current = NULL;
+
+///// deque /////
+static vm_executor_ring_t* vm_executor_ring_create(int64_t size) {
+    vm_executor_ring_t *ring = malloc(sizeof(vm_executor_ring_t) + size * sizeof(_Atomic(vm_job_t*)));
+    if (ring == NULL)
+        return NULL;
+
+    ring->size = size;
+    ring->prev = NULL;
+
+    return ring;
+}
+
+static bool vm_executor_deque_init(vm_executor_deque_t *deque) {
+    vm_executor_ring_t *ring = vm_executor_ring_create(VM_EXECUTOR_DEQUE_SIZE);
+
+    atomic_init(&deque->top, 0);
+    atomic_init(&deque->bottom, 0);
+    atomic_init(&deque->ring, ring);
+
+    return ring != NULL;
+}
+
+static void vm_executor_deque_destroy(vm_executor_deque_t *deque) {
+    vm_executor_ring_t *ring = atomic_load_explicit(&deque->ring, memory_order_relaxed);
+
+    while (ring != NULL) {
+        vm_executor_ring_t *prev = ring->prev;
+        free(ring);
+        ring = prev;
+    }
+}
+
+// owner only
+static bool vm_executor_deque_push(vm_executor_deque_t *deque, vm_job_t *job) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    vm_executor_ring_t *ring = atomic_load_explicit(&deque->ring, memory_order_relaxed);
+
+    if (bottom - top > ring->size - 1) {
+        vm_executor_ring_t *grown = vm_executor_ring_create(ring->size * 2);
+        if (grown == NULL)
+            return false;
+
+        for (int64_t n = top; n < bottom; n++)
+            atomic_store_explicit(&grown->jobs[n & (grown->size - 1)],
+                    atomic_load_explicit(&ring->jobs[n & (ring->size - 1)], memory_order_relaxed), memory_order_relaxed);
+        grown->prev = ring;
+        atomic_store_explicit(&deque->ring, grown, memory_order_release);
+        ring = grown;
+    }
+
+    atomic_store_explicit(&ring->jobs[bottom & (ring->size - 1)], job, memory_order_release);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+
+    return true;
+}
+
+// owner only
+static vm_job_t* vm_executor_deque_take(vm_executor_deque_t *deque) {
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    vm_executor_ring_t *ring = atomic_load_explicit(&deque->ring, memory_order_relaxed);
+    vm_job_t *job = NULL;
+
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top <= bottom) {
+        job = atomic_load_explicit(&ring->jobs[bottom & (ring->size - 1)], memory_order_acquire);
+        if (top == bottom) {
+            // last job: race with thieves
+            if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+                job = NULL;
+            atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        }
+    } else
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+
+    return job;
+}
+
+// any worker. NULL: empty or lost race
+static vm_job_t* vm_executor_deque_steal(vm_executor_deque_t *deque) {
+    int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+
+    if (top >= bottom)
+        return NULL;
+
+    vm_executor_ring_t *ring = atomic_load_explicit(&deque->ring, memory_order_acquire);
+    vm_job_t *job = atomic_load_explicit(&ring->jobs[top & (ring->size - 1)], memory_order_acquire);
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed))
+        return NULL;
+
+    return job;
+}
+
+///// injection queue /////
+static void vm_executor_inject(vm_executor_t *executor, vm_job_t *job) {
+    job->next = NULL;
+    if (executor->inject_tail != NULL)
+        executor->inject_tail->next = job;
+    else
+        executor->inject = job;
+    executor->inject_tail = job;
+    atomic_fetch_add(&executor->injected, 1);
+}
+
+static vm_job_t* vm_executor_uninject(vm_executor_t *executor) {
+    vm_job_t *job = NULL;
+
+    // count avoids the lock while empty
+    if (atomic_load_explicit(&executor->injected, memory_order_relaxed) == 0)
+        return NULL;
+
+    pthread_mutex_lock(&executor->lock);
+    job = executor->inject;
+    if (job != NULL) {
+        executor->inject = job->next;
+        if (executor->inject == NULL)
+            executor->inject_tail = NULL;
+        atomic_fetch_sub(&executor->injected, 1);
+    }
+    pthread_mutex_unlock(&executor->lock);
+
+    return job;
+}
+
+///// worker /////
+static vm_job_t* vm_executor_take(vm_executor_worker_t *worker) {
+    vm_executor_t *executor = worker->executor;
+    vm_job_t *job = vm_executor_deque_take(&worker->deque);
+
+    if (job == NULL)
+        job = vm_executor_uninject(executor);
+
+    for (uint32_t n = 1; job == NULL && n < executor->workers_qty; n++)
+        job = vm_executor_deque_steal(&executor->workers[(worker->index + n) % executor->workers_qty].deque);
+
+    if (job != NULL)
+        atomic_fetch_sub(&executor->queued, 1);
+
+    return job;
+}
+
+static void vm_executor_run(vm_executor_worker_t *worker, vm_job_t *job) {
+    vm_executor_t *executor = worker->executor;
+    vm_thread_t *thread = job->thread;
+    uint32_t turn = executor->slice;
+
+    if (job->fuel != 0 && (turn == 0 || job->fuel < turn))
+        turn = job->fuel;
+
+    // first turn: pooled thread of this worker (a new one if it was given to a preempted job)
+    if (thread == NULL) {
+        if (worker->thread == NULL)
+            vm_create_thread(&worker->thread, &executor->config);
+        thread = worker->thread;
+        worker->thread = NULL;
+        if (thread == NULL) {
+            job->status = VM_ERR_OUTOFMEMORY;
+            goto end;
+        }
+
+        thread->externals = job->externals;
+        for (uint8_t n = 0; n < job->args_qty && n < VM_EXECUTOR_ARGS; n++)
+            vm_push(&thread, job->args[n]);
+    }
+
+    vm_refuel(&thread, turn);
+    job->status = vm_run(&thread, job->program);
+
+    // preempted: the job keeps its thread (stack, heap, fibers) and continues on any worker
+    if (job->status == VM_ERR_OUTOFFUEL && (job->fuel == 0 || (job->fuel -= turn) != 0)) {
+        job->thread = thread;
+        pthread_mutex_lock(&executor->lock);
+        vm_executor_inject(executor, job);
+        atomic_fetch_add(&executor->queued, 1);
+        pthread_cond_signal(&executor->wake);
+        pthread_mutex_unlock(&executor->lock);
+        return;
+    }
+
+    job->exit_value = thread->exit_value;
+    job->ret_val = thread->ret_val;
+    if (job->done != NULL)
+        job->done(job, &thread);
+
+    vm_thread_reset(&thread);
+    job->thread = NULL;
+    if (worker->thread == NULL)
+        worker->thread = thread;
+    else
+        vm_destroy_thread(&thread);
+
+end:
+    pthread_mutex_lock(&executor->lock);
+    if (--executor->pending == 0)
+        pthread_cond_broadcast(&executor->idle);
+    pthread_mutex_unlock(&executor->lock);
+}
+
+static void* vm_executor_worker(void *arg) {
+    vm_executor_worker_t *worker = arg;
+    vm_executor_t *executor = worker->executor;
+    bool stop = false;
+
+    vm_executor_current = worker;
+    while (!stop) {
+        vm_job_t *job = vm_executor_take(worker);
+        if (job != NULL) {
+            vm_executor_run(worker, job);
+            continue;
+        }
+
+        pthread_mutex_lock(&executor->lock);
+        while (atomic_load(&executor->queued) == 0 && !executor->stop)
+            pthread_cond_wait(&executor->wake, &executor->lock);
+        stop = executor->stop && atomic_load(&executor->queued) == 0;
+        pthread_mutex_unlock(&executor->lock);
+    }
+    vm_executor_current = NULL;
+
+    return NULL;
+}
+
+/////////////////
+vm_executor_t* vm_executor_create(uint32_t workers, const vm_thread_config_t *config) {
+    vm_executor_t *executor = calloc(1, sizeof(vm_executor_t));
+    if (executor == NULL)
+        return NULL;
+
+    if (workers == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? cores : 1;
+    }
+    if (config != NULL)
+        executor->config = *config;
+
+    pthread_mutex_init(&executor->lock, NULL);
+    pthread_cond_init(&executor->wake, NULL);
+    pthread_cond_init(&executor->idle, NULL);
+    atomic_init(&executor->queued, 0);
+    atomic_init(&executor->injected, 0);
+
+    executor->workers = calloc(workers, sizeof(vm_executor_worker_t));
+    if (executor->workers == NULL) {
+        vm_executor_destroy(executor);
+        return NULL;
+    }
+
+    // workers steal from all queues: every one is ready before any starts
+    for (uint32_t n = 0; n < workers; n++) {
+        vm_executor_worker_t *worker = &executor->workers[n];
+        worker->executor = executor;
+        worker->index = n;
+        vm_create_thread(&worker->thread, &executor->config);
+        if (worker->thread == NULL || !vm_executor_deque_init(&worker->deque)) {
+            if (worker->thread != NULL)
+                vm_destroy_thread(&worker->thread);
+            vm_executor_deque_destroy(&worker->deque);
+            break;
+        }
+        ++executor->workers_qty;
+    }
+
+    for (uint32_t n = 0; n < executor->workers_qty; n++) {
+        if (pthread_create(&executor->workers[n].id, NULL, vm_executor_worker, &executor->workers[n]) != 0) {
+            // not started workers are dropped (their queues are empty)
+            uint32_t qty = executor->workers_qty;
+            executor->workers_qty = n;
+            for (uint32_t m = n; m < qty; m++) {
+                vm_destroy_thread(&executor->workers[m].thread);
+                vm_executor_deque_destroy(&executor->workers[m].deque);
+            }
+            break;
+        }
+    }
+
+    if (executor->workers_qty == 0) {
+        vm_executor_destroy(executor);
+        return NULL;
+    }
+
+    return executor;
+}
+
+bool vm_executor_submit(vm_executor_t *executor, vm_job_t *job) {
+    vm_executor_worker_t *worker = vm_executor_current;
+
+    job->thread = NULL;
+
+    // counted before push: a worker that takes it never sees queued under zero
+    pthread_mutex_lock(&executor->lock);
+    ++executor->pending;
+    atomic_fetch_add(&executor->queued, 1);
+    if (worker == NULL || worker->executor != executor) {
+        vm_executor_inject(executor, job);
+        pthread_cond_signal(&executor->wake);
+        pthread_mutex_unlock(&executor->lock);
+        return true;
+    }
+    pthread_mutex_unlock(&executor->lock);
+
+    // from a job: own deque, without lock (stolen by idle workers)
+    bool pushed = vm_executor_deque_push(&worker->deque, job);
+
+    pthread_mutex_lock(&executor->lock);
+    if (pushed)
+        pthread_cond_signal(&executor->wake);
+    else {
+        atomic_fetch_sub(&executor->queued, 1);
+        if (--executor->pending == 0)
+            pthread_cond_broadcast(&executor->idle);
+    }
+    pthread_mutex_unlock(&executor->lock);
+
+    return pushed;
+}
+
+void vm_executor_wait(vm_executor_t *executor) {
+    pthread_mutex_lock(&executor->lock);
+    while (executor->pending > 0)
+        pthread_cond_wait(&executor->idle, &executor->lock);
+    pthread_mutex_unlock(&executor->lock);
+}
+
+void vm_executor_destroy(vm_executor_t *executor) {
+    if (executor == NULL)
+        return;
+
+    vm_executor_wait(executor);
+
+    pthread_mutex_lock(&executor->lock);
+    executor->stop = true;
+    pthread_cond_broadcast(&executor->wake);
+    pthread_mutex_unlock(&executor->lock);
+
+    // workers steal from all queues until they end
+    for (uint32_t n = 0; n < executor->workers_qty; n++)
+        pthread_join(executor->workers[n].id, NULL);
+
+    // pooled thread is NULL if it was given to a preempted job and no other job followed
+    for (uint32_t n = 0; n < executor->workers_qty; n++) {
+        if (executor->workers[n].thread != NULL)
+            vm_destroy_thread(&executor->workers[n].thread);
+        vm_executor_deque_destroy(&executor->workers[n].deque);
+    }
+
+    pthread_cond_destroy(&executor->wake);
+    pthread_cond_destroy(&executor->idle);
+    pthread_mutex_destroy(&executor->lock);
+    free(executor->workers);
+    free(executor);
+}
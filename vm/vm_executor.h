@@ -0,0 +1,159 @@
+/*
+ * @vm_executor.h
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#ifndef VM_EXECUTOR_H
+#define VM_EXECUTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "vm.h"
+
+#define VM_EXECUTOR_ARGS       8   // maximum arguments of a job
+#define VM_EXECUTOR_DEQUE_SIZE 256 // initial jobs of a worker deque (grows on demand)
+
+typedef struct vm_job_s vm_job_t;
+
+/**
+ * @fn void (*vm_job_done_t)(vm_job_t *job, vm_thread_t **thread)
+ * @brief Job completion callback. Runs on the worker before its thread is reset, so values of the
+ * thread (stack, heap, strings) can be copied out.
+ *
+ * @param job Job (status, exit_value and ret_val are set)
+ * @param thread Thread that run the job
+ */
+typedef void (*vm_job_done_t)(vm_job_t *job, vm_thread_t **thread);
+
+/**
+ * @struct vm_job_s
+ * @brief Program run request
+ *
+ */
+struct vm_job_s {
+    vm_program_t *program;                 /**< program (shared between workers, never modified) */
+     vm_ffilib_t *externals;               /**< external functions and libraries */
+      vm_value_t args[VM_EXECUTOR_ARGS];   /**< arguments pushed on stack before run (numbers or program strings) */
+         uint8_t args_qty;                 /**< arguments quantity */
+        uint32_t fuel;                     /**< fuel of the run (0: not metered, see vm_refuel). Remaining fuel while preempted */
+   vm_job_done_t done;                     /**< completion callback (NULL: none, not called if no thread can be created) */
+            void *userdata;                /**< generic userdata pointer (for done) */
+     vm_errors_t status;                   /**< result: status */
+         uint8_t exit_value;               /**< result: exit value from HALT */
+      vm_value_t ret_val;                  /**< result: ret_val (heap references, owned and interned strings only valid in done) */
+     vm_thread_t *thread;                  /**< (internal) thread of a preempted job, moves with it to any worker */
+        vm_job_t *next;                    /**< (internal) next in injection queue */
+};
+
+/**
+ * @struct vm_executor_ring_s
+ * @brief Buffer of a worker deque. Replaced buffers are kept until destroy (a thief may still read them)
+ *
+ */
+typedef struct vm_executor_ring_s {
+                      int64_t size;  /**< slots (power of 2) */
+    struct vm_executor_ring_s *prev; /**< replaced buffer */
+           _Atomic(vm_job_t*) jobs[]; /**< slots */
+} vm_executor_ring_t;
+
+/**
+ * @struct vm_executor_deque_s
+ * @brief Chase-Lev work stealing deque. Owner pushes and takes at bottom without locks, other workers steal at top
+ * @see Correct and Efficient Work-Stealing for Weak Memory Models (Le, Pop, Cohen, Zappa Nardelli, 2013)
+ *
+ */
+typedef struct vm_executor_deque_s {
+             _Atomic int64_t top;    /**< steal position */
+             _Atomic int64_t bottom; /**< push / take position */
+    _Atomic(vm_executor_ring_t*) ring; /**< buffer */
+} vm_executor_deque_t;
+
+typedef struct vm_executor_s vm_executor_t;
+
+/**
+ * @struct vm_executor_worker_s
+ * @brief Worker: OS thread with its pooled vm thread and job queue
+ *
+ */
+typedef struct vm_executor_worker_s {
+          vm_executor_t *executor; /**< executor */
+               uint32_t index;     /**< worker index */
+              pthread_t id;        /**< OS thread */
+            vm_thread_t *thread;   /**< pooled thread (reset after each job, NULL: given to a preempted job) */
+    vm_executor_deque_t deque;     /**< jobs submitted from jobs of this worker */
+} vm_executor_worker_t;
+
+/**
+ * @struct vm_executor_s
+ * @brief Pool of workers running jobs.
+ * A worker takes from its deque, then from the injection queue (submits from outside and preempted jobs, FIFO),
+ * then steals from the other workers.
+ *
+ */
+struct vm_executor_s {
+    vm_executor_worker_t *workers;     /**< workers */
+                uint32_t workers_qty;  /**< workers quantity */
+      vm_thread_config_t config;       /**< configuration of pooled threads */
+                uint32_t slice;        /**< fuel of a job per turn (0: run to the end). Preempted jobs go to injection queue */
+         pthread_mutex_t lock;         /**< protect injection queue, counters and conditions */
+          pthread_cond_t wake;         /**< jobs queued */
+          pthread_cond_t idle;         /**< all jobs done */
+                vm_job_t *inject;      /**< injection queue head */
+                vm_job_t *inject_tail; /**< injection queue tail */
+        _Atomic uint32_t injected;     /**< jobs in injection queue */
+        _Atomic uint32_t queued;       /**< jobs in all queues */
+                uint32_t pending;      /**< jobs submitted and not done */
+                    bool stop;         /**< workers end */
+};
+
+/**
+ * @fn vm_executor_t* vm_executor_create(uint32_t workers, const vm_thread_config_t *config)
+ * @brief Create executor and start its workers
+ *
+ * @param workers Workers quantity (0: one per online core)
+ * @param config Configuration of pooled threads (NULL: defaults)
+ * @return Executor (NULL: fail)
+ */
+vm_executor_t* vm_executor_create(uint32_t workers, const vm_thread_config_t *config);
+
+/**
+ * @fn bool vm_executor_submit(vm_executor_t *executor, vm_job_t *job)
+ * @brief Queue a job. The job must stay valid until its completion
+ *
+ * @param executor Executor
+ * @param job Job
+ * @return false if fail
+ */
+bool vm_executor_submit(vm_executor_t *executor, vm_job_t *job);
+
+/**
+ * @fn void vm_executor_wait(vm_executor_t *executor)
+ * @brief Wait until all submitted jobs are done
+ *
+ * @param executor Executor
+ */
+void vm_executor_wait(vm_executor_t *executor);
+
+/**
+ * @fn void vm_executor_destroy(vm_executor_t *executor)
+ * @brief Wait all jobs, stop workers and destroy pooled threads
+ *
+ * @param executor Executor
+ */
+void vm_executor_destroy(vm_executor_t *executor);
+
+#endif /* VM_EXECUTOR_H */
@@ -20,50 +20,129 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "vm.h"
 
-vm_heap_object_t vm_heap_object_null = { VM_VAL_NULL };
+// objects owning memory that must be released on collection
+static inline bool vm_heap_need_finalize(vm_value_type_t type, vm_heap_object_t *value) {
+    return type == VM_VAL_LIB_OBJ || type == VM_VAL_ARRAY
+            || (type == VM_VAL_GENERIC && value->value.type == VM_VAL_CONST_STRING && !VM_CSTR_IS_PROGRAM(value->value));
+}
+
+// once per allocation: finalizers of containers may collect objects that reference back
+static void vm_heap_finalize(vm_heap_t *heap, uint32_t pos, vm_thread_t **thread) {
+    if (!vm_wordpos_isset_bit(heap->finalize, pos))
+        return;
+
+    vm_wordpos_unset_bit(heap->finalize, pos);
+
+    // payload belongs to image
+    if (vm_wordpos_isset_bit(heap->shared, pos)) {
+        vm_wordpos_unset_bit(heap->shared, pos);
+        return;
+    }
+
+    switch (heap->types[pos]) {
+        case VM_VAL_LIB_OBJ:
+            (*thread)->externals->lib[heap->data[pos].lib_obj.lib_idx](thread, VM_EDFAT_GC, heap->data[pos].lib_obj.lib_idx, pos);
+            break;
+        case VM_VAL_GENERIC:
+            free(VM_CSTR_ADDR(heap->data[pos].value));
+            break;
+        case VM_VAL_ARRAY:
+            free(heap->data[pos].array.fields);
+            break;
+        default:
+    }
+}
+
+static inline void vm_heap_image_lock(vm_heap_image_t *image) {
+    while (atomic_flag_test_and_set_explicit(&image->lock, memory_order_acquire))
+        ;
+}
+
+static inline void vm_heap_image_unlock(vm_heap_image_t *image) {
+    atomic_flag_clear_explicit(&image->lock, memory_order_release);
+}
+
+static void vm_heap_image_release(vm_heap_image_t *image) {
+    if (image == NULL || atomic_fetch_sub(&image->refs, 1) != 1)
+        return;
+
+    for (uint32_t n = 0; n < image->qty; n++)
+        free(image->buffers[n]);
+    free(image->buffers);
+    if (image->map != NULL && image->map_size > 0)
+        munmap(image->map, image->map_size);
+    else
+        free(image->map);
+    free(image);
+}
+
+// payload of an object that needs finalization (not library)
+static inline void* vm_heap_payload(vm_heap_t *heap, uint32_t pos) {
+    if (heap->types[pos] == VM_VAL_ARRAY)
+        return heap->data[pos].array.fields;
+
+    return VM_CSTR_ADDR(heap->data[pos].value);
+}
 
 vm_heap_t* vm_heap_create(uint32_t size) {
     if (size == 0)
         size = 1;
 
-    static vm_heap_t *heap;
-
-    heap = malloc(sizeof(vm_heap_t));
-    heap->allocated = calloc(((size - 1) / 32) + 1, sizeof(uint32_t));
+    vm_heap_t *heap = malloc(sizeof(vm_heap_t));
+    if (heap == NULL)
+        return NULL;
+    heap->allocated = calloc(VM_HEAP_MARK_WORDS, sizeof(uint32_t));
+    heap->statics = calloc(VM_HEAP_MARK_WORDS, sizeof(uint32_t));
+    heap->finalize = calloc(VM_HEAP_MARK_WORDS, sizeof(uint32_t));
+    heap->shared = calloc(VM_HEAP_MARK_WORDS, sizeof(uint32_t));
+    heap->image = NULL;
     heap->size = size;
+    heap->types = calloc(size, sizeof(uint8_t));
     heap->data = calloc(size, sizeof(vm_heap_object_t));
+    if (heap->allocated == NULL || heap->statics == NULL || heap->finalize == NULL || heap->shared == NULL || heap->types == NULL
+            || heap->data == NULL) {
+        free(heap->allocated);
+        free(heap->statics);
+        free(heap->finalize);
+        free(heap->shared);
+        free(heap->types);
+        free(heap->data);
+        free(heap);
+        return NULL;
+    }
+    memset(&heap->null_object, 0, sizeof(vm_heap_object_t));
+    heap->null_object.value.type = VM_VAL_NULL;
     return heap;
 }
 
 void vm_heap_destroy(vm_heap_t *heap, vm_thread_t **thread) {
     vm_heap_gc_collect(heap, &(heap->allocated), true, thread, true);
+    free(heap->statics);
+    free(heap->finalize);
+    free(heap->shared);
+    vm_heap_image_release(heap->image);
+    free(heap->types);
     free(heap->data);
     free(heap);
 }
 
-uint32_t vm_heap_save(vm_heap_t *heap, vm_heap_object_t value, uint32_t **gc_mark) {
+uint32_t vm_heap_save(vm_heap_t *heap, vm_value_type_t type, bool static_obj, vm_heap_object_t value, uint32_t **gc_mark) {
     uint32_t allocated_word = 0xffffffff;
     uint32_t vm_heap_pos = 0;
 
     // search free heap position
     while (++allocated_word <= ID_ALLOC_WORD(heap->size - 1)) {
-        if (heap->allocated[allocated_word] == 0xffffffff) { // block is fully allocated, try next
+        if (heap->allocated[allocated_word] == 0xffffffff) // block is fully allocated, try next
             continue;
-        } else {
-            for (uint8_t b = 0; b < 32; b++) {
-                if (!GET_BIT(heap->allocated[allocated_word], b)) {
-                    if (ID_POS(allocated_word, b) > heap->size - 1)
-                        goto grow;
-                    else {
-                        vm_heap_pos = ID_POS(allocated_word, b);
-                        goto save;
-                    }
-                }
-            }
-        }
+
+        vm_heap_pos = ID_POS(allocated_word, __builtin_ctz(~heap->allocated[allocated_word]));
+        if (vm_heap_pos > heap->size - 1)
+            goto grow;
+        goto save;
     }
 
 grow:
@@ -71,21 +150,26 @@ grow:
     if (heap->size + 1 > VM_MAX_HEAP)
         return 0xffffffff;
 
-    heap->data = realloc(heap->data, (++heap->size + 1) * sizeof(vm_heap_object_t));
-
-    if (ID_ALLOC_WORD(heap->size) == ID_ALLOC_WORD(heap->size) - ID_ALLOC_BIT(heap->size)) { // need more allocated positions
-        heap->allocated = realloc(heap->allocated, (ID_ALLOC_WORD(heap->size) + 1) * sizeof(uint32_t));
-        heap->allocated[ID_ALLOC_WORD(heap->size)] = 0;
-
-        *gc_mark = realloc(*gc_mark, (ID_ALLOC_WORD(heap->size) + 1) * sizeof(uint32_t));
-        *gc_mark[ID_ALLOC_WORD(heap->size)] = 0;
-    }
+    // marks are sized for VM_MAX_HEAP, only data grows
+    ++heap->size;
+    heap->types = realloc(heap->types, (heap->size + 1) * sizeof(uint8_t));
+    heap->data = realloc(heap->data, (heap->size + 1) * sizeof(vm_heap_object_t));
 
     vm_heap_pos = heap->size - 1;
 
 save:
 
+    heap->types[vm_heap_pos] = type;
     memcpy(heap->data + vm_heap_pos, &value, sizeof(vm_heap_object_t));
+    if (static_obj)
+        vm_wordpos_set_bit(heap->statics, vm_heap_pos);
+    else
+        vm_wordpos_unset_bit(heap->statics, vm_heap_pos);
+    if (vm_heap_need_finalize(type, &value))
+        vm_wordpos_set_bit(heap->finalize, vm_heap_pos);
+    else
+        vm_wordpos_unset_bit(heap->finalize, vm_heap_pos);
+    vm_wordpos_unset_bit(heap->shared, vm_heap_pos);
     vm_wordpos_set_bit(heap->allocated, vm_heap_pos);
     vm_wordpos_set_bit((*gc_mark), vm_heap_pos);
 
@@ -93,17 +177,30 @@ save:
 }
 
 vm_heap_object_t* vm_heap_load(vm_heap_t *heap, uint32_t pos) {
+    // per heap: threads never write the same one
     if (pos > heap->size - 1 || !vm_wordpos_isset_bit(heap->allocated, pos))
-        return &vm_heap_object_null;
+        return &heap->null_object;
 
     return &(heap->data[pos]);
 }
 
+vm_value_type_t vm_heap_type(vm_heap_t *heap, uint32_t pos) {
+    if (pos > heap->size - 1 || !vm_wordpos_isset_bit(heap->allocated, pos))
+        return VM_VAL_NULL;
+
+    return heap->types[pos];
+}
+
 bool vm_heap_set(vm_heap_t *heap, vm_heap_object_t value, uint32_t pos) {
     if(!vm_heap_isallocated(heap, pos))
         return false;
 
     memcpy(heap->data + pos, &value, sizeof(vm_heap_object_t));
+    if (vm_heap_need_finalize(heap->types[pos], &value))
+        vm_wordpos_set_bit(heap->finalize, pos);
+    else
+        vm_wordpos_unset_bit(heap->finalize, pos);
+    vm_wordpos_unset_bit(heap->shared, pos);
 
     return true;
 }
@@ -125,72 +222,172 @@ bool vm_heap_isstatic(vm_heap_t *heap, uint32_t pos) {
     if (pos > heap->size - 1 || !vm_wordpos_isset_bit(heap->allocated, pos))
         return false;
 
-    return heap->data[pos].static_obj;
+    return vm_wordpos_isset_bit(heap->statics, pos);
 }
 
 void vm_heap_gc_collect(vm_heap_t *heap, uint32_t **gc_mark, bool free_mark, vm_thread_t **thread, bool full) {
     uint32_t allocated_word = 0xffffffff;
 
-    while (++allocated_word < ((ID_ALLOC_WORD(heap->size)) / 32) + 1) {
-        if ((*gc_mark)[allocated_word] == 0) { // block is not used
+    // only metadata words are scanned, payload is touched for objects that need finalization
+    while (++allocated_word <= ID_ALLOC_WORD(heap->size - 1)) {
+        uint32_t collect = (*gc_mark)[allocated_word];
+        if (!full)
+            collect &= ~heap->statics[allocated_word];
+        if (collect == 0)
             continue;
-        } else {
-            for (uint8_t b = 0; b < 32; b++) {
-                if (GET_BIT((*gc_mark)[allocated_word], b) && (!(heap->data[ID_POS(allocated_word, b)].static_obj) || full)) {
-                    switch (heap->data[ID_POS(allocated_word, b)].type) {
-                        case VM_VAL_LIB_OBJ: {
-                            uint32_t idx = ID_POS(allocated_word, b);
-                            (*thread)->externals->lib[heap->data[ID_POS(allocated_word, b)].lib_obj.lib_idx](thread, VM_EDFAT_GC,
-                                    heap->data[ID_POS(allocated_word, b)].lib_obj.lib_idx, idx);
-                        }
-                            break;
-                        case VM_VAL_GENERIC: {
-                            if (heap->data[ID_POS(allocated_word, b)].value.type == VM_VAL_CONST_STRING
-                                    && heap->data[ID_POS(allocated_word, b)].value.cstr.is_program == false)
-                                free(heap->data[ID_POS(allocated_word, b)].value.cstr.addr);
-                        }
-                            break;
-                        case VM_VAL_ARRAY:
-                            free(heap->data[ID_POS(allocated_word, b)].array.fields);
-                            break;
-                        default:
-                    }
-
-                    vm_wordpos_unset_bit((*gc_mark), ID_POS(allocated_word, b));
-                    vm_wordpos_unset_bit(heap->allocated, ID_POS(allocated_word, b));
-                }
-            }
+
+        uint32_t finalize = collect & heap->finalize[allocated_word] & heap->allocated[allocated_word];
+        while (finalize != 0) {
+            vm_heap_finalize(heap, ID_POS(allocated_word, __builtin_ctz(finalize)), thread);
+            finalize &= finalize - 1;
         }
+
+        (*gc_mark)[allocated_word] &= ~collect;
+        heap->allocated[allocated_word] &= ~collect;
     }
 
     if (free_mark)
         free(*gc_mark);
 }
 
+void vm_heap_retain(vm_thread_t **thread, uint32_t pos) {
+    if (!vm_heap_isallocated((*thread)->heap, pos) || vm_heap_isstatic((*thread)->heap, pos))
+        return;
+
+    for (uint32_t n = 0; n <= (*thread)->fc; n++)
+        vm_wordpos_unset_bit((*thread)->frames[n].gc_mark, pos);
+}
+
+void vm_heap_release(vm_thread_t **thread, uint32_t pos) {
+    if (!vm_heap_isallocated((*thread)->heap, pos) || vm_heap_isstatic((*thread)->heap, pos))
+        return;
+
+    vm_wordpos_set_bit((*thread)->frames[(*thread)->fc].gc_mark, pos);
+}
+
+void vm_heap_collect(vm_thread_t **thread, uint32_t pos) {
+    vm_heap_t *heap = (*thread)->heap;
+
+    if (!vm_heap_isallocated(heap, pos) || vm_heap_isstatic(heap, pos))
+        return;
+
+    vm_heap_finalize(heap, pos, thread);
+    vm_wordpos_unset_bit(heap->allocated, pos);
+}
+
 uint32_t* vm_heap_new_gc_mark(vm_heap_t *heap) {
-    return calloc(((ID_ALLOC_WORD(heap->size)) / 32) + 1, sizeof(uint32_t));
+    return calloc(VM_HEAP_MARK_WORDS, sizeof(uint32_t));
 }
 
 void vm_heap_shrink(vm_heap_t *heap) {
     if (heap->size == 0)
         return;
 
-    uint32_t allocated_word = ID_ALLOC_WORD(heap->size) + 1;
-
-    while (--allocated_word >= 0) {
-        if (heap->allocated[allocated_word] == 0) { // block is empty, erase
-            if (allocated_word > 0) {
-                heap->size -= 32;
-                heap->data = realloc(heap->data, (heap->size + 1) * sizeof(vm_heap_object_t));
-                heap->allocated = realloc(heap->allocated, (ID_ALLOC_WORD(heap->size) + 1) * sizeof(uint32_t));
-            } else {
-                heap->size = 1;
-                heap->allocated = realloc(heap->allocated, sizeof(uint32_t));
-                break;
+    uint32_t allocated_word = ID_ALLOC_WORD(heap->size - 1);
+
+    // search upper used block
+    while (allocated_word > 0 && heap->allocated[allocated_word] == 0)
+        --allocated_word;
+
+    uint32_t size = (allocated_word + 1) * 32;
+    if (allocated_word == 0 && heap->allocated[0] == 0)
+        size = 1;
+
+    if (size >= heap->size)
+        return;
+
+    heap->size = size;
+    heap->types = realloc(heap->types, (heap->size + 1) * sizeof(uint8_t));
+    heap->data = realloc(heap->data, (heap->size + 1) * sizeof(vm_heap_object_t));
+}
+
+vm_heap_t* vm_heap_clone(vm_heap_t *heap) {
+    vm_heap_image_t *image = heap->image;
+
+    if (image == NULL) {
+        if ((image = calloc(1, sizeof(vm_heap_image_t))) == NULL)
+            return NULL;
+        atomic_init(&image->refs, 1);
+        atomic_flag_clear(&image->lock);
+        heap->image = image;
+    }
+
+    vm_heap_t *clone = vm_heap_create(heap->size);
+    if (clone == NULL)
+        return NULL;
+    memcpy(clone->allocated, heap->allocated, VM_HEAP_MARK_WORDS * sizeof(uint32_t));
+    memcpy(clone->statics, heap->statics, VM_HEAP_MARK_WORDS * sizeof(uint32_t));
+    memcpy(clone->finalize, heap->finalize, VM_HEAP_MARK_WORDS * sizeof(uint32_t));
+    memcpy(clone->types, heap->types, heap->size * sizeof(uint8_t));
+    memcpy(clone->data, heap->data, heap->size * sizeof(vm_heap_object_t));
+
+    // payloads not shared yet go to the image, both heaps stop owning them
+    vm_heap_image_lock(image);
+    uint32_t needed = 0;
+    for (uint32_t word = 0; word <= ID_ALLOC_WORD(heap->size - 1); word++)
+        needed += __builtin_popcount(heap->finalize[word] & heap->allocated[word] & ~heap->shared[word]);
+    if (image->qty + needed > image->size) {
+        uint32_t size = image->size == 0 ? 32 : image->size * 2;
+        if (size < image->qty + needed)
+            size = image->qty + needed;
+        void **buffers = realloc(image->buffers, size * sizeof(void*));
+        if (buffers == NULL) {
+            // nothing moved yet: the clone owns no payload
+            vm_heap_image_unlock(image);
+            memset(clone->finalize, 0, VM_HEAP_MARK_WORDS * sizeof(uint32_t));
+            vm_heap_destroy(clone, NULL);
+            return NULL;
+        }
+        image->buffers = buffers;
+        image->size = size;
+    }
+
+    uint32_t allocated_word = 0xffffffff;
+    while (++allocated_word <= ID_ALLOC_WORD(heap->size - 1)) {
+        uint32_t finalize = heap->finalize[allocated_word] & heap->allocated[allocated_word];
+        while (finalize != 0) {
+            uint32_t pos = ID_POS(allocated_word, __builtin_ctz(finalize));
+            finalize &= finalize - 1;
+
+            if (heap->types[pos] == VM_VAL_LIB_OBJ) {
+                vm_wordpos_unset_bit(clone->finalize, pos);
+                continue;
+            }
+
+            if (!vm_wordpos_isset_bit(heap->shared, pos)) {
+                image->buffers[image->qty++] = vm_heap_payload(heap, pos);
+                vm_wordpos_set_bit(heap->shared, pos);
             }
+            vm_wordpos_set_bit(clone->shared, pos);
         }
+    }
+    vm_heap_image_unlock(image);
 
-        if(allocated_word == 0)
-            break;
+    atomic_fetch_add(&image->refs, 1);
+    clone->image = image;
+
+    return clone;
+}
+
+bool vm_heap_own(vm_heap_t *heap, uint32_t pos) {
+    if (pos > heap->size - 1 || !vm_wordpos_isset_bit(heap->shared, pos))
+        return true;
+
+    if (heap->types[pos] == VM_VAL_ARRAY) {
+        size_t size = heap->data[pos].array.qty * sizeof(vm_value_t);
+        vm_value_t *fields = malloc(size);
+        if (fields == NULL)
+            return false;
+        memcpy(fields, heap->data[pos].array.fields, size);
+        heap->data[pos].array.fields = fields;
+    } else {
+        char *str = strdup(VM_CSTR_ADDR(heap->data[pos].value));
+        if (str == NULL)
+            return false;
+        VM_CSTR_SET(heap->data[pos].value, str, false);
     }
+
+    vm_wordpos_unset_bit(heap->shared, pos);
+
+    return true;
 }
@@ -0,0 +1,196 @@
+/*
+ * @vm_intern.c
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "vm.h"
+
+#define VM_INTERN_INITIAL_SIZE 64 // records / constants cache initial slots (power of 2)
+
+vm_strings_t* vm_intern_table(vm_thread_t **thread) {
+    if ((*thread)->strings == NULL) {
+        (*thread)->strings = calloc(1, sizeof(vm_strings_t));
+        (*thread)->strings->size = VM_INTERN_INITIAL_SIZE;
+        (*thread)->strings->table = calloc(VM_INTERN_INITIAL_SIZE, sizeof(vm_intern_t*));
+    }
+
+    return (*thread)->strings;
+}
+
+// keep load under 1/2
+static void vm_intern_grow(vm_strings_t *strings) {
+    uint32_t size = strings->size * 2;
+    vm_intern_t **table = calloc(size, sizeof(vm_intern_t*));
+
+    for (uint32_t n = 0; n < strings->size; n++) {
+        if (strings->table[n] == NULL)
+            continue;
+
+        uint32_t pos = strings->table[n]->hash & (size - 1);
+        while (table[pos] != NULL)
+            pos = (pos + 1) & (size - 1);
+        table[pos] = strings->table[n];
+    }
+
+    free(strings->table);
+    strings->table = table;
+    strings->size = size;
+}
+
+static void vm_intern_const_grow(vm_strings_t *strings) {
+    uint32_t size = strings->const_size == 0 ? VM_INTERN_INITIAL_SIZE : strings->const_size * 2;
+    uint32_t *const_pc = malloc(size * sizeof(uint32_t));
+    vm_intern_t **const_str = malloc(size * sizeof(vm_intern_t*));
+
+    memset(const_pc, 0xff, size * sizeof(uint32_t));
+    for (uint32_t n = 0; n < strings->const_size; n++) {
+        if (strings->const_pc[n] == 0xffffffff)
+            continue;
+
+        uint32_t pos = (strings->const_pc[n] * 2654435761U) & (size - 1);
+        while (const_pc[pos] != 0xffffffff)
+            pos = (pos + 1) & (size - 1);
+        const_pc[pos] = strings->const_pc[n];
+        const_str[pos] = strings->const_str[n];
+    }
+
+    free(strings->const_pc);
+    free(strings->const_str);
+    strings->const_pc = const_pc;
+    strings->const_str = const_str;
+    strings->const_size = size;
+}
+
+static vm_intern_t* vm_intern_record(vm_strings_t *strings, const char *str, uint32_t len) {
+    uint32_t hash = vm_string_hash(str, len);
+    uint32_t pos = hash & (strings->size - 1);
+
+    while (strings->table[pos] != NULL) {
+        vm_intern_t *record = strings->table[pos];
+        if (record->hash == hash && record->len == len && memcmp(record->str, str, len) == 0)
+            return record;
+        pos = (pos + 1) & (strings->size - 1);
+    }
+
+    vm_intern_t *record = malloc(sizeof(vm_intern_t) + len + 1);
+    record->hash = hash;
+    record->len = len;
+    memcpy(record->str, str, len);
+    record->str[len] = '\0';
+    strings->table[pos] = record;
+
+    if (++strings->qty * 2 > strings->size)
+        vm_intern_grow(strings);
+
+    return record;
+}
+
+uint32_t vm_string_hash(const char *str, uint32_t len) {
+    uint32_t hash = 2166136261U;
+
+    for (uint32_t n = 0; n < len; n++) {
+        hash ^= (uint8_t) str[n];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+vm_value_t vm_intern(vm_thread_t **thread, const char *str, uint32_t len) {
+    vm_value_t value = { .type = VM_VAL_CONST_STRING };
+
+    VM_CSTR_SET_INTERNED(value, vm_intern_record(vm_intern_table(thread), str, len)->str);
+
+    return value;
+}
+
+uint32_t vm_intern_hash(vm_value_t value) {
+    if (VM_CSTR_IS_INTERNED(value))
+        return VM_INTERN_RECORD(VM_CSTR_ADDR(value))->hash;
+
+    return vm_string_hash(VM_CSTR_ADDR(value), strlen(VM_CSTR_ADDR(value)));
+}
+
+char* vm_intern_constant(vm_thread_t **thread, vm_program_t *program, uint32_t const_pc) {
+    vm_strings_t *strings = vm_intern_table(thread);
+
+    // cache is per program: cleared when program or length changes and by vm_thread_reset
+    if (strings->const_prog != program->prog || strings->const_len != program->prog_len) {
+        if (strings->const_qty > 0)
+            memset(strings->const_pc, 0xff, strings->const_size * sizeof(uint32_t));
+        strings->const_qty = 0;
+        strings->const_prog = program->prog;
+        strings->const_len = program->prog_len;
+    }
+
+    if (strings->const_size == 0)
+        vm_intern_const_grow(strings);
+
+    const char *str = (const char*) (program->prog + const_pc);
+    uint32_t pos = (const_pc * 2654435761U) & (strings->const_size - 1);
+    while (strings->const_pc[pos] != 0xffffffff) {
+        if (strings->const_pc[pos] == const_pc)
+            return strings->const_str[pos]->str;
+        pos = (pos + 1) & (strings->const_size - 1);
+    }
+
+    vm_intern_t *record = vm_intern_record(strings, str, strlen(str));
+    strings->const_pc[pos] = const_pc;
+    strings->const_str[pos] = record;
+
+    if (++strings->const_qty * 2 > strings->const_size)
+        vm_intern_const_grow(strings);
+
+    return record->str;
+}
+
+void vm_intern_reset(vm_thread_t **thread) {
+    vm_strings_t *strings = (*thread)->strings;
+
+    if (strings == NULL)
+        return;
+
+    // capacity is kept for the next run
+    for (uint32_t n = 0; n < strings->size; n++) {
+        free(strings->table[n]);
+        strings->table[n] = NULL;
+    }
+    strings->qty = 0;
+
+    if (strings->const_qty > 0)
+        memset(strings->const_pc, 0xff, strings->const_size * sizeof(uint32_t));
+    strings->const_qty = 0;
+    strings->const_prog = NULL;
+}
+
+void vm_intern_destroy(vm_thread_t **thread) {
+    if ((*thread)->strings == NULL)
+        return;
+
+    for (uint32_t n = 0; n < (*thread)->strings->size; n++)
+        free((*thread)->strings->table[n]);
+
+    free((*thread)->strings->table);
+    free((*thread)->strings->const_pc);
+    free((*thread)->strings->const_str);
+    free((*thread)->strings);
+    (*thread)->strings = NULL;
+}
@@ -0,0 +1,185 @@
+/*
+ * @vm_module.c
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vm.h"
+#include "vm_module.h"
+
+#define VM_MODULE_ALIGN_SIZE(size) (((size) + VM_MODULE_ALIGN - 1) & ~((uint64_t) VM_MODULE_ALIGN - 1))
+
+// section of len bytes, aligned after *end
+static uint32_t vm_module_section(uint64_t *end, uint64_t len) {
+    uint64_t off = VM_MODULE_ALIGN_SIZE(*end);
+
+    *end = off + len;
+
+    return off;
+}
+
+static inline bool vm_module_in(const vm_module_header_t *header, uint32_t off, uint64_t len) {
+    return off >= header->header_size && off <= header->size && len <= header->size - off && off % sizeof(uint32_t) == 0;
+}
+
+/////////////////
+bool vm_module_write(int fd, vm_program_t *program, const vm_module_build_t *build, bool debug) {
+    vm_module_build_t none = { 0 };
+    vm_module_header_t header = { 0 };
+    uint64_t end = sizeof(vm_module_header_t);
+
+    if (build == NULL)
+        build = &none;
+
+    header.magic = VM_MODULE_MAGIC;
+    header.version = VM_MODULE_VERSION;
+    header.header_size = sizeof(vm_module_header_t);
+    header.globals_qty = program->globals_qty;
+    header.code = vm_module_section(&end, program->prog_len);
+    header.code_len = program->prog_len;
+    header.consts = vm_module_section(&end, build->consts_qty * sizeof(vm_module_const_t));
+    header.consts_qty = build->consts_qty;
+    header.symbols = vm_module_section(&end, build->symbols_qty * sizeof(vm_module_symbol_t));
+    header.symbols_qty = build->symbols_qty;
+    header.names = vm_module_section(&end, build->names_len);
+    header.names_len = build->names_len;
+    if (debug) {
+        header.lines = vm_module_section(&end, build->lines_qty * sizeof(vm_module_line_t));
+        header.lines_qty = build->lines_qty;
+    }
+    if (end > UINT32_MAX)
+        return false;
+    header.size = end;
+
+    uint8_t *file = calloc(1, end);
+    if (file == NULL)
+        return false;
+
+    memcpy(file + header.code, program->prog, program->prog_len);
+    if (build->consts_qty > 0)
+        memcpy(file + header.consts, build->consts, build->consts_qty * sizeof(vm_module_const_t));
+    if (build->symbols_qty > 0)
+        memcpy(file + header.symbols, build->symbols, build->symbols_qty * sizeof(vm_module_symbol_t));
+    if (build->names_len > 0)
+        memcpy(file + header.names, build->names, build->names_len);
+    if (header.lines_qty > 0)
+        memcpy(file + header.lines, build->lines, build->lines_qty * sizeof(vm_module_line_t));
+
+    header.checksum = vm_string_hash((const char*) file + sizeof(vm_module_header_t), end - sizeof(vm_module_header_t));
+    memcpy(file, &header, sizeof(vm_module_header_t));
+
+    bool ok = true;
+    for (uint64_t done = 0; done < end && ok;) {
+        ssize_t written = write(fd, file + done, end - done);
+        ok = written > 0;
+        done += ok ? written : 0;
+    }
+    free(file);
+
+    return ok;
+}
+
+vm_module_t* vm_module_load(const char *path, bool verify) {
+    vm_module_header_t header;
+    struct stat st;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) != 0 || (uint64_t) st.st_size < sizeof(vm_module_header_t)
+            || pread(fd, &header, sizeof(vm_module_header_t), 0) != sizeof(vm_module_header_t)
+            || header.magic != VM_MODULE_MAGIC || header.version != VM_MODULE_VERSION
+            || header.header_size != sizeof(vm_module_header_t) || header.size > (uint64_t) st.st_size) {
+        close(fd);
+        return NULL;
+    }
+
+    // shared read only mapping: clean pages of the page cache, the mapping outlives fd
+    void *map = mmap(NULL, header.size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    const uint8_t *file = map;
+    if (!vm_module_in(&header, header.code, header.code_len) || header.code_len == 0
+            || !vm_module_in(&header, header.consts, header.consts_qty * (uint64_t) sizeof(vm_module_const_t))
+            || !vm_module_in(&header, header.symbols, header.symbols_qty * (uint64_t) sizeof(vm_module_symbol_t))
+            || !vm_module_in(&header, header.names, header.names_len)
+            || (header.names_len > 0 && file[header.names + header.names_len - 1] != '\0')
+            || (header.lines_qty > 0 && !vm_module_in(&header, header.lines, header.lines_qty * (uint64_t) sizeof(vm_module_line_t)))
+            || (verify && header.checksum != vm_string_hash((const char*) file + header.header_size, header.size - header.header_size))) {
+        munmap(map, header.size);
+        return NULL;
+    }
+
+    vm_module_t *module = malloc(sizeof(vm_module_t));
+    if (module == NULL) {
+        munmap(map, header.size);
+        return NULL;
+    }
+
+    module->header = map;
+    module->program.prog = (uint8_t*) file + header.code;
+    module->program.prog_len = header.code_len;
+    module->program.globals_qty = header.globals_qty;
+    module->consts = (const vm_module_const_t*) (file + header.consts);
+    module->symbols = (const vm_module_symbol_t*) (file + header.symbols);
+    module->names = (const char*) file + header.names;
+    module->lines = header.lines_qty > 0 ? (const vm_module_line_t*) (file + header.lines) : NULL;
+    module->map = map;
+    module->map_size = header.size;
+
+    return module;
+}
+
+void vm_module_unload(vm_module_t *module) {
+    if (module == NULL)
+        return;
+
+    munmap(module->map, module->map_size);
+    free(module);
+}
+
+uint32_t vm_module_symbol(vm_module_t *module, const char *name) {
+    for (uint32_t n = 0; n < module->header->symbols_qty; n++)
+        if (module->symbols[n].name < module->header->names_len && strcmp(module->names + module->symbols[n].name, name) == 0)
+            return module->symbols[n].pc;
+
+    return 0xffffffff;
+}
+
+uint32_t vm_module_line(vm_module_t *module, uint32_t pc) {
+    uint32_t low = 0, high = module->header->lines_qty;
+
+    // last line with address <= pc (lines without code share the address of the next one)
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (module->lines[mid].pc <= pc)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low == 0 ? 0 : module->lines[low - 1].line;
+}
@@ -0,0 +1,169 @@
+/*
+ * @vm_module.h
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#ifndef VM_MODULE_H
+#define VM_MODULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "vm.h"
+
+#define VM_MODULE_MAGIC   0x424d5653 // "SVMB"
+#define VM_MODULE_VERSION 1          // format version (load only accepts the same)
+#define VM_MODULE_ALIGN   64         // sections alignment (code starts on its own cache line)
+
+/**
+ * @struct vm_module_header_s
+ * @brief Module (.svmb) header. Sections follow at the given offsets (from file start), little endian.
+ * The checksum (vm_string_hash) covers the file after the header.
+ *
+ */
+typedef struct vm_module_header_s {
+    uint32_t magic;        /**< VM_MODULE_MAGIC */
+    uint16_t version;      /**< VM_MODULE_VERSION */
+    uint16_t header_size;  /**< sizeof(vm_module_header_t) */
+    uint32_t checksum;     /**< hash of the file after the header */
+    uint32_t size;         /**< file size */
+    uint32_t globals_qty;  /**< global vars used by program */
+    uint32_t code;         /**< offset of code (program image) */
+    uint32_t code_len;     /**< code length */
+    uint32_t consts;       /**< offset of constants (vm_module_const_t) */
+    uint32_t consts_qty;   /**< constants */
+    uint32_t symbols;      /**< offset of symbols (vm_module_symbol_t) */
+    uint32_t symbols_qty;  /**< symbols */
+    uint32_t names;        /**< offset of symbol names (NUL terminated) */
+    uint32_t names_len;    /**< names length */
+    uint32_t lines;        /**< offset of debug lines (vm_module_line_t, ascending pc) */
+    uint32_t lines_qty;    /**< debug lines (0: none) */
+} vm_module_header_t;
+
+/**
+ * @struct vm_module_const_s
+ * @brief Constant: data emitted in code (strings and data directives), not instructions
+ *
+ */
+typedef struct vm_module_const_s {
+    uint32_t pc;  /**< address */
+    uint32_t len; /**< length */
+} vm_module_const_t;
+
+/**
+ * @struct vm_module_symbol_s
+ * @brief Symbol: label of program
+ *
+ */
+typedef struct vm_module_symbol_s {
+    uint32_t name; /**< offset of name in names */
+    uint32_t pc;   /**< address */
+} vm_module_symbol_t;
+
+/**
+ * @struct vm_module_line_s
+ * @brief Debug line: source line of an address
+ *
+ */
+typedef struct vm_module_line_s {
+    uint32_t pc;   /**< address */
+    uint32_t line; /**< source line (as the assembler counts them) */
+} vm_module_line_t;
+
+/**
+ * @struct vm_module_build_s
+ * @brief Sections of a module besides code (from the assembler, see assembler_module)
+ *
+ */
+typedef struct vm_module_build_s {
+     vm_module_const_t *consts;      /**< constants */
+              uint32_t consts_qty;   /**< constants quantity */
+    vm_module_symbol_t *symbols;     /**< symbols */
+              uint32_t symbols_qty;  /**< symbols quantity */
+                  char *names;       /**< symbol names */
+              uint32_t names_len;    /**< names length */
+      vm_module_line_t *lines;       /**< debug lines */
+              uint32_t lines_qty;    /**< debug lines quantity */
+} vm_module_build_t;
+
+/**
+ * @struct vm_module_s
+ * @brief Loaded module. All sections point into the mapping
+ *
+ */
+typedef struct vm_module_s {
+                vm_program_t program;   /**< program (code in mapping, read only) */
+    const vm_module_header_t *header;   /**< header */
+     const vm_module_const_t *consts;   /**< constants */
+    const vm_module_symbol_t *symbols;  /**< symbols */
+                  const char *names;    /**< symbol names */
+      const vm_module_line_t *lines;    /**< debug lines (NULL: none) */
+                        void *map;      /**< mapping */
+                      size_t map_size;  /**< mapping size */
+} vm_module_t;
+
+/**
+ * @fn bool vm_module_write(int fd, vm_program_t *program, const vm_module_build_t *build, bool debug)
+ * @brief Write program as a module to fd (from its current position)
+ *
+ * @param fd File descriptor
+ * @param program Program
+ * @param build Constants, symbols and lines (NULL: only code)
+ * @param debug Write debug lines
+ * @return false if fail
+ */
+bool vm_module_write(int fd, vm_program_t *program, const vm_module_build_t *build, bool debug);
+
+/**
+ * @fn vm_module_t* vm_module_load(const char *path, bool verify)
+ * @brief Map a module file (read only, shared). Code is used in place: no copy and no parse, pages are
+ * read on demand and shared through the page cache by all processes that load the same file.
+ *
+ * @param path File
+ * @param verify Check checksum (reads the whole file)
+ * @return Module (NULL: fail, bad format or version)
+ */
+vm_module_t* vm_module_load(const char *path, bool verify);
+
+/**
+ * @fn void vm_module_unload(vm_module_t *module)
+ * @brief Unmap module. Threads must not run its program after
+ *
+ * @param module Module
+ */
+void vm_module_unload(vm_module_t *module);
+
+/**
+ * @fn uint32_t vm_module_symbol(vm_module_t *module, const char *name)
+ * @brief Address of a symbol
+ *
+ * @param module Module
+ * @param name Label name
+ * @return Address (0xffffffff: not exist)
+ */
+uint32_t vm_module_symbol(vm_module_t *module, const char *name);
+
+/**
+ * @fn uint32_t vm_module_line(vm_module_t *module, uint32_t pc)
+ * @brief Source line of an address
+ *
+ * @param module Module
+ * @param pc Address
+ * @return Line (0: no debug lines)
+ */
+uint32_t vm_module_line(vm_module_t *module, uint32_t pc);
+
+#endif /* VM_MODULE_H */
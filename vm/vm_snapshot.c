@@ -0,0 +1,670 @@
+/*
+ * @vm_snapshot.c
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vm.h"
+
+#define VM_SNAPSHOT_ALIGN(size) (((size) + 15) & ~((uint64_t) 15)) // sections alignment
+
+/**
+ * @struct vm_snapshot_ctx_s
+ * @brief (internal) Snapshot in progress. Written in a buffer, read from the mapping
+ *
+ */
+typedef struct vm_snapshot_ctx_s {
+     vm_program_t *program;   /**< program */
+             bool writing;    /**< vm_snapshot (else vm_restore) */
+          uint8_t *data;      /**< buffer (writing) or snapshot (reading) */
+         uint64_t len;        /**< bytes in buffer or snapshot size */
+         uint64_t size;       /**< allocated buffer */
+             bool fail;       /**< buffer allocation failed */
+    const uint8_t *cursor;    /**< record of library object (reading) */
+    const uint8_t *end;       /**< end of record (reading) */
+} vm_snapshot_ctx_t;
+
+// context of library calls, one snapshot at a time per OS thread
+static __thread vm_snapshot_ctx_t *vm_snapshot_ctx = NULL;
+
+///// write /////
+
+// len bytes (zeroed) at end of buffer, return its offset
+static uint64_t vm_snapshot_reserve(vm_snapshot_ctx_t *ctx, uint64_t len, bool align) {
+    uint64_t off = align ? VM_SNAPSHOT_ALIGN(ctx->len) : ctx->len;
+
+    if (ctx->fail)
+        return 0;
+
+    if (off + len > ctx->size) {
+        uint64_t size = ctx->size == 0 ? 4096 : ctx->size;
+        while (size < off + len)
+            size *= 2;
+
+        uint8_t *data = realloc(ctx->data, size);
+        if (data == NULL) {
+            ctx->fail = true;
+            return 0;
+        }
+        ctx->data = data;
+        ctx->size = size;
+    }
+
+    memset(ctx->data + ctx->len, 0, off + len - ctx->len);
+    ctx->len = off + len;
+
+    return off;
+}
+
+static uint64_t vm_snapshot_put(vm_snapshot_ctx_t *ctx, const void *data, uint64_t len, bool align) {
+    uint64_t off = vm_snapshot_reserve(ctx, len, align);
+
+    if (!ctx->fail && len > 0)
+        memcpy(ctx->data + off, data, len);
+
+    return off;
+}
+
+// string record: length, string and NUL. Return offset of string
+static uint64_t vm_snapshot_put_string(vm_snapshot_ctx_t *ctx, const char *str, uint32_t len) {
+    uint64_t off = vm_snapshot_reserve(ctx, sizeof(uint32_t) + len + 1, false);
+
+    if (ctx->fail)
+        return 0;
+
+    memcpy(ctx->data + off, &len, sizeof(uint32_t));
+    memcpy(ctx->data + off + sizeof(uint32_t), str, len);
+
+    return off + sizeof(uint32_t);
+}
+
+static inline bool vm_snapshot_in_program(vm_program_t *program, const char *str) {
+    return (const uint8_t*) str >= program->prog && (const uint8_t*) str < program->prog + program->prog_len;
+}
+
+// value with strings as offsets: program strings from program start, others to a string record
+static vm_value_t vm_snapshot_value(vm_snapshot_ctx_t *ctx, vm_value_t value) {
+    if (value.type != VM_VAL_CONST_STRING)
+        return value;
+
+    char *str = VM_CSTR_ADDR(value);
+    if (VM_CSTR_IS_INTERNED(value))
+        VM_CSTR_SET_INTERNED(value, (char* ) (uintptr_t) vm_snapshot_put_string(ctx, str, VM_INTERN_RECORD(str)->len));
+    else if (!VM_CSTR_IS_PROGRAM(value))
+        VM_CSTR_SET(value, (char* ) (uintptr_t) vm_snapshot_put_string(ctx, str, strlen(str)), false);
+    else if (vm_snapshot_in_program(ctx->program, str))
+        VM_CSTR_SET(value, (char* ) (uintptr_t) ((uint8_t* ) str - ctx->program->prog), true);
+    else
+        // not owned and out of program (library memory): restored as interned
+        VM_CSTR_SET_INTERNED(value, (char* ) (uintptr_t) vm_snapshot_put_string(ctx, str, strlen(str)));
+
+    return value;
+}
+
+static uint64_t vm_snapshot_values(vm_snapshot_ctx_t *ctx, vm_value_t *values, uint32_t qty) {
+    uint64_t off = vm_snapshot_reserve(ctx, qty * sizeof(vm_value_t), true);
+
+    for (uint32_t n = 0; n < qty; n++) {
+        vm_value_t value = vm_snapshot_value(ctx, values[n]);
+        if (!ctx->fail)
+            memcpy(ctx->data + off + n * sizeof(vm_value_t), &value, sizeof(vm_value_t));
+    }
+
+    return off;
+}
+
+// heap objects with payloads as offsets. Library objects are written by their library as a record (length and data)
+static vm_errors_t vm_snapshot_heap(vm_thread_t **thread, vm_snapshot_ctx_t *ctx, uint64_t data_off) {
+    vm_heap_t *heap = (*thread)->heap;
+
+    for (uint32_t pos = 0; pos < heap->size; pos++) {
+        if (!vm_heap_isallocated(heap, pos))
+            continue;
+
+        vm_heap_object_t obj = heap->data[pos];
+        switch (heap->types[pos]) {
+            case VM_VAL_ARRAY:
+                obj.array.fields = (vm_value_t*) (uintptr_t) vm_snapshot_values(ctx, heap->data[pos].array.fields, obj.array.qty);
+                break;
+
+            case VM_VAL_GENERIC:
+                obj.value = vm_snapshot_value(ctx, obj.value);
+                break;
+
+            case VM_VAL_LIB_OBJ: {
+                uint32_t lib_idx = obj.lib_obj.lib_idx;
+                if ((*thread)->externals == NULL || lib_idx >= (*thread)->externals->lib_qty)
+                    return VM_ERR_FAIL;
+
+                uint64_t off = vm_snapshot_reserve(ctx, sizeof(uint32_t), true);
+                vm_snapshot_ctx = ctx;
+                vm_errors_t status = (*thread)->externals->lib[lib_idx](thread, VM_EDFAT_SERIALIZE, lib_idx, pos);
+                vm_snapshot_ctx = NULL;
+                if (status != VM_ERR_OK)
+                    return status;
+                if (ctx->fail)
+                    break;
+
+                uint32_t len = ctx->len - off - sizeof(uint32_t);
+                memcpy(ctx->data + off, &len, sizeof(uint32_t));
+                obj.lib_obj.addr = (void*) (uintptr_t) off;
+            }
+                break;
+
+            default:
+        }
+
+        if (ctx->fail)
+            return VM_ERR_OUTOFMEMORY;
+        memcpy(ctx->data + data_off + pos * sizeof(vm_heap_object_t), &obj, sizeof(vm_heap_object_t));
+    }
+
+    return VM_ERR_OK;
+}
+
+static bool vm_snapshot_flush(int fd, const uint8_t *data, uint64_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written <= 0)
+            return false;
+        data += written;
+        len -= written;
+    }
+
+    return true;
+}
+
+///// read /////
+
+static inline bool vm_restore_section(vm_snapshot_header_t *header, uint64_t off, uint64_t len) {
+    return off >= sizeof(vm_snapshot_header_t) && off <= header->size && len <= header->size - off;
+}
+
+static bool vm_restore_check(vm_snapshot_header_t *header, vm_program_t *program) {
+    if (header->magic != VM_SNAPSHOT_MAGIC || header->version != VM_SNAPSHOT_VERSION || header->value_size != sizeof(vm_value_t)
+            || header->object_size != sizeof(vm_heap_object_t) || header->mark_words != VM_HEAP_MARK_WORDS)
+        return false;
+
+    if (program == NULL || header->prog_len != program->prog_len
+            || header->prog_hash != vm_string_hash((const char*) program->prog, program->prog_len))
+        return false;
+
+    if (header->stack_size == 0 || header->stack_size > VM_SNAPSHOT_MAX_STACK || header->max_call_depth == 0
+            || header->max_call_depth > VM_SNAPSHOT_MAX_CALL_DEPTH || header->frames_size == 0 || header->frames_size > header->max_call_depth
+            || header->globals_qty > VM_MAX_GLOBAL_VARS || header->sp > header->stack_size || header->fc > header->frames_size || header->heap_size == 0 || header->heap_size > VM_MAX_HEAP)
+        return false;
+
+    if (header->pc >= header->prog_len || header->fp > header->sp)
+        return false;
+
+    return vm_restore_section(header, header->frames, (header->fc + 1) * (uint64_t) sizeof(vm_snapshot_frame_t))
+#ifdef VM_ENABLE_FRAMES_ALIVE
+            && vm_restore_section(header, header->frame_exist, (ID_ALLOC_WORD(header->max_call_depth) + 1) * sizeof(uint32_t))
+#endif
+            && vm_restore_section(header, header->stack, header->sp * (uint64_t) sizeof(vm_value_t))
+            && vm_restore_section(header, header->globals, header->globals_qty * (uint64_t) sizeof(vm_value_t))
+            && vm_restore_section(header, header->heap_marks, 3 * VM_HEAP_MARK_WORDS * sizeof(uint32_t))
+            && vm_restore_section(header, header->heap_types, header->heap_size)
+            && vm_restore_section(header, header->heap_data, header->heap_size * (uint64_t) sizeof(vm_heap_object_t));
+}
+
+// value from snapshot: owned strings are allocated (owned) or used in place
+static bool vm_restore_value(vm_thread_t **thread, vm_snapshot_ctx_t *ctx, vm_value_t *value, bool owned) {
+    if (value->type != VM_VAL_CONST_STRING)
+        return true;
+
+    uint64_t off = (uintptr_t) VM_CSTR_ADDR(*value);
+    if (VM_CSTR_IS_PROGRAM(*value) && !VM_CSTR_IS_INTERNED(*value)) {
+        if (off >= ctx->program->prog_len)
+            return false;
+        VM_CSTR_SET(*value, (char* ) ctx->program->prog + off, true);
+        return true;
+    }
+
+    uint32_t len;
+    if (off < sizeof(uint32_t) || off >= ctx->len)
+        return false;
+    memcpy(&len, ctx->data + off - sizeof(uint32_t), sizeof(uint32_t));
+    if (len >= ctx->len - off || ctx->data[off + len] != '\0')
+        return false;
+
+    char *str = (char*) ctx->data + off;
+    if (VM_CSTR_IS_INTERNED(*value)) {
+        *value = vm_intern(thread, str, len);
+        return true;
+    }
+
+    if (owned && (str = strdup(str)) == NULL)
+        return false;
+    VM_CSTR_SET(*value, str, false);
+
+    return true;
+}
+
+// payloads of arrays and owned strings stay in the snapshot (shared with image), library objects are rebuilt
+static vm_errors_t vm_restore_heap(vm_thread_t **thread, vm_snapshot_ctx_t *ctx, vm_snapshot_header_t *header) {
+    vm_heap_t *heap = (*thread)->heap;
+    uint32_t lib_finalize[VM_HEAP_MARK_WORDS];
+
+    uint8_t *types = realloc(heap->types, (header->heap_size + 1) * sizeof(uint8_t));
+    if (types == NULL)
+        return VM_ERR_OUTOFMEMORY;
+    heap->types = types;
+    vm_heap_object_t *data = realloc(heap->data, (header->heap_size + 1) * sizeof(vm_heap_object_t));
+    if (data == NULL)
+        return VM_ERR_OUTOFMEMORY;
+    heap->data = data;
+    heap->size = header->heap_size;
+
+    memcpy(heap->types, ctx->data + header->heap_types, heap->size);
+    memcpy(heap->data, ctx->data + header->heap_data, heap->size * sizeof(vm_heap_object_t));
+    memcpy(heap->allocated, ctx->data + header->heap_marks, VM_HEAP_MARK_WORDS * sizeof(uint32_t));
+    memcpy(heap->statics, ctx->data + header->heap_marks + VM_HEAP_MARK_WORDS * sizeof(uint32_t), VM_HEAP_MARK_WORDS * sizeof(uint32_t));
+    memcpy(heap->finalize, ctx->data + header->heap_marks + 2 * VM_HEAP_MARK_WORDS * sizeof(uint32_t), VM_HEAP_MARK_WORDS * sizeof(uint32_t));
+
+    for (uint32_t pos = heap->size; pos < VM_MAX_HEAP; pos++)
+        vm_wordpos_unset_bit(heap->allocated, pos);
+
+    // objects not rebuilt yet are never released (on fail the heap is destroyed)
+    for (uint32_t word = 0; word < VM_HEAP_MARK_WORDS; word++) {
+        lib_finalize[word] = 0;
+        heap->shared[word] = heap->finalize[word] & heap->allocated[word];
+    }
+    for (uint32_t pos = 0; pos < heap->size; pos++) {
+        if (vm_heap_isallocated(heap, pos) && heap->types[pos] == VM_VAL_LIB_OBJ && vm_wordpos_isset_bit(heap->shared, pos)) {
+            vm_wordpos_unset_bit(heap->shared, pos);
+            vm_wordpos_unset_bit(heap->finalize, pos);
+            vm_wordpos_set_bit(lib_finalize, pos);
+        }
+    }
+
+    for (uint32_t pos = 0; pos < heap->size; pos++) {
+        if (!vm_heap_isallocated(heap, pos))
+            continue;
+
+        vm_heap_object_t *obj = &heap->data[pos];
+        switch (heap->types[pos]) {
+            case VM_VAL_ARRAY: {
+                uint64_t off = (uintptr_t) obj->array.fields;
+                if (!vm_restore_section(header, off, obj->array.qty * (uint64_t) sizeof(vm_value_t)) || off % _Alignof(vm_value_t) != 0)
+                    return VM_ERR_FAIL;
+
+                obj->array.fields = (vm_value_t*) (ctx->data + off);
+                for (uint32_t n = 0; n < obj->array.qty; n++)
+                    if (!vm_restore_value(thread, ctx, &obj->array.fields[n], true))
+                        return VM_ERR_FAIL;
+            }
+                break;
+
+            case VM_VAL_GENERIC:
+                if (!vm_restore_value(thread, ctx, &obj->value, false))
+                    return VM_ERR_FAIL;
+                break;
+
+            case VM_VAL_LIB_OBJ: {
+                uint64_t off = (uintptr_t) obj->lib_obj.addr;
+                uint32_t lib_idx = obj->lib_obj.lib_idx;
+                uint32_t len;
+
+                if (!vm_restore_section(header, off, sizeof(uint32_t)) || (*thread)->externals == NULL || lib_idx >= (*thread)->externals->lib_qty)
+                    return VM_ERR_FAIL;
+                memcpy(&len, ctx->data + off, sizeof(uint32_t));
+                if (!vm_restore_section(header, off + sizeof(uint32_t), len))
+                    return VM_ERR_FAIL;
+
+                ctx->cursor = ctx->data + off + sizeof(uint32_t);
+                ctx->end = ctx->cursor + len;
+                obj->lib_obj.addr = NULL;
+
+                vm_snapshot_ctx = ctx;
+                vm_errors_t status = (*thread)->externals->lib[lib_idx](thread, VM_EDFAT_DESERIALIZE, lib_idx, pos);
+                vm_snapshot_ctx = NULL;
+                if (status != VM_ERR_OK)
+                    return status;
+
+                if (vm_wordpos_isset_bit(lib_finalize, pos))
+                    vm_wordpos_set_bit(heap->finalize, pos);
+            }
+                break;
+
+            default:
+        }
+    }
+
+    return VM_ERR_OK;
+}
+
+static vm_errors_t vm_restore_state(vm_thread_t **thread, vm_snapshot_ctx_t *ctx, vm_snapshot_header_t *header) {
+    // callers unwind inside the stack (locals below each frame pointer) and return inside the program
+    uint32_t fp = header->fp;
+    for (uint32_t n = header->fc; n-- > 0;) {
+        vm_snapshot_frame_t frame;
+        memcpy(&frame, ctx->data + header->frames + n * sizeof(vm_snapshot_frame_t), sizeof(vm_snapshot_frame_t));
+        if (frame.locals > UINT8_MAX || frame.locals > fp || frame.fp > fp - frame.locals || frame.pc > header->prog_len)
+            return VM_ERR_FAIL;
+        fp = frame.fp;
+    }
+
+    vm_errors_t status = vm_restore_heap(thread, ctx, header);
+    if (status != VM_ERR_OK)
+        return status;
+
+    if (header->globals_qty > 0) {
+        vm_globals_t *globals = (*thread)->globals;
+        if ((status = vm_globals_reserve(thread, header->globals_qty)) != VM_ERR_OK)
+            return status;
+
+        for (uint32_t n = 0; n < header->globals_qty; n++) {
+            memcpy(&globals->global_vars[n], ctx->data + header->globals + n * sizeof(vm_value_t), sizeof(vm_value_t));
+            if (!vm_restore_value(thread, ctx, &globals->global_vars[n], true))
+                return VM_ERR_FAIL;
+            globals->global_vars_qty = n + 1;
+        }
+    }
+
+    for (uint32_t n = 0; n < header->sp; n++) {
+        memcpy(&(*thread)->stack[n], ctx->data + header->stack + n * sizeof(vm_value_t), sizeof(vm_value_t));
+        if (!vm_restore_value(thread, ctx, &(*thread)->stack[n], true))
+            return VM_ERR_FAIL;
+        (*thread)->sp = n + 1;
+    }
+
+    vm_value_t ret_val = header->ret_val;
+    if (!vm_restore_value(thread, ctx, &ret_val, true))
+        return VM_ERR_FAIL;
+    (*thread)->ret_val = ret_val;
+
+    for (uint32_t n = 0; n <= header->fc; n++) {
+        vm_snapshot_frame_t frame;
+        memcpy(&frame, ctx->data + header->frames + n * sizeof(vm_snapshot_frame_t), sizeof(vm_snapshot_frame_t));
+
+        if (n > 0 && ((*thread)->frames[n].gc_mark = vm_heap_new_gc_mark((*thread)->heap)) == NULL)
+            return VM_ERR_OUTOFMEMORY;
+        memcpy((*thread)->frames[n].gc_mark, frame.gc_mark, VM_HEAP_MARK_WORDS * sizeof(uint32_t));
+        (*thread)->frames[n].pc = frame.pc;
+        (*thread)->frames[n].fp = frame.fp;
+        (*thread)->frames[n].locals = frame.locals;
+        (*thread)->fc = n;
+    }
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    memcpy((*thread)->frame_exist, ctx->data + header->frame_exist, (ID_ALLOC_WORD(header->max_call_depth) + 1) * sizeof(uint32_t));
+#endif
+
+    (*thread)->exit_value = header->exit_value;
+    (*thread)->status = header->status;
+    (*thread)->halted = header->halted;
+    (*thread)->indirect = header->indirect;
+    (*thread)->pc = header->pc;
+    (*thread)->fp = header->fp;
+    (*thread)->fuel = header->fuel;
+
+    return VM_ERR_OK;
+}
+
+/////////////////
+vm_errors_t vm_snapshot(vm_thread_t **thread, vm_program_t *program, int fd) {
+    vm_thread_t *src = *thread;
+    vm_heap_t *heap = src->heap;
+
+    if (src->pending != 0 || program == NULL || src->pc >= program->prog_len)
+        return VM_ERR_FAIL;
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    if (src->fibers != NULL)
+        return VM_ERR_FAIL;
+#endif
+
+    vm_snapshot_ctx_t ctx = { .program = program, .writing = true };
+    vm_snapshot_header_t header;
+    memset(&header, 0, sizeof(vm_snapshot_header_t));
+    vm_snapshot_reserve(&ctx, sizeof(vm_snapshot_header_t), false);
+
+    header.magic = VM_SNAPSHOT_MAGIC;
+    header.version = VM_SNAPSHOT_VERSION;
+    header.value_size = sizeof(vm_value_t);
+    header.object_size = sizeof(vm_heap_object_t);
+    header.mark_words = VM_HEAP_MARK_WORDS;
+    header.prog_len = program->prog_len;
+    header.prog_hash = vm_string_hash((const char*) program->prog, program->prog_len);
+    header.stack_size = src->stack_size;
+    header.max_call_depth = src->max_call_depth;
+    header.frames_size = src->frames_size - 1;
+#ifdef VM_ENABLE_STACK_GUARD
+    header.stack_guard = src->stack_map != NULL;
+#endif
+    header.intern_strings = src->strings != NULL && src->strings->constants;
+    header.exit_value = src->exit_value;
+    header.halted = src->halted;
+    header.status = src->status;
+    header.indirect = src->indirect;
+    header.pc = src->pc;
+    header.fp = src->fp;
+    header.sp = src->sp;
+    header.fc = src->fc;
+    header.fuel = src->fuel;
+    header.globals_qty = src->globals->global_vars_qty;
+    header.heap_size = heap->size;
+    header.ret_val = vm_snapshot_value(&ctx, src->ret_val);
+
+    // frames grown over the configured ones
+    if (header.frames_size < src->fc)
+        header.frames_size = src->fc;
+
+    header.frames = vm_snapshot_reserve(&ctx, (src->fc + 1) * sizeof(vm_snapshot_frame_t), true);
+    for (uint32_t n = 0; n <= src->fc && !ctx.fail; n++) {
+        vm_snapshot_frame_t frame = { .pc = src->frames[n].pc, .fp = src->frames[n].fp, .locals = src->frames[n].locals };
+        memcpy(frame.gc_mark, src->frames[n].gc_mark, VM_HEAP_MARK_WORDS * sizeof(uint32_t));
+        memcpy(ctx.data + header.frames + n * sizeof(vm_snapshot_frame_t), &frame, sizeof(vm_snapshot_frame_t));
+    }
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    header.frame_exist = vm_snapshot_put(&ctx, src->frame_exist, (ID_ALLOC_WORD(src->max_call_depth) + 1) * sizeof(uint32_t), true);
+#endif
+
+    header.stack = vm_snapshot_values(&ctx, src->stack, src->sp);
+    header.globals = vm_snapshot_values(&ctx, src->globals->global_vars, src->globals->global_vars_qty);
+
+    header.heap_marks = vm_snapshot_put(&ctx, heap->allocated, VM_HEAP_MARK_WORDS * sizeof(uint32_t), true);
+    vm_snapshot_put(&ctx, heap->statics, VM_HEAP_MARK_WORDS * sizeof(uint32_t), false);
+    vm_snapshot_put(&ctx, heap->finalize, VM_HEAP_MARK_WORDS * sizeof(uint32_t), false);
+    header.heap_types = vm_snapshot_put(&ctx, heap->types, heap->size, true);
+    header.heap_data = vm_snapshot_reserve(&ctx, heap->size * sizeof(vm_heap_object_t), true);
+
+    vm_errors_t status = ctx.fail ? VM_ERR_OUTOFMEMORY : vm_snapshot_heap(thread, &ctx, header.heap_data);
+
+    if (status == VM_ERR_OK) {
+        header.size = ctx.len;
+        memcpy(ctx.data, &header, sizeof(vm_snapshot_header_t));
+        if (!vm_snapshot_flush(fd, ctx.data, ctx.len))
+            status = VM_ERR_FAIL;
+    }
+
+    free(ctx.data);
+
+    return status;
+}
+
+vm_errors_t vm_restore(vm_thread_t **thread, vm_program_t *program, vm_ffilib_t *externals, int fd) {
+    vm_snapshot_header_t header;
+    struct stat st;
+
+    *thread = NULL;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0 || pread(fd, &header, sizeof(vm_snapshot_header_t), pos) != sizeof(vm_snapshot_header_t) || !vm_restore_check(&header, program))
+        return VM_ERR_FAIL;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t) st.st_size - pos < header.size)
+        return VM_ERR_FAIL;
+
+    // private mapping from the page of snapshot start: pages are read on demand and copied only when written
+    long page = sysconf(_SC_PAGESIZE);
+    off_t map_pos = pos & ~((off_t) page - 1);
+    size_t map_size = header.size + (pos - map_pos);
+    uint8_t *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, map_pos);
+    uint8_t *data;
+
+    if (map != MAP_FAILED)
+        data = map + (pos - map_pos);
+    else {
+        // not mappable (pipe, socket ...): read it
+        map_size = 0;
+        if ((data = map = malloc(header.size)) == NULL)
+            return VM_ERR_OUTOFMEMORY;
+        for (uint64_t done = 0; done < header.size;) {
+            ssize_t got = read(fd, data + done, header.size - done);
+            if (got <= 0) {
+                free(map);
+                return VM_ERR_FAIL;
+            }
+            done += got;
+        }
+    }
+
+    vm_heap_image_t *image = calloc(1, sizeof(vm_heap_image_t));
+    if (image == NULL) {
+        if (map_size > 0)
+            munmap(map, map_size);
+        else
+            free(map);
+        return VM_ERR_OUTOFMEMORY;
+    }
+    atomic_init(&image->refs, 1);
+    atomic_flag_clear(&image->lock);
+    image->map = map;
+    image->map_size = map_size;
+
+    vm_thread_config_t config = {
+            .stack_size = header.stack_size,
+            .max_call_depth = header.max_call_depth,
+            .frames_size = header.frames_size,
+            .intern_strings = header.intern_strings
+    };
+#ifdef VM_ENABLE_STACK_GUARD
+    config.stack_guard = header.stack_guard;
+#endif
+    vm_create_thread(thread, &config);
+    if (*thread == NULL) {
+        if (map_size > 0)
+            munmap(map, map_size);
+        else
+            free(map);
+        free(image);
+        return VM_ERR_OUTOFMEMORY;
+    }
+    (*thread)->externals = externals;
+    (*thread)->heap->image = image;
+
+    vm_snapshot_ctx_t ctx = { .program = program, .data = data, .len = header.size };
+    vm_errors_t status = vm_restore_state(thread, &ctx, &header);
+    if (status != VM_ERR_OK) {
+        vm_destroy_thread(thread);
+        *thread = NULL;
+        return status;
+    }
+
+    lseek(fd, pos + header.size, SEEK_SET);
+
+    return VM_ERR_OK;
+}
+
+bool vm_snapshot_write(vm_thread_t **thread, const void *data, uint32_t len) {
+    vm_snapshot_ctx_t *ctx = vm_snapshot_ctx;
+
+    if (ctx == NULL || !ctx->writing)
+        return false;
+
+    vm_snapshot_put(ctx, data, len, false);
+
+    return !ctx->fail;
+}
+
+bool vm_snapshot_write_value(vm_thread_t **thread, vm_value_t value) {
+    vm_snapshot_ctx_t *ctx = vm_snapshot_ctx;
+
+    if (ctx == NULL || !ctx->writing)
+        return false;
+
+    if (value.type != VM_VAL_CONST_STRING || (VM_CSTR_IS_PROGRAM(value) && !VM_CSTR_IS_INTERNED(value) && vm_snapshot_in_program(ctx->program, VM_CSTR_ADDR(value)))) {
+        value = vm_snapshot_value(ctx, value);
+        vm_snapshot_put(ctx, &value, sizeof(vm_value_t), false);
+        return !ctx->fail;
+    }
+
+    // string in the record, length in place of address
+    char *str = VM_CSTR_ADDR(value);
+    uint32_t len = VM_CSTR_IS_INTERNED(value) ? VM_INTERN_RECORD(str)->len : strlen(str);
+    if (VM_CSTR_IS_PROGRAM(value))
+        VM_CSTR_SET_INTERNED(value, (char* ) (uintptr_t) len);
+    else
+        VM_CSTR_SET(value, (char* ) (uintptr_t) len, false);
+
+    vm_snapshot_put(ctx, &value, sizeof(vm_value_t), false);
+    vm_snapshot_put(ctx, str, len, false);
+
+    return !ctx->fail;
+}
+
+const void* vm_snapshot_read(vm_thread_t **thread, uint32_t len) {
+    vm_snapshot_ctx_t *ctx = vm_snapshot_ctx;
+
+    if (ctx == NULL || ctx->writing || len > (uint64_t) (ctx->end - ctx->cursor))
+        return NULL;
+
+    const void *data = ctx->cursor;
+    ctx->cursor += len;
+
+    return data;
+}
+
+bool vm_snapshot_read_value(vm_thread_t **thread, vm_value_t *value) {
+    const void *data = vm_snapshot_read(thread, sizeof(vm_value_t));
+
+    if (data == NULL)
+        return false;
+
+    memcpy(value, data, sizeof(vm_value_t));
+    if (value->type != VM_VAL_CONST_STRING)
+        return true;
+
+    uint64_t len = (uintptr_t) VM_CSTR_ADDR(*value);
+    if (VM_CSTR_IS_PROGRAM(*value) && !VM_CSTR_IS_INTERNED(*value)) {
+        if (len >= vm_snapshot_ctx->program->prog_len)
+            return false;
+        VM_CSTR_SET(*value, (char* ) vm_snapshot_ctx->program->prog + len, true);
+        return true;
+    }
+
+    const char *str = len <= UINT32_MAX ? vm_snapshot_read(thread, len) : NULL;
+    if (str == NULL)
+        return false;
+
+    if (VM_CSTR_IS_INTERNED(*value)) {
+        *value = vm_intern(thread, str, len);
+        return true;
+    }
+
+    char *copy = malloc(len + 1);
+    if (copy == NULL)
+        return false;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    VM_CSTR_SET(*value, copy, false);
+
+    return true;
+}
@@ -0,0 +1,342 @@
+/*
+ * @ffi_async.c
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "vm.h"
+#include "ffi_async.h"
+#ifdef VM_ENABLE_FRAMES_ALIVE
+#include "ffi_fiber.h"
+#endif
+
+// pending timer or file descriptor (epoll data)
+typedef struct ffi_async_waiter_s {
+                          int fd;    // timerfd or watched file descriptor
+                         bool timer; // fd is owned timerfd
+            ffi_async_token_t token; // pending call
+    struct ffi_async_waiter_s *prev, *next;
+} ffi_async_waiter_t;
+
+static void ffi_async_ready(ffi_async_loop_t *loop, ffi_async_script_t *script) {
+    if (script->ready || script->done)
+        return;
+
+    script->ready = true;
+    script->next = NULL;
+    if (loop->ready_tail != NULL)
+        loop->ready_tail->next = script;
+    else
+        loop->ready = script;
+    loop->ready_tail = script;
+}
+
+static void ffi_async_unlink(ffi_async_loop_t *loop, ffi_async_waiter_t *waiter) {
+    if (waiter->prev != NULL)
+        waiter->prev->next = waiter->next;
+    else
+        loop->waiters = waiter->next;
+
+    if (waiter->next != NULL)
+        waiter->next->prev = waiter->prev;
+}
+
+static void ffi_async_release(ffi_async_loop_t *loop, ffi_async_waiter_t *waiter) {
+    ffi_async_unlink(loop, waiter);
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, waiter->fd, NULL);
+    if (waiter->timer)
+        close(waiter->fd);
+    free(waiter);
+}
+
+// run until end, end of slice or until no fiber of the thread is ready
+static void ffi_async_step(ffi_async_loop_t *loop, ffi_async_script_t *script) {
+    if (loop->slice != 0)
+        vm_refuel(&script->thread, loop->slice);
+
+    for (;;) {
+        vm_errors_t status = vm_run(&script->thread, script->program);
+
+        if (status == VM_ERR_OUTOFFUEL) {
+            ffi_async_ready(loop, script);
+            return;
+        }
+
+        if (status != VM_ERR_PENDING) {
+            script->done = true;
+            --loop->active;
+            return;
+        }
+#ifdef VM_ENABLE_FRAMES_ALIVE
+        if (ffi_fiber_park(&script->thread))
+            continue;
+#endif
+        return;
+    }
+}
+
+static void ffi_async_drain(ffi_async_loop_t *loop) {
+    uint64_t count;
+    ffi_async_post_t *posts;
+    uint32_t posts_qty;
+
+    if (read(loop->event_fd, &count, sizeof(count)) < 0)
+        return;
+
+    pthread_mutex_lock(&loop->lock);
+    posts = loop->posts;
+    posts_qty = loop->posts_qty;
+    loop->posts = NULL;
+    loop->posts_qty = 0;
+    loop->posts_size = 0;
+    pthread_mutex_unlock(&loop->lock);
+
+    for (uint32_t n = 0; n < posts_qty; n++)
+        ffi_async_complete(&posts[n].token, posts[n].value);
+    free(posts);
+}
+
+/////////////////
+vm_value_t ffi_async(vm_thread_t **thread, uint8_t fn, uint32_t arg) {
+    ffi_async_script_t *script = (*thread)->async;
+    vm_value_t ret = { .type = VM_VAL_BOOL };
+    ret.number.boolean = false;
+    uint32_t events = EPOLLIN;
+    int fd = -1;
+
+    switch (fn) {
+        case FFI_ASYNC_SLEEP: {
+            if (script == NULL)
+                break;
+
+            // zero it_value disarms the timer
+            struct itimerspec spec = { .it_value = { .tv_sec = arg / 1000, .tv_nsec = (arg % 1000) * 1000000 + (arg == 0) } };
+            fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+            if (fd >= 0 && timerfd_settime(fd, 0, &spec, NULL) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+            break;
+
+        case FFI_ASYNC_WRITABLE:
+            events = EPOLLOUT;
+            /* fall through */
+        case FFI_ASYNC_READABLE: {
+            vm_value_t value = vm_pop(thread);
+            if (script == NULL || (value.type != VM_VAL_INT && value.type != VM_VAL_UINT) || value.number.integer < 0)
+                break;
+            fd = value.number.integer;
+        }
+            break;
+    }
+
+    if (fd < 0)
+        return ret;
+
+    ffi_async_waiter_t *waiter = calloc(1, sizeof(ffi_async_waiter_t));
+    struct epoll_event event = { .events = events | EPOLLONESHOT, .data.ptr = waiter };
+    if (waiter == NULL || epoll_ctl(script->loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        if (fn == FFI_ASYNC_SLEEP)
+            close(fd);
+        free(waiter);
+        return ret;
+    }
+
+    waiter->fd = fd;
+    waiter->timer = (fn == FFI_ASYNC_SLEEP);
+    waiter->next = script->loop->waiters;
+    if (waiter->next != NULL)
+        waiter->next->prev = waiter;
+    script->loop->waiters = waiter;
+    ffi_async_suspend(thread, &waiter->token);
+
+    return ret;
+}
+
+ffi_async_loop_t* ffi_async_create(void) {
+    ffi_async_loop_t *loop = calloc(1, sizeof(ffi_async_loop_t));
+    if (loop == NULL)
+        return NULL;
+
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+    if (loop->epoll_fd < 0 || loop->event_fd < 0 || epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->event_fd, &event) != 0) {
+        if (loop->epoll_fd >= 0)
+            close(loop->epoll_fd);
+        if (loop->event_fd >= 0)
+            close(loop->event_fd);
+        free(loop);
+        return NULL;
+    }
+    pthread_mutex_init(&loop->lock, NULL);
+
+    return loop;
+}
+
+void ffi_async_destroy(ffi_async_loop_t *loop) {
+    if (loop == NULL)
+        return;
+
+    while (loop->waiters != NULL)
+        ffi_async_release(loop, loop->waiters);
+
+    for (uint32_t n = 0; n < loop->scripts_qty; n++) {
+        loop->scripts[n]->thread->async = NULL;
+        free(loop->scripts[n]);
+    }
+
+    close(loop->epoll_fd);
+    close(loop->event_fd);
+    pthread_mutex_destroy(&loop->lock);
+    free(loop->scripts);
+    free(loop->posts);
+    free(loop);
+}
+
+bool ffi_async_attach(ffi_async_loop_t *loop, vm_thread_t *thread, vm_program_t *program) {
+    if (thread->async != NULL)
+        return false;
+
+    ffi_async_script_t **scripts = realloc(loop->scripts, (loop->scripts_qty + 1) * sizeof(ffi_async_script_t*));
+    if (scripts == NULL)
+        return false;
+    loop->scripts = scripts;
+
+    ffi_async_script_t *script = calloc(1, sizeof(ffi_async_script_t));
+    if (script == NULL)
+        return false;
+
+    script->loop = loop;
+    script->thread = thread;
+    script->program = program;
+    loop->scripts[loop->scripts_qty++] = script;
+    thread->async = script;
+    ++loop->active;
+    ffi_async_ready(loop, script);
+
+    return true;
+}
+
+bool ffi_async_suspend(vm_thread_t **thread, ffi_async_token_t *token) {
+    if ((*thread)->async == NULL)
+        return false;
+
+    token->script = (*thread)->async;
+    token->fiber = 0;
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    if ((*thread)->fibers != NULL)
+        token->fiber = ((ffi_fiber_scheduler_t*) (*thread)->fibers)->current;
+#endif
+    token->token = vm_suspend(thread);
+
+    return true;
+}
+
+void ffi_async_complete(const ffi_async_token_t *token, vm_value_t value) {
+    ffi_async_script_t *script = token->script;
+
+    if (script->done)
+        return;
+
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    // parked fiber: back to the run queue, the thread runs again if it was waiting with no fiber ready
+    ffi_fiber_scheduler_t *scheduler = script->thread->fibers;
+    if (scheduler != NULL && scheduler->current != token->fiber) {
+        if (ffi_fiber_wake(&script->thread, token->fiber, token->token, value) && script->thread->status == VM_ERR_PENDING)
+            ffi_async_ready(script->loop, script);
+        return;
+    }
+#endif
+
+    if (vm_resume(&script->thread, token->token, value))
+        ffi_async_ready(script->loop, script);
+}
+
+bool ffi_async_post(const ffi_async_token_t *token, vm_value_t value) {
+    ffi_async_loop_t *loop = token->script->loop;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&loop->lock);
+    if (loop->posts_qty == loop->posts_size) {
+        uint32_t size = loop->posts_size == 0 ? 8 : loop->posts_size * 2;
+        ffi_async_post_t *posts = realloc(loop->posts, size * sizeof(ffi_async_post_t));
+        if (posts == NULL) {
+            pthread_mutex_unlock(&loop->lock);
+            return false;
+        }
+        loop->posts = posts;
+        loop->posts_size = size;
+    }
+    loop->posts[loop->posts_qty].token = *token;
+    loop->posts[loop->posts_qty].value = value;
+    ++loop->posts_qty;
+    pthread_mutex_unlock(&loop->lock);
+
+    return write(loop->event_fd, &one, sizeof(one)) == sizeof(one);
+}
+
+void ffi_async_run(ffi_async_loop_t *loop) {
+    struct epoll_event events[FFI_ASYNC_EVENTS];
+
+    while (loop->active > 0) {
+        // one turn of each ready thread, then events (without wait if a thread is still ready)
+        ffi_async_script_t *last = loop->ready_tail;
+        while (loop->ready != NULL) {
+            ffi_async_script_t *script = loop->ready;
+            loop->ready = script->next;
+            if (loop->ready == NULL)
+                loop->ready_tail = NULL;
+            script->ready = false;
+            ffi_async_step(loop, script);
+            if (script == last)
+                break;
+        }
+
+        if (loop->active == 0)
+            break;
+
+        int qty = epoll_wait(loop->epoll_fd, events, FFI_ASYNC_EVENTS, loop->ready != NULL ? 0 : -1);
+        if (qty < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (int n = 0; n < qty; n++) {
+            ffi_async_waiter_t *waiter = events[n].data.ptr;
+            if (waiter == NULL) {
+                ffi_async_drain(loop);
+                continue;
+            }
+
+            vm_value_t value = { .type = VM_VAL_BOOL };
+            value.number.boolean = (events[n].events & (EPOLLIN | EPOLLOUT)) != 0 && (events[n].events & EPOLLERR) == 0;
+            ffi_async_token_t token = waiter->token;
+            ffi_async_release(loop, waiter);
+            ffi_async_complete(&token, value);
+        }
+    }
+}
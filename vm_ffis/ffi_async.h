@@ -0,0 +1,170 @@
+/*
+ * @ffi_async.h
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#ifndef FFI_ASYNC_H_
+#define FFI_ASYNC_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "vm.h"
+
+#define FFI_ASYNC_EVENTS 64 // events read by one epoll_wait
+
+typedef enum {
+    FFI_ASYNC_SLEEP,    // wait arg milliseconds
+    FFI_ASYNC_READABLE, // wait until file descriptor (top of stack) is readable
+    FFI_ASYNC_WRITABLE, // wait until file descriptor (top of stack) is writable
+} ffi_async_fn_t;
+
+typedef struct ffi_async_loop_s ffi_async_loop_t;
+
+/**
+ * @struct ffi_async_script_s
+ * @brief Thread run by an event loop
+ */
+typedef struct ffi_async_script_s {
+          ffi_async_loop_t *loop;    /**< event loop */
+               vm_thread_t *thread;  /**< thread */
+              vm_program_t *program; /**< program */
+                      bool ready;    /**< in ready list */
+                      bool done;     /**< run ended (status not VM_ERR_PENDING) */
+    struct ffi_async_script_s *next; /**< next in ready list */
+} ffi_async_script_t;
+
+/**
+ * @struct ffi_async_token_s
+ * @brief Pending foreign call of a thread or fiber
+ */
+typedef struct ffi_async_token_s {
+    ffi_async_script_t *script; /**< script */
+              uint32_t fiber;   /**< fiber id (0: thread or no fibers) */
+              uint32_t token;   /**< token from vm_suspend */
+} ffi_async_token_t;
+
+/**
+ * @struct ffi_async_post_s
+ * @brief Completion posted from another OS thread
+ */
+typedef struct ffi_async_post_s {
+    ffi_async_token_t token; /**< pending call */
+           vm_value_t value; /**< result */
+} ffi_async_post_t;
+
+/**
+ * @struct ffi_async_loop_s
+ * @brief Event loop: epoll for timers and file descriptors, eventfd for completions from other OS threads
+ */
+struct ffi_async_loop_s {
+                          int epoll_fd;    /**< epoll instance */
+                          int event_fd;    /**< wakeup for posted completions */
+          ffi_async_script_t **scripts;    /**< attached scripts */
+                     uint32_t scripts_qty; /**< attached scripts quantity */
+                     uint32_t active;      /**< scripts not done */
+           ffi_async_script_t *ready;      /**< ready list head */
+           ffi_async_script_t *ready_tail; /**< ready list tail */
+                     uint32_t slice;       /**< fuel of each thread per turn (0: run until suspend or end, see vm_refuel) */
+    struct ffi_async_waiter_s *waiters;    /**< pending timers and file descriptors */
+              pthread_mutex_t lock;        /**< protect posts */
+             ffi_async_post_t *posts;      /**< posted completions */
+                     uint32_t posts_qty;   /**< posted completions quantity */
+                     uint32_t posts_size;  /**< allocated posts */
+};
+
+/**
+ * @fn vm_value_t ffi_async(vm_thread_t **thread, uint8_t fn, uint32_t arg)
+ * @brief Asynchronous waits. The calling thread or fiber is suspended, the others attached to the loop keep running.
+ * Only for threads attached to an event loop (return false otherwise).
+ * This functions support functions:
+ *      SLEEP: Wait arg milliseconds. Return true.
+ *   READABLE: Wait until file descriptor (top of stack, INT or UINT) is readable. Return false on error or hang up.
+ *   WRITABLE: Wait until file descriptor (top of stack, INT or UINT) is writable. Return false on error or hang up.
+ *
+ * @param thread Thread
+ * @param fn Function
+ * @param arg Argument
+ * @return Value
+ */
+vm_value_t ffi_async(vm_thread_t **thread, uint8_t fn, uint32_t arg);
+
+/**
+ * @fn ffi_async_loop_t* ffi_async_create(void)
+ * @brief Create event loop
+ *
+ * @return Event loop (NULL: fail)
+ */
+ffi_async_loop_t* ffi_async_create(void);
+
+/**
+ * @fn void ffi_async_destroy(ffi_async_loop_t *loop)
+ * @brief Destroy event loop. Pending waits are dropped and threads are detached (not destroyed)
+ *
+ * @param loop Event loop
+ */
+void ffi_async_destroy(ffi_async_loop_t *loop);
+
+/**
+ * @fn bool ffi_async_attach(ffi_async_loop_t *loop, vm_thread_t *thread, vm_program_t *program)
+ * @brief Attach a thread to run its program in the event loop
+ *
+ * @param loop Event loop
+ * @param thread Thread
+ * @param program Program
+ * @return false if fail
+ */
+bool ffi_async_attach(ffi_async_loop_t *loop, vm_thread_t *thread, vm_program_t *program);
+
+/**
+ * @fn bool ffi_async_suspend(vm_thread_t **thread, ffi_async_token_t *token)
+ * @brief Suspend the current foreign call of an attached thread (or its current fiber). For foreign functions that complete later.
+ *
+ * @param thread Thread
+ * @param token Pending call (for ffi_async_complete / ffi_async_post)
+ * @return false if thread is not attached to an event loop
+ */
+bool ffi_async_suspend(vm_thread_t **thread, ffi_async_token_t *token);
+
+/**
+ * @fn void ffi_async_complete(const ffi_async_token_t *token, vm_value_t value)
+ * @brief Complete a pending call. Only from the thread that runs the event loop
+ *
+ * @param token Pending call
+ * @param value Result (ret_val of the suspended thread or fiber)
+ */
+void ffi_async_complete(const ffi_async_token_t *token, vm_value_t value);
+
+/**
+ * @fn bool ffi_async_post(const ffi_async_token_t *token, vm_value_t value)
+ * @brief Complete a pending call from any OS thread (the event loop is woken by eventfd)
+ *
+ * @param token Pending call
+ * @param value Result (ret_val of the suspended thread or fiber)
+ * @return false if fail
+ */
+bool ffi_async_post(const ffi_async_token_t *token, vm_value_t value);
+
+/**
+ * @fn void ffi_async_run(ffi_async_loop_t *loop)
+ * @brief Run attached threads until all of them end (status of each one in its thread).
+ * Ready threads run in turns (FIFO). With slice, a thread out of fuel goes to the end of the ready list.
+ *
+ * @param loop Event loop
+ */
+void ffi_async_run(ffi_async_loop_t *loop);
+
+#endif /* FFI_ASYNC_H_ */
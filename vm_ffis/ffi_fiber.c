@@ -0,0 +1,315 @@
+/*
+ * @ffi_fiber.c
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "ffi_fiber.h"
+
+#define FFI_FIBER_INITIAL_QTY 16 // fibers allocated on first use (grows on demand)
+
+static ffi_fiber_scheduler_t* ffi_fiber_scheduler(vm_thread_t **thread) {
+    if ((*thread)->fibers == NULL) {
+        ffi_fiber_scheduler_t *scheduler = calloc(1, sizeof(ffi_fiber_scheduler_t));
+        if (scheduler == NULL)
+            return NULL;
+        if ((scheduler->fibers = calloc(FFI_FIBER_INITIAL_QTY, sizeof(ffi_fiber_t))) == NULL) {
+            free(scheduler);
+            return NULL;
+        }
+        scheduler->size = FFI_FIBER_INITIAL_QTY;
+        scheduler->qty = 1;
+        scheduler->current = 0;
+        scheduler->head = FFI_FIBER_NONE;
+        scheduler->tail = FFI_FIBER_NONE;
+        scheduler->free_id = 1;
+        scheduler->fibers[0].in_use = true;
+        (*thread)->fibers = scheduler;
+        (*thread)->fibers_destroy = ffi_fiber_destroy;
+    }
+
+    return (*thread)->fibers;
+}
+
+///// run queue /////
+static void ffi_fiber_queue_push(ffi_fiber_scheduler_t *scheduler, uint32_t id) {
+    scheduler->fibers[id].next = FFI_FIBER_NONE;
+    scheduler->fibers[id].prev = scheduler->tail;
+
+    if (scheduler->tail != FFI_FIBER_NONE)
+        scheduler->fibers[scheduler->tail].next = id;
+    else
+        scheduler->head = id;
+    scheduler->tail = id;
+}
+
+static void ffi_fiber_queue_remove(ffi_fiber_scheduler_t *scheduler, uint32_t id) {
+    ffi_fiber_t *fiber = &scheduler->fibers[id];
+
+    if (fiber->prev != FFI_FIBER_NONE)
+        scheduler->fibers[fiber->prev].next = fiber->next;
+    else
+        scheduler->head = fiber->next;
+
+    if (fiber->next != FFI_FIBER_NONE)
+        scheduler->fibers[fiber->next].prev = fiber->prev;
+    else
+        scheduler->tail = fiber->prev;
+}
+
+static uint32_t ffi_fiber_queue_pop(ffi_fiber_scheduler_t *scheduler) {
+    uint32_t id = scheduler->head;
+
+    if (id != FFI_FIBER_NONE)
+        ffi_fiber_queue_remove(scheduler, id);
+
+    return id;
+}
+
+///// context /////
+static void ffi_fiber_save(vm_thread_t **thread, ffi_fiber_t *fiber) {
+    fiber->pc = (*thread)->pc;
+    fiber->fp = (*thread)->fp;
+    fiber->sp = (*thread)->sp;
+    fiber->fc = (*thread)->fc;
+    fiber->indirect = (*thread)->indirect;
+    fiber->ret_val = (*thread)->ret_val;
+    fiber->pending = (*thread)->pending;
+    fiber->frames = (*thread)->frames;
+    fiber->frames_size = (*thread)->frames_size;
+    fiber->frame_exist = (*thread)->frame_exist;
+    fiber->stack = (*thread)->stack;
+    fiber->stack_size = (*thread)->stack_size;
+    fiber->stack_grow = (*thread)->stack_grow;
+}
+
+static void ffi_fiber_load(vm_thread_t **thread, const ffi_fiber_t *fiber) {
+    (*thread)->pc = fiber->pc;
+    (*thread)->fp = fiber->fp;
+    (*thread)->sp = fiber->sp;
+    (*thread)->fc = fiber->fc;
+    (*thread)->indirect = fiber->indirect;
+    (*thread)->ret_val = fiber->ret_val;
+    (*thread)->pending = fiber->pending;
+    (*thread)->frames = fiber->frames;
+    (*thread)->frames_size = fiber->frames_size;
+    (*thread)->frame_exist = fiber->frame_exist;
+    (*thread)->stack = fiber->stack;
+    (*thread)->stack_size = fiber->stack_size;
+    (*thread)->stack_grow = fiber->stack_grow;
+}
+
+// the switching call returns true to the fiber left when it runs again (a parked one gets the result of its pending call)
+static void ffi_fiber_switch(vm_thread_t **thread, ffi_fiber_scheduler_t *scheduler, uint32_t id) {
+    ffi_fiber_save(thread, &scheduler->fibers[scheduler->current]);
+    scheduler->fibers[scheduler->current].ret_val.type = VM_VAL_BOOL;
+    scheduler->fibers[scheduler->current].ret_val.number.boolean = true;
+    ffi_fiber_load(thread, &scheduler->fibers[id]);
+    scheduler->current = id;
+}
+
+// fiber is not running: its context is only in the scheduler
+static void ffi_fiber_release(vm_thread_t **thread, ffi_fiber_scheduler_t *scheduler, uint32_t id) {
+    ffi_fiber_t *fiber = &scheduler->fibers[id];
+
+    for (uint32_t n = 1; n <= fiber->fc; n++)
+        if (vm_wordpos_isset_bit(fiber->frame_exist, n))
+            vm_heap_gc_collect((*thread)->heap, &(fiber->frames[n].gc_mark), true, thread, false);
+    vm_heap_gc_collect((*thread)->heap, &(fiber->frames[0].gc_mark), true, thread, false);
+
+    for (uint32_t n = 0; n < fiber->sp; n++)
+        STK_FREECSTR(thread, fiber->stack[n]);
+
+    free(fiber->stack);
+    free(fiber->frames);
+    free(fiber->frame_exist);
+    fiber->in_use = false;
+
+    --scheduler->qty;
+    if (id < scheduler->free_id)
+        scheduler->free_id = id;
+}
+
+static uint32_t ffi_fiber_new(vm_thread_t **thread, ffi_fiber_scheduler_t *scheduler, uint32_t pc) {
+    uint32_t id = scheduler->free_id;
+
+    while (id < scheduler->size && scheduler->fibers[id].in_use)
+        ++id;
+
+    if (id == scheduler->size) {
+        if (scheduler->size >= FFI_FIBER_NONE / 2)
+            return FFI_FIBER_NONE;
+
+        ffi_fiber_t *fibers = realloc(scheduler->fibers, scheduler->size * 2 * sizeof(ffi_fiber_t));
+        if (fibers == NULL)
+            return FFI_FIBER_NONE;
+        memset(fibers + scheduler->size, 0, scheduler->size * sizeof(ffi_fiber_t));
+        scheduler->fibers = fibers;
+        scheduler->size *= 2;
+    }
+
+    ffi_fiber_t *fiber = &scheduler->fibers[id];
+    memset(fiber, 0, sizeof(ffi_fiber_t));
+    fiber->stack = malloc(FFI_FIBER_STACK_SIZE * sizeof(vm_value_t));
+    fiber->frames = malloc(FFI_FIBER_FRAMES_SIZE * sizeof(vm_frame_t));
+    fiber->frame_exist = calloc(ID_ALLOC_WORD((*thread)->max_call_depth) + 1, sizeof(uint32_t));
+    if (fiber->stack == NULL || fiber->frames == NULL || fiber->frame_exist == NULL) {
+        free(fiber->stack);
+        free(fiber->frames);
+        free(fiber->frame_exist);
+        return FFI_FIBER_NONE;
+    }
+
+    fiber->in_use = true;
+    fiber->pc = pc;
+    fiber->stack_size = FFI_FIBER_STACK_SIZE;
+    fiber->stack_grow = true;
+    fiber->frames_size = FFI_FIBER_FRAMES_SIZE;
+    memset(&fiber->frames[0], 0, sizeof(vm_frame_t));
+    fiber->frames[0].gc_mark = vm_heap_new_gc_mark((*thread)->heap);
+    fiber->ret_val.type = VM_VAL_NULL;
+
+    // argument of the fiber
+    if ((*thread)->sp > 0)
+        fiber->stack[0] = vm_pop(thread);
+    else
+        fiber->stack[0].type = VM_VAL_NULL;
+    fiber->sp = 1;
+
+    ++scheduler->qty;
+    scheduler->free_id = id + 1;
+
+    return id;
+}
+
+/////////////////
+vm_value_t ffi_fiber(vm_thread_t **thread, uint8_t fn, uint32_t arg) {
+    ffi_fiber_scheduler_t *scheduler = ffi_fiber_scheduler(thread);
+    vm_value_t ret = { .type = VM_VAL_BOOL };
+    ret.number.boolean = false;
+
+    if (scheduler == NULL)
+        return ret;
+
+    switch (fn) {
+        case FFI_FIBER_ENQUEUE: {
+            uint32_t id = ffi_fiber_new(thread, scheduler, arg);
+            if (id != FFI_FIBER_NONE) {
+                ffi_fiber_queue_push(scheduler, id);
+                ret.type = VM_VAL_UINT;
+                ret.number.uinteger = id;
+            }
+        }
+            break;
+
+        case FFI_FIBER_DEQUEUE: {
+            uint32_t id = scheduler->current;
+            if (id == 0)
+                break;
+
+            // fiber 0 is ready or parked when another fiber runs. If parked the thread goes on waiting for its pending call
+            uint32_t next = ffi_fiber_queue_pop(scheduler);
+            ffi_fiber_switch(thread, scheduler, next == FFI_FIBER_NONE ? 0 : next);
+            ffi_fiber_release(thread, scheduler, id);
+            ret = (*thread)->ret_val;
+        }
+            break;
+
+        case FFI_FIBER_CURRENT:
+            ret.type = VM_VAL_UINT;
+            ret.number.uinteger = scheduler->current;
+            break;
+
+        case FFI_FIBER_RESUME: {
+            vm_value_t id = vm_pop(thread);
+            if (id.type != VM_VAL_UINT || id.number.uinteger >= scheduler->size || !scheduler->fibers[id.number.uinteger].in_use
+                    || id.number.uinteger == scheduler->current || scheduler->fibers[id.number.uinteger].pending != 0)
+                break;
+
+            ffi_fiber_queue_remove(scheduler, id.number.uinteger);
+            ffi_fiber_queue_push(scheduler, scheduler->current);
+            ffi_fiber_switch(thread, scheduler, id.number.uinteger);
+            ret = (*thread)->ret_val;
+        }
+            break;
+
+        case FFI_FIBER_YIELD: {
+            uint32_t id = ffi_fiber_queue_pop(scheduler);
+            if (id == FFI_FIBER_NONE)
+                break;
+
+            ffi_fiber_queue_push(scheduler, scheduler->current);
+            ffi_fiber_switch(thread, scheduler, id);
+            ret = (*thread)->ret_val;
+        }
+            break;
+    }
+
+    return ret;
+}
+
+bool ffi_fiber_park(vm_thread_t **thread) {
+    ffi_fiber_scheduler_t *scheduler = (*thread)->fibers;
+
+    if (scheduler == NULL || (*thread)->status != VM_ERR_PENDING)
+        return false;
+
+    uint32_t id = ffi_fiber_queue_pop(scheduler);
+    if (id == FFI_FIBER_NONE)
+        return false;
+
+    ffi_fiber_switch(thread, scheduler, id);
+    (*thread)->status = VM_ERR_OK;
+    (*thread)->halted = false;
+
+    return true;
+}
+
+bool ffi_fiber_wake(vm_thread_t **thread, uint32_t id, uint32_t token, vm_value_t value) {
+    ffi_fiber_scheduler_t *scheduler = (*thread)->fibers;
+
+    if (scheduler == NULL || id >= scheduler->size || !scheduler->fibers[id].in_use || id == scheduler->current || token == 0
+            || scheduler->fibers[id].pending != token)
+        return false;
+
+    scheduler->fibers[id].pending = 0;
+    scheduler->fibers[id].ret_val = value;
+    ffi_fiber_queue_push(scheduler, id);
+
+    return true;
+}
+
+void ffi_fiber_destroy(vm_thread_t **thread) {
+    ffi_fiber_scheduler_t *scheduler = (*thread)->fibers;
+
+    if (scheduler == NULL)
+        return;
+
+    if (scheduler->current != 0)
+        ffi_fiber_switch(thread, scheduler, 0);
+
+    for (uint32_t id = 1; id < scheduler->size; id++)
+        if (scheduler->fibers[id].in_use)
+            ffi_fiber_release(thread, scheduler, id);
+
+    free(scheduler->fibers);
+    free(scheduler);
+    (*thread)->fibers = NULL;
+}
@@ -0,0 +1,121 @@
+/*
+ * @ffi_fiber.h
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#ifndef FFI_FIBER_H_
+#define FFI_FIBER_H_
+
+#include <stdint.h>
+
+#include "vm.h"
+
+#ifndef VM_ENABLE_FRAMES_ALIVE
+#error "ffi_fiber needs VM_ENABLE_FRAMES_ALIVE"
+#endif
+
+#define FFI_FIBER_STACK_SIZE  16         // initial stack slots of a fiber (grows on demand)
+#define FFI_FIBER_FRAMES_SIZE 4          // initial frames of a fiber (grows on demand up to max_call_depth)
+#define FFI_FIBER_NONE        0xffffffff // no fiber (end of run queue)
+
+typedef enum {
+    FFI_FIBER_ENQUEUE, // enqueue function
+    FFI_FIBER_DEQUEUE, // dequeue function
+    FFI_FIBER_CURRENT, // fiber id for this function
+    FFI_FIBER_RESUME,  // resume fiber id
+    FFI_FIBER_YIELD,   // return to scheduler
+} ffi_fiber_fn_t;
+
+/**
+ * @struct ffi_fiber_s
+ * @brief Fiber execution context (swapped with the one of the thread on switch)
+ */
+typedef struct ffi_fiber_s {
+        bool in_use;         /**< fiber exist */
+    uint32_t pc, fp, sp;     /**< program counter, frame pointer, stack pointer */
+    uint32_t fc;             /**< frame counter */
+    uint32_t indirect;       /**< indirect register */
+  vm_value_t ret_val;        /**< return value from CALL / CALL_FOREIGN */
+    uint32_t pending;        /**< token of the pending foreign call (0: none, not 0 and not current: parked) */
+  vm_frame_t *frames;        /**< frames */
+    uint32_t frames_size;    /**< allocated frames */
+    uint32_t *frame_exist;   /**< frames alive */
+  vm_value_t *stack;         /**< stack */
+    uint32_t stack_size;     /**< stack slots */
+        bool stack_grow;     /**< stack grows on demand */
+    uint32_t prev, next;     /**< run queue links (FFI_FIBER_NONE: none) */
+} ffi_fiber_t;
+
+/**
+ * @struct ffi_fiber_scheduler_s
+ * @brief Fibers of a thread. Fiber 0 is the thread itself
+ */
+typedef struct ffi_fiber_scheduler_s {
+    ffi_fiber_t *fibers;     /**< fibers by id */
+       uint32_t size;        /**< allocated fibers */
+       uint32_t qty;         /**< fibers in use (fiber 0 included) */
+       uint32_t current;     /**< running fiber */
+       uint32_t head, tail;  /**< run queue (fibers ready to run, current not included) */
+       uint32_t free_id;     /**< lowest id that may be free */
+} ffi_fiber_scheduler_t;
+
+/**
+ * @fn vm_value_t ffi_fiber(vm_thread_t **thread, uint8_t fn, uint32_t arg)
+ * @brief Fibers: cooperative execution contexts on one thread (shared heap and globals, own stack and frames)
+ * This functions support functions:
+ *   ENQUEUE: Create a fiber that starts in address arg with top of stack (moved) as only stack value. Return fiber id.
+ *   DEQUEUE: End current fiber (not 0) and run next one.
+ *   CURRENT: Return current fiber id.
+ *    RESUME: Run fiber id (top of stack). Current fiber goes to the end of the run queue. Return false if not runnable.
+ *     YIELD: Run next fiber of the run queue. Current fiber goes to the end. Return false if there are no other fiber.
+ *
+ * @param thread Thread
+ * @param fn Function
+ * @param arg Argument
+ * @return Value (false if the scheduler can't be allocated)
+ */
+vm_value_t ffi_fiber(vm_thread_t **thread, uint8_t fn, uint32_t arg);
+
+/**
+ * @fn bool ffi_fiber_park(vm_thread_t **thread)
+ * @brief Park the current fiber of a thread suspended on a foreign call (VM_ERR_PENDING) and run the next ready one.
+ * A parked fiber is out of the run queue until ffi_fiber_wake.
+ *
+ * @param thread Thread
+ * @return false if there is no ready fiber (thread stays pending)
+ */
+bool ffi_fiber_park(vm_thread_t **thread);
+
+/**
+ * @fn bool ffi_fiber_wake(vm_thread_t **thread, uint32_t id, uint32_t token, vm_value_t value)
+ * @brief Complete the pending foreign call of a parked fiber (value goes to its ret_val) and put it at the end of the run queue.
+ *
+ * @param thread Thread
+ * @param id Fiber id
+ * @param token Token from vm_suspend
+ * @param value Result of the foreign call
+ * @return false if fiber is not parked on token
+ */
+bool ffi_fiber_wake(vm_thread_t **thread, uint32_t id, uint32_t token, vm_value_t value);
+
+/**
+ * @fn void ffi_fiber_destroy(vm_thread_t **thread)
+ * @brief Release all fibers and restore the context of fiber 0. Called by vm_thread_reset / vm_destroy_thread (can be called before)
+ *
+ * @param thread Thread
+ */
+void ffi_fiber_destroy(vm_thread_t **thread);
+
+#endif /* FFI_FIBER_H_ */
@@ -0,0 +1,346 @@
+/*
+ * @ffi_parallel.c
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "vm.h"
+#include "ffi_parallel.h"
+
+// values that mean the same on any thread
+static bool ffi_parallel_portable(vm_value_t value) {
+    switch (value.type) {
+        case VM_VAL_NULL:
+        case VM_VAL_BOOL:
+        case VM_VAL_UINT:
+        case VM_VAL_INT:
+        case VM_VAL_FLOAT:
+            return true;
+        case VM_VAL_CONST_STRING:
+            return VM_CSTR_IS_PROGRAM(value) && !VM_CSTR_IS_INTERNED(value);
+        default:
+            return false;
+    }
+}
+
+static void ffi_parallel_fail(ffi_parallel_task_t *task, vm_errors_t status) {
+    uint32_t ok = VM_ERR_OK;
+    atomic_compare_exchange_strong(&task->status, &ok, status);
+}
+
+// call function of task on the child thread of worker
+static bool ffi_parallel_call(ffi_parallel_worker_t *worker, ffi_parallel_task_t *task, vm_value_t a, vm_value_t b, uint8_t nargs, vm_value_t *result) {
+    vm_thread_t **thread = &worker->thread;
+    vm_program_t *program = worker->pool->program;
+
+    (*thread)->externals = task->externals;
+    vm_push(thread, a);
+    if (nargs > 1)
+        vm_push(thread, b);
+
+    // return address is the end of program: the run ends with the return
+    (*thread)->pc = program->prog_len;
+    if (!vm_push_frame(thread, nargs)) {
+        ffi_parallel_fail(task, VM_ERR_OUTOFMEMORY);
+        vm_thread_reset(thread);
+        return false;
+    }
+    (*thread)->pc = task->pc;
+    vm_run(thread, program);
+
+    if ((*thread)->status != VM_ERR_OK || (*thread)->fc != 0 || !ffi_parallel_portable((*thread)->ret_val)) {
+        ffi_parallel_fail(task, (*thread)->status != VM_ERR_OK ? (*thread)->status : VM_ERR_BAD_VALUE);
+        vm_thread_reset(thread);
+        return false;
+    }
+
+    *result = (*thread)->ret_val;
+    return true;
+}
+
+// chunks of qty indexes (64 bits: qty near UINT32_MAX must not wrap)
+static inline uint32_t ffi_parallel_chunks(uint32_t qty) {
+    return ((uint64_t) qty + FFI_PARALLEL_CHUNK - 1) / FFI_PARALLEL_CHUNK;
+}
+
+// take chunks until all are taken or a call fails
+static void ffi_parallel_work(ffi_parallel_worker_t *worker, ffi_parallel_task_t *task) {
+    uint32_t chunks = ffi_parallel_chunks(task->qty);
+    vm_value_t index = { .type = VM_VAL_UINT };
+    vm_value_t result;
+
+    for (;;) {
+        uint32_t chunk = atomic_fetch_add(&task->next, 1);
+        if (chunk >= chunks || atomic_load_explicit(&task->status, memory_order_relaxed) != VM_ERR_OK)
+            return;
+
+        uint64_t first = (uint64_t) chunk * FFI_PARALLEL_CHUNK;
+        uint64_t last = first + FFI_PARALLEL_CHUNK < task->qty ? first + FFI_PARALLEL_CHUNK : task->qty;
+
+        switch (task->fn) {
+            case FFI_PARALLEL_MAP:
+                for (uint64_t n = first; n < last; n++) {
+                    index.number.uinteger = n;
+                    if (!ffi_parallel_call(worker, task, task->in[n], index, 2, &task->out[n]))
+                        return;
+                }
+                break;
+
+            case FFI_PARALLEL_FOR:
+                for (uint64_t n = first; n < last; n++) {
+                    index.number.uinteger = n;
+                    if (!ffi_parallel_call(worker, task, index, index, 1, &result))
+                        return;
+                }
+                break;
+
+            case FFI_PARALLEL_REDUCE:
+                // chunk bounds only depend on qty: same partials for any number of workers
+                result = task->in[first];
+                for (uint64_t n = first + 1; n < last; n++)
+                    if (!ffi_parallel_call(worker, task, result, task->in[n], 2, &result))
+                        return;
+                task->out[chunk] = result;
+                break;
+        }
+    }
+}
+
+static void* ffi_parallel_worker(void *arg) {
+    ffi_parallel_worker_t *worker = arg;
+    ffi_parallel_t *pool = worker->pool;
+    uint64_t generation = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->stop && pool->generation == generation)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop)
+            break;
+
+        generation = pool->generation;
+        ffi_parallel_task_t *task = pool->task;
+        pthread_mutex_unlock(&pool->lock);
+
+        ffi_parallel_work(worker, task);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+// run task on all workers, the calling OS thread is worker 0
+static vm_errors_t ffi_parallel_run(ffi_parallel_t *pool, ffi_parallel_task_t *task) {
+    uint32_t chunks = ffi_parallel_chunks(task->qty);
+    bool wake = chunks > 1 && pool->workers_qty > 1;
+
+    atomic_init(&task->next, 0);
+    atomic_init(&task->status, VM_ERR_OK);
+
+    if (wake) {
+        pthread_mutex_lock(&pool->lock);
+        pool->task = task;
+        pool->running = pool->workers_qty - 1;
+        ++pool->generation;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    ffi_parallel_work(&pool->workers[0], task);
+
+    if (wake) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->running > 0)
+            pthread_cond_wait(&pool->done, &pool->lock);
+        pool->task = NULL;
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return atomic_load(&task->status);
+}
+
+// elements of an array on stack, all portable
+static vm_value_t* ffi_parallel_elements(vm_thread_t **thread, vm_value_t array, uint32_t *qty) {
+    if (array.type != VM_VAL_ARRAY || vm_heap_type((*thread)->heap, array.heap_ref) != VM_VAL_ARRAY)
+        return NULL;
+
+    vm_heap_object_t *arr = vm_heap_load((*thread)->heap, array.heap_ref);
+    for (uint32_t n = 0; n < arr->array.qty; n++)
+        if (!ffi_parallel_portable(arr->array.fields[n]))
+            return NULL;
+
+    *qty = arr->array.qty;
+    return arr->array.fields;
+}
+
+/////////////////
+vm_value_t ffi_parallel(vm_thread_t **thread, uint8_t fn, uint32_t arg) {
+    ffi_parallel_t *pool = (*thread)->parallel;
+    ffi_parallel_task_t task = { .fn = fn, .pc = arg, .externals = (*thread)->externals };
+    vm_value_t ret = { .type = VM_VAL_NULL };
+    vm_value_t initial = ret;
+
+    switch (fn) {
+        case FFI_PARALLEL_MAP: {
+            vm_value_t array = vm_pop(thread);
+            if (pool == NULL || (task.in = ffi_parallel_elements(thread, array, &task.qty)) == NULL)
+                break;
+
+            vm_heap_object_t arr;
+            arr.array.qty = task.qty;
+            arr.array.fields = malloc(task.qty * sizeof(vm_value_t));
+            if (arr.array.fields == NULL)
+                break;
+            task.out = arr.array.fields;
+
+            pthread_mutex_lock(&pool->call);
+            vm_errors_t status = ffi_parallel_run(pool, &task);
+            pthread_mutex_unlock(&pool->call);
+
+            uint32_t ref = 0xffffffff;
+            if (status == VM_ERR_OK)
+                ref = vm_heap_save((*thread)->heap, VM_VAL_ARRAY, false, arr, &((*thread)->frames[(*thread)->fc].gc_mark));
+            if (ref == 0xffffffff) {
+                free(arr.array.fields);
+                break;
+            }
+
+            ret.type = VM_VAL_ARRAY;
+            ret.heap_ref = ref;
+        }
+            break;
+
+        case FFI_PARALLEL_FOR: {
+            vm_value_t qty = vm_pop(thread);
+            ret.type = VM_VAL_BOOL;
+            ret.number.boolean = false;
+            if (pool == NULL || qty.type != VM_VAL_UINT)
+                break;
+
+            task.qty = qty.number.uinteger;
+            pthread_mutex_lock(&pool->call);
+            ret.number.boolean = ffi_parallel_run(pool, &task) == VM_ERR_OK;
+            pthread_mutex_unlock(&pool->call);
+        }
+            break;
+
+        case FFI_PARALLEL_REDUCE: {
+            vm_value_t array = vm_pop(thread);
+            initial = vm_pop(thread);
+            if (pool == NULL || !ffi_parallel_portable(initial) || (task.in = ffi_parallel_elements(thread, array, &task.qty)) == NULL)
+                break;
+
+            uint32_t chunks = ffi_parallel_chunks(task.qty);
+            task.out = malloc(chunks * sizeof(vm_value_t));
+            if (task.out == NULL)
+                break;
+
+            // partials in parallel, then folded in order from initial value
+            pthread_mutex_lock(&pool->call);
+            if (ffi_parallel_run(pool, &task) == VM_ERR_OK) {
+                vm_value_t acc = initial;
+                uint32_t n = 0;
+                while (n < chunks && ffi_parallel_call(&pool->workers[0], &task, acc, task.out[n], 2, &acc))
+                    ++n;
+                if (n == chunks)
+                    ret = acc;
+            }
+            pthread_mutex_unlock(&pool->call);
+            free(task.out);
+        }
+            break;
+    }
+
+    return ret;
+}
+
+ffi_parallel_t* ffi_parallel_create(vm_program_t *program, uint32_t workers, const vm_thread_config_t *config) {
+    ffi_parallel_t *pool = calloc(1, sizeof(ffi_parallel_t));
+    if (pool == NULL)
+        return NULL;
+
+    if (workers == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cores > 0 ? cores : 1;
+    }
+
+    pool->program = program;
+    pthread_mutex_init(&pool->call, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pool->workers = calloc(workers, sizeof(ffi_parallel_worker_t));
+    if (pool->workers == NULL) {
+        ffi_parallel_destroy(pool);
+        return NULL;
+    }
+
+    for (uint32_t n = 0; n < workers; n++) {
+        pool->workers[n].pool = pool;
+        vm_create_thread(&pool->workers[n].thread, config);
+        if (pool->workers[n].thread == NULL)
+            break;
+        ++pool->workers_qty;
+    }
+
+    // worker 0 is the calling thread
+    for (uint32_t n = 1; n < pool->workers_qty; n++) {
+        if (pthread_create(&pool->workers[n].id, NULL, ffi_parallel_worker, &pool->workers[n]) != 0) {
+            for (uint32_t m = n; m < pool->workers_qty; m++)
+                vm_destroy_thread(&pool->workers[m].thread);
+            pool->workers_qty = n;
+            break;
+        }
+    }
+
+    if (pool->workers_qty == 0) {
+        ffi_parallel_destroy(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void ffi_parallel_destroy(ffi_parallel_t *pool) {
+    if (pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (uint32_t n = 1; n < pool->workers_qty; n++)
+        pthread_join(pool->workers[n].id, NULL);
+    for (uint32_t n = 0; n < pool->workers_qty; n++)
+        vm_destroy_thread(&pool->workers[n].thread);
+
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->call);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,119 @@
+/*
+ * @ffi_parallel.h
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#ifndef FFI_PARALLEL_H_
+#define FFI_PARALLEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "vm.h"
+
+#define FFI_PARALLEL_CHUNK 8 // indexes taken by a worker at once (and elements of each partial reduction)
+
+typedef enum {
+    FFI_PARALLEL_MAP,    // new array with f(element, index) of each element of array (top of stack)
+    FFI_PARALLEL_FOR,    // call f(index) for index 0 to n - 1 (top of stack)
+    FFI_PARALLEL_REDUCE, // fold array (top of stack) with f(accumulator, element) from initial value (second)
+} ffi_parallel_fn_t;
+
+typedef struct ffi_parallel_s ffi_parallel_t;
+
+/**
+ * @struct ffi_parallel_task_s
+ * @brief (internal) Call in progress, shared by the workers
+ */
+typedef struct ffi_parallel_task_s {
+                uint8_t fn;        /**< function */
+               uint32_t pc;        /**< address of the function called for each index */
+            vm_ffilib_t *externals; /**< externals of the calling thread */
+             vm_value_t *in;       /**< elements (NULL: FOR) */
+             vm_value_t *out;      /**< results (MAP) or partial reductions (REDUCE, one per chunk) */
+               uint32_t qty;       /**< indexes */
+       _Atomic uint32_t next;      /**< next chunk */
+       _Atomic uint32_t status;    /**< first error (VM_ERR_OK: none) */
+} ffi_parallel_task_t;
+
+/**
+ * @struct ffi_parallel_worker_s
+ * @brief Worker: OS thread with its child thread
+ */
+typedef struct ffi_parallel_worker_s {
+    ffi_parallel_t *pool;   /**< pool */
+         pthread_t id;      /**< OS thread */
+       vm_thread_t *thread; /**< child thread (calls run on it, reset only after an error) */
+} ffi_parallel_worker_t;
+
+/**
+ * @struct ffi_parallel_s
+ * @brief Pool of child threads for a program. The calling thread takes part with its own child (worker 0)
+ */
+struct ffi_parallel_s {
+             vm_program_t *program;     /**< program (shared, never modified) */
+    ffi_parallel_worker_t *workers;     /**< workers (0: the calling OS thread, not started) */
+                 uint32_t workers_qty;  /**< workers quantity */
+          pthread_mutex_t call;         /**< one call at a time */
+          pthread_mutex_t lock;         /**< protect task, generation and running */
+           pthread_cond_t start;        /**< new task */
+           pthread_cond_t done;         /**< workers out of task */
+      ffi_parallel_task_t *task;        /**< task in progress */
+                 uint64_t generation;   /**< task number */
+                 uint32_t running;      /**< started workers still in task */
+                     bool stop;         /**< workers end */
+};
+
+/**
+ * @fn vm_value_t ffi_parallel(vm_thread_t **thread, uint8_t fn, uint32_t arg)
+ * @brief Data parallel calls on child threads. Only for threads with a pool (return NULL otherwise).
+ * arg is the address of a function (as CALL), it runs on child threads: it only sees its arguments and its own globals.
+ * Array elements, arguments and results must be numbers, bool, NULL or program constant strings.
+ * This functions support functions:
+ *      MAP: Return a new array with the result of f(element, index) of each element of array (top of stack). NULL if fail.
+ *      FOR: Call f(index) for index 0 to n - 1 (UINT, top of stack). Return false if fail.
+ *   REDUCE: Fold array (top of stack) from initial value (second) with f(accumulator, element). NULL if fail.
+ *           f must be associative: elements are reduced in fixed chunks of FFI_PARALLEL_CHUNK and chunk results are
+ *           folded in order, so the result is the same for any number of workers.
+ *
+ * @param thread Thread
+ * @param fn Function
+ * @param arg Argument
+ * @return Value
+ */
+vm_value_t ffi_parallel(vm_thread_t **thread, uint8_t fn, uint32_t arg);
+
+/**
+ * @fn ffi_parallel_t* ffi_parallel_create(vm_program_t *program, uint32_t workers, const vm_thread_config_t *config)
+ * @brief Create pool and start its workers. Set it in thread->parallel of the threads that run program
+ *
+ * @param program Program
+ * @param workers Workers quantity, the calling thread included (0: one per online core)
+ * @param config Configuration of child threads (NULL: defaults)
+ * @return Pool (NULL: fail)
+ */
+ffi_parallel_t* ffi_parallel_create(vm_program_t *program, uint32_t workers, const vm_thread_config_t *config);
+
+/**
+ * @fn void ffi_parallel_destroy(ffi_parallel_t *pool)
+ * @brief Stop workers and destroy child threads
+ *
+ * @param pool Pool
+ */
+void ffi_parallel_destroy(ffi_parallel_t *pool);
+
+#endif /* FFI_PARALLEL_H_ */
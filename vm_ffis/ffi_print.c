@@ -44,9 +44,9 @@ vm_value_t ffi_print(vm_thread_t **thread, uint8_t fn, uint32_t arg) {
             break;
 
         case VM_VAL_CONST_STRING:
-            printf("%s\n", val.cstr.addr);
-            if (!val.cstr.is_program)
-                free(val.cstr.addr);
+            printf("%s\n", VM_CSTR_ADDR(val));
+            if (!VM_CSTR_IS_PROGRAM(val))
+                free(VM_CSTR_ADDR(val));
             break;
 
         default:
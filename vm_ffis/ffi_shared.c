@@ -0,0 +1,176 @@
+/*
+ * @ffi_shared.c
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+#include "ffi_shared.h"
+
+static inline vm_value_t ffi_shared_value(uint8_t type, uint32_t bits) {
+    vm_value_t value = { .type = type };
+    value.number.uinteger = bits;
+    return value;
+}
+
+// slot of thread segment with the type of value
+static inline ffi_shared_slot_t* ffi_shared_slot(vm_thread_t **thread, uint32_t slot, vm_value_t value) {
+    ffi_shared_t *shared = (*thread)->shared;
+
+    if (shared == NULL || slot >= shared->qty || shared->slots[slot].type != value.type)
+        return NULL;
+
+    return &shared->slots[slot];
+}
+
+/////////////////
+vm_value_t ffi_shared(vm_thread_t **thread, uint8_t fn, uint32_t arg) {
+    vm_value_t ret = { .type = VM_VAL_NULL };
+    vm_value_t value, expected;
+    ffi_shared_slot_t *slot;
+    uint32_t bits;
+
+    switch (fn) {
+        case FFI_SHARED_LOAD: {
+            ffi_shared_t *shared = (*thread)->shared;
+            if (shared == NULL || arg >= shared->qty)
+                break;
+            slot = &shared->slots[arg];
+            ret = ffi_shared_value(slot->type, atomic_load_explicit(&slot->bits, memory_order_acquire));
+        }
+            break;
+
+        case FFI_SHARED_STORE:
+            value = vm_pop(thread);
+            ret.type = VM_VAL_BOOL;
+            ret.number.boolean = false;
+            if ((slot = ffi_shared_slot(thread, arg, value)) == NULL)
+                break;
+            atomic_store_explicit(&slot->bits, value.number.uinteger, memory_order_release);
+            ret.number.boolean = true;
+            break;
+
+        case FFI_SHARED_ADD:
+            value = vm_pop(thread);
+            if ((slot = ffi_shared_slot(thread, arg, value)) == NULL)
+                break;
+
+            if (value.type != VM_VAL_FLOAT) {
+                // two's complement: same add for INT and UINT
+                bits = atomic_fetch_add_explicit(&slot->bits, value.number.uinteger, memory_order_acq_rel) + value.number.uinteger;
+            } else {
+                vm_value_t sum;
+                bits = atomic_load_explicit(&slot->bits, memory_order_relaxed);
+                do {
+                    sum = ffi_shared_value(VM_VAL_FLOAT, bits);
+                    sum.number.real += value.number.real;
+                } while (!atomic_compare_exchange_weak_explicit(&slot->bits, &bits, sum.number.uinteger, memory_order_acq_rel, memory_order_relaxed));
+                bits = sum.number.uinteger;
+            }
+            ret = ffi_shared_value(value.type, bits);
+            break;
+
+        case FFI_SHARED_CAS:
+            value = vm_pop(thread);
+            expected = vm_pop(thread);
+            ret.type = VM_VAL_BOOL;
+            ret.number.boolean = false;
+            if ((slot = ffi_shared_slot(thread, arg, value)) == NULL || expected.type != value.type)
+                break;
+            bits = expected.number.uinteger;
+            ret.number.boolean = atomic_compare_exchange_strong_explicit(&slot->bits, &bits, value.number.uinteger, memory_order_acq_rel,
+                    memory_order_acquire);
+            break;
+
+        case FFI_SHARED_EXCHANGE:
+            value = vm_pop(thread);
+            if ((slot = ffi_shared_slot(thread, arg, value)) == NULL)
+                break;
+            ret = ffi_shared_value(value.type, atomic_exchange_explicit(&slot->bits, value.number.uinteger, memory_order_acq_rel));
+            break;
+    }
+
+    return ret;
+}
+
+ffi_shared_t* ffi_shared_create(uint32_t qty) {
+    if (qty == 0)
+        return NULL;
+
+    ffi_shared_t *shared = malloc(sizeof(ffi_shared_t));
+    if (shared == NULL)
+        return NULL;
+
+    shared->slots = aligned_alloc(FFI_SHARED_CACHE_LINE, qty * sizeof(ffi_shared_slot_t));
+    if (shared->slots == NULL) {
+        free(shared);
+        return NULL;
+    }
+
+    memset(shared->slots, 0, qty * sizeof(ffi_shared_slot_t));
+    for (uint32_t n = 0; n < qty; n++) {
+        atomic_init(&shared->slots[n].bits, 0);
+        shared->slots[n].type = VM_VAL_UINT;
+    }
+    shared->qty = qty;
+    atomic_init(&shared->refs, 1);
+
+    return shared;
+}
+
+bool ffi_shared_init(ffi_shared_t *shared, uint32_t slot, vm_value_t value) {
+    if (slot >= shared->qty || (value.type != VM_VAL_INT && value.type != VM_VAL_UINT && value.type != VM_VAL_FLOAT))
+        return false;
+
+    shared->slots[slot].type = value.type;
+    atomic_store(&shared->slots[slot].bits, value.number.uinteger);
+
+    return true;
+}
+
+vm_value_t ffi_shared_load(ffi_shared_t *shared, uint32_t slot) {
+    vm_value_t ret = { .type = VM_VAL_NULL };
+
+    if (slot < shared->qty)
+        ret = ffi_shared_value(shared->slots[slot].type, atomic_load(&shared->slots[slot].bits));
+
+    return ret;
+}
+
+void ffi_shared_attach(ffi_shared_t *shared, vm_thread_t *thread) {
+    atomic_fetch_add(&shared->refs, 1);
+    ffi_shared_detach(thread);
+    thread->shared = shared;
+}
+
+void ffi_shared_detach(vm_thread_t *thread) {
+    if (thread->shared == NULL)
+        return;
+
+    ffi_shared_release(thread->shared);
+    thread->shared = NULL;
+}
+
+void ffi_shared_release(ffi_shared_t *shared) {
+    if (shared == NULL || atomic_fetch_sub(&shared->refs, 1) != 1)
+        return;
+
+    free(shared->slots);
+    free(shared);
+}
@@ -0,0 +1,132 @@
+/*
+ * @ffi_shared.h
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#ifndef FFI_SHARED_H_
+#define FFI_SHARED_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "vm.h"
+
+#define FFI_SHARED_CACHE_LINE 64 // each slot on its own line: no false sharing between counters
+
+typedef enum {
+    FFI_SHARED_LOAD,     // return value of slot
+    FFI_SHARED_STORE,    // store value (top of stack)
+    FFI_SHARED_ADD,      // add value (top of stack), return new value
+    FFI_SHARED_CAS,      // store value (top of stack) if slot is expected (second)
+    FFI_SHARED_EXCHANGE, // store value (top of stack), return previous value
+} ffi_shared_fn_t;
+
+/**
+ * @struct ffi_shared_slot_s
+ * @brief Slot. The type is fixed by the host, the payload is changed atomically
+ */
+typedef struct ffi_shared_slot_s {
+    _Alignas(FFI_SHARED_CACHE_LINE)
+    _Atomic uint32_t bits; /**< payload (integer, uinteger or real of vm_value_t) */
+             uint8_t type; /**< VM_VAL_INT, VM_VAL_UINT or VM_VAL_FLOAT */
+} ffi_shared_slot_t;
+
+/**
+ * @struct ffi_shared_s
+ * @brief Global segment shared by threads. Freed with the last reference
+ */
+typedef struct ffi_shared_s {
+    ffi_shared_slot_t *slots; /**< slots */
+             uint32_t qty;    /**< slots quantity */
+     _Atomic uint32_t refs;   /**< attached threads and host references */
+} ffi_shared_t;
+
+/**
+ * @fn vm_value_t ffi_shared(vm_thread_t **thread, uint8_t fn, uint32_t arg)
+ * @brief Atomic access to the shared segment attached to thread. arg is the slot.
+ * Values must have the type of the slot (INT, UINT or FLOAT). INT and UINT wrap on overflow.
+ * This functions support functions:
+ *       LOAD: Return value of slot. NULL if fail.
+ *      STORE: Store value (top of stack). Return false if fail.
+ *        ADD: Add value (top of stack). Return the new value, NULL if fail.
+ *        CAS: Store value (top of stack) if slot is equal to expected value (second, FLOAT compared by bits).
+ *             Return true if stored.
+ *   EXCHANGE: Store value (top of stack). Return the previous value, NULL if fail.
+ *
+ * @param thread Thread
+ * @param fn Function
+ * @param arg Argument
+ * @return Value
+ */
+vm_value_t ffi_shared(vm_thread_t **thread, uint8_t fn, uint32_t arg);
+
+/**
+ * @fn ffi_shared_t* ffi_shared_create(uint32_t qty)
+ * @brief Create segment (host reference). Slots are UINT 0
+ *
+ * @param qty Slots quantity
+ * @return Segment (NULL: fail)
+ */
+ffi_shared_t* ffi_shared_create(uint32_t qty);
+
+/**
+ * @fn bool ffi_shared_init(ffi_shared_t *shared, uint32_t slot, vm_value_t value)
+ * @brief Set type and value of a slot. Not atomic with other calls: set before the threads use it
+ *
+ * @param shared Segment
+ * @param slot Slot
+ * @param value Value (INT, UINT or FLOAT)
+ * @return false if fail
+ */
+bool ffi_shared_init(ffi_shared_t *shared, uint32_t slot, vm_value_t value);
+
+/**
+ * @fn vm_value_t ffi_shared_load(ffi_shared_t *shared, uint32_t slot)
+ * @brief Value of a slot (for host)
+ *
+ * @param shared Segment
+ * @param slot Slot
+ * @return Value (NULL: fail)
+ */
+vm_value_t ffi_shared_load(ffi_shared_t *shared, uint32_t slot);
+
+/**
+ * @fn void ffi_shared_attach(ffi_shared_t *shared, vm_thread_t *thread)
+ * @brief Attach segment to thread (takes a reference). A previous segment is detached.
+ * The reference is only given back by ffi_shared_detach: call it before vm_destroy_thread
+ *
+ * @param shared Segment
+ * @param thread Thread
+ */
+void ffi_shared_attach(ffi_shared_t *shared, vm_thread_t *thread);
+
+/**
+ * @fn void ffi_shared_detach(vm_thread_t *thread)
+ * @brief Detach segment of thread (releases its reference)
+ *
+ * @param thread Thread
+ */
+void ffi_shared_detach(vm_thread_t *thread);
+
+/**
+ * @fn void ffi_shared_release(ffi_shared_t *shared)
+ * @brief Release a reference. The segment is freed with the last one
+ *
+ * @param shared Segment
+ */
+void ffi_shared_release(ffi_shared_t *shared);
+
+#endif /* FFI_SHARED_H_ */
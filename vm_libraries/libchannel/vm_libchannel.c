@@ -0,0 +1,621 @@
+/*
+ * @vm_libchannel.c
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Bounded MPMC queue: https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @version 2.0
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "vm.h"
+#include "vm_libstring.h"
+#include "vm_libchannel.h"
+#ifdef VM_ENABLE_FRAMES_ALIVE
+#include "ffi_fiber.h"
+#endif
+
+/**
+ * @def CHANNEL_OBJ
+ * @brief channel of a library object in stack
+ *
+ */
+#define CHANNEL_OBJ(value) ((libchannel_t*) (HEAP_OBJ((value).lib_obj.heap_ref)->lib_obj.addr))
+
+/**
+ * @def LIBCHANNEL_RETRY
+ * @brief Run the LIB_FN again (opcode, call type and u32 argument). A back jump: fuel and interrupt are checked
+ *
+ */
+#define LIBCHANNEL_RETRY(thread) ((*thread)->pc -= 6)
+
+// result of a wait
+typedef enum LIBCHANNEL_WAIT {
+    LIBCHANNEL_WAIT_AGAIN, // try again now
+    LIBCHANNEL_WAIT_FAIL,  // end the call without result
+    LIBCHANNEL_WAIT_RETRY, // end the call with stack untouched, it runs again
+} libchannel_wait_t;
+
+///// messages /////
+static void libchannel_msg_free(libchannel_msg_t *msg) {
+    switch (msg->value.type) {
+        case VM_VAL_CONST_STRING:
+            free(msg->str);
+            break;
+        case VM_VAL_ARRAY:
+            for (uint32_t n = 0; n < msg->qty; n++)
+                libchannel_msg_free(&msg->fields[n]);
+            free(msg->fields);
+            break;
+        case VM_VAL_LIB_OBJ:
+            libchannel_release(msg->channel);
+            break;
+        default:
+    }
+}
+
+// copy of a value out of the heap of thread
+static vm_errors_t libchannel_pack(vm_thread_t **thread, vm_value_t value, libchannel_msg_t *msg, uint32_t depth) {
+    libstring_view_t string;
+
+    msg->value.type = value.type;
+    msg->qty = 0;
+    switch (value.type) {
+        case VM_VAL_NULL:
+        case VM_VAL_BOOL:
+        case VM_VAL_UINT:
+        case VM_VAL_INT:
+        case VM_VAL_FLOAT:
+            msg->value = value;
+            return VM_ERR_OK;
+
+        case VM_VAL_ARRAY: {
+            vm_heap_object_t *arr = HEAP_OBJ(value.heap_ref);
+            if (depth >= LIBCHANNEL_DEPTH || vm_heap_type((*thread)->heap, value.heap_ref) != VM_VAL_ARRAY)
+                return VM_ERR_BAD_VALUE;
+
+            msg->fields = malloc(arr->array.qty * sizeof(libchannel_msg_t));
+            if (msg->fields == NULL)
+                return VM_ERR_OUTOFMEMORY;
+
+            for (uint32_t n = 0; n < arr->array.qty; n++) {
+                vm_errors_t res = libchannel_pack(thread, arr->array.fields[n], &msg->fields[n], depth + 1);
+                if (res != VM_ERR_OK) {
+                    libchannel_msg_free(msg);
+                    return res;
+                }
+                ++msg->qty;
+            }
+        }
+            return VM_ERR_OK;
+
+        case VM_VAL_LIB_OBJ:
+            if (HEAP_OBJ(value.lib_obj.heap_ref)->lib_obj.identifier == CHANNEL_LIBRARY_IDENTIFIER) {
+                msg->channel = CHANNEL_OBJ(value);
+                atomic_fetch_add(&msg->channel->refs, 1);
+                return VM_ERR_OK;
+            }
+            /* fall through */
+        case VM_VAL_CONST_STRING:
+            // strings only out of arrays: fields of received arrays can't own memory
+            if (depth > 0 || !libstring_arg(thread, value, &string))
+                return VM_ERR_BAD_VALUE;
+
+            msg->value.type = VM_VAL_CONST_STRING;
+            msg->str = malloc(string.len + 1);
+            if (msg->str == NULL)
+                return VM_ERR_OUTOFMEMORY;
+
+            memcpy(msg->str, string.str, string.len);
+            msg->str[string.len] = '\0';
+            msg->qty = string.len;
+            return VM_ERR_OK;
+
+        default:
+            return VM_ERR_BAD_VALUE;
+    }
+}
+
+// value in the heap of thread (message is consumed)
+static vm_value_t libchannel_unpack(vm_thread_t **thread, uint32_t lib_idx, libchannel_msg_t *msg) {
+    vm_value_t value = msg->value;
+
+    switch (msg->value.type) {
+        case VM_VAL_CONST_STRING:
+            VM_CSTR_SET(value, msg->str, false);
+            break;
+
+        case VM_VAL_ARRAY: {
+            vm_heap_object_t arr;
+            arr.array.qty = msg->qty;
+            arr.array.fields = malloc(msg->qty * sizeof(vm_value_t));
+            if (arr.array.fields == NULL) {
+                libchannel_msg_free(msg);
+                value.type = VM_VAL_NULL;
+                break;
+            }
+
+            for (uint32_t n = 0; n < msg->qty; n++)
+                arr.array.fields[n] = libchannel_unpack(thread, lib_idx, &msg->fields[n]);
+            free(msg->fields);
+
+            value.heap_ref = vm_heap_save((*thread)->heap, VM_VAL_ARRAY, false, arr, &((*thread)->frames[(*thread)->fc].gc_mark));
+            if (value.heap_ref == 0xffffffff) {
+                free(arr.array.fields);
+                value.type = VM_VAL_NULL;
+            }
+        }
+            break;
+
+        case VM_VAL_LIB_OBJ: {
+            vm_heap_object_t obj;
+            obj.lib_obj.addr = msg->channel;
+            obj.lib_obj.identifier = CHANNEL_LIBRARY_IDENTIFIER;
+            obj.lib_obj.lib_idx = lib_idx;
+            value.lib_obj.lib_idx = lib_idx;
+            value.lib_obj.heap_ref = vm_heap_save((*thread)->heap, VM_VAL_LIB_OBJ, false, obj, &((*thread)->frames[(*thread)->fc].gc_mark));
+            if (value.lib_obj.heap_ref == 0xffffffff) {
+                libchannel_release(msg->channel);
+                value.type = VM_VAL_NULL;
+            }
+        }
+            break;
+
+        default:
+    }
+
+    return value;
+}
+
+///// ring /////
+static bool libchannel_push(libchannel_t *channel, libchannel_msg_t *msg) {
+    uint64_t head = atomic_load_explicit(&channel->head, memory_order_relaxed);
+    libchannel_slot_t *slot;
+
+    if (channel->spsc) {
+        if (head - channel->tail_cache > channel->mask) {
+            channel->tail_cache = atomic_load_explicit(&channel->tail, memory_order_acquire);
+            if (head - channel->tail_cache > channel->mask)
+                return false;
+        }
+        channel->slots[head & channel->mask].msg = *msg;
+        atomic_store_explicit(&channel->head, head + 1, memory_order_release);
+        return true;
+    }
+
+    // slot is free when its turn is head
+    for (;;) {
+        slot = &channel->slots[head & channel->mask];
+        int64_t diff = (int64_t) (atomic_load_explicit(&slot->seq, memory_order_acquire) - head);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&channel->head, &head, head + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0)
+            return false;
+        else
+            head = atomic_load_explicit(&channel->head, memory_order_relaxed);
+    }
+
+    slot->msg = *msg;
+    atomic_store_explicit(&slot->seq, head + 1, memory_order_release);
+
+    return true;
+}
+
+static bool libchannel_pop(libchannel_t *channel, libchannel_msg_t *msg) {
+    uint64_t tail = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+    libchannel_slot_t *slot;
+
+    if (channel->spsc) {
+        if (tail == channel->head_cache) {
+            channel->head_cache = atomic_load_explicit(&channel->head, memory_order_acquire);
+            if (tail == channel->head_cache)
+                return false;
+        }
+        *msg = channel->slots[tail & channel->mask].msg;
+        atomic_store_explicit(&channel->tail, tail + 1, memory_order_release);
+        return true;
+    }
+
+    // slot is full when its turn is tail + 1
+    for (;;) {
+        slot = &channel->slots[tail & channel->mask];
+        int64_t diff = (int64_t) (atomic_load_explicit(&slot->seq, memory_order_acquire) - (tail + 1));
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&channel->tail, &tail, tail + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0)
+            return false;
+        else
+            tail = atomic_load_explicit(&channel->tail, memory_order_relaxed);
+    }
+
+    *msg = slot->msg;
+    atomic_store_explicit(&slot->seq, tail + channel->mask + 1, memory_order_release);
+
+    return true;
+}
+
+static inline uint64_t libchannel_len(libchannel_t *channel) {
+    uint64_t tail = atomic_load(&channel->tail);
+    uint64_t head = atomic_load(&channel->head);
+
+    return head > tail ? head - tail : 0;
+}
+
+///// wait /////
+// after send or receive: wake blocked calls (a fence pairs with the one of sleepers, so no wake is lost)
+static void libchannel_notify(libchannel_t *channel) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&channel->waiting, memory_order_relaxed) == 0)
+        return;
+
+    pthread_mutex_lock(&channel->lock);
+    pthread_cond_broadcast(&channel->wake);
+    pthread_mutex_unlock(&channel->lock);
+}
+
+static void libchannel_sleep(libchannel_t *channel, bool send) {
+    struct timespec until;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += LIBCHANNEL_WAIT_MS * 1000000L;
+    if (until.tv_nsec >= 1000000000L) {
+        until.tv_nsec -= 1000000000L;
+        ++until.tv_sec;
+    }
+
+    pthread_mutex_lock(&channel->lock);
+    atomic_fetch_add(&channel->waiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    uint64_t len = libchannel_len(channel);
+    if (send ? len > channel->mask : len == 0)
+        pthread_cond_timedwait(&channel->wake, &channel->lock, &until);
+    atomic_fetch_sub(&channel->waiting, 1);
+    pthread_mutex_unlock(&channel->lock);
+}
+
+// channel full (send) or empty
+static libchannel_wait_t libchannel_wait(vm_thread_t **thread, libchannel_t *channel, bool send, uint32_t mode, uint32_t *spins) {
+    if (mode == LIBCHANNEL_TRY)
+        return LIBCHANNEL_WAIT_FAIL;
+
+    if (mode == LIBCHANNEL_YIELD || atomic_load_explicit(&(*thread)->interrupt, memory_order_relaxed) != 0)
+        return LIBCHANNEL_WAIT_RETRY;
+
+    if (++(*spins) < LIBCHANNEL_SPIN)
+        sched_yield();
+    else
+        libchannel_sleep(channel, send);
+
+    return LIBCHANNEL_WAIT_AGAIN;
+}
+
+// last action of a call that runs again: the stack may belong to another fiber after it
+static void libchannel_retry(vm_thread_t **thread, uint32_t mode) {
+    LIBCHANNEL_RETRY(thread);
+#ifdef VM_ENABLE_FRAMES_ALIVE
+    if (mode == LIBCHANNEL_YIELD && (*thread)->fibers != NULL && ffi_fiber(thread, FFI_FIBER_YIELD, 0).number.boolean)
+        return;
+#endif
+    sched_yield();
+}
+
+/////////////////
+vm_errors_t lib_entry_channel(vm_thread_t **thread, uint8_t call_type, uint32_t lib_idx, uint32_t arg) {
+    if (*thread == NULL)
+        return VM_ERR_FAIL;
+
+    vm_errors_t res = VM_ERR_OK;
+    switch (call_type) {
+        // vm cases
+        case VM_EDFAT_NEW: {
+            NEW_HEAP_REF(obj, arg);
+            obj->lib_obj.addr = libchannel_create(LIBCHANNEL_DEFAULT_SIZE, false);
+            obj->lib_obj.identifier = CHANNEL_LIBRARY_IDENTIFIER;
+        }
+            break;
+
+        case VM_EDFAT_PUSH:
+            break;
+
+        case VM_EDFAT_CMP:
+            if (CHANNEL_OBJ(STK_TOP(thread)) != CHANNEL_OBJ(STK_SND(thread)))
+                res = VM_ERR_FAIL;
+            break;
+
+        case VM_EDFAT_GC:
+            libchannel_release(vm_heap_load((*thread)->heap, arg)->lib_obj.addr);
+            break;
+
+        case VM_EDFAT_TOTYPE:
+            break;
+
+        case VM_EDFAT_CLONE:
+            // same channel: the clone takes a reference
+            atomic_fetch_add(&((libchannel_t*) vm_heap_load((*thread)->heap, arg)->lib_obj.addr)->refs, 1);
+            break;
+
+        case VM_EDFAT_SERIALIZE:
+        case VM_EDFAT_DESERIALIZE:
+            // a channel is shared with other threads alive in this process: it can't be saved
+            res = VM_ERR_FAIL;
+            break;
+
+            // internal cases
+        case LIBCHANNEL_FN_SEND: {
+            libchannel_t *channel = CHANNEL_OBJ(STK_TOP(thread));
+            libchannel_msg_t msg;
+            uint32_t spins = 0;
+            bool sent = false;
+
+            if (channel == NULL)
+                return VM_ERR_FAIL;
+
+            res = libchannel_pack(thread, STK_SND(thread), &msg, 0);
+            if (res != VM_ERR_OK)
+                return res;
+
+            for (;;) {
+                if (libchannel_push(channel, &msg)) {
+                    libchannel_notify(channel);
+                    sent = true;
+                    break;
+                }
+
+                libchannel_wait_t wait = libchannel_wait(thread, channel, true, arg, &spins);
+                if (wait == LIBCHANNEL_WAIT_AGAIN)
+                    continue;
+
+                libchannel_msg_free(&msg);
+                if (wait == LIBCHANNEL_WAIT_RETRY) {
+                    libchannel_retry(thread, arg);
+                    return VM_ERR_OK;
+                }
+                break;
+            }
+
+            STKDROPSND(thread);
+            STK_TOP(thread).type = VM_VAL_BOOL;
+            STK_TOP(thread).number.boolean = sent;
+        }
+            break;
+
+        case LIBCHANNEL_FN_RECV: {
+            libchannel_t *channel = CHANNEL_OBJ(STK_TOP(thread));
+            libchannel_msg_t msg;
+            uint32_t spins = 0;
+            vm_new_bool(received, false);
+
+            if (channel == NULL)
+                return VM_ERR_FAIL;
+
+            for (;;) {
+                if (libchannel_pop(channel, &msg)) {
+                    libchannel_notify(channel);
+                    received.number.boolean = true;
+                    break;
+                }
+
+                libchannel_wait_t wait = libchannel_wait(thread, channel, false, arg, &spins);
+                if (wait == LIBCHANNEL_WAIT_AGAIN)
+                    continue;
+                if (wait == LIBCHANNEL_WAIT_RETRY) {
+                    libchannel_retry(thread, arg);
+                    return VM_ERR_OK;
+                }
+                break;
+            }
+
+            STK_TOP(thread).type = VM_VAL_NULL;
+            if (received.number.boolean)
+                STK_TOP(thread) = libchannel_unpack(thread, lib_idx, &msg);
+            vm_push(thread, received);
+        }
+            break;
+
+        case LIBCHANNEL_FN_SEND_BATCH: {
+            libchannel_t *channel = CHANNEL_OBJ(STK_TOP(thread));
+            libchannel_msg_t msg;
+            uint32_t spins = 0, sent = 0, qty;
+            libchannel_wait_t wait = LIBCHANNEL_WAIT_AGAIN;
+
+            if (channel == NULL)
+                return VM_ERR_FAIL;
+            if (STK_SND(thread).type != VM_VAL_UINT || STK_SND(thread).number.uinteger > (*thread)->sp - 2)
+                return VM_ERR_BAD_VALUE;
+
+            qty = STK_SND(thread).number.uinteger;
+            uint32_t base = (*thread)->sp - 2 - qty;
+
+            while (sent < qty) {
+                res = libchannel_pack(thread, (*thread)->stack[base + sent], &msg, 0);
+                if (res != VM_ERR_OK)
+                    break;
+
+                // one notify for the messages sent until full
+                while (!libchannel_push(channel, &msg)) {
+                    libchannel_notify(channel);
+                    wait = libchannel_wait(thread, channel, true, arg, &spins);
+                    if (wait != LIBCHANNEL_WAIT_AGAIN) {
+                        libchannel_msg_free(&msg);
+                        break;
+                    }
+                }
+                if (wait != LIBCHANNEL_WAIT_AGAIN)
+                    break;
+                ++sent;
+            }
+
+            if (sent > 0) {
+                libchannel_notify(channel);
+                for (uint32_t n = 0; n < sent; n++)
+                    STK_FREECSTR(thread, (*thread)->stack[base + n]);
+                memmove(&(*thread)->stack[base], &(*thread)->stack[base + sent], (qty - sent + 2) * sizeof(vm_value_t));
+                (*thread)->sp -= sent;
+            }
+
+            // the call runs again with the rest
+            if (wait == LIBCHANNEL_WAIT_RETRY) {
+                STK_SND(thread).number.uinteger = qty - sent;
+                libchannel_retry(thread, arg);
+                return VM_ERR_OK;
+            }
+            if (res != VM_ERR_OK)
+                return res;
+
+            STK_SND(thread).number.uinteger = sent;
+            --(*thread)->sp;
+        }
+            break;
+
+        case LIBCHANNEL_FN_RECV_BATCH: {
+            libchannel_t *channel = CHANNEL_OBJ(STK_TOP(thread));
+            libchannel_msg_t msg;
+            uint32_t spins = 0, received = 0, qty;
+
+            if (channel == NULL)
+                return VM_ERR_FAIL;
+            if (STK_SND(thread).type != VM_VAL_UINT)
+                return VM_ERR_BAD_VALUE;
+
+            qty = STK_SND(thread).number.uinteger;
+            // received values and count replace the 2 arguments, never over the stack end
+            if (qty > (*thread)->stack_size - (*thread)->sp + 1)
+                qty = (*thread)->stack_size - (*thread)->sp + 1;
+
+            // wait only for the first one
+            while (received < qty) {
+                if (libchannel_pop(channel, &msg)) {
+                    if (received++ == 0)
+                        (*thread)->sp -= 2;
+                    vm_push(thread, libchannel_unpack(thread, lib_idx, &msg));
+                    continue;
+                }
+                if (received > 0)
+                    break;
+
+                libchannel_wait_t wait = libchannel_wait(thread, channel, false, arg, &spins);
+                if (wait == LIBCHANNEL_WAIT_AGAIN)
+                    continue;
+                if (wait == LIBCHANNEL_WAIT_RETRY) {
+                    libchannel_retry(thread, arg);
+                    return VM_ERR_OK;
+                }
+                break;
+            }
+
+            if (received > 0)
+                libchannel_notify(channel);
+            else
+                (*thread)->sp -= 2;
+
+            vm_new_uint(count, received);
+            vm_push(thread, count);
+        }
+            break;
+
+        case LIBCHANNEL_FN_LEN: {
+            libchannel_t *channel = CHANNEL_OBJ(STK_TOP(thread));
+            if (channel == NULL)
+                return VM_ERR_FAIL;
+
+            STK_TOP(thread).type = VM_VAL_UINT;
+            STK_TOP(thread).number.uinteger = libchannel_len(channel);
+        }
+            break;
+
+        default:
+            res = VM_ERR_FAIL;
+    }
+
+    return res;
+}
+
+libchannel_t* libchannel_create(uint32_t size, bool spsc) {
+    libchannel_t *channel = aligned_alloc(LIBCHANNEL_CACHE_LINE, sizeof(libchannel_t));
+    uint64_t slots = 1;
+
+    if (channel == NULL)
+        return NULL;
+
+    while (slots < size)
+        slots <<= 1;
+
+    memset(channel, 0, sizeof(libchannel_t));
+    channel->slots = malloc(slots * sizeof(libchannel_slot_t));
+    if (channel->slots == NULL) {
+        free(channel);
+        return NULL;
+    }
+
+    for (uint64_t n = 0; n < slots; n++)
+        atomic_init(&channel->slots[n].seq, n);
+    atomic_init(&channel->head, 0);
+    atomic_init(&channel->tail, 0);
+    atomic_init(&channel->refs, 1);
+    atomic_init(&channel->waiting, 0);
+    channel->mask = slots - 1;
+    channel->spsc = spsc;
+    pthread_mutex_init(&channel->lock, NULL);
+    pthread_cond_init(&channel->wake, NULL);
+
+    return channel;
+}
+
+void libchannel_release(libchannel_t *channel) {
+    libchannel_msg_t msg;
+
+    if (channel == NULL || atomic_fetch_sub(&channel->refs, 1) != 1)
+        return;
+
+    // no other user: spsc pop is safe from here
+    channel->spsc = true;
+    channel->head_cache = atomic_load(&channel->head);
+    while (libchannel_pop(channel, &msg))
+        libchannel_msg_free(&msg);
+
+    pthread_cond_destroy(&channel->wake);
+    pthread_mutex_destroy(&channel->lock);
+    free(channel->slots);
+    free(channel);
+}
+
+vm_value_t libchannel_value(vm_thread_t **thread, uint32_t lib_idx, libchannel_t *channel) {
+    vm_value_t value = { .type = VM_VAL_NULL };
+    vm_heap_object_t obj;
+
+    obj.lib_obj.addr = channel;
+    obj.lib_obj.identifier = CHANNEL_LIBRARY_IDENTIFIER;
+    obj.lib_obj.lib_idx = lib_idx;
+
+    // static: survives the frames of the run, released on thread reset or destroy
+    uint32_t ref = vm_heap_save((*thread)->heap, VM_VAL_LIB_OBJ, true, obj, &((*thread)->frames[(*thread)->fc].gc_mark));
+    if (ref == 0xffffffff)
+        return value;
+
+    atomic_fetch_add(&channel->refs, 1);
+    value.type = VM_VAL_LIB_OBJ;
+    value.lib_obj.lib_idx = lib_idx;
+    value.lib_obj.heap_ref = ref;
+
+    return value;
+}
@@ -0,0 +1,150 @@
+/*
+ * @vm_libchannel.h
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Bounded MPMC queue: https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @version 2.0
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#ifndef VM_LIBCHANNEL_H_
+#define VM_LIBCHANNEL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "vm.h"
+
+#define CHANNEL_LIBRARY_IDENTIFIER 0x00000013
+
+#define LIBCHANNEL_CACHE_LINE   64  // producer and consumer indexes are kept on different lines
+#define LIBCHANNEL_DEFAULT_SIZE 64  // capacity of channels created by NEW_LIB_OBJ
+#define LIBCHANNEL_SPIN         128 // failed attempts of a blocking call before sleeping
+#define LIBCHANNEL_WAIT_MS      10  // sleep of a blocking call between checks of vm_interrupt
+#define LIBCHANNEL_DEPTH        8   // maximum nesting of arrays in a message
+
+enum LIBCHANNEL_FN {
+    LIBCHANNEL_FN_SEND,       //
+    LIBCHANNEL_FN_RECV,       //
+    LIBCHANNEL_FN_SEND_BATCH, //
+    LIBCHANNEL_FN_RECV_BATCH, //
+    LIBCHANNEL_FN_LEN,        //
+};
+
+/**
+ * @enum LIBCHANNEL_MODE
+ * @brief Wait mode (argument of the calls) when the channel is full (send) or empty (receive)
+ */
+typedef enum LIBCHANNEL_MODE {
+    LIBCHANNEL_BLOCK, /**< wait on the OS thread */
+    LIBCHANNEL_TRY,   /**< don't wait */
+    LIBCHANNEL_YIELD, /**< run the call again later: yield to the next ready fiber (or the OS), charged as a back jump */
+} libchannel_mode_t;
+
+/**
+ * @struct libchannel_msg_s
+ * @brief Message. Owns its copy of strings and arrays, references no heap
+ */
+typedef struct libchannel_msg_s {
+                 vm_value_t value;  /**< number, bool or NULL. Type CONST_STRING: str, ARRAY: fields, LIB_OBJ: channel */
+                   uint32_t qty;    /**< string length or array fields */
+    union {
+                       char *str;    /**< string (NUL terminated) */
+    struct libchannel_msg_s *fields; /**< array fields */
+      struct libchannel_s   *channel; /**< channel (referenced) */
+    };
+} libchannel_msg_t;
+
+/**
+ * @struct libchannel_slot_s
+ * @brief Ring slot
+ */
+typedef struct libchannel_slot_s {
+    _Atomic uint64_t seq; /**< turn of the slot (MPMC) */
+    libchannel_msg_t msg; /**< message */
+} libchannel_slot_t;
+
+/**
+ * @struct libchannel_s
+ * @brief Bounded channel shared between threads. SPSC: one sender and one receiver OS thread, MPMC: any
+ */
+typedef struct libchannel_s {
+    _Alignas(LIBCHANNEL_CACHE_LINE)
+          _Atomic uint64_t head;       /**< next send */
+                  uint64_t tail_cache; /**< (SPSC) tail seen by sender */
+    _Alignas(LIBCHANNEL_CACHE_LINE)
+          _Atomic uint64_t tail;       /**< next receive */
+                  uint64_t head_cache; /**< (SPSC) head seen by receiver */
+    _Alignas(LIBCHANNEL_CACHE_LINE)
+                  uint64_t mask;       /**< slots - 1 */
+                      bool spsc;       /**< single producer single consumer */
+          _Atomic uint32_t refs;       /**< library objects and host references */
+          _Atomic uint32_t waiting;    /**< blocked calls */
+           pthread_mutex_t lock;       /**< protect sleep of blocked calls */
+            pthread_cond_t wake;       /**< sent or received */
+         libchannel_slot_t *slots;     /**< ring */
+} libchannel_t;
+
+/**
+ * @fn vm_errors_t lib_entry_channel(vm_thread_t **thread, uint8_t call_type, uint32_t lib_idx, uint32_t arg)
+ * @brief Function entry for channel library
+ * Messages are copied between heaps: numbers, bool, NULL, strings (constant or string objects, received as constant strings),
+ * arrays (deep copy of numbers, bool, NULL and arrays, received as new arrays) and channels.
+ * Argument of the calls is the wait mode (libchannel_mode_t).
+ * This functions support functions:
+ *         SEND: Send value (second). Return true if sent.
+ *         RECV: Push received value (NULL if none) and true if received.
+ *   SEND_BATCH: Send n values (under count n, second) in order. Return the count sent, unsent values stay under it.
+ *   RECV_BATCH: Receive up to n (second) values, no more than the free stack. Push them in order and the count (blocking and yield wait for one).
+ *          LEN: Return the number of messages in channel.
+ *
+ * @param thread Thread
+ * @param call_type Call type
+ * @param lib_idx Index of called lib
+ * @param args Arguments
+ * @return
+ */
+vm_errors_t lib_entry_channel(vm_thread_t **thread, uint8_t call_type, uint32_t lib_idx, uint32_t arg);
+
+/**
+ * @fn libchannel_t* libchannel_create(uint32_t size, bool spsc)
+ * @brief Create channel (host reference)
+ *
+ * @param size Capacity (rounded up to power of 2)
+ * @param spsc Single producer single consumer
+ * @return Channel (NULL: fail)
+ */
+libchannel_t* libchannel_create(uint32_t size, bool spsc);
+
+/**
+ * @fn void libchannel_release(libchannel_t *channel)
+ * @brief Release a reference. The channel and its messages are freed with the last one
+ *
+ * @param channel Channel
+ */
+void libchannel_release(libchannel_t *channel);
+
+/**
+ * @fn vm_value_t libchannel_value(vm_thread_t **thread, uint32_t lib_idx, libchannel_t *channel)
+ * @brief Library object of a channel in heap of thread (for stack or globals). Takes a reference
+ *
+ * @param thread Thread
+ * @param lib_idx Index of channel library
+ * @param channel Channel
+ * @return Value (NULL: fail)
+ */
+vm_value_t libchannel_value(vm_thread_t **thread, uint32_t lib_idx, libchannel_t *channel);
+
+#endif /* VM_LIBCHANNEL_H_ */
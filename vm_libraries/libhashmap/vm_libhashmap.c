@@ -0,0 +1,681 @@
+/*
+ * @vm_libhashmap.c
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   SwissTable: https://abseil.io/about/design/swisstables
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @version 2.0
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "vm_libhashmap.h"
+#include "vm_libstring.h"
+#include "vm.h"
+
+/**
+ * @def MAP_OBJ
+ * @brief map of a library object in stack
+ *
+ */
+#define MAP_OBJ(value) ((libhashmap_t*) (HEAP_OBJ((value).lib_obj.heap_ref)->lib_obj.addr))
+
+#define LIBHASHMAP_NOT_FOUND 0xffffffff
+
+// key to search: number value, or string content (any string form)
+typedef struct libhashmap_key_s {
+    vm_value_t value;
+    const char *str;
+    uint32_t len;
+    uint64_t hash;
+    libstring_view_t view;
+} libhashmap_key_t;
+
+///// utils /////
+static inline uint64_t libhashmap_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+static inline uint64_t libhashmap_stored_hash(vm_value_t key) {
+    if (key.type == VM_VAL_CONST_STRING)
+        return LIBHASHMAP_STRING(VM_CSTR_ADDR(key))->hash;
+
+    return libhashmap_mix(((uint64_t) key.type << 32) | key.number.uinteger);
+}
+
+static bool libhashmap_key(vm_thread_t **thread, vm_value_t value, libhashmap_key_t *key) {
+    key->str = NULL;
+
+    switch (value.type) {
+        case VM_VAL_FLOAT:
+            if (value.number.real != value.number.real)
+                return false; // NaN is never equal to itself
+            if (value.number.real == 0)
+                value.number.real = 0; // -0 and 0 are the same key
+            /* fall through */
+        case VM_VAL_UINT:
+        case VM_VAL_INT:
+            key->value = (vm_value_t) { .type = value.type };
+            key->value.number.uinteger = value.number.uinteger;
+            key->hash = libhashmap_mix(((uint64_t) value.type << 32) | value.number.uinteger);
+            return true;
+
+        default:
+            if (!libstring_arg(thread, value, &key->view))
+                return false;
+            key->value = value;
+            key->str = key->view.str;
+            key->len = key->view.len;
+            if (value.type == VM_VAL_CONST_STRING && VM_CSTR_IS_INTERNED(value))
+                key->hash = libhashmap_mix(VM_INTERN_RECORD(VM_CSTR_ADDR(value))->hash);
+            else
+                key->hash = libhashmap_mix(vm_string_hash(key->str, key->len));
+            return true;
+    }
+}
+
+// key of a stored entry (string keys take their cached hash)
+static void libhashmap_stored_key(vm_value_t stored, libhashmap_key_t *key) {
+    key->value = stored;
+    if (stored.type != VM_VAL_CONST_STRING) {
+        key->str = NULL;
+        key->hash = libhashmap_stored_hash(stored);
+        return;
+    }
+
+    libhashmap_string_t *record = LIBHASHMAP_STRING(VM_CSTR_ADDR(stored));
+    key->str = record->str;
+    key->len = record->len;
+    key->hash = record->hash;
+}
+
+static inline bool libhashmap_key_equal(vm_value_t stored, const libhashmap_key_t *key) {
+    if (key->str == NULL)
+        return stored.type == key->value.type && stored.number.uinteger == key->value.number.uinteger;
+
+    if (stored.type != VM_VAL_CONST_STRING)
+        return false;
+
+    libhashmap_string_t *record = LIBHASHMAP_STRING(VM_CSTR_ADDR(stored));
+    return record->hash == key->hash && record->len == key->len && memcmp(record->str, key->str, key->len) == 0;
+}
+
+// stored key: numbers as they are, strings copied in a map owned record
+static bool libhashmap_key_store(const libhashmap_key_t *key, vm_value_t *stored) {
+    if (key->str == NULL) {
+        *stored = key->value;
+        return true;
+    }
+
+    libhashmap_string_t *record = malloc(sizeof(libhashmap_string_t) + key->len + 1);
+    if (record == NULL)
+        return false;
+
+    record->hash = key->hash;
+    record->len = key->len;
+    memcpy(record->str, key->str, key->len);
+    record->str[key->len] = '\0';
+    *stored = (vm_value_t) { .type = VM_VAL_CONST_STRING };
+    VM_CSTR_SET(*stored, record->str, false);
+
+    return true;
+}
+
+// copy of a value: map and stack own their own copy of owned strings
+static bool libhashmap_copy(vm_value_t stored, vm_value_t *value) {
+    *value = stored;
+    if (stored.type != VM_VAL_CONST_STRING || VM_CSTR_IS_PROGRAM(stored))
+        return true;
+
+    char *str = strdup(VM_CSTR_ADDR(stored));
+    if (str == NULL)
+        return false;
+    VM_CSTR_SET(*value, str, false);
+
+    return true;
+}
+
+// strings owned by the map (key record, owned value)
+static void libhashmap_free_key(vm_value_t key) {
+    if (key.type == VM_VAL_CONST_STRING)
+        free(LIBHASHMAP_STRING(VM_CSTR_ADDR(key)));
+}
+
+static void libhashmap_free_value(vm_value_t value) {
+    if (value.type == VM_VAL_CONST_STRING && !VM_CSTR_IS_PROGRAM(value))
+        free(VM_CSTR_ADDR(value));
+}
+
+// strings of used slots below qty
+static void libhashmap_free_entries(libhashmap_t *map, uint32_t qty) {
+    for (uint32_t n = 0; n < qty; n++) {
+        if (map->ctrl[n] < 0)
+            continue;
+        libhashmap_free_key(map->entries[n].key);
+        libhashmap_free_value(map->entries[n].value);
+    }
+}
+
+// heap object held by a value (positions are under VM_MAX_HEAP)
+static inline bool libhashmap_heap_ref(vm_value_t value, uint32_t *ref) {
+    switch (value.type) {
+        case VM_VAL_LIB_OBJ:
+            *ref = value.lib_obj.heap_ref;
+            return *ref < VM_MAX_HEAP;
+        case VM_VAL_ARRAY:
+        case VM_VAL_HEAP_REF:
+            *ref = value.heap_ref;
+            return *ref < VM_MAX_HEAP;
+        default:
+            return false;
+    }
+}
+
+///// group probing /////
+// bit n set if control byte n of group is h2
+static inline uint32_t libhashmap_match(const int8_t *ctrl, int8_t h2) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((const __m128i*) ctrl), _mm_set1_epi8(h2)));
+#else
+    uint32_t mask = 0;
+    for (uint32_t n = 0; n < LIBHASHMAP_GROUP; n++)
+        mask |= (uint32_t) (ctrl[n] == h2) << n;
+    return mask;
+#endif
+}
+
+// bit n set if slot n of group is empty or deleted (sign bit of control byte)
+static inline uint32_t libhashmap_match_free(const int8_t *ctrl) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_load_si128((const __m128i*) ctrl));
+#else
+    uint32_t mask = 0;
+    for (uint32_t n = 0; n < LIBHASHMAP_GROUP; n++)
+        mask |= (uint32_t) (ctrl[n] < 0) << n;
+    return mask;
+#endif
+}
+
+static inline uint32_t libhashmap_match_empty(const int8_t *ctrl) {
+    return libhashmap_match(ctrl, LIBHASHMAP_CTRL_EMPTY);
+}
+
+// groups are probed in triangular sequence, visits all of them (power of 2)
+static uint32_t libhashmap_find(const libhashmap_t *map, const libhashmap_key_t *key) {
+    if (map->cap == 0)
+        return LIBHASHMAP_NOT_FOUND;
+
+    const uint32_t groups_mask = map->cap / LIBHASHMAP_GROUP - 1;
+    const int8_t h2 = key->hash & 0x7f;
+    uint32_t group = (key->hash >> 7) & groups_mask;
+
+    for (uint32_t step = 1;; step++) {
+        const int8_t *ctrl = map->ctrl + group * LIBHASHMAP_GROUP;
+
+        for (uint32_t match = libhashmap_match(ctrl, h2); match != 0; match &= match - 1) {
+            uint32_t slot = group * LIBHASHMAP_GROUP + __builtin_ctz(match);
+            if (libhashmap_key_equal(map->entries[slot].key, key))
+                return slot;
+        }
+
+        // an empty slot ends the chain: key was never stored beyond this group
+        if (libhashmap_match_empty(ctrl) != 0)
+            return LIBHASHMAP_NOT_FOUND;
+
+        group = (group + step) & groups_mask;
+    }
+}
+
+static uint32_t libhashmap_find_free(const libhashmap_t *map, uint64_t hash) {
+    const uint32_t groups_mask = map->cap / LIBHASHMAP_GROUP - 1;
+    uint32_t group = (hash >> 7) & groups_mask;
+
+    for (uint32_t step = 1;; step++) {
+        uint32_t match = libhashmap_match_free(map->ctrl + group * LIBHASHMAP_GROUP);
+        if (match != 0)
+            return group * LIBHASHMAP_GROUP + __builtin_ctz(match);
+
+        group = (group + step) & groups_mask;
+    }
+}
+
+static bool libhashmap_rehash(libhashmap_t *map, uint32_t cap) {
+    // control bytes first: groups are 16 bytes aligned and so are the entries after them
+    int8_t *ctrl = aligned_alloc(LIBHASHMAP_GROUP, cap + (size_t) cap * sizeof(libhashmap_entry_t));
+    if (ctrl == NULL)
+        return false;
+
+    libhashmap_t new_map = {
+            .ctrl = ctrl,
+            .entries = (libhashmap_entry_t*) (ctrl + cap),
+            .cap = cap,
+            .qty = map->qty,
+            .growth_left = cap - cap / 8 - map->qty,
+            .refs = map->refs
+    };
+    memset(ctrl, LIBHASHMAP_CTRL_EMPTY, cap);
+
+    for (uint32_t n = 0; n < map->cap; n++) {
+        if (map->ctrl[n] < 0)
+            continue;
+
+        uint64_t hash = libhashmap_stored_hash(map->entries[n].key);
+        uint32_t slot = libhashmap_find_free(&new_map, hash);
+        new_map.ctrl[slot] = hash & 0x7f;
+        new_map.entries[slot] = map->entries[n];
+    }
+
+    free(map->ctrl);
+    *map = new_map;
+
+    return true;
+}
+
+// first entry holding a heap object takes it out of the frames gc
+static bool libhashmap_hold(vm_thread_t **thread, libhashmap_t *map, vm_value_t value) {
+    uint32_t ref;
+
+    if (!libhashmap_heap_ref(value, &ref))
+        return true;
+
+    if (map->refs == NULL && (map->refs = calloc(VM_MAX_HEAP, sizeof(uint32_t))) == NULL)
+        return false;
+    if (map->refs[ref]++ == 0)
+        vm_heap_retain(thread, ref);
+
+    return true;
+}
+
+// heap object of a removed value goes back to the frame when no other entry holds it
+static void libhashmap_release(vm_thread_t **thread, libhashmap_t *map, vm_value_t value) {
+    uint32_t ref;
+
+    if (libhashmap_heap_ref(value, &ref) && --map->refs[ref] == 0)
+        vm_heap_release(thread, ref);
+}
+
+static vm_errors_t libhashmap_set(vm_thread_t **thread, libhashmap_t *map, const libhashmap_key_t *key, vm_value_t value) {
+    // owned constant strings are freed when dropped from stack
+    if (!libhashmap_copy(value, &value))
+        return VM_ERR_OUTOFMEMORY;
+
+    uint32_t slot = libhashmap_find(map, key);
+    if (slot != LIBHASHMAP_NOT_FOUND) {
+        // held before the old value is released: the same object stays out of the frames gc
+        if (!libhashmap_hold(thread, map, value)) {
+            libhashmap_free_value(value);
+            return VM_ERR_OUTOFMEMORY;
+        }
+        libhashmap_release(thread, map, map->entries[slot].value);
+        libhashmap_free_value(map->entries[slot].value);
+    } else {
+        vm_value_t stored;
+
+        if (map->growth_left == 0) {
+            // many tombstones: clean in place, else double
+            uint32_t cap = map->cap == 0 ? LIBHASHMAP_GROUP : (map->qty < map->cap / 2 ? map->cap : map->cap * 2);
+            if (cap > 0x80000000 || !libhashmap_rehash(map, cap)) {
+                libhashmap_free_value(value);
+                return VM_ERR_FAIL;
+            }
+        }
+        if (!libhashmap_key_store(key, &stored)) {
+            libhashmap_free_value(value);
+            return VM_ERR_OUTOFMEMORY;
+        }
+        if (!libhashmap_hold(thread, map, value)) {
+            libhashmap_free_key(stored);
+            libhashmap_free_value(value);
+            return VM_ERR_OUTOFMEMORY;
+        }
+
+        slot = libhashmap_find_free(map, key->hash);
+        if (map->ctrl[slot] == LIBHASHMAP_CTRL_EMPTY)
+            --map->growth_left;
+        map->ctrl[slot] = key->hash & 0x7f;
+        map->entries[slot].key = stored;
+        ++map->qty;
+    }
+
+    map->entries[slot].value = value;
+
+    return VM_ERR_OK;
+}
+
+static void libhashmap_delete(vm_thread_t **thread, libhashmap_t *map, uint32_t slot) {
+    libhashmap_release(thread, map, map->entries[slot].value);
+    libhashmap_free_key(map->entries[slot].key);
+    libhashmap_free_value(map->entries[slot].value);
+
+    // probing never passes a group with an empty slot, so the slot can be empty again
+    if (libhashmap_match_empty(map->ctrl + (slot & ~(LIBHASHMAP_GROUP - 1))) != 0) {
+        map->ctrl[slot] = LIBHASHMAP_CTRL_EMPTY;
+        ++map->growth_left;
+    } else
+        map->ctrl[slot] = LIBHASHMAP_CTRL_DELETED;
+
+    --map->qty;
+}
+
+static bool libhashmap_value_equal(vm_value_t a, vm_value_t b) {
+    if (a.type != b.type)
+        return false;
+
+    switch (a.type) {
+        case VM_VAL_NULL:
+            return true;
+        case VM_VAL_BOOL:
+            return a.number.boolean == b.number.boolean;
+        case VM_VAL_CONST_STRING:
+            return strcmp(VM_CSTR_ADDR(a), VM_CSTR_ADDR(b)) == 0;
+        case VM_VAL_LIB_OBJ:
+            return a.lib_obj.heap_ref == b.lib_obj.heap_ref;
+        default:
+            return a.number.uinteger == b.number.uinteger;
+    }
+}
+
+/////////////////
+vm_errors_t lib_entry_hashtable(vm_thread_t **thread, uint8_t call_type, uint32_t lib_idx, uint32_t arg) {
+    if (*thread == NULL)
+        return VM_ERR_FAIL;
+
+    vm_errors_t res = VM_ERR_OK;
+    switch (call_type) {
+        // vm cases
+        case VM_EDFAT_NEW: {
+            NEW_HEAP_REF(obj, arg);
+            obj->lib_obj.addr = calloc(1, sizeof(libhashmap_t));
+            obj->lib_obj.identifier = HASHTABLE_LIBRARY_IDENTIFIER;
+        }
+            break;
+
+        case VM_EDFAT_PUSH:
+            break;
+
+        case VM_EDFAT_CMP: {
+            libhashmap_t *map1 = MAP_OBJ(STK_TOP(thread));
+            libhashmap_t *map2 = MAP_OBJ(STK_SND(thread));
+            libhashmap_key_t key;
+
+            if (map1->qty != map2->qty) {
+                res = VM_ERR_FAIL;
+                break;
+            }
+
+            for (uint32_t n = 0; n < map1->cap && res == VM_ERR_OK; n++) {
+                if (map1->ctrl[n] < 0)
+                    continue;
+
+                libhashmap_stored_key(map1->entries[n].key, &key);
+                uint32_t slot = libhashmap_find(map2, &key);
+                if (slot == LIBHASHMAP_NOT_FOUND || !libhashmap_value_equal(map1->entries[n].value, map2->entries[slot].value))
+                    res = VM_ERR_FAIL;
+            }
+        }
+            break;
+
+        case VM_EDFAT_GC: {
+            libhashmap_t *map = vm_heap_load((*thread)->heap, arg)->lib_obj.addr;
+
+            // values are owned by the map (once, even if stored under many keys)
+            for (uint32_t ref = 0; map->refs != NULL && ref < VM_MAX_HEAP; ref++)
+                if (map->refs[ref] > 0 && ref != arg)
+                    vm_heap_collect(thread, ref);
+
+            libhashmap_free_entries(map, map->cap);
+
+            free(map->refs);
+            free(map->ctrl);
+            free(map);
+        }
+            break;
+
+        case VM_EDFAT_TOTYPE:
+            break;
+
+        case VM_EDFAT_CLONE: {
+            // heap references keep their positions in the clone, strings of the map are copied and interned strings are interned again
+            vm_heap_object_t *obj = vm_heap_load((*thread)->heap, arg);
+            libhashmap_t *src = obj->lib_obj.addr;
+            libhashmap_t *map = malloc(sizeof(libhashmap_t));
+            if (map == NULL)
+                return VM_ERR_OUTOFMEMORY;
+
+            *map = *src;
+            if (src->refs != NULL) {
+                if ((map->refs = malloc(VM_MAX_HEAP * sizeof(uint32_t))) == NULL) {
+                    free(map);
+                    return VM_ERR_OUTOFMEMORY;
+                }
+                memcpy(map->refs, src->refs, VM_MAX_HEAP * sizeof(uint32_t));
+            }
+            if (src->ctrl != NULL) {
+                size_t size = src->cap + (size_t) src->cap * sizeof(libhashmap_entry_t);
+                map->ctrl = aligned_alloc(LIBHASHMAP_GROUP, size);
+                if (map->ctrl == NULL) {
+                    free(map->refs);
+                    free(map);
+                    return VM_ERR_OUTOFMEMORY;
+                }
+                memcpy(map->ctrl, src->ctrl, size);
+                map->entries = (libhashmap_entry_t*) (map->ctrl + map->cap);
+
+                for (uint32_t n = 0; n < map->cap; n++) {
+                    if (map->ctrl[n] < 0)
+                        continue;
+                    libhashmap_entry_t *entry = &map->entries[n];
+                    libhashmap_key_t key;
+                    vm_value_t stored;
+
+                    libhashmap_stored_key(entry->key, &key);
+                    bool ok = libhashmap_key_store(&key, &stored);
+                    if (ok && !(ok = libhashmap_copy(entry->value, &entry->value)))
+                        libhashmap_free_key(stored);
+                    if (!ok) {
+                        // slots from n still hold the strings of the source
+                        libhashmap_free_entries(map, n);
+                        free(map->refs);
+                        free(map->ctrl);
+                        free(map);
+                        return VM_ERR_OUTOFMEMORY;
+                    }
+                    entry->key = stored;
+                    if (entry->value.type == VM_VAL_CONST_STRING && VM_CSTR_IS_INTERNED(entry->value))
+                        entry->value = vm_intern(thread, VM_CSTR_ADDR(entry->value), VM_INTERN_RECORD(VM_CSTR_ADDR(entry->value))->len);
+                }
+            }
+            obj->lib_obj.addr = map;
+        }
+            break;
+
+        case VM_EDFAT_SERIALIZE: {
+            // control bytes, then key and value of used slots (heap references keep their positions)
+            libhashmap_t *map = vm_heap_load((*thread)->heap, arg)->lib_obj.addr;
+            bool ok = vm_snapshot_write(thread, &map->cap, sizeof(uint32_t)) && vm_snapshot_write(thread, &map->qty, sizeof(uint32_t))
+                    && vm_snapshot_write(thread, &map->growth_left, sizeof(uint32_t)) && vm_snapshot_write(thread, map->ctrl, map->cap);
+
+            for (uint32_t n = 0; n < map->cap && ok; n++)
+                if (map->ctrl[n] >= 0)
+                    ok = vm_snapshot_write_value(thread, map->entries[n].key) && vm_snapshot_write_value(thread, map->entries[n].value);
+            if (!ok)
+                res = VM_ERR_OUTOFMEMORY;
+        }
+            break;
+
+        case VM_EDFAT_DESERIALIZE: {
+            vm_heap_object_t *obj = vm_heap_load((*thread)->heap, arg);
+            const void *fields = vm_snapshot_read(thread, 3 * sizeof(uint32_t));
+            const int8_t *ctrl;
+            libhashmap_t *map;
+
+            if (fields == NULL || (map = calloc(1, sizeof(libhashmap_t))) == NULL)
+                return VM_ERR_FAIL;
+            memcpy(&map->cap, fields, sizeof(uint32_t));
+            memcpy(&map->qty, (const uint8_t*) fields + sizeof(uint32_t), sizeof(uint32_t));
+            memcpy(&map->growth_left, (const uint8_t*) fields + 2 * sizeof(uint32_t), sizeof(uint32_t));
+            obj->lib_obj.addr = map;
+
+            if (map->cap == 0)
+                break;
+            if ((map->cap & (map->cap - 1)) != 0 || map->cap % LIBHASHMAP_GROUP != 0 || (ctrl = vm_snapshot_read(thread, map->cap)) == NULL)
+                return VM_ERR_FAIL;
+
+            size_t size = map->cap + (size_t) map->cap * sizeof(libhashmap_entry_t);
+            if ((map->ctrl = aligned_alloc(LIBHASHMAP_GROUP, size)) == NULL)
+                return VM_ERR_OUTOFMEMORY;
+            memset(map->ctrl, LIBHASHMAP_CTRL_EMPTY, map->cap);
+            map->entries = (libhashmap_entry_t*) (map->ctrl + map->cap);
+
+            for (uint32_t n = 0; n < map->cap; n++) {
+                if (ctrl[n] < 0) {
+                    map->ctrl[n] = ctrl[n];
+                    continue;
+                }
+                vm_value_t key;
+                libhashmap_key_t stored;
+                if (!vm_snapshot_read_value(thread, &key))
+                    return VM_ERR_FAIL;
+                if (key.type == VM_VAL_CONST_STRING) {
+                    // string key goes to a record of the map
+                    stored.str = VM_CSTR_ADDR(key);
+                    stored.len = strlen(stored.str);
+                    stored.hash = libhashmap_mix(vm_string_hash(stored.str, stored.len));
+                    bool ok = libhashmap_key_store(&stored, &map->entries[n].key);
+                    libhashmap_free_value(key);
+                    if (!ok)
+                        return VM_ERR_OUTOFMEMORY;
+                } else
+                    map->entries[n].key = key;
+                if (!vm_snapshot_read_value(thread, &map->entries[n].value)) {
+                    libhashmap_free_key(map->entries[n].key);
+                    return VM_ERR_FAIL;
+                }
+                if (!libhashmap_hold(thread, map, map->entries[n].value)) {
+                    libhashmap_free_key(map->entries[n].key);
+                    libhashmap_free_value(map->entries[n].value);
+                    return VM_ERR_OUTOFMEMORY;
+                }
+                map->ctrl[n] = ctrl[n];
+            }
+        }
+            break;
+
+            // internal cases
+        case LIBHASHMAP_FN_SET: {
+            libhashmap_key_t key;
+            if (!libhashmap_key(thread, STK_SND(thread), &key)) {
+                return VM_ERR_BAD_VALUE;
+            }
+
+            res = libhashmap_set(thread, MAP_OBJ(STK_TOP(thread)), &key, STK_TRD(thread));
+            if (res != VM_ERR_OK)
+                return res;
+
+            STKDROPST(thread);
+        }
+            break;
+
+        case LIBHASHMAP_FN_GET:
+        case LIBHASHMAP_FN_CONTAINS: {
+            libhashmap_key_t key;
+            if (!libhashmap_key(thread, STK_SND(thread), &key)) {
+                return VM_ERR_BAD_VALUE;
+            }
+
+            libhashmap_t *map = MAP_OBJ(STK_TOP(thread));
+            uint32_t slot = libhashmap_find(map, &key);
+            vm_value_t value = { .type = VM_VAL_NULL };
+
+            if (call_type == LIBHASHMAP_FN_CONTAINS) {
+                value.type = VM_VAL_BOOL;
+                value.number.boolean = slot != LIBHASHMAP_NOT_FOUND;
+            } else if (slot != LIBHASHMAP_NOT_FOUND && !libhashmap_copy(map->entries[slot].value, &value))
+                return VM_ERR_OUTOFMEMORY;
+
+            STK_DROP(thread);
+            STK_DROP(thread);
+            vm_push(thread, value);
+        }
+            break;
+
+        case LIBHASHMAP_FN_DELETE: {
+            libhashmap_key_t key;
+            if (!libhashmap_key(thread, STK_SND(thread), &key)) {
+                return VM_ERR_BAD_VALUE;
+            }
+
+            libhashmap_t *map = MAP_OBJ(STK_TOP(thread));
+            uint32_t slot = libhashmap_find(map, &key);
+            if (slot != LIBHASHMAP_NOT_FOUND)
+                libhashmap_delete(thread, map, slot);
+            STKDROPSND(thread);
+        }
+            break;
+
+        case LIBHASHMAP_FN_LEN: {
+            libhashmap_t *map = MAP_OBJ(STK_TOP(thread));
+            STK_TOP(thread).type = VM_VAL_UINT;
+            STK_TOP(thread).number.uinteger = map->qty;
+        }
+            break;
+
+        case LIBHASHMAP_FN_NEXT: {
+            if (STK_SND(thread).type != VM_VAL_UINT) {
+                return VM_ERR_BAD_VALUE;
+            }
+
+            libhashmap_t *map = MAP_OBJ(STK_TOP(thread));
+            uint32_t slot = STK_SND(thread).number.uinteger;
+            vm_value_t cursor = { .type = VM_VAL_UINT };
+            vm_value_t key, value;
+
+            while (slot < map->cap && map->ctrl[slot] < 0)
+                ++slot;
+
+            if (slot < map->cap) {
+                if (!libhashmap_copy(map->entries[slot].value, &value))
+                    return VM_ERR_OUTOFMEMORY;
+                if (!libhashmap_copy(map->entries[slot].key, &key)) {
+                    libhashmap_free_value(value);
+                    return VM_ERR_OUTOFMEMORY;
+                }
+                (*thread)->sp -= 2;
+                vm_push(thread, value);
+                vm_push(thread, key);
+                cursor.number.uinteger = slot + 1;
+            } else
+                (*thread)->sp -= 2;
+            vm_push(thread, cursor);
+        }
+            break;
+
+        default:
+            res = VM_ERR_FAIL;
+    }
+
+    return res;
+}
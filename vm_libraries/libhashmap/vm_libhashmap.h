@@ -0,0 +1,102 @@
+/*
+ * @vm_libhashmap.h
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   SwissTable: https://abseil.io/about/design/swisstables
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @version 2.0
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+
+#ifndef VM_LIBHASHMAP_H_
+#define VM_LIBHASHMAP_H_
+
+#include <stddef.h>
+
+#include "vm.h"
+
+#define HASHTABLE_LIBRARY_IDENTIFIER 0x00000012
+
+#define LIBHASHMAP_GROUP     16 // control bytes probed at once (one SSE2 register)
+#define LIBHASHMAP_CTRL_EMPTY   ((int8_t) 0x80) // control byte of empty slot
+#define LIBHASHMAP_CTRL_DELETED ((int8_t) 0xfe) // control byte of deleted slot (tombstone)
+
+enum LIBHASHMAP_FN {
+    LIBHASHMAP_FN_SET,      //
+    LIBHASHMAP_FN_GET,      //
+    LIBHASHMAP_FN_DELETE,   //
+    LIBHASHMAP_FN_CONTAINS, //
+    LIBHASHMAP_FN_LEN,      //
+    LIBHASHMAP_FN_NEXT,     //
+};
+
+/**
+ * @struct libhashmap_string_s
+ * @brief String key owned by the map (freed with its entry)
+ */
+typedef struct libhashmap_string_s {
+    uint64_t hash;  /**< cached hash (mixed, as probed) */
+    uint32_t len;   /**< length */
+        char str[]; /**< string (null terminated) */
+} libhashmap_string_t;
+
+#define LIBHASHMAP_STRING(addr) ((libhashmap_string_t*) ((addr) - offsetof(libhashmap_string_t, str))) /**< record of a string key address */
+
+/**
+ * @struct libhashmap_entry_s
+ * @brief Hash map slot
+ */
+typedef struct libhashmap_entry_s {
+    vm_value_t key;   /**< key (number or constant string in a libhashmap_string_t) */
+    vm_value_t value; /**< value (owned constant strings are copies owned by the map) */
+} libhashmap_entry_t;
+
+/**
+ * @struct libhashmap_s
+ * @brief Hash map library object.
+ * Open addressing, one control byte per slot (empty, deleted or 7 bits of hash) probed LIBHASHMAP_GROUP slots at a time.
+ */
+typedef struct libhashmap_s {
+                int8_t *ctrl;        /**< control bytes (cap), entries follow in the same allocation */
+    libhashmap_entry_t *entries;     /**< slots (cap) */
+              uint32_t cap;          /**< slots (power of 2, multiple of LIBHASHMAP_GROUP) */
+              uint32_t qty;          /**< entries */
+              uint32_t growth_left;  /**< empty slots usable before rehash (max load 7/8) */
+              uint32_t *refs;        /**< entries holding each heap object (VM_MAX_HEAP counts, NULL: none stored yet) */
+} libhashmap_t;
+
+/**
+ * @fn vm_errors_t lib_entry_hashtable(vm_thread_t **thread, uint8_t call_type, uint32_t lib_idx, uint32_t arg)
+ * @brief Function entry for hash map library
+ * Keys are INT, UINT, FLOAT (not NaN), constant strings or string objects (strings are compared by content,
+ * the map keeps its own copy of string keys and owned string values, freed on delete, overwrite and GC).
+ * Values are any vm_value_t. Heap objects stored as values belong to the map until no key holds them
+ * (a heap object can be stored under many keys of the same map, but only in one map).
+ * GET and NEXT push copies of string keys and owned string values (owned by stack).
+ * This functions support functions:
+ *        SET: Set value (third) for key (second). Map stays on stack.
+ *        GET: Return value for key (second) or NULL if not exist.
+ *     DELETE: Delete key (second). Map stays on stack.
+ *   CONTAINS: Return true if key (second) exist.
+ *        LEN: Return the number of entries.
+ *       NEXT: Iterate from cursor (second, start with 0). Push value, key and next cursor, or only cursor 0 at end.
+ *
+ * @param thread Thread
+ * @param call_type Call type
+ * @param lib_idx Index of called lib
+ * @param args Arguments
+ * @return
+ */
+vm_errors_t lib_entry_hashtable(vm_thread_t **thread, uint8_t call_type, uint32_t lib_idx, uint32_t arg);
+
+#endif /* VM_LIBHASHMAP_H_ */
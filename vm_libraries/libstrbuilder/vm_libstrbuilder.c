@@ -0,0 +1,249 @@
+/*
+ * @vm_libstrbuilder.c
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @version 2.0
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "vm.h"
+#include "vm_libstring.h"
+#include "vm_libstrbuilder.h"
+
+/**
+ * @def BUILDER_OBJ
+ * @brief builder of a library object in stack
+ *
+ */
+#define BUILDER_OBJ(value) ((libstrbuilder_t*) (HEAP_OBJ((value).lib_obj.heap_ref)->lib_obj.addr))
+
+///// utils /////
+// geometric growth: appends are amortized O(1) per character
+static bool libstrbuilder_reserve(libstrbuilder_t *builder, uint32_t more) {
+    uint64_t need = (uint64_t) builder->len + more;
+
+    if (need <= builder->cap)
+        return true;
+    if (need >= UINT32_MAX)
+        return false;
+
+    uint64_t cap = builder->cap > 0 ? builder->cap : LIBSTRBUILDER_INITIAL_CAP;
+    while (cap < need)
+        cap *= 2;
+    if (cap >= UINT32_MAX)
+        cap = need;
+
+    char *str = realloc(builder->str, cap + 1);
+    if (str == NULL)
+        return false;
+
+    builder->str = str;
+    builder->cap = cap;
+
+    return true;
+}
+
+static bool libstrbuilder_append(libstrbuilder_t *builder, const char *str, uint32_t len) {
+    if (!libstrbuilder_reserve(builder, len))
+        return false;
+
+    memcpy(builder->str + builder->len, str, len);
+    builder->len += len;
+    builder->str[builder->len] = '\0';
+
+    return true;
+}
+
+/////////////////
+vm_errors_t lib_entry_strbuilder(vm_thread_t **thread, uint8_t call_type, uint32_t lib_idx, uint32_t arg) {
+    if (*thread == NULL)
+        return VM_ERR_FAIL;
+
+    vm_errors_t res = VM_ERR_OK;
+    switch (call_type) {
+        // vm cases
+        case VM_EDFAT_NEW: {
+            NEW_HEAP_REF(obj, arg);
+            obj->lib_obj.addr = calloc(1, sizeof(libstrbuilder_t));
+            obj->lib_obj.identifier = STRBUILDER_LIBRARY_IDENTIFIER;
+        }
+            break;
+
+        case VM_EDFAT_PUSH:
+            break;
+
+        case VM_EDFAT_CMP: {
+            libstrbuilder_t *builder1 = BUILDER_OBJ(STK_TOP(thread));
+            libstrbuilder_t *builder2 = BUILDER_OBJ(STK_SND(thread));
+            if (builder1->len != builder2->len || memcmp(builder1->str, builder2->str, builder1->len) != 0)
+                res = VM_ERR_FAIL;
+        }
+            break;
+
+        case VM_EDFAT_GC: {
+            libstrbuilder_t *builder = vm_heap_load((*thread)->heap, arg)->lib_obj.addr;
+            free(builder->str);
+            free(builder);
+        }
+            break;
+
+        case VM_EDFAT_TOTYPE:
+            break;
+
+        case VM_EDFAT_CLONE: {
+            vm_heap_object_t *obj = vm_heap_load((*thread)->heap, arg);
+            libstrbuilder_t *src = obj->lib_obj.addr;
+            libstrbuilder_t *builder = malloc(sizeof(libstrbuilder_t));
+            if (builder == NULL)
+                return VM_ERR_OUTOFMEMORY;
+
+            *builder = *src;
+            if (src->str != NULL) {
+                builder->str = malloc(src->cap + 1);
+                if (builder->str == NULL) {
+                    free(builder);
+                    return VM_ERR_OUTOFMEMORY;
+                }
+                memcpy(builder->str, src->str, src->len);
+                builder->str[src->len] = '\0';
+            }
+            obj->lib_obj.addr = builder;
+        }
+            break;
+
+        case VM_EDFAT_SERIALIZE: {
+            libstrbuilder_t *builder = vm_heap_load((*thread)->heap, arg)->lib_obj.addr;
+            if (!vm_snapshot_write(thread, &builder->len, sizeof(uint32_t)) || !vm_snapshot_write(thread, builder->str, builder->len))
+                res = VM_ERR_OUTOFMEMORY;
+        }
+            break;
+
+        case VM_EDFAT_DESERIALIZE: {
+            vm_heap_object_t *obj = vm_heap_load((*thread)->heap, arg);
+            const void *len_data = vm_snapshot_read(thread, sizeof(uint32_t));
+            const char *str;
+            uint32_t len;
+
+            if (len_data == NULL)
+                return VM_ERR_FAIL;
+            memcpy(&len, len_data, sizeof(uint32_t));
+            if ((str = vm_snapshot_read(thread, len)) == NULL)
+                return VM_ERR_FAIL;
+
+            libstrbuilder_t *builder = calloc(1, sizeof(libstrbuilder_t));
+            if (builder == NULL)
+                return VM_ERR_OUTOFMEMORY;
+            if (!libstrbuilder_append(builder, str, len)) {
+                free(builder);
+                return VM_ERR_OUTOFMEMORY;
+            }
+            obj->lib_obj.addr = builder;
+        }
+            break;
+
+            // internal cases
+        case LIBSTRBUILDER_FN_APPEND: {
+            libstrbuilder_t *builder = BUILDER_OBJ(STK_TOP(thread));
+            vm_value_t value = STK_SND(thread);
+            libstring_view_t string;
+
+            if (libstring_arg(thread, value, &string)) {
+                if (!libstrbuilder_append(builder, string.str, string.len))
+                    return VM_ERR_FAIL;
+            } else {
+                if (!libstrbuilder_reserve(builder, LIBSTRING_NUMBER_MAX))
+                    return VM_ERR_FAIL;
+
+                char *str = builder->str + builder->len;
+                switch (value.type) {
+                    case VM_VAL_BOOL:
+                        memcpy(str, value.number.boolean ? "true" : "false", 5);
+                        builder->len += value.number.boolean ? 4 : 5;
+                        break;
+                    case VM_VAL_UINT:
+                        builder->len += libstring_utoa(value.number.uinteger, str);
+                        break;
+                    case VM_VAL_INT:
+                        builder->len += libstring_itoa(value.number.integer, str);
+                        break;
+                    case VM_VAL_FLOAT:
+                        builder->len += libstring_ftoa(value.number.real, str);
+                        break;
+                    default:
+                        return VM_ERR_BAD_VALUE;
+                }
+                builder->str[builder->len] = '\0';
+            }
+            STKDROPSND(thread);
+        }
+            break;
+
+        case LIBSTRBUILDER_FN_RESERVE: {
+            if (STK_SND(thread).type != VM_VAL_UINT) {
+                return VM_ERR_BAD_VALUE;
+            }
+
+            if (!libstrbuilder_reserve(BUILDER_OBJ(STK_TOP(thread)), STK_SND(thread).number.uinteger))
+                return VM_ERR_FAIL;
+            STKDROPSND(thread);
+        }
+            break;
+
+        case LIBSTRBUILDER_FN_LEN: {
+            libstrbuilder_t *builder = BUILDER_OBJ(STK_TOP(thread));
+            STK_TOP(thread).type = VM_VAL_UINT;
+            STK_TOP(thread).number.uinteger = builder->len;
+        }
+            break;
+
+        case LIBSTRBUILDER_FN_FINISH: {
+            if (arg >= (*thread)->externals->lib_qty || (*thread)->externals->lib[arg] != lib_entry_strings) {
+                return VM_ERR_BAD_VALUE;
+            }
+
+            libstrbuilder_t *builder = BUILDER_OBJ(STK_TOP(thread));
+            vm_heap_object_t obj;
+
+            if (builder->len <= LIBSTRING_INLINE_MAX) {
+                // short result is stored inline, builder keeps its buffer
+                char *str = libstring_set(&obj, builder->len);
+                if (builder->len > 0)
+                    memcpy(str, builder->str, builder->len);
+            } else {
+                // hand over the buffer, builder is left empty
+                obj.lib_obj.identifier = STRING_LIBRARY_IDENTIFIER;
+                obj.lib_obj.addr = libstring_own(builder->str, builder->len, builder->cap);
+                builder->str = NULL;
+                builder->cap = 0;
+            }
+            builder->len = 0;
+
+            vm_value_t value = { .type = VM_VAL_LIB_OBJ };
+            obj.lib_obj.lib_idx = arg;
+            value.lib_obj.lib_idx = arg;
+            value.lib_obj.heap_ref = vm_heap_save((*thread)->heap, VM_VAL_LIB_OBJ, false, obj, &((*thread)->frames[(*thread)->fc].gc_mark));
+            STK_TOP(thread) = value;
+        }
+            break;
+
+        default:
+            res = VM_ERR_FAIL;
+    }
+
+    return res;
+}
@@ -0,0 +1,63 @@
+/*
+ * @vm_libstrbuilder.h
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @version 2.0
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#ifndef LIBSTRBUILDER_H_
+#define LIBSTRBUILDER_H_
+
+#include "vm.h"
+
+#define STRBUILDER_LIBRARY_IDENTIFIER 0x00000010
+
+#define LIBSTRBUILDER_INITIAL_CAP 64 // first allocation of a builder
+
+enum LIBSTRBUILDER_FN {
+    LIBSTRBUILDER_FN_APPEND,  //
+    LIBSTRBUILDER_FN_RESERVE, //
+    LIBSTRBUILDER_FN_LEN,     //
+    LIBSTRBUILDER_FN_FINISH,  //
+};
+
+/**
+ * @struct libstrbuilder_s
+ * @brief String builder library object
+ */
+typedef struct libstrbuilder_s {
+    uint32_t len; /**< length */
+    uint32_t cap; /**< capacity (buffer has cap + 1 bytes) */
+    char *str;    /**< buffer */
+} libstrbuilder_t;
+
+/**
+ * @fn vm_errors_t lib_entry_strbuilder(vm_thread_t **thread, uint8_t call_type, uint32_t lib_idx, uint32_t arg)
+ * @brief Function entry for string builder library
+ * This functions support functions:
+ *    APPEND: Append a constant string, string object or number. Builder stays on stack.
+ *   RESERVE: Ensure capacity for n more characters. Builder stays on stack.
+ *       LEN: Return the length of the built string.
+ *    FINISH: Replace the builder by a string object (arg: index of strings library). The buffer is handed over without copy
+ *            and the builder is left empty.
+ *
+ * @param thread Thread
+ * @param call_type Call type
+ * @param lib_idx Index of called lib
+ * @param args Arguments
+ * @return
+ */
+vm_errors_t lib_entry_strbuilder(vm_thread_t **thread, uint8_t call_type, uint32_t lib_idx, uint32_t arg);
+
+#endif /* LIBSTRBUILDER_H_ */
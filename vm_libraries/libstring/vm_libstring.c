@@ -22,6 +22,13 @@
 #include <string.h>
 #include <stdio.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
 #include "vm.h"
 #include "vm_libstring.h"
 
@@ -36,33 +43,345 @@
                 _zzz_new_value.type = VM_VAL_LIB_OBJ;                                                                                              \
                 _zzz_new_value.lib_obj.lib_idx = lidx;                                                                                             \
                 vm_heap_object_t _zzz_new_obj;                                                                                                     \
-                _zzz_new_obj.type = VM_VAL_LIB_OBJ;                                                                                                \
                 _zzz_new_obj.lib_obj.identifier = STRING_LIBRARY_IDENTIFIER;                                                                       \
                 _zzz_new_obj.lib_obj.lib_idx = lidx;                                                                                               \
                 _zzz_new_obj.lib_obj.addr = NULL;                                                                                                  \
-                _zzz_new_value.lib_obj.heap_ref = vm_heap_save((*thread)->heap, _zzz_new_obj, &((*thread)->frames[(*thread)->fc].gc_mark)); \
-                vm_push(thread, _zzz_new_value);                                                                                                \
+                _zzz_new_value.lib_obj.heap_ref = vm_heap_save((*thread)->heap, VM_VAL_LIB_OBJ, false, _zzz_new_obj,                               \
+                        &((*thread)->frames[(*thread)->fc].gc_mark));                                                                              \
+                vm_push(thread, _zzz_new_value);                                                                                                   \
             }
 
+/**
+ * @def STR_VIEW
+ * @brief view of a library object in stack
+ *
+ */
+#define STR_VIEW(value, view) libstring_obj_view(HEAP_OBJ((value).lib_obj.heap_ref), &(view))
+
 ///// utils /////
-static uint32_t libstring_strpos(char *str, char *substr, uint32_t offset) {
-    if (str == NULL || substr == NULL)
-        return 0;
+libstring_t* libstring_new(uint32_t cap) {
+    libstring_t *string = malloc(sizeof(libstring_t));
 
-    if (str == NULL || substr == NULL)
-        return 0xffffffff;
-    char *found = NULL;
+    if (cap == 0)
+        cap = 1; // cap 0 means not owned
+
+    string->refs = 1;
+    string->len = 0;
+    string->cap = cap;
+    string->str = malloc(cap + 1);
+    string->str[0] = '\0';
+    string->parent = NULL;
+
+    return string;
+}
+
+libstring_t* libstring_ref(char *str, uint32_t len) {
+    libstring_t *string = malloc(sizeof(libstring_t));
+
+    string->refs = 1;
+    string->len = len;
+    string->cap = 0;
+    string->str = str;
+    string->parent = NULL;
+
+    return string;
+}
+
+libstring_t* libstring_own(char *str, uint32_t len, uint32_t cap) {
+    libstring_t *string = libstring_ref(str, len);
+
+    string->cap = cap;
+
+    return string;
+}
+
+libstring_t* libstring_slice(libstring_t *parent, uint32_t pos, uint32_t len) {
+    libstring_t *root = parent->parent != NULL ? parent->parent : parent;
+    libstring_t *string = libstring_ref(parent->str + pos, len);
+
+    string->parent = root;
+    ++root->refs;
 
-    if ((found = strstr(str + offset, substr)) == NULL)
+    return string;
+}
+
+void libstring_release(libstring_t *string) {
+    if (string == NULL || --string->refs > 0)
+        return;
+
+    if (string->cap > 0)
+        free(string->str);
+    if (string->parent != NULL)
+        libstring_release(string->parent);
+    free(string);
+}
+
+static void libstring_obj_view(vm_heap_object_t *obj, libstring_view_t *view) {
+    if (obj->lib_obj.identifier == STRING_LIBRARY_IDENTIFIER_INLINE) {
+        memcpy(view->data, obj->lib_obj.data, LIBSTRING_INLINE_MAX);
+        view->data[LIBSTRING_INLINE_MAX] = '\0';
+        view->str = view->data;
+        view->len = strlen(view->data);
+        view->string = NULL;
+    } else {
+        view->string = obj->lib_obj.addr;
+        view->str = view->string->str;
+        view->len = view->string->len;
+    }
+}
+
+bool libstring_arg(vm_thread_t **thread, vm_value_t value, libstring_view_t *view) {
+    if (value.type == VM_VAL_CONST_STRING) {
+        view->str = VM_CSTR_ADDR(value);
+        view->len = strlen(view->str);
+        view->string = NULL;
+        return true;
+    }
+
+    if (value.type == VM_VAL_LIB_OBJ && vm_heap_type((*thread)->heap, value.lib_obj.heap_ref) == VM_VAL_LIB_OBJ
+            && (HEAP_OBJ(value.lib_obj.heap_ref)->lib_obj.identifier == STRING_LIBRARY_IDENTIFIER
+                    || HEAP_OBJ(value.lib_obj.heap_ref)->lib_obj.identifier == STRING_LIBRARY_IDENTIFIER_INLINE)) {
+        STR_VIEW(value, *view);
+        return true;
+    }
+
+    return false;
+}
+
+char* libstring_set(vm_heap_object_t *obj, uint32_t len) {
+    if (len <= LIBSTRING_INLINE_MAX) {
+        obj->lib_obj.identifier = STRING_LIBRARY_IDENTIFIER_INLINE;
+        memset(obj->lib_obj.data, 0, LIBSTRING_INLINE_MAX);
+        return obj->lib_obj.data;
+    }
+
+    libstring_t *string = libstring_new(len);
+    string->len = len;
+    string->str[len] = '\0';
+    obj->lib_obj.identifier = STRING_LIBRARY_IDENTIFIER;
+    obj->lib_obj.addr = string;
+
+    return string->str;
+}
+
+// scalar search: first byte with memchr, then compare
+static uint32_t libstring_strpos_scalar(const char *str, uint32_t len, const char *substr, uint32_t sublen, uint32_t offset) {
+    const char *pos = str + offset;
+    const char *last = str + len - sublen;
+
+    while (pos <= last && (pos = memchr(pos, substr[0], last - pos + 1)) != NULL) {
+        if (memcmp(pos, substr, sublen) == 0)
+            return pos - str;
+        ++pos;
+    }
+
+    return 0xffffffff;
+}
+
+#ifdef __SSE2__
+// first and last byte filter, 32 candidates at a time. Only positions where both bytes match are compared
+static uint32_t libstring_strpos_sse2(const char *str, uint32_t len, const char *substr, uint32_t sublen, uint32_t offset) {
+    const __m128i first = _mm_set1_epi8(substr[0]);
+    const __m128i last = _mm_set1_epi8(substr[sublen - 1]);
+    const char *end = str + len - (sublen - 1);
+    const char *pos = str + offset;
+
+    for (; pos + 32 <= end; pos += 32) {
+        __m128i eq0 = _mm_and_si128(_mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i*) pos)),
+                _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i*) (pos + sublen - 1))));
+        __m128i eq1 = _mm_and_si128(_mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i*) (pos + 16))),
+                _mm_cmpeq_epi8(last, _mm_loadu_si128((const __m128i*) (pos + 16 + sublen - 1))));
+        uint32_t mask = _mm_movemask_epi8(eq0) | (_mm_movemask_epi8(eq1) << 16);
+
+        while (mask != 0) {
+            uint32_t bit = __builtin_ctz(mask);
+            if (memcmp(pos + bit + 1, substr + 1, sublen - 2) == 0)
+                return pos - str + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    return libstring_strpos_scalar(str, len, substr, sublen, pos - str);
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define LIBSTRING_AVX2
+// same filter with 32 bytes registers, selected at run time
+__attribute__((target("avx2")))
+static uint32_t libstring_strpos_avx2(const char *str, uint32_t len, const char *substr, uint32_t sublen, uint32_t offset) {
+    const __m256i first = _mm256_set1_epi8(substr[0]);
+    const __m256i last = _mm256_set1_epi8(substr[sublen - 1]);
+    const char *end = str + len - (sublen - 1);
+    const char *pos = str + offset;
+
+    for (; pos + 32 <= end; pos += 32) {
+        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i*) pos)),
+                _mm256_cmpeq_epi8(last, _mm256_loadu_si256((const __m256i*) (pos + sublen - 1))));
+        uint32_t mask = _mm256_movemask_epi8(eq);
+
+        while (mask != 0) {
+            uint32_t bit = __builtin_ctz(mask);
+            if (memcmp(pos + bit + 1, substr + 1, sublen - 2) == 0)
+                return pos - str + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    return libstring_strpos_scalar(str, len, substr, sublen, pos - str);
+}
+#endif
+
+static uint32_t libstring_strpos(const char *str, uint32_t len, const char *substr, uint32_t sublen, uint32_t offset) {
+    if (offset > len || sublen > len - offset)
         return 0xffffffff;
+    if (sublen == 0)
+        return offset;
+
+#ifdef LIBSTRING_AVX2
+    if (sublen > 1 && __builtin_cpu_supports("avx2"))
+        return libstring_strpos_avx2(str, len, substr, sublen, offset);
+#endif
+#ifdef __SSE2__
+    if (sublen > 1)
+        return libstring_strpos_sse2(str, len, substr, sublen, offset);
+#endif
+
+    return libstring_strpos_scalar(str, len, substr, sublen, offset);
+}
+
+static inline bool libstring_match_any(const char *str, uint32_t len, uint32_t at, libstring_view_t *needles, uint32_t qty, uint32_t *needle) {
+    for (uint32_t n = 0; n < qty; n++)
+        if (needles[n].str[0] == str[at] && needles[n].len <= len - at && memcmp(str + at, needles[n].str, needles[n].len) == 0) {
+            *needle = n;
+            return true;
+        }
 
-    return found - str;
+    return false;
 }
 
-static void libstring_strins(char **str_to, char *str_ins, size_t pos) {
-    *str_to = realloc(*str_to, (strlen(*str_to) + strlen(str_ins) + 1) * sizeof(char));
-    memcpy(*str_to + pos + strlen(str_ins), *str_to + pos, strlen(*str_to) - pos + 1);
-    memcpy(*str_to + pos, str_ins, strlen(str_ins));
+#define LIBSTRING_SCAN_FOUND 0x80000000 // scan result: match position, else position where scan stopped
+
+#ifdef __SSE2__
+static uint32_t libstring_scan_any_sse2(const char *str, uint32_t len, uint32_t pos, uint32_t end, uint32_t shortest, const uint8_t *firsts,
+        uint32_t first_qty, const uint8_t *lasts, uint32_t last_qty, libstring_view_t *needles, uint32_t qty, uint32_t *needle) {
+    __m128i set_first[16], set_last[16];
+    for (uint32_t n = 0; n < first_qty; n++)
+        set_first[n] = _mm_set1_epi8(firsts[n]);
+    for (uint32_t n = 0; n < last_qty; n++)
+        set_last[n] = _mm_set1_epi8(lasts[n]);
+
+    for (; pos + 16 <= end; pos += 16) {
+        __m128i block_first = _mm_loadu_si128((const __m128i*) (str + pos));
+        __m128i block_last = _mm_loadu_si128((const __m128i*) (str + pos + shortest - 1));
+        __m128i eq_first = _mm_setzero_si128(), eq_last = _mm_setzero_si128();
+        for (uint32_t n = 0; n < first_qty; n++)
+            eq_first = _mm_or_si128(eq_first, _mm_cmpeq_epi8(block_first, set_first[n]));
+        for (uint32_t n = 0; n < last_qty; n++)
+            eq_last = _mm_or_si128(eq_last, _mm_cmpeq_epi8(block_last, set_last[n]));
+
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(eq_first, eq_last));
+        while (mask != 0) {
+            uint32_t at = pos + __builtin_ctz(mask);
+            if (libstring_match_any(str, len, at, needles, qty, needle))
+                return at | LIBSTRING_SCAN_FOUND;
+            mask &= mask - 1;
+        }
+    }
+
+    return pos;
+}
+#endif
+
+#ifdef LIBSTRING_AVX2
+__attribute__((target("avx2")))
+static uint32_t libstring_scan_any_avx2(const char *str, uint32_t len, uint32_t pos, uint32_t end, uint32_t shortest, const uint8_t *firsts,
+        uint32_t first_qty, const uint8_t *lasts, uint32_t last_qty, libstring_view_t *needles, uint32_t qty, uint32_t *needle) {
+    __m256i set_first[16], set_last[16];
+    for (uint32_t n = 0; n < first_qty; n++)
+        set_first[n] = _mm256_set1_epi8(firsts[n]);
+    for (uint32_t n = 0; n < last_qty; n++)
+        set_last[n] = _mm256_set1_epi8(lasts[n]);
+
+    for (; pos + 32 <= end; pos += 32) {
+        __m256i block_first = _mm256_loadu_si256((const __m256i*) (str + pos));
+        __m256i block_last = _mm256_loadu_si256((const __m256i*) (str + pos + shortest - 1));
+        __m256i eq_first = _mm256_setzero_si256(), eq_last = _mm256_setzero_si256();
+        for (uint32_t n = 0; n < first_qty; n++)
+            eq_first = _mm256_or_si256(eq_first, _mm256_cmpeq_epi8(block_first, set_first[n]));
+        for (uint32_t n = 0; n < last_qty; n++)
+            eq_last = _mm256_or_si256(eq_last, _mm256_cmpeq_epi8(block_last, set_last[n]));
+
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(eq_first, eq_last));
+        while (mask != 0) {
+            uint32_t at = pos + __builtin_ctz(mask);
+            if (libstring_match_any(str, len, at, needles, qty, needle))
+                return at | LIBSTRING_SCAN_FOUND;
+            mask &= mask - 1;
+        }
+    }
+
+    return pos;
+}
+#endif
+
+// one scan for several needles: candidates are positions holding the first byte of any needle and, at distance of
+// shortest needle, its last byte for any needle (up to 16 distinct bytes each, else scalar)
+static uint32_t libstring_strpos_any(const char *str, uint32_t len, libstring_view_t *needles, uint32_t qty, uint32_t offset, uint32_t *needle) {
+    uint8_t distinct_first[16], distinct_last[16];
+    uint32_t first_qty = 0, last_qty = 0, shortest = UINT32_MAX;
+
+    if (qty == 0 || offset > len)
+        return 0xffffffff;
+
+    for (uint32_t n = 0; n < qty; n++) {
+        if (needles[n].len == 0) {
+            *needle = n;
+            return offset;
+        }
+        if (needles[n].len < shortest)
+            shortest = needles[n].len;
+    }
+
+    for (uint32_t n = 0; n < qty && first_qty <= sizeof(distinct_first) && last_qty <= sizeof(distinct_last); n++) {
+        uint8_t f = needles[n].str[0], l = needles[n].str[shortest - 1];
+        uint32_t m;
+        for (m = 0; m < first_qty && distinct_first[m] != f; m++)
+            ;
+        if (m == first_qty && first_qty++ < sizeof(distinct_first))
+            distinct_first[m] = f;
+        for (m = 0; m < last_qty && distinct_last[m] != l; m++)
+            ;
+        if (m == last_qty && last_qty++ < sizeof(distinct_last))
+            distinct_last[m] = l;
+    }
+
+    if (shortest > len - offset)
+        return 0xffffffff;
+
+    uint32_t pos = offset;
+    uint32_t end = len - (shortest - 1); // candidates
+    if (first_qty <= sizeof(distinct_first) && last_qty <= sizeof(distinct_last) && len < LIBSTRING_SCAN_FOUND) {
+#ifdef LIBSTRING_AVX2
+        if (__builtin_cpu_supports("avx2")) {
+            if ((pos = libstring_scan_any_avx2(str, len, pos, end, shortest, distinct_first, first_qty, distinct_last, last_qty, needles, qty, needle))
+                    & LIBSTRING_SCAN_FOUND)
+                return pos & ~LIBSTRING_SCAN_FOUND;
+        }
+#endif
+#ifdef __SSE2__
+        if ((pos = libstring_scan_any_sse2(str, len, pos, end, shortest, distinct_first, first_qty, distinct_last, last_qty, needles, qty, needle))
+                & LIBSTRING_SCAN_FOUND)
+            return pos & ~LIBSTRING_SCAN_FOUND;
+#endif
+    }
+
+    for (; pos < end; pos++) {
+        if (libstring_match_any(str, len, pos, needles, qty, needle))
+            return pos;
+    }
+
+    return 0xffffffff;
 }
 
 /////////////////
@@ -75,8 +394,16 @@ vm_errors_t lib_entry_strings(vm_thread_t **thread, uint8_t call_type, uint32_t
         // vm cases
         case VM_EDFAT_NEW: {
             NEW_HEAP_REF(obj, arg);
-            obj->lib_obj.addr = strdup(STK_SND(thread).cstr.addr);
-            obj->lib_obj.identifier = STRING_LIBRARY_IDENTIFIER;
+            vm_value_t value = STK_SND(thread);
+            const char *str = value.type == VM_VAL_CONST_STRING ? VM_CSTR_ADDR(value) : "";
+            uint32_t len = strlen(str);
+
+            if (len > LIBSTRING_INLINE_MAX && value.type == VM_VAL_CONST_STRING && VM_CSTR_IS_PROGRAM(value)) {
+                // program image (or interned) strings outlive the object, reference them
+                obj->lib_obj.addr = libstring_ref(VM_CSTR_ADDR(value), len);
+                obj->lib_obj.identifier = STRING_LIBRARY_IDENTIFIER;
+            } else
+                memcpy(libstring_set(obj, len), str, len);
             STKDROPSND(thread);
         }
             break;
@@ -85,26 +412,62 @@ vm_errors_t lib_entry_strings(vm_thread_t **thread, uint8_t call_type, uint32_t
             break;
 
         case VM_EDFAT_CMP: {
-            NEW_HEAP_REF(obj1, STK_TOP(thread).lib_obj.heap_ref);
-            NEW_HEAP_REF(obj2, STK_SND(thread).lib_obj.heap_ref);
-            if (strcmp(obj1->lib_obj.addr, obj2->lib_obj.addr) != 0)
+            libstring_view_t string1, string2;
+            STR_VIEW(STK_TOP(thread), string1);
+            STR_VIEW(STK_SND(thread), string2);
+            if (string1.len != string2.len || memcmp(string1.str, string2.str, string1.len) != 0)
                 res = VM_ERR_FAIL;
         }
             break;
 
         case VM_EDFAT_GC: {
-            free(vm_heap_load((*thread)->heap, arg)->lib_obj.addr);
+            vm_heap_object_t *obj = vm_heap_load((*thread)->heap, arg);
+            if (obj->lib_obj.identifier == STRING_LIBRARY_IDENTIFIER)
+                libstring_release(obj->lib_obj.addr);
         }
             break;
 
         case VM_EDFAT_TOTYPE:
             break;
 
+        case VM_EDFAT_CLONE: {
+            // inline strings are already copied, others may reference the source thread (interned or slices)
+            vm_heap_object_t *obj = vm_heap_load((*thread)->heap, arg);
+            if (obj->lib_obj.identifier == STRING_LIBRARY_IDENTIFIER) {
+                libstring_t *string = obj->lib_obj.addr;
+                memcpy(libstring_set(obj, string->len), string->str, string->len);
+            }
+        }
+            break;
+
+        case VM_EDFAT_SERIALIZE: {
+            libstring_view_t string;
+            libstring_obj_view(vm_heap_load((*thread)->heap, arg), &string);
+            if (!vm_snapshot_write(thread, &string.len, sizeof(uint32_t)) || !vm_snapshot_write(thread, string.str, string.len))
+                res = VM_ERR_OUTOFMEMORY;
+        }
+            break;
+
+        case VM_EDFAT_DESERIALIZE: {
+            const void *len_data = vm_snapshot_read(thread, sizeof(uint32_t));
+            const char *str;
+            uint32_t len;
+
+            if (len_data == NULL)
+                return VM_ERR_FAIL;
+            memcpy(&len, len_data, sizeof(uint32_t));
+            if ((str = vm_snapshot_read(thread, len)) == NULL)
+                return VM_ERR_FAIL;
+            memcpy(libstring_set(vm_heap_load((*thread)->heap, arg), len), str, len);
+        }
+            break;
+
             // internal cases
         case LIBSTRING_FN_LEN: {
-            NEW_HEAP_REF(obj, STK_TOP(thread).lib_obj.heap_ref);
+            libstring_view_t string;
+            STR_VIEW(STK_TOP(thread), string);
             STK_TOP(thread).type = VM_VAL_UINT;
-            STK_TOP(thread).number.uinteger = strlen((char*)obj->lib_obj.addr);
+            STK_TOP(thread).number.uinteger = string.len;
         }
         break;
 
@@ -116,28 +479,30 @@ vm_errors_t lib_entry_strings(vm_thread_t **thread, uint8_t call_type, uint32_t
 
             uint32_t size;
             uint32_t pos;
+            libstring_view_t string;
 
-            NEW_HEAP_REF(obj, STK_TOP(thread).lib_obj.heap_ref);
+            STR_VIEW(STK_TOP(thread), string);
             pos = STK_SND(thread).number.uinteger;
             STK_DROP2(thread);
-            char *string = (char*)obj->lib_obj.addr;
-            STR_NEW_OBJ(thread, lib_idx);
-            NEW_HEAP_REF(new_obj, STK_TOP(thread).lib_obj.heap_ref);
 
             if(call_type == LIBSTRING_FN_RIGHT) {
-                if(pos + 1 > strlen(string)) {
-                    size = strlen(string);
+                if(pos + 1 > string.len) {
+                    size = string.len;
                     pos = 0;
                 } else {
-                    size = strlen(string) - pos + 1;
+                    size = string.len - pos;
                 }
-                new_obj->lib_obj.addr = calloc(size + 1, sizeof(char));
-                memcpy(new_obj->lib_obj.addr, string + pos, size);
             } else {
-                size = pos + 1 > strlen(string) ? strlen(string) : pos + 1;
-                new_obj->lib_obj.addr = calloc(size + 1, sizeof(char));
-                memcpy(new_obj->lib_obj.addr, string, size);
+                size = pos + 1 > string.len ? string.len : pos + 1;
+                pos = 0;
             }
+
+            STR_NEW_OBJ(thread, lib_idx);
+            NEW_HEAP_REF(new_obj, STK_TOP(thread).lib_obj.heap_ref);
+            if (size > LIBSTRING_INLINE_MAX)
+                new_obj->lib_obj.addr = libstring_slice(string.string, pos, size);
+            else
+                memcpy(libstring_set(new_obj, size), string.str + pos, size);
         }
         break;
 
@@ -146,49 +511,42 @@ vm_errors_t lib_entry_strings(vm_thread_t **thread, uint8_t call_type, uint32_t
                 return VM_ERR_BAD_VALUE;
             }
 
-            NEW_HEAP_REF(obj, STK_TOP(thread).lib_obj.heap_ref);
+            libstring_view_t string;
+            STR_VIEW(STK_TOP(thread), string);
             uint32_t posr = STK_SND(thread).number.uinteger;
             uint32_t posl = STK_TRD(thread).number.uinteger;
             STK_DROP3(thread);
-            char *string = (char*)obj->lib_obj.addr;
 
-            if(posl > posr || posl > strlen(string) - 1 || posl > strlen(string) - 1) {
+            if(posl > posr || posl >= string.len) {
                 posl = 0;
-                posr = strlen(string) - 1;
+                posr = string.len - 1;
             }
+            if (posr >= string.len)
+                posr = string.len - 1;
+            uint32_t size = string.len == 0 ? 0 : posr - posl + 1;
 
             STR_NEW_OBJ(thread, lib_idx);
             NEW_HEAP_REF(new_obj, STK_TOP(thread).lib_obj.heap_ref);
-
-            uint32_t size = posr - posl + 1;
-            new_obj->lib_obj.addr = calloc(size + 1, sizeof(char));
-            memcpy(new_obj->lib_obj.addr, string + posl, size);
+            if (size > LIBSTRING_INLINE_MAX)
+                new_obj->lib_obj.addr = libstring_slice(string.string, posl, size);
+            else
+                memcpy(libstring_set(new_obj, size), string.str + posl, size);
         }
         break;
 
         case LIBSTRING_FN_CONCAT: {
-            if((STK_SND(thread).type != VM_VAL_LIB_OBJ
-                    && (vm_heap_load((*thread)->heap, STK_SND(thread).lib_obj.heap_ref))->lib_obj.identifier == STRING_LIBRARY_IDENTIFIER)
-                    || STK_SND(thread).type != VM_VAL_CONST_STRING) {
+            libstring_view_t string1, string2;
+            if(!libstring_arg(thread, STK_SND(thread), &string2)) {
                 return VM_ERR_BAD_VALUE;
             }
 
-            char *string2 = NULL;
-            NEW_HEAP_REF(obj, STK_TOP(thread).lib_obj.heap_ref);
-            if(STK_SND(thread).type == VM_VAL_LIB_OBJ) {
-                NEW_HEAP_REF(obj2, STK_SND(thread).lib_obj.heap_ref);
-                string2 = (char*)obj2->lib_obj.addr;
-            } else {
-                string2 = STK_SND(thread).cstr.addr;
-            }
-
-            char *string1 = (char*)obj->lib_obj.addr;
+            STR_VIEW(STK_TOP(thread), string1);
             STR_NEW_OBJ(thread, lib_idx);
             NEW_HEAP_REF(new_obj, STK_TOP(thread).lib_obj.heap_ref);
 
-            uint32_t size = strlen(string1) + strlen(string2);
-            new_obj->lib_obj.addr = calloc(size + 1, sizeof(char));
-            sprintf(new_obj->lib_obj.addr, "%s%s", string1, string2);
+            char *str = libstring_set(new_obj, string1.len + string2.len);
+            memcpy(str, string1.str, string1.len);
+            memcpy(str + string1.len, string2.str, string2.len);
             STKDROPST(thread);
         }
         break;
@@ -198,88 +556,204 @@ vm_errors_t lib_entry_strings(vm_thread_t **thread, uint8_t call_type, uint32_t
                 return VM_ERR_BAD_VALUE;
             }
 
+            libstring_view_t string1;
             uint32_t posr = STK_SND(thread).number.uinteger;
             uint32_t posl = STK_TRD(thread).number.uinteger;
-            NEW_HEAP_REF(obj, STK_TOP(thread).lib_obj.heap_ref);
-            char *string = obj->lib_obj.addr;
+            STR_VIEW(STK_TOP(thread), string1);
             STK_DROP3(thread);
-            if(posl > posr || posl > strlen(string) - 1 || posl > strlen(string) - 1) {
+            if(posl > posr || posl >= string1.len) {
                 posl = 0;
                 posr = 0;
             }
+            if (posr > string1.len)
+                posr = string1.len;
 
             STR_NEW_OBJ(thread, lib_idx);
             NEW_HEAP_REF(new_obj, STK_TOP(thread).lib_obj.heap_ref);
 
-            uint32_t size = strlen(string) - (posr - posl) + 1;
-            new_obj->lib_obj.addr = calloc(size + 1, sizeof(char));
-            memcpy(new_obj->lib_obj.addr, string, posl + 1);
-            memcpy(new_obj->lib_obj.addr + posl + 1, string + posr, strlen(string) - posr);
+            // keep [0, posl] and [posr, len)
+            uint32_t keep = string1.len == 0 ? 0 : posl + 1;
+            char *str = libstring_set(new_obj, keep + string1.len - posr);
+            memcpy(str, string1.str, keep);
+            memcpy(str + keep, string1.str + posr, string1.len - posr);
         }
         break;
 
         case LIBSTRING_FN_INSERT:
         case LIBSTRING_FN_REPLACE: {
-            if(STK_TRD(thread).type != VM_VAL_UINT
-                    || (STK_SND(thread).type != VM_VAL_LIB_OBJ && (HEAP_OBJ(STK_SND(thread).lib_obj.heap_ref))->lib_obj.identifier == STRING_LIBRARY_IDENTIFIER)
-                    || STK_SND(thread).type != VM_VAL_CONST_STRING) {
+            libstring_view_t string1, string2;
+            if(STK_TRD(thread).type != VM_VAL_UINT || !libstring_arg(thread, STK_SND(thread), &string2)) {
                 return VM_ERR_BAD_VALUE;
             }
 
-            NEW_HEAP_REF(obj, STK_TOP(thread).lib_obj.heap_ref);
-            char *string1 = (char*)obj->lib_obj.addr;
-            char *string2 = NULL;
-            if(STK_SND(thread).type == VM_VAL_LIB_OBJ) {
-                NEW_HEAP_REF(obj2, STK_SND(thread).lib_obj.heap_ref);
-                string2 = (char*)obj2->lib_obj.addr;
-            } else {
-                string2 = STK_SND(thread).cstr.addr;
-            }
-
+            STR_VIEW(STK_TOP(thread), string1);
             uint32_t pos = STK_TRD(thread).number.uinteger;
+            if (pos > string1.len)
+                pos = string1.len;
+
             STR_NEW_OBJ(thread, lib_idx);
             NEW_HEAP_REF(new_obj, STK_TOP(thread).lib_obj.heap_ref);
-            new_obj->lib_obj.addr = strdup(string1);
 
             if(call_type == LIBSTRING_FN_REPLACE) {
-            uint32_t len = strlen(string2) > strlen(string1) - pos ? strlen(string1) - pos : strlen(string2);
-            memcpy(new_obj->lib_obj.addr + pos, string2, len);
+                uint32_t len = string2.len > string1.len - pos ? string1.len - pos : string2.len;
+                char *str = libstring_set(new_obj, string1.len);
+                memcpy(str, string1.str, string1.len);
+                memcpy(str + pos, string2.str, len);
             } else {
-                libstring_strins((char**)&(new_obj->lib_obj.addr), string2, pos);
+                char *str = libstring_set(new_obj, string1.len + string2.len);
+                memcpy(str, string1.str, pos);
+                memcpy(str + pos, string2.str, string2.len);
+                memcpy(str + pos + string2.len, string1.str + pos, string1.len - pos);
             }
             STKDROPSTF(thread);
         }
         break;
 
         case LIBSTRING_FN_FIND: {
-            if(STK_TRD(thread).type != VM_VAL_UINT
-                    || (STK_SND(thread).type != VM_VAL_LIB_OBJ && (HEAP_OBJ(STK_SND(thread).lib_obj.heap_ref))->lib_obj.identifier == STRING_LIBRARY_IDENTIFIER)
-                    || STK_SND(thread).type != VM_VAL_CONST_STRING) {
+            libstring_view_t string1, string2;
+            if(STK_TRD(thread).type != VM_VAL_UINT || !libstring_arg(thread, STK_SND(thread), &string2)) {
                 return VM_ERR_BAD_VALUE;
             }
 
-            NEW_HEAP_REF(obj, STK_TOP(thread).lib_obj.heap_ref);
-            char *string1 = (char*)obj->lib_obj.addr;
-            char *string2 = NULL;
-            if(STK_SND(thread).type == VM_VAL_LIB_OBJ) {
-                NEW_HEAP_REF(obj2, STK_SND(thread).lib_obj.heap_ref);
-                string2 = (char*)obj2->lib_obj.addr;
-            } else {
-                string2 = STK_SND(thread).cstr.addr;
+            STR_VIEW(STK_TOP(thread), string1);
+            vm_value_t find_pos = { .type = VM_VAL_UINT };
+            find_pos.number.uinteger = libstring_strpos(string1.str, string1.len, string2.str, string2.len, STK_TRD(thread).number.uinteger);
+            STK_DROP3(thread);
+            vm_push(thread, find_pos);
+        }
+        break;
+
+        case LIBSTRING_FN_FIND_ANY: {
+            if (STK_TRD(thread).type != VM_VAL_UINT || STK_SND(thread).type != VM_VAL_ARRAY
+                    || vm_heap_type((*thread)->heap, STK_SND(thread).heap_ref) != VM_VAL_ARRAY) {
+                return VM_ERR_BAD_VALUE;
             }
 
-            vm_value_t find_pos = {VM_VAL_UINT};
-            find_pos.number.uinteger = libstring_strpos(string1, string2, STK_TRD(thread).number.uinteger);
+            vm_heap_object_t *needles = HEAP_OBJ(STK_SND(thread).heap_ref);
+            libstring_view_t views_local[8];
+            libstring_view_t *views = needles->array.qty <= 8 ? views_local : malloc(needles->array.qty * sizeof(libstring_view_t));
+            if (views == NULL)
+                return VM_ERR_OUTOFMEMORY;
+            for (uint32_t n = 0; n < needles->array.qty; n++) {
+                if (!libstring_arg(thread, needles->array.fields[n], &views[n])) {
+                    if (views != views_local)
+                        free(views);
+                    return VM_ERR_BAD_VALUE;
+                }
+            }
+
+            libstring_view_t string1;
+            STR_VIEW(STK_TOP(thread), string1);
+            vm_value_t find_pos = { .type = VM_VAL_UINT };
+            vm_value_t find_needle = { .type = VM_VAL_UINT };
+            find_needle.number.uinteger = 0xffffffff;
+            find_pos.number.uinteger = libstring_strpos_any(string1.str, string1.len, views, needles->array.qty, STK_TRD(thread).number.uinteger,
+                    &find_needle.number.uinteger);
+            if (views != views_local)
+                free(views);
             STK_DROP3(thread);
+            vm_push(thread, find_needle);
             vm_push(thread, find_pos);
         }
         break;
 
+        case LIBSTRING_FN_FIND_ALL: {
+            libstring_view_t string1, string2;
+            if(STK_TRD(thread).type != VM_VAL_UINT || !libstring_arg(thread, STK_SND(thread), &string2)) {
+                return VM_ERR_BAD_VALUE;
+            }
+
+            STR_VIEW(STK_TOP(thread), string1);
+            vm_heap_object_t arr;
+            uint32_t pos = STK_TRD(thread).number.uinteger;
+            uint32_t qty = 0;
+
+            // non overlapping matches, up to array capacity
+            if ((arr.array.fields = malloc(LIBSTRING_FIND_ALL_MAX * sizeof(vm_value_t))) == NULL)
+                return VM_ERR_OUTOFMEMORY;
+            while (qty < LIBSTRING_FIND_ALL_MAX
+                    && (pos = libstring_strpos(string1.str, string1.len, string2.str, string2.len, pos)) != 0xffffffff) {
+                arr.array.fields[qty] = (vm_value_t) { .type = VM_VAL_UINT };
+                arr.array.fields[qty++].number.uinteger = pos;
+                pos += string2.len > 0 ? string2.len : 1;
+            }
+            arr.array.qty = qty;
+
+            vm_value_t positions = { .type = VM_VAL_ARRAY };
+            positions.heap_ref = vm_heap_save((*thread)->heap, VM_VAL_ARRAY, false, arr, &((*thread)->frames[(*thread)->fc].gc_mark));
+            if (positions.heap_ref == 0xffffffff) {
+                free(arr.array.fields);
+                return VM_ERR_OUTOFMEMORY;
+            }
+            STK_DROP3(thread);
+            vm_push(thread, positions);
+        }
+        break;
+
         case LIBSTRING_FN_TO_CSTR: {
-            NEW_HEAP_REF(obj, STK_TOP(thread).lib_obj.heap_ref);
+            libstring_view_t string;
+            STR_VIEW(STK_TOP(thread), string);
             STK_TOP(thread).type = VM_VAL_CONST_STRING;
-            STK_TOP(thread).cstr.addr = strdup(obj->lib_obj.addr);
-            STK_TOP(thread).cstr.is_program = false;
+            VM_CSTR_SET(STK_TOP(thread), strndup(string.str, string.len), false);
+        }
+        break;
+
+        case LIBSTRING_FN_INTERN: {
+            libstring_view_t string;
+            STR_VIEW(STK_TOP(thread), string);
+            STK_TOP(thread) = vm_intern(thread, string.str, string.len);
+        }
+        break;
+
+        case LIBSTRING_FN_FROM_NUM: {
+            libstring_view_t string1;
+            char number[LIBSTRING_NUMBER_MAX];
+            uint32_t len;
+            vm_value_t value = STK_SND(thread);
+
+            switch (value.type) {
+                case VM_VAL_BOOL:
+                    len = value.number.boolean ? 4 : 5;
+                    memcpy(number, value.number.boolean ? "true" : "false", len);
+                    break;
+                case VM_VAL_UINT:
+                    len = libstring_utoa(value.number.uinteger, number);
+                    break;
+                case VM_VAL_INT:
+                    len = libstring_itoa(value.number.integer, number);
+                    break;
+                case VM_VAL_FLOAT:
+                    len = libstring_ftoa(value.number.real, number);
+                    break;
+                default:
+                    return VM_ERR_BAD_VALUE;
+            }
+
+            STR_VIEW(STK_TOP(thread), string1);
+            STR_NEW_OBJ(thread, lib_idx);
+            NEW_HEAP_REF(new_obj, STK_TOP(thread).lib_obj.heap_ref);
+
+            char *str = libstring_set(new_obj, string1.len + len);
+            memcpy(str, string1.str, string1.len);
+            memcpy(str + string1.len, number, len);
+            STKDROPST(thread);
+        }
+        break;
+
+        case LIBSTRING_FN_TO_NUM: {
+            libstring_view_t string;
+            vm_value_t value;
+
+            if (arg != VM_VAL_NULL && arg != VM_VAL_UINT && arg != VM_VAL_INT && arg != VM_VAL_FLOAT) {
+                return VM_ERR_BAD_VALUE;
+            }
+
+            STR_VIEW(STK_TOP(thread), string);
+            if (!libstring_parse_number(string.str, string.len, arg, &value)) {
+                return VM_ERR_BAD_VALUE;
+            }
+
+            STK_TOP(thread) = value;
         }
         break;
         default:
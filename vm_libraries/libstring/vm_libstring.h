@@ -21,21 +21,169 @@
 
 #include "vm.h"
 
-#define STRING_LIBRARY_IDENTIFIER 0x0000000f
+#define STRING_LIBRARY_IDENTIFIER        0x0000000f // libstring_t in addr
+#define STRING_LIBRARY_IDENTIFIER_INLINE 0x00000011 // string in place of addr (up to LIBSTRING_INLINE_MAX, NUL padded)
+
+#define LIBSTRING_INLINE_MAX sizeof(((vm_heap_object_t*) 0)->lib_obj.data)
+#define LIBSTRING_FIND_ALL_MAX 255 // array capacity
+#define LIBSTRING_NUMBER_MAX   16  // longest formatted number (libstring_utoa / itoa / ftoa)
 
 enum LIBSTRING_FN {
-    LIBSTRING_FN_LEN,     //
-    LIBSTRING_FN_LEFT,    //
-    LIBSTRING_FN_RIGHT,   //
-    LIBSTRING_FN_MID,     //
-    LIBSTRING_FN_CONCAT,  //
-    LIBSTRING_FN_INSERT,  //
-    LIBSTRING_FN_DELETE,  //
-    LIBSTRING_FN_REPLACE, //
-    LIBSTRING_FN_FIND,    //
-    LIBSTRING_FN_TO_CSTR, //
+    LIBSTRING_FN_LEN,      //
+    LIBSTRING_FN_LEFT,     //
+    LIBSTRING_FN_RIGHT,    //
+    LIBSTRING_FN_MID,      //
+    LIBSTRING_FN_CONCAT,   //
+    LIBSTRING_FN_INSERT,   //
+    LIBSTRING_FN_DELETE,   //
+    LIBSTRING_FN_REPLACE,  //
+    LIBSTRING_FN_FIND,     //
+    LIBSTRING_FN_TO_CSTR,  //
+    LIBSTRING_FN_INTERN,   //
+    LIBSTRING_FN_FIND_ANY, //
+    LIBSTRING_FN_FIND_ALL, //
+    LIBSTRING_FN_FROM_NUM, //
+    LIBSTRING_FN_TO_NUM,   //
 };
 
+/**
+ * @struct libstring_s
+ * @brief String library object
+ * Length prefixed, not necessarily NUL terminated (slices). Always use len.
+ */
+typedef struct libstring_s {
+    uint32_t refs;              /**< references (object and slices) */
+    uint32_t len;               /**< length */
+    uint32_t cap;               /**< owned buffer capacity (0: not owned, program image / interned / slice) */
+    char *str;                  /**< buffer */
+    struct libstring_s *parent; /**< owner of buffer for slices */
+} libstring_t;
+
+/**
+ * @struct libstring_view_s
+ * @brief Buffer and length of any string form
+ * Inline strings are copied, so the view stays valid when heap moves.
+ */
+typedef struct libstring_view_s {
+     const char *str;                             /**< buffer */
+       uint32_t len;                              /**< length */
+    libstring_t *string;                          /**< string object (NULL for inline and constant strings) */
+           char data[LIBSTRING_INLINE_MAX + 1];   /**< copy of inline string */
+} libstring_view_t;
+
+/**
+ * @fn libstring_t* libstring_new(uint32_t cap)
+ * @brief Create an empty string with owned buffer
+ *
+ * @param cap Capacity
+ * @return String
+ */
+libstring_t* libstring_new(uint32_t cap);
+
+/**
+ * @fn libstring_t* libstring_ref(char *str, uint32_t len)
+ * @brief Create a string referencing memory that outlives it (program image, interned)
+ *
+ * @param str Buffer
+ * @param len Length
+ * @return String
+ */
+libstring_t* libstring_ref(char *str, uint32_t len);
+
+/**
+ * @fn libstring_t* libstring_own(char *str, uint32_t len, uint32_t cap)
+ * @brief Create a string taking ownership of a malloc'd buffer (freed on release)
+ *
+ * @param str Buffer (len + 1 bytes at least, NUL terminated)
+ * @param len Length
+ * @param cap Capacity (greater than 0)
+ * @return String
+ */
+libstring_t* libstring_own(char *str, uint32_t len, uint32_t cap);
+
+/**
+ * @fn libstring_t* libstring_slice(libstring_t *parent, uint32_t pos, uint32_t len)
+ * @brief Create a zero copy slice of a string. Parent buffer is kept alive by reference count
+ *
+ * @param parent Parent string
+ * @param pos Start position
+ * @param len Length
+ * @return String
+ */
+libstring_t* libstring_slice(libstring_t *parent, uint32_t pos, uint32_t len);
+
+/**
+ * @fn void libstring_release(libstring_t *string)
+ * @brief Release a string reference
+ *
+ * @param string String
+ */
+void libstring_release(libstring_t *string);
+
+/**
+ * @fn bool libstring_arg(vm_thread_t **thread, vm_value_t value, libstring_view_t *view)
+ * @brief View of a string argument (constant string or string library object, any form)
+ *
+ * @param thread Thread
+ * @param value Value
+ * @param view View
+ * @return true if value is a string
+ */
+bool libstring_arg(vm_thread_t **thread, vm_value_t value, libstring_view_t *view);
+
+/**
+ * @fn char* libstring_set(vm_heap_object_t *obj, uint32_t len)
+ * @brief Prepare string library object storage for len characters. Short strings are stored inline
+ *
+ * @param obj Library object
+ * @param len Length
+ * @return Buffer to fill with len characters (already NUL terminated)
+ */
+char* libstring_set(vm_heap_object_t *obj, uint32_t len);
+
+/**
+ * @fn uint32_t libstring_utoa(uint32_t value, char *buf)
+ * @brief Format unsigned integer in decimal (not NUL terminated)
+ *
+ * @param value Value
+ * @param buf Buffer (at least LIBSTRING_NUMBER_MAX)
+ * @return Length
+ */
+uint32_t libstring_utoa(uint32_t value, char *buf);
+
+/**
+ * @fn uint32_t libstring_itoa(int32_t value, char *buf)
+ * @brief Format signed integer in decimal (not NUL terminated)
+ *
+ * @param value Value
+ * @param buf Buffer (at least LIBSTRING_NUMBER_MAX)
+ * @return Length
+ */
+uint32_t libstring_itoa(int32_t value, char *buf);
+
+/**
+ * @fn uint32_t libstring_ftoa(float value, char *buf)
+ * @brief Format float as the shortest decimal that reads back to the same value (Ryu). Not NUL terminated.
+ * Plain notation for exponents from -5 to 8, else d.ddde[-]xx
+ *
+ * @param value Value
+ * @param buf Buffer (at least LIBSTRING_NUMBER_MAX)
+ * @return Length
+ */
+uint32_t libstring_ftoa(float value, char *buf);
+
+/**
+ * @fn bool libstring_parse_number(const char *str, uint32_t len, vm_value_type_t type, vm_value_t *value)
+ * @brief Parse a decimal number. The whole string must be consumed
+ *
+ * @param str String (need not be NUL terminated)
+ * @param len Length
+ * @param type VM_VAL_UINT, VM_VAL_INT, VM_VAL_FLOAT or VM_VAL_NULL (guess from text)
+ * @param value Parsed value
+ * @return Valid number of requested type
+ */
+bool libstring_parse_number(const char *str, uint32_t len, vm_value_type_t type, vm_value_t *value);
+
 /**
  * @fn vm_errors_t lib_entry_strings(vm_thread_t **thread, uint8_t call_type, uint32_t lib_idx, uint32_t arg)
  * @brief Function entry for strings library
@@ -50,6 +198,11 @@ enum LIBSTRING_FN {
  *   REPLACE: Replaces part of one string with another string.
  *      FIND: Finds the location of one string within another.
  *   TO_CSTR: Make a copy in stack as constant string
+ *    INTERN: Make an interned constant string in stack (see vm_intern)
+ *  FIND_ANY: Finds the first location of any of several strings (array) in one scan. Push needle index and location.
+ *  FIND_ALL: Finds all the locations of one string within another (array, up to LIBSTRING_FIND_ALL_MAX).
+ *  FROM_NUM: Append a number (or bool) to a string.
+ *    TO_NUM: Convert a string to number (arg: VM_VAL_UINT, VM_VAL_INT, VM_VAL_FLOAT or VM_VAL_NULL to guess type).
  *
  * @param thread Thread
  * @param call_type Call type
@@ -0,0 +1,432 @@
+/*
+ * @vm_libstring_number.c
+ *
+ * @brief Stack VM
+ * @details
+ * This is based on other projects:
+ *   Tiny language: https://github.com/goodpaul6/Tiny
+ *   Ryu (float to string): https://github.com/ulfjack/ryu
+ *   Others (see individual files)
+ *
+ *   please contact their authors for more information.
+ *
+ * @author Emiliano Augusto Gonzalez (egonzalez . hiperion @ gmail . com)
+ * @version 2.0
+ * @date 2024
+ * @copyright MIT License
+ * @see https://github.com/hiperiondev/stack_vm
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "vm.h"
+#include "vm_libstring.h"
+
+static const char libstring_digits[200] = {
+        '0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+        '1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+        '2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+        '3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+        '4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+        '5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+        '6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+        '7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+        '8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+        '9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9',
+};
+
+static inline uint32_t libstring_decimal_len(uint32_t value) {
+    uint32_t len = 1;
+
+    for (uint32_t limit = 10; len < 10 && value >= limit; limit *= 10)
+        ++len;
+
+    return len;
+}
+
+// write len digits of value ending at buf + len, two at a time
+static inline void libstring_write_digits(char *buf, uint32_t value, uint32_t len) {
+    char *pos = buf + len;
+
+    while (value >= 100) {
+        uint32_t pair = (value % 100) * 2;
+        value /= 100;
+        *--pos = libstring_digits[pair + 1];
+        *--pos = libstring_digits[pair];
+    }
+
+    if (value >= 10) {
+        *--pos = libstring_digits[value * 2 + 1];
+        *--pos = libstring_digits[value * 2];
+    } else
+        *--pos = '0' + value;
+}
+
+uint32_t libstring_utoa(uint32_t value, char *buf) {
+    uint32_t len = libstring_decimal_len(value);
+
+    libstring_write_digits(buf, value, len);
+
+    return len;
+}
+
+uint32_t libstring_itoa(int32_t value, char *buf) {
+    if (value >= 0)
+        return libstring_utoa(value, buf);
+
+    buf[0] = '-';
+    return libstring_utoa(-(uint32_t) value, buf + 1) + 1;
+}
+
+///// float to string (Ryu, f2s) /////
+#define LIBSTRING_FLOAT_MANTISSA_BITS   23
+#define LIBSTRING_FLOAT_BIAS            127
+#define LIBSTRING_POW5_INV_BITCOUNT     59
+#define LIBSTRING_POW5_BITCOUNT         61
+
+static const uint64_t libstring_pow5_inv_split[31] = {
+        576460752303423489ull, 461168601842738791ull, 368934881474191033ull,
+        295147905179352826ull, 472236648286964522ull, 377789318629571618ull,
+        302231454903657294ull, 483570327845851670ull, 386856262276681336ull,
+        309485009821345069ull, 495176015714152110ull, 396140812571321688ull,
+        316912650057057351ull, 507060240091291761ull, 405648192073033409ull,
+        324518553658426727ull, 519229685853482763ull, 415383748682786211ull,
+        332306998946228969ull, 531691198313966350ull, 425352958651173080ull,
+        340282366920938464ull, 544451787073501542ull, 435561429658801234ull,
+        348449143727040987ull, 557518629963265579ull, 446014903970612463ull,
+        356811923176489971ull, 570899077082383953ull, 456719261665907162ull,
+        365375409332725730ull,
+};
+
+static const uint64_t libstring_pow5_split[48] = {
+        1152921504606846976ull, 1441151880758558720ull, 1801439850948198400ull,
+        2251799813685248000ull, 1407374883553280000ull, 1759218604441600000ull,
+        2199023255552000000ull, 1374389534720000000ull, 1717986918400000000ull,
+        2147483648000000000ull, 1342177280000000000ull, 1677721600000000000ull,
+        2097152000000000000ull, 1310720000000000000ull, 1638400000000000000ull,
+        2048000000000000000ull, 1280000000000000000ull, 1600000000000000000ull,
+        2000000000000000000ull, 1250000000000000000ull, 1562500000000000000ull,
+        1953125000000000000ull, 1220703125000000000ull, 1525878906250000000ull,
+        1907348632812500000ull, 1192092895507812500ull, 1490116119384765625ull,
+        1862645149230957031ull, 1164153218269348144ull, 1455191522836685180ull,
+        1818989403545856475ull, 2273736754432320594ull, 1421085471520200371ull,
+        1776356839400250464ull, 2220446049250313080ull, 1387778780781445675ull,
+        1734723475976807094ull, 2168404344971008868ull, 1355252715606880542ull,
+        1694065894508600678ull, 2117582368135750847ull, 1323488980084844279ull,
+        1654361225106055349ull, 2067951531382569187ull, 1292469707114105741ull,
+        1615587133892632177ull, 2019483917365790221ull, 1262177448353618888ull,
+};
+
+static inline int32_t libstring_pow5bits(int32_t e) {
+    return (int32_t) (((uint32_t) e * 1217359) >> 19) + 1;
+}
+
+static inline uint32_t libstring_log10_pow2(int32_t e) {
+    return ((uint32_t) e * 78913) >> 18;
+}
+
+static inline uint32_t libstring_log10_pow5(int32_t e) {
+    return ((uint32_t) e * 732923) >> 20;
+}
+
+static inline bool libstring_multiple_pow5(uint32_t value, uint32_t p) {
+    uint32_t count = 0;
+
+    while (value % 5 == 0) {
+        value /= 5;
+        ++count;
+    }
+
+    return count >= p;
+}
+
+static inline uint32_t libstring_mul_shift(uint32_t m, uint64_t factor, int32_t shift) {
+    uint64_t bits0 = (uint64_t) m * (uint32_t) factor;
+    uint64_t bits1 = (uint64_t) m * (uint32_t) (factor >> 32);
+
+    return (uint32_t) (((bits0 >> 32) + bits1) >> (shift - 32));
+}
+
+// shortest decimal (mantissa * 10^exponent) that rounds to the float
+static void libstring_f2d(uint32_t ieee_mantissa, uint32_t ieee_exponent, uint32_t *mantissa, int32_t *exponent) {
+    int32_t e2;
+    uint32_t m2;
+
+    if (ieee_exponent == 0) {
+        e2 = 1 - LIBSTRING_FLOAT_BIAS - LIBSTRING_FLOAT_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    } else {
+        e2 = (int32_t) ieee_exponent - LIBSTRING_FLOAT_BIAS - LIBSTRING_FLOAT_MANTISSA_BITS - 2;
+        m2 = (1u << LIBSTRING_FLOAT_MANTISSA_BITS) | ieee_mantissa;
+    }
+
+    const bool accept_bounds = (m2 & 1) == 0;
+    const uint32_t mv = 4 * m2;
+    const uint32_t mp = 4 * m2 + 2;
+    const uint32_t mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+    const uint32_t mm = 4 * m2 - 1 - mm_shift;
+
+    uint32_t vr, vp, vm;
+    int32_t e10;
+    bool vm_trailing_zeros = false;
+    bool vr_trailing_zeros = false;
+    uint8_t last_removed = 0;
+
+    if (e2 >= 0) {
+        const uint32_t q = libstring_log10_pow2(e2);
+        const int32_t k = LIBSTRING_POW5_INV_BITCOUNT + libstring_pow5bits(q) - 1;
+        const int32_t i = -e2 + (int32_t) q + k;
+        e10 = q;
+        vr = libstring_mul_shift(mv, libstring_pow5_inv_split[q], i);
+        vp = libstring_mul_shift(mp, libstring_pow5_inv_split[q], i);
+        vm = libstring_mul_shift(mm, libstring_pow5_inv_split[q], i);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            const int32_t l = LIBSTRING_POW5_INV_BITCOUNT + libstring_pow5bits(q - 1) - 1;
+            last_removed = libstring_mul_shift(mv, libstring_pow5_inv_split[q - 1], -e2 + (int32_t) q - 1 + l) % 10;
+        }
+        if (q <= 9) {
+            if (mv % 5 == 0)
+                vr_trailing_zeros = libstring_multiple_pow5(mv, q);
+            else if (accept_bounds)
+                vm_trailing_zeros = libstring_multiple_pow5(mm, q);
+            else
+                vp -= libstring_multiple_pow5(mp, q);
+        }
+    } else {
+        const uint32_t q = libstring_log10_pow5(-e2);
+        const int32_t i = -e2 - (int32_t) q;
+        const int32_t k = libstring_pow5bits(i) - LIBSTRING_POW5_BITCOUNT;
+        int32_t j = (int32_t) q - k;
+        e10 = (int32_t) q + e2;
+        vr = libstring_mul_shift(mv, libstring_pow5_split[i], j);
+        vp = libstring_mul_shift(mp, libstring_pow5_split[i], j);
+        vm = libstring_mul_shift(mm, libstring_pow5_split[i], j);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            j = (int32_t) q - 1 - (libstring_pow5bits(i + 1) - LIBSTRING_POW5_BITCOUNT);
+            last_removed = libstring_mul_shift(mv, libstring_pow5_split[i + 1], j) % 10;
+        }
+        if (q <= 1) {
+            vr_trailing_zeros = true;
+            if (accept_bounds)
+                vm_trailing_zeros = mm_shift == 1;
+            else
+                --vp;
+        } else if (q < 31)
+            vr_trailing_zeros = (mv & ((1u << (q - 1)) - 1)) == 0;
+    }
+
+    int32_t removed = 0;
+    uint32_t output;
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        while (vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            ++removed;
+        }
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                ++removed;
+            }
+        }
+        if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0)
+            last_removed = 4; // round to even
+        output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed >= 5);
+    } else {
+        while (vp / 10 > vm / 10) {
+            last_removed = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            ++removed;
+        }
+        output = vr + (vr == vm || last_removed >= 5);
+    }
+
+    *mantissa = output;
+    *exponent = e10 + removed;
+}
+
+uint32_t libstring_ftoa(float value, char *buf) {
+    uint32_t bits;
+    uint32_t len = 0;
+
+    memcpy(&bits, &value, sizeof(bits));
+    const bool sign = bits >> 31;
+    const uint32_t ieee_mantissa = bits & ((1u << LIBSTRING_FLOAT_MANTISSA_BITS) - 1);
+    const uint32_t ieee_exponent = (bits >> LIBSTRING_FLOAT_MANTISSA_BITS) & 0xff;
+
+    if (ieee_exponent == 0xff) {
+        if (ieee_mantissa != 0) {
+            memcpy(buf, "nan", 3);
+            return 3;
+        }
+        if (sign)
+            buf[len++] = '-';
+        memcpy(buf + len, "inf", 3);
+        return len + 3;
+    }
+
+    if (sign)
+        buf[len++] = '-';
+
+    if (ieee_exponent == 0 && ieee_mantissa == 0) {
+        buf[len++] = '0';
+        return len;
+    }
+
+    uint32_t mantissa;
+    int32_t exponent;
+    libstring_f2d(ieee_mantissa, ieee_exponent, &mantissa, &exponent);
+
+    const int32_t olength = libstring_decimal_len(mantissa);
+    const int32_t point = olength + exponent; // digits before decimal point
+
+    if (exponent >= 0 && point <= 9) {
+        // integer: ddd000
+        libstring_write_digits(buf + len, mantissa, olength);
+        len += olength;
+        memset(buf + len, '0', exponent);
+        len += exponent;
+    } else if (point > 0 && point <= 9) {
+        // dd.ddd
+        libstring_write_digits(buf + len + 1, mantissa, olength);
+        memmove(buf + len, buf + len + 1, point);
+        buf[len + point] = '.';
+        len += olength + 1;
+    } else if (point <= 0 && point > -5) {
+        // 0.000ddd
+        buf[len++] = '0';
+        buf[len++] = '.';
+        memset(buf + len, '0', -point);
+        len += -point;
+        libstring_write_digits(buf + len, mantissa, olength);
+        len += olength;
+    } else {
+        // d.ddde[-]xx
+        libstring_write_digits(buf + len + 1, mantissa, olength);
+        buf[len] = buf[len + 1];
+        len += 1;
+        if (olength > 1) {
+            buf[len] = '.';
+            len += olength;
+        }
+        buf[len++] = 'e';
+        len += libstring_itoa(point - 1, buf + len);
+    }
+
+    return len;
+}
+
+///// string to number /////
+static const float libstring_pow10f[11] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+bool libstring_parse_number(const char *str, uint32_t len, vm_value_type_t type, vm_value_t *value) {
+    const char *pos = str;
+    const char *end = str + len;
+    bool negative = false;
+    uint64_t mantissa = 0;
+    uint32_t digits = 0, dropped = 0;
+    int32_t exponent = 0;
+    bool is_float = false;
+
+    if (pos < end && (*pos == '-' || *pos == '+'))
+        negative = *pos++ == '-';
+
+    const char *start = pos;
+    for (; pos < end && *pos >= '0' && *pos <= '9'; pos++) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*pos - '0');
+            digits += mantissa != 0;
+        } else
+            ++dropped;
+    }
+    const bool has_int = pos != start;
+
+    if (pos < end && *pos == '.') {
+        is_float = true;
+        start = ++pos;
+        for (; pos < end && *pos >= '0' && *pos <= '9'; pos++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*pos - '0');
+                digits += mantissa != 0;
+                --exponent;
+            }
+        }
+        if (!has_int && pos == start)
+            return false;
+    } else if (!has_int)
+        return false;
+
+    if (pos < end && (*pos == 'e' || *pos == 'E')) {
+        is_float = true;
+        ++pos;
+        bool exp_negative = false;
+        int32_t exp = 0;
+        if (pos < end && (*pos == '-' || *pos == '+'))
+            exp_negative = *pos++ == '-';
+        if (pos == end || *pos < '0' || *pos > '9')
+            return false;
+        for (; pos < end && *pos >= '0' && *pos <= '9'; pos++)
+            if (exp < 100000)
+                exp = exp * 10 + (*pos - '0');
+        exponent += exp_negative ? -exp : exp;
+    }
+
+    if (pos != end)
+        return false;
+
+    if (type == VM_VAL_NULL)
+        type = is_float ? VM_VAL_FLOAT : (negative ? VM_VAL_INT : VM_VAL_UINT);
+
+    switch (type) {
+        case VM_VAL_UINT:
+            if (is_float || negative || dropped > 0 || mantissa > UINT32_MAX)
+                return false;
+            *value = (vm_value_t) { .type = VM_VAL_UINT };
+            value->number.uinteger = mantissa;
+            return true;
+
+        case VM_VAL_INT:
+            if (is_float || dropped > 0 || mantissa > (negative ? (uint64_t) INT32_MAX + 1 : (uint64_t) INT32_MAX))
+                return false;
+            *value = (vm_value_t) { .type = VM_VAL_INT };
+            value->number.integer = negative ? (int32_t) -(int64_t) mantissa : (int32_t) mantissa;
+            return true;
+
+        case VM_VAL_FLOAT: {
+            float result;
+            exponent += dropped;
+            // exact operands, one correctly rounded operation
+            if (mantissa <= (1u << 24) && exponent >= -10 && exponent <= 10) {
+                result = exponent < 0 ? (float) mantissa / libstring_pow10f[-exponent] : (float) mantissa * libstring_pow10f[exponent];
+            } else {
+                char buffer[64];
+                char *copy = len < sizeof(buffer) ? buffer : malloc(len + 1);
+                memcpy(copy, str, len);
+                copy[len] = '\0';
+                result = strtof(copy, NULL);
+                if (copy != buffer)
+                    free(copy);
+                negative = false;
+            }
+            *value = (vm_value_t) { .type = VM_VAL_FLOAT };
+            value->number.real = negative ? -result : result;
+            return true;
+        }
+
+        default:
+            return false;
+    }
+}
@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "vm.h"
 #include "vm_libtest.h"
@@ -57,6 +58,30 @@ vm_errors_t lib_entry_test(vm_thread_t **thread, uint8_t call_type, uint32_t lib
 
         case VM_EDFAT_TOTYPE: {
 
+        }
+            break;
+
+        case VM_EDFAT_CLONE: {
+            vm_heap_object_t *obj = vm_heap_load((*thread)->heap, arg);
+            libtest_data_t *data = malloc(sizeof(libtest_data_t));
+            *data = *(libtest_data_t*) obj->lib_obj.addr;
+            obj->lib_obj.addr = data;
+        }
+            break;
+
+        case VM_EDFAT_SERIALIZE: {
+            if (!vm_snapshot_write(thread, vm_heap_load((*thread)->heap, arg)->lib_obj.addr, sizeof(libtest_data_t)))
+                res = VM_ERR_OUTOFMEMORY;
+        }
+            break;
+
+        case VM_EDFAT_DESERIALIZE: {
+            const void *saved = vm_snapshot_read(thread, sizeof(libtest_data_t));
+            libtest_data_t *data;
+            if (saved == NULL || (data = malloc(sizeof(libtest_data_t))) == NULL)
+                return VM_ERR_FAIL;
+            memcpy(data, saved, sizeof(libtest_data_t));
+            vm_heap_load((*thread)->heap, arg)->lib_obj.addr = data;
         }
             break;
 